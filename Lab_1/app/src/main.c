@@ -3,12 +3,24 @@
 #include <stdbool.h>
 #include "../../core/inc/device.h"
 #include "../../core/inc/util.h"
+#include "../../core/inc/mft_scan.h"
 #include <getopt.h>
 
 
 static void help();
 
-static void shell(char *filename);
+static void shell(char *filename, char *index, uint64_t memory_limit, char *latency_file);
+
+static void batch(char *filename, char *script, char *index, uint64_t memory_limit, char *latency_file);
+
+static void serve_volumes(char *socket_path, char **images, int image_count, uint64_t memory_limit,
+                          char *output_root, char *latency_file);
+
+static void write_latency(char *latency_file, GENERAL_INFORMATION **volumes, char **images, int count);
+
+static GENERAL_INFORMATION *open_volume(char *filename, char *index, uint64_t memory_limit);
+
+static char *execute(SESSION *session, char *input, bool batch_mode, bool *exit, bool *failed);
 
 static void options(int argc, char *argv[]);
 
@@ -18,17 +30,32 @@ int main(int argc, char *argv[]) {
 }
 
 static void options(int argc, char *argv[]) {
-    const char *short_flags = "lhs:";
+    const char *short_flags = "lhs:b:c:i:d:j:m:o:";
 
     const struct option long_flags[] = {
-            {"list",  0, NULL, 'l'},
-            {"help",  0, NULL, 'h'},
-            {"shell", 1, NULL, 's'},
-            {0,       0, 0,    0}
+            {"list",     0, NULL, 'l'},
+            {"help",     0, NULL, 'h'},
+            {"shell",    1, NULL, 's'},
+            {"batch",    1, NULL, 'b'},
+            {"commands", 1, NULL, 'c'},
+            {"index",    1, NULL, 'i'},
+            {"daemon",   1, NULL, 'd'},
+            {"latency-json", 1, NULL, 'j'},
+            {"memory",   1, NULL, 'm'},
+            {"output-root", 1, NULL, 'o'},
+            {0,          0, 0,    0}
     };
 
     int rez;
     int long_id = 0;
+    char *shell_image = NULL;
+    char *batch_image = NULL;
+    char *script = NULL;
+    char *index = NULL;
+    char *socket_path = NULL;
+    char *latency_file = NULL;
+    char *output_root = NULL;
+    uint64_t memory_limit = BUDGET_UNLIMITED;
 
     while ((rez = getopt_long(argc, argv, short_flags, long_flags, &long_id)) != -1) {
         switch (rez) {
@@ -40,10 +67,45 @@ static void options(int argc, char *argv[]) {
                 help();
                 break;
             case 's':
-                shell(optarg);
+                shell_image = optarg;
+                break;
+            case 'b':
+                batch_image = optarg;
+                break;
+            case 'c':
+                script = optarg;
+                break;
+            case 'i':
+                index = optarg;
+                break;
+            case 'd':
+                socket_path = optarg;
+                break;
+            case 'j':
+                latency_file = optarg;
+                break;
+            case 'm':
+                if (parse_budget_size(optarg, &memory_limit) == -1) {
+                    fprintf(stderr, "ERROR: Memory limit is a size like 512M, or 0 for none\n");
+                    return;
+                }
+                break;
+            case 'o':
+                output_root = optarg;
                 break;
         }
     }
+
+    // volumes are opened after all options are known, the command file and index may follow the image
+    if (shell_image != NULL) {
+        shell(shell_image, index, memory_limit, latency_file);
+    }
+    if (batch_image != NULL) {
+        batch(batch_image, script, index, memory_limit, latency_file);
+    }
+    if (socket_path != NULL) {
+        serve_volumes(socket_path, argv + optind, argc - optind, memory_limit, output_root, latency_file);
+    }
 }
 
 struct help {
@@ -52,17 +114,31 @@ struct help {
     char *description;
 };
 
-static struct help help_list[3] = {
+static struct help help_list[10] = {
+        {
+                'l', "list",     "show list of devices and partition"},
+        {
+                'h', "help",     "show help (this message)"},
+        {
+                's', "shell",    "shell mode (interactive mode)"},
+        {
+                'b', "batch",    "batch mode: run commands without prompts, one framed reply per command"},
+        {
+                'c', "commands", "command file for batch mode (stdin by default)"},
+        {
+                'i', "index",    "metadata sidecar of the image, built on first use and rebuilt when stale"},
+        {
+                'd', "daemon",   "serve the images that follow the options (image[:index]) on a unix socket"},
         {
-                'l', "list",  "show list of devices and partition"},
+                'j', "latency-json", "write latency histograms of every volume to this file as JSON at exit"},
         {
-                'h', "help",  "show help (this message)"},
+                'm', "memory",   "memory limit of the caches, indexes and copy buffers of every volume, like 512M"},
         {
-                's', "shell", "shell mode (interactive mode)"}
+                'o', "output-root", "directory daemon clients may cp into, cp is refused without it"}
 };
 
 static void help() {
-    for (uint8_t i = 0; i < 3; i++) {
+    for (uint8_t i = 0; i < sizeof(help_list) / sizeof(help_list[0]); i++) {
         printf("\tshor name: %c\n"
                "\tlong name: %s\n"
                "\tdescription: %s\n\n",
@@ -73,72 +149,318 @@ static void help() {
     }
 }
 
-static void shell(char *filename) {
+/*
+ * Opens the volume, with the metadata sidecar when index is given. A volume
+ * without a usable sidecar still works, it is only slower to navigate.
+ */
+static GENERAL_INFORMATION *open_volume(char *filename, char *index, uint64_t memory_limit) {
     GENERAL_INFORMATION *g_info = init(filename);
+    if (g_info != NULL) {
+        set_budget_limit(g_info->budget, memory_limit);
+    }
+    if (g_info != NULL && index != NULL && open_sidecar(g_info, index) == -1) {
+        fprintf(stderr, "WARNING: Can't use index %s\n", index);
+    }
+    return g_info;
+}
+
+static void shell(char *filename, char *index, uint64_t memory_limit, char *latency_file) {
+    GENERAL_INFORMATION *g_info = open_volume(filename, index, memory_limit);
     if (g_info == NULL) {
         puts("No NTFS file system detected");
         return;
     }
+    print_g_info(g_info);
+    SESSION *session = open_session(g_info);
 
     bool exit = false;
+    bool failed;
     char *input = malloc(1024);
-    char *sep = " \n";
     char *output = NULL;
     while (!exit) {
-        char *current_dir = pwd(g_info);
+        char *current_dir = pwd(session);
         printf("%s> ", current_dir);
         free(current_dir);
-        fgets(input, 1024, stdin);
-        char *command = strtok(input, sep);
-        if (command == NULL) {
-            continue;
+        if (fgets(input, 1024, stdin) == NULL) {
+            break;
         }
-        char *from_path = strtok(NULL, sep);
-        char *to_path = strtok(NULL, sep);
-        if (strcmp(command, "ls") == 0) {
-            output = ls(g_info, from_path);
-            if (output == NULL) {
-                printf("No such directory\n");
-                continue;
-            }
+        output = execute(session, input, false, &exit, &failed);
+        if (output != NULL) {
             printf("%s", output);
             free(output);
-        } else if (strcmp(command, "pwd") == 0) {
-            output = pwd(g_info);
-            printf("%s\n", output);
-            free(output);
-        } else if (strcmp(command, "cd") == 0) {
-            if (from_path == NULL) {
-                puts("cd require path argument");
-                continue;
-            }
-            output = cd(g_info, from_path);
-            printf("%s", output);
+        }
+    }
+    free(input);
+    close_session(session);
+    write_latency(latency_file, &g_info, &filename, 1);
+    free_g_info(g_info);
+}
+
+/*
+ * Runs commands from script (or stdin) against one opened volume, so caches
+ * stay warm between commands. No prompts are printed; every command gets one
+ * reply on stdout:
+ *
+ *     ok|error <payload length>\n<payload>
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ */
+static void batch(char *filename, char *script, char *index, uint64_t memory_limit, char *latency_file) {
+    FILE *in = stdin;
+    if (script != NULL && strcmp(script, "-") != 0) {
+        in = fopen(script, "r");
+        if (in == NULL) {
+            fprintf(stderr, "ERROR: Can't open %s\n", script);
+            return;
+        }
+    }
+    GENERAL_INFORMATION *g_info = open_volume(filename, index, memory_limit);
+    if (g_info == NULL) {
+        fprintf(stderr, "No NTFS file system detected\n");
+        if (in != stdin) {
+            fclose(in);
+        }
+        return;
+    }
+    SESSION *session = open_session(g_info);
+
+    bool exit = false;
+    bool failed;
+    char *input = NULL;
+    size_t input_size = 0;
+    while (!exit && getline(&input, &input_size, in) != -1) {
+        char *start = input + strspn(input, " \t");
+        if (start[0] == '#' || start[0] == '\n' || start[0] == '\0') {
+            continue;
+        }
+        char *output = execute(session, start, true, &exit, &failed);
+        if (exit) {
             free(output);
-        } else if (strcmp(command, "cp") == 0) {
-            if (from_path == NULL) {
-                puts("cp require from_path argument");
-                continue;
+            break;
+        }
+        size_t length = output != NULL ? strlen(output) : 0;
+        printf("%s %zu\n", failed ? "error" : "ok", length);
+        if (length > 0) {
+            fwrite(output, 1, length, stdout);
+        }
+        free(output);
+    }
+    fflush(stdout);
+
+    free(input);
+    if (in != stdin) {
+        fclose(in);
+    }
+    close_session(session);
+    write_latency(latency_file, &g_info, &filename, 1);
+    free_g_info(g_info);
+}
+
+/*
+ * Opens every image once and answers requests of local clients on the socket
+ * until SIGINT or SIGTERM, see serve(). An image may name its sidecar as
+ * image:index.
+ */
+static void serve_volumes(char *socket_path, char **images, int image_count, uint64_t memory_limit,
+                          char *output_root, char *latency_file) {
+    if (image_count == 0 || image_count > SERVER_MAX_VOLUMES) {
+        fprintf(stderr, "ERROR: Daemon mode needs 1 to %d images\n", SERVER_MAX_VOLUMES);
+        return;
+    }
+    GENERAL_INFORMATION *volumes[SERVER_MAX_VOLUMES];
+    int opened = 0;
+    for (; opened < image_count; opened++) {
+        char *index = strchr(images[opened], ':');
+        if (index != NULL) {
+            *index++ = '\0';
+        }
+        if ((volumes[opened] = open_volume(images[opened], index, memory_limit)) == NULL) {
+            fprintf(stderr, "No NTFS file system detected on %s\n", images[opened]);
+            break;
+        }
+    }
+    if (opened == image_count && serve(socket_path, volumes, image_count, scan_threads(), output_root) == -1) {
+        fprintf(stderr, "ERROR: Can't serve on %s\n", socket_path);
+    }
+    write_latency(latency_file, volumes, images, opened);
+    for (int i = 0; i < opened; i++) {
+        free_g_info(volumes[i]);
+    }
+}
+
+/*
+ * Writes the latency histograms of the volumes as a JSON array, one object
+ * per volume: {"image": ..., "elapsed_ns": ..., "latency": {operation: ...}}.
+ * Does nothing when no file was asked for with -j.
+ */
+static void write_latency(char *latency_file, GENERAL_INFORMATION **volumes, char **images, int count) {
+    if (latency_file == NULL || count == 0) {
+        return;
+    }
+    FILE *out = fopen(latency_file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: Can't write %s\n", latency_file);
+        return;
+    }
+    STATS_SNAPSHOT *snapshot = malloc(sizeof(STATS_SNAPSHOT));
+    fputs("[", out);
+    for (int i = 0; i < count; i++) {
+        read_stats(volumes[i], snapshot);
+        char *histograms = format_latency(snapshot, true);
+        fprintf(out, "%s{\"image\":\"", i > 0 ? "," : "");
+        for (char *c = images[i]; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', out);
             }
-            if (to_path == NULL) {
-                puts("cp require to_path argument");
-                continue;
+            fputc(*c, out);
+        }
+        fprintf(out, "\",\"elapsed_ns\":%lu,\"latency\":%s}", snapshot->elapsed, histograms);
+        free(histograms);
+    }
+    fputs("]\n", out);
+    free(snapshot);
+    fclose(out);
+}
+
+static char *message(const char *text) {
+    char *output = malloc(strlen(text) + 2);
+    sprintf(output, "%s\n", text);
+    return output;
+}
+
+/*
+ * Runs one command line, returns its output (NULL when there is nothing to print).
+ * failed is set when the command did not succeed.
+ */
+static char *execute(SESSION *session, char *input, bool batch_mode, bool *exit, bool *failed) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char *sep = " \n";
+    char *output = NULL;
+    *failed = true;
+
+    char *command = strtok(input, sep);
+    if (command == NULL) {
+        *failed = false;
+        return NULL;
+    }
+    char *from_path = strtok(NULL, sep);
+    char *to_path = strtok(NULL, sep);
+    int command_id = stats_command_id(command);
+    uint64_t start = stats_clock();
+    if (strcmp(command, "ls") == 0) {
+        output = ls(session, from_path);
+        if (output == NULL) {
+            return message("No such directory");
+        }
+        *failed = false;
+    } else if (strcmp(command, "pwd") == 0) {
+        char *dir = pwd(session);
+        output = message(dir);
+        free(dir);
+        *failed = false;
+    } else if (strcmp(command, "cd") == 0) {
+        if (from_path == NULL) {
+            return message("cd require path argument");
+        }
+        output = cd(session, from_path);
+        *failed = output[0] != '\0';
+    } else if (strcmp(command, "cp") == 0) {
+        if (from_path == NULL) {
+            return message("cp require from_path argument");
+        }
+        if (to_path == NULL) {
+            return message("cp require to_path argument");
+        }
+        uint32_t flags = 0;
+        for (char *option = strtok(NULL, sep); option != NULL; option = strtok(NULL, sep)) {
+            if (strcmp(option, "mirror") == 0) {
+                flags |= CP_MIRROR;
+            } else if (strcmp(option, "mirror-delete") == 0) {
+                flags |= CP_MIRROR | CP_DELETE;
+            } else if (strcmp(option, "reflink") == 0) {
+                flags |= CP_REFLINK;
+            } else {
+                return message("cp options are mirror, mirror-delete and reflink");
             }
-            output = cp(g_info, from_path, to_path);
-            printf("%s", output);
+        }
+        output = cp(session, from_path, to_path, flags);
+        *failed = strncmp(output, "Successfully", 12) != 0;
+    } else if (strcmp(command, "tar") == 0) {
+        if (from_path == NULL) {
+            return message("tar require path argument");
+        }
+        if (to_path == NULL) {
+            return message("tar require archive argument");
+        }
+        // raw archive on stdout would break the framing of batch replies
+        if (batch_mode && strcmp(to_path, "-") == 0) {
+            return message("tar can't write to stdout in batch mode");
+        }
+        output = tar(session, from_path, to_path);
+        *failed = strncmp(output, "Successfully", 12) != 0;
+        if (strcmp(to_path, "-") == 0) {
+            // keep the archive clean when it goes to stdout
+            fputs(output, stderr);
             free(output);
-        } else if (strcmp(command, "help") == 0) {
-            puts("ls - show working directory elements\n"
-                 "cd [directory] - change working directory\n"
-                 "pwd - print working directory\n"
-                 "cp [directory] [target directory] - copy dir or file from file system\n"
-                 "help - list of commands\n"
-                 "exit - terminate");
-        } else if (strcmp(command, "exit") == 0) {
-            exit = true;
-        } else {
-            puts("Wrong command. Please enter 'help' to get help");
-        }
-    }
-    free(g_info);
-}
\ No newline at end of file
+            output = NULL;
+        }
+    } else if (strcmp(command, "stat") == 0) {
+        output = file_stat(session, from_path);
+        *failed = strncmp(output, "record", 6) != 0;
+    } else if (strcmp(command, "find") == 0) {
+        if (from_path == NULL) {
+            return message("find require pattern argument");
+        }
+        output = find(g_info, from_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "du") == 0) {
+        output = du(session, from_path, to_path);
+        *failed = strncmp(output, "logical", 7) != 0;
+    } else if (strcmp(command, "bitmap") == 0) {
+        output = bitmap(g_info);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "undelete") == 0) {
+        output = undelete(g_info, from_path, to_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "journal") == 0) {
+        output = journal(g_info, from_path, to_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "stats") == 0) {
+        output = io_stats(g_info, from_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "latency") == 0) {
+        output = latency(g_info, from_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "memory") == 0) {
+        output = memory(g_info, from_path);
+        *failed = strncmp(output, "ERROR", 5) == 0;
+    } else if (strcmp(command, "help") == 0) {
+        output = message("ls - show working directory elements\n"
+                         "cd [directory] - change working directory\n"
+                         "pwd - print working directory\n"
+                         "cp [directory] [target directory] [mirror|mirror-delete] [reflink] - copy dir or file from file system, mirror only what\n"
+                         "    changed since the last mirror, hard links are copied once and linked, or reflinked\n"
+                         "tar [directory] [archive] - export dir or file as a pax archive, '-' for stdout\n"
+                         "stat [path] - record, sizes and times of a file or directory\n"
+                         "find [pattern] - list paths of files whose name contains pattern, '*', '?' and '[' make it a glob\n"
+                         "du [directory] [count] - size of a tree with its largest files and directories\n"
+                         "bitmap - used and free clusters, free extents and allocation heatmap\n"
+                         "undelete [record] [target directory] - list recoverable deleted files or recover one\n"
+                         "journal [usn] [journal id] - change journal position, or records changed since usn\n"
+                         "stats [reset] - reads, writes, records, cache hits and time of commands since open or reset\n"
+                         "latency [json] - percentiles of ls, cd, cp, record fetches and cluster reads since open or reset\n"
+                         "memory [limit] - memory of caches, indexes and copy buffers with high-water marks, or set the limit (0 for none)\n"
+                         "help - list of commands\n"
+                         "exit - terminate");
+        *failed = false;
+    } else if (strcmp(command, "exit") == 0) {
+        *exit = true;
+        *failed = false;
+    } else {
+        output = message("Wrong command. Please enter 'help' to get help");
+    }
+    if (command_id != -1) {
+        stats_command(g_info, command_id, stats_clock() - start);
+    }
+    return output;
+}
@@ -0,0 +1,59 @@
+#ifndef SYSTEM_SOFTWARE_ATTRIBUTE_LIST_H
+#define SYSTEM_SOFTWARE_ATTRIBUTE_LIST_H
+
+#include <stdint.h>
+#include "attribute.h"
+
+/**
+ * MREF - Extract the mft record number from an mft reference.
+ *
+ * An mft reference is a 48-bit mft record number and a 16-bit sequence
+ * number packed together into one 64-bit value.
+ */
+#define MREF(x) ((uint64_t) ((x) & 0x0000ffffffffffffULL))
+#define MSEQNO(x) ((uint16_t) (((x) >> 48) & 0xffff))
+#define MK_MREF(m, s) ((uint64_t) (((uint64_t) (s) << 48) | ((uint64_t) (m) & 0x0000ffffffffffffULL)))
+
+/**
+ * struct ATTR_LIST_ENTRY - Attribute: Attribute list (0x20).
+ *
+ * - Can be either resident or non-resident.
+ * - Value consists of a sequence of variable length, 8-byte aligned,
+ * ATTR_LIST_ENTRY records.
+ * - The list is not terminated by anything at all! The only way to know when
+ * the end is reached is to keep track of the current offset and compare it to
+ * the attribute value size.
+ * - The attribute list attribute contains one entry for each attribute of
+ * the file in which the list is located, except for the list attribute
+ * itself. The list is sorted: first by attribute type, second by attribute
+ * name (if present), third by instance number. The extents of one
+ * non-resident attribute (if present) immediately follow after the initial
+ * extent. They are ordered by lowest_vcn and have their instance set to zero.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    ATTR_TYPES type;    /* Type of referenced attribute. */
+/*  4*/    uint16_t length;        /* Byte size of this entry (8-byte aligned). */
+/*  6*/    uint8_t name_length;    /* Size in Unicode chars of the name of the
+				   attribute or 0 if unnamed. */
+/*  7*/    uint8_t name_offset;    /* Byte offset to beginning of attribute name
+				   (always set this to where the name would
+				   start even if unnamed). */
+/*  8*/    uint64_t lowest_vcn;    /* Lowest virtual cluster number of this portion
+				   of the attribute value. This is usually 0. It
+				   is non-zero for the case where one attribute
+				   does not fit into one mft record and thus
+				   several mft records are allocated to hold
+				   this attribute. */
+/* 16*/    uint64_t mft_reference;    /* The reference of the mft record holding
+				   the ATTR_RECORD for this portion of the
+				   attribute value. */
+/* 24*/    uint16_t instance;        /* If lowest_vcn = 0, the instance of the
+				   attribute being referenced; otherwise 0. */
+/* 26*/    uint16_t name[0];        /* Use when creating only. When reading use
+				   name_offset to determine the location of the
+				   name. */
+/* sizeof() = 26 + (attribute_name_length * 2) bytes */
+} __attribute__((__packed__)) ATTR_LIST_ENTRY;
+
+#endif //SYSTEM_SOFTWARE_ATTRIBUTE_LIST_H
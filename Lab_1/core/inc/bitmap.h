@@ -0,0 +1,41 @@
+#ifndef SYSTEM_SOFTWARE_BITMAP_H
+#define SYSTEM_SOFTWARE_BITMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "general_information.h"
+
+#define BITMAP_CHUNK_SIZE (1024 * 1024)    /* Bytes of $Bitmap read with one request. */
+#define BITMAP_HISTOGRAM_BUCKETS 48    /* Bucket k counts free extents of 2^k .. 2^(k+1) - 1 clusters. */
+#define BITMAP_REGIONS 64    /* Parts of the volume in the allocation heatmap. */
+#define BITMAP_REGION_ALIGN 512    /* Regions start at multiples of 512 clusters (64 bytes of $Bitmap). */
+
+/**
+ * struct BITMAP_STATS - Allocation of the clusters of the volume.
+ *
+ * $Bitmap has one bit per cluster, set when the cluster is in use. Region r
+ * of the heatmap covers clusters r * region_clusters .. (r + 1) * region_clusters - 1.
+ */
+typedef struct {
+    uint64_t clusters;
+    uint64_t used_clusters;
+    uint64_t free_clusters;
+
+    uint64_t free_extents;    /* Runs of free clusters. */
+    uint64_t largest_free_extent;
+    uint64_t histogram[BITMAP_HISTOGRAM_BUCKETS];
+
+    uint32_t region_count;
+    uint64_t region_clusters;
+    uint64_t region_used[BITMAP_REGIONS];
+} BITMAP_STATS;
+
+int bitmap_stats(GENERAL_INFORMATION *g_info, BITMAP_STATS *stats);
+
+uint8_t *load_bitmap(GENERAL_INFORMATION *g_info, uint64_t *clusters);
+
+int clusters_free(const uint8_t *bitmap, uint64_t clusters, uint64_t lcn, uint64_t length);
+
+uint64_t count_bits(const uint8_t *data, size_t length);
+
+#endif //SYSTEM_SOFTWARE_BITMAP_H
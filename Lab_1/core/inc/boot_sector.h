@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define NTFS_OEM_ID 0x202020205346544eULL    /* "NTFS    " read as a little endian uint64_t. */
+
 /**
  * struct BIOS_PARAMETER_BLOCK - BIOS parameter block (bpb) structure.
  */
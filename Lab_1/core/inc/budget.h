@@ -0,0 +1,103 @@
+#ifndef SYSTEM_SOFTWARE_BUDGET_H
+#define SYSTEM_SOFTWARE_BUDGET_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define BUDGET_UNLIMITED 0
+#define BUDGET_SAMPLE 32    /* Entries of a large cache compared to pick one victim. */
+#define BUDGET_PRIORITY_UNIT 1024    /* Priority grows by the cost in ns of every BUDGET_PRIORITY_UNIT bytes. */
+
+/**
+ * enum BUDGET_COMPONENTS - Users of the memory of one volume.
+ */
+typedef enum {
+    BUDGET_EXTENT_MAPS = 0,    /* cached runlists and resident values decoded from records */
+    BUDGET_PATH_CACHE = 1,    /* directory paths remembered by record_path() */
+    BUDGET_PATH_TABLE = 2,    /* record -> parent and name of the whole volume */
+    BUDGET_NAME_INDEX = 3,    /* trigram index of file names and its build buffers */
+    BUDGET_COPY_BUFFERS = 4,    /* record batches and output buffers of cp and tar */
+    BUDGET_COMPONENT_COUNT = 5,
+} BUDGET_COMPONENTS;
+
+/**
+ * struct BUDGET_EVICTOR - Cache a component can shrink when the budget is short.
+ *
+ * Entries of all caches are ranked by one GreedyDual-Size priority: clock of
+ * the budget at the last use plus the cost to load the entry again per
+ * BUDGET_PRIORITY_UNIT bytes, see budget_priority(). The cheapest entry of
+ * all caches is evicted first and the clock moves to its priority, so
+ * entries that are not used again age out whatever their cost.
+ *
+ * Both functions are called with the lock of the budget held and may only
+ * trylock the lock of their cache, the thread asking for memory may hold it.
+ */
+typedef struct {
+    /* Priority of the entry evict() would drop, -1 when nothing can be dropped now. */
+    int (*lowest)(void *context, uint64_t *priority);
+    /* Drops that entry, releases its charge and returns its size, 0 when nothing was dropped. */
+    uint64_t (*evict)(void *context);
+} BUDGET_EVICTOR;
+
+/**
+ * struct BUDGET_USAGE - Memory of one component, in bytes.
+ */
+typedef struct {
+    uint64_t used;
+    uint64_t high_water;    /* Highest value of used since init(). */
+    uint64_t evictions;    /* Entries dropped to make room. */
+    uint64_t refusals;    /* Charges refused, or cut to their minimum, because the budget was full. */
+} BUDGET_USAGE;
+
+/**
+ * struct MEMORY_BUDGET - One memory limit shared by the caches and buffers of a volume.
+ *
+ * Components charge what they allocate and release what they free. When a
+ * charge does not fit, registered caches are shrunk, cheapest entries first;
+ * a charge that still does not fit is refused with budget_charge(), or taken
+ * over the limit with budget_force() for memory that is in use right now.
+ * Counters are atomic, the lock only serialises evictions.
+ */
+typedef struct memory_budget {
+    uint64_t limit;    /* Bytes, BUDGET_UNLIMITED for no limit. */
+    uint64_t used;
+    uint64_t high_water;
+    uint64_t clock;    /* Priority of the last evicted entry. */
+    BUDGET_USAGE components[BUDGET_COMPONENT_COUNT];
+    const BUDGET_EVICTOR *evictors[BUDGET_COMPONENT_COUNT];
+    void *contexts[BUDGET_COMPONENT_COUNT];
+    pthread_mutex_t lock;
+} MEMORY_BUDGET;
+
+MEMORY_BUDGET *create_budget(uint64_t limit);
+
+void free_budget(MEMORY_BUDGET *budget);
+
+void set_budget_limit(MEMORY_BUDGET *budget, uint64_t limit);
+
+void budget_trim(MEMORY_BUDGET *budget);
+
+void budget_register(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, const BUDGET_EVICTOR *evictor,
+                     void *context);
+
+void budget_unregister(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component);
+
+int budget_charge(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes);
+
+uint64_t budget_charge_up_to(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes, uint64_t minimum);
+
+void budget_force(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes);
+
+void budget_release(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes);
+
+void budget_evicted(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t priority);
+
+int budget_over(const MEMORY_BUDGET *budget);
+
+uint64_t budget_priority(const MEMORY_BUDGET *budget, uint64_t cost, uint64_t size);
+
+char *format_budget(const MEMORY_BUDGET *budget);
+
+int parse_budget_size(const char *text, uint64_t *size);
+
+#endif //SYSTEM_SOFTWARE_BUDGET_H
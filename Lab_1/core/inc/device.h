@@ -6,7 +6,7 @@
 #define H_DEVICE
 
 #include <stdio.h>
-#include <blkid/blkid.h>
+#include <stdint.h>
 #include <math.h>
 
 #define _KiB_ pow(2,10)
@@ -14,17 +14,41 @@
 #define _GiB_ pow(2,30)
 #define _TiB_ pow(2,40)
 
-int init_cache(blkid_cache *cache);
-
-int probe_devices(blkid_cache *cache);
-
-int iterate_devices(blkid_cache *cache);
+#define DEVICE_PROBE_THREADS 16    /* Devices probed at the same time. */
+#define DEVICE_NAME_MAX 32
+#define DEVICE_LABEL_MAX 128
+
+/**
+ * struct DEVICE_INFO - Block device found in /sys/block and what its first sector holds.
+ *
+ * The geometry fields are only filled when ntfs is set. error is the errno of
+ * a failed open or read, the rest of the fields stay zero then.
+ */
+typedef struct {
+    char name[DEVICE_NAME_MAX];    /* Kernel name, the device node is /dev/<name>. */
+    char parent[DEVICE_NAME_MAX];    /* Disk of a partition, empty for a whole disk. */
+    uint64_t size;    /* Size in bytes. */
+    int32_t error;
+    uint8_t ntfs;    /* The boot sector has the "NTFS    " OEM id. */
+    uint8_t read_only;
+    uint16_t bytes_per_sector;
+    uint32_t cluster_size;
+    uint64_t number_of_sectors;
+    uint64_t mft_lcn;
+    uint32_t mft_record_size;
+    uint32_t index_block_size;
+    uint64_t serial_number;
+    char label[DEVICE_LABEL_MAX];    /* $VOLUME_NAME, empty if the volume has none. */
+/* sizeof() = 244 bytes */
+} __attribute__((__packed__)) DEVICE_INFO;
+
+int probe_device(const char *path, DEVICE_INFO *device);
+
+int list_devices(DEVICE_INFO **devices, uint32_t *count);
 
 void size_print(long long size);
 
-void get_tag(blkid_probe *probe, char *tag_name);
-
 void print_device();
 
 
-#endif
\ No newline at end of file
+#endif
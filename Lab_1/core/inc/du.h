@@ -0,0 +1,51 @@
+#ifndef SYSTEM_SOFTWARE_DU_H
+#define SYSTEM_SOFTWARE_DU_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define DU_DEFAULT_TOP 10    /* Largest files and directories listed by default. */
+
+/**
+ * struct DU_ENTRY - Record ranked by allocated size.
+ */
+typedef struct {
+    uint64_t allocated_size;
+    uint64_t logical_size;
+    uint32_t mft_num;
+} DU_ENTRY;
+
+/**
+ * struct DU_HEAP - The capacity largest entries seen so far.
+ *
+ * A min-heap while records are added, so the smallest kept entry is replaced
+ * in O(log capacity). Sorted from the largest entry when the report is done.
+ */
+typedef struct {
+    DU_ENTRY *entries;
+    uint32_t count;
+    uint32_t capacity;
+} DU_HEAP;
+
+/**
+ * struct DU_REPORT - Disk usage of one directory tree.
+ *
+ * Logical size is the byte size of all $DATA streams, allocated size the
+ * clusters they take (compressed size of compressed and sparse streams) plus
+ * index blocks of directories. Hard linked files are counted once, under the
+ * directory of their first name.
+ */
+typedef struct {
+    uint64_t logical_size;
+    uint64_t allocated_size;
+    uint64_t files;
+    uint64_t directories;
+    DU_HEAP largest_files;
+    DU_HEAP largest_directories;
+} DU_REPORT;
+
+int disk_usage(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t top, DU_REPORT *report);
+
+void free_du_report(DU_REPORT *report);
+
+#endif //SYSTEM_SOFTWARE_DU_H
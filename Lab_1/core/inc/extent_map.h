@@ -0,0 +1,100 @@
+#ifndef SYSTEM_SOFTWARE_EXTENT_MAP_H
+#define SYSTEM_SOFTWARE_EXTENT_MAP_H
+
+#include <stdint.h>
+#include "mft.h"
+#include "attribute.h"
+#include "general_information.h"
+
+#define EXTENT_MAP_CACHE_SIZE 32
+#define LCN_HOLE (-1)
+
+/**
+ * struct EXTENT - One decoded run of a runlist (mapping pair).
+ *
+ * Maps @length clusters starting at virtual cluster @vcn of the attribute
+ * value to logical cluster @lcn of the volume. Sparse runs have lcn LCN_HOLE.
+ */
+typedef struct {
+    uint64_t vcn;
+    int64_t lcn;
+    uint64_t length;
+} EXTENT;
+
+/**
+ * struct EXTENT_SEGMENT - Runlist of one attribute extent (one ATTR_RECORD).
+ *
+ * When an attribute is described by an $ATTRIBUTE_LIST its runlist is split
+ * between several mft records. Each segment is decoded only when a vcn inside
+ * it is requested for the first time and is kept afterwards. Segments of a
+ * map that is not complete are loaded under the cache lock of the volume.
+ */
+typedef struct {
+    uint64_t lowest_vcn;
+    uint64_t mft_reference; /* record holding ATTR_RECORD of this segment */
+    EXTENT *extents; /* NULL until the segment is loaded */
+    uint32_t extent_count;
+    uint8_t loading; /* protects from recursion while the segment is loaded */
+} EXTENT_SEGMENT;
+
+/**
+ * struct EXTENT_MAP - Cached vcn -> lcn map of one attribute.
+ *
+ * Segments are sorted by lowest_vcn, extents inside a segment are sorted by
+ * vcn, so any vcn is found with two binary searches.
+ * Resident attributes keep a copy of their value in resident_data.
+ */
+typedef struct extent_map {
+    uint32_t mft_num;
+    uint32_t type;
+    char *name; // named stream of $DATA, NULL for the unnamed attribute
+    uint8_t resident;
+    uint8_t *resident_data;
+
+    uint64_t data_size;
+    uint64_t allocated_size;
+    uint64_t initialized_size;
+
+    EXTENT_SEGMENT *segments;
+    uint32_t segment_count;
+    uint8_t complete; // every segment is decoded, the map never changes and is read without locking
+
+    uint32_t refs; // users holding the map, cache never evicts referenced maps
+    pthread_mutex_t *lock; // cache lock of the volume while the map is cached
+    struct extent_map *next; // connected list of cached maps (LRU order)
+
+    struct memory_budget *budget; // budget of the volume while the map is cached
+    uint64_t charged; // bytes charged to BUDGET_EXTENT_MAPS
+    uint64_t cost; // ns spent loading the map and its segments
+    uint64_t priority; // eviction order, see BUDGET_EVICTOR
+} EXTENT_MAP;
+
+int decode_runlist(const uint8_t *run_list, const uint8_t *end, uint64_t lowest_vcn, EXTENT **extents,
+                   uint32_t *extent_count);
+
+EXTENT_MAP *load_extent_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD *base_record, uint32_t type);
+
+EXTENT_MAP *get_extent_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t type);
+
+EXTENT_MAP *get_stream_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *name);
+
+void put_extent_map(EXTENT_MAP *map);
+
+void complete_extent_map(GENERAL_INFORMATION *g_info, EXTENT_MAP *map);
+
+int lookup_vcn(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, uint64_t vcn, EXTENT *extent);
+
+int64_t read_volume(GENERAL_INFORMATION *g_info, void *buf, uint64_t size, uint64_t offset);
+
+int64_t read_attr_data(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, uint64_t offset, uint8_t *buf,
+                       uint64_t length);
+
+int read_attribute_list(GENERAL_INFORMATION *g_info, ATTR_RECORD *list_attr, uint8_t **list, uint64_t *list_length);
+
+void free_extent_map(EXTENT_MAP *map);
+
+void register_extent_map_cache(GENERAL_INFORMATION *g_info);
+
+void free_extent_map_cache(GENERAL_INFORMATION *g_info);
+
+#endif //SYSTEM_SOFTWARE_EXTENT_MAP_H
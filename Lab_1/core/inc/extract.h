@@ -0,0 +1,52 @@
+#ifndef SYSTEM_SOFTWARE_EXTRACT_H
+#define SYSTEM_SOFTWARE_EXTRACT_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define EXTRACT_BATCH_RECORDS 256   /* Records read from $MFT at once. */
+#define EXTRACT_MAX_GAP 32          /* Unneeded records worth reading instead of starting a new batch. */
+
+/**
+ * enum EXTRACT_LINK_MODES - How further names of an already written record are created.
+ *
+ * When the destination can't link or clone, the data is written once more.
+ */
+enum {
+    EXTRACT_LINK_HARD = 0,      /* hard link to the first copy */
+    EXTRACT_LINK_REFLINK = 1,   /* independent copy sharing the blocks of the first one (FICLONE) */
+};
+
+/**
+ * struct EXTRACT_ENTRY - One file to be written out of the volume.
+ */
+typedef struct {
+    uint32_t mft_num;
+    char *path; /* destination path on the host */
+} EXTRACT_ENTRY;
+
+/**
+ * struct EXTRACT_LIST - Files collected for one extraction.
+ *
+ * Files are written only after the whole tree is walked: the list is sorted
+ * by mft record number and resident $DATA is written straight from records
+ * read in contiguous batches, one pass over the touched part of $MFT.
+ * Entries of one record (hard links on the volume) end up next to each other,
+ * its data is read once and the other names are linked to the first copy.
+ */
+typedef struct {
+    EXTRACT_ENTRY *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t link_mode;  /* EXTRACT_LINK_MODES */
+} EXTRACT_LIST;
+
+int add_extract_entry(EXTRACT_LIST *list, uint32_t mft_num, const char *path);
+
+int extract_file(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *path);
+
+int extract_files(GENERAL_INFORMATION *g_info, EXTRACT_LIST *list);
+
+void free_extract_list(EXTRACT_LIST *list);
+
+#endif //SYSTEM_SOFTWARE_EXTRACT_H
@@ -2,10 +2,22 @@
 #define SYSTEM_SOFTWARE_GENERAL_INFORMATION_H
 
 #include <stdint.h>
-#include "inode.h"
+#include <pthread.h>
+
+struct extent_map;
+struct sidecar;
+struct name_index;
+struct path_table;
+struct volume_stats;
+struct memory_budget;
 
 /**
  * Basic information collected from different structures to facilitate the work
+ *
+ * One volume is shared by all of its sessions (see SESSION). Geometry, the
+ * descriptor, the sidecar and the map of $MFT are written before the first
+ * session is opened and only read afterwards. The caches below are filled on
+ * demand by any thread and are guarded by the two locks.
  */
 typedef struct {
     uint64_t mft_lcn;            /* Cluster location of mft data. */
@@ -17,9 +29,19 @@ typedef struct {
 
     uint64_t mft_record_size_in_bytes;
     uint16_t block_size_in_bytes;
+    uint32_t cluster_size_in_bytes;
+    uint64_t volume_serial_number;
 
-    INODE *cur_node;
-    INODE *root_node;
+    struct extent_map *mft_map;    /* Data runs of $MFT itself, used to locate records. */
+    struct extent_map *extent_maps;    /* Recently used maps of file attributes. */
+    uint32_t extent_maps_count;
+    struct sidecar *sidecar;    /* Mapped metadata index, NULL when not used. */
+    struct name_index *name_index;    /* Trigram index of file names, built by the first search. */
+    struct path_table *path_table;    /* Record -> path of the whole volume, built when first needed. */
+    pthread_mutex_t *cache_lock;    /* Recursive, guards extent_maps and segments loaded on demand. */
+    pthread_mutex_t *index_lock;    /* Held while name_index or path_table is built, scans never take it. */
+    struct volume_stats *stats;    /* I/O and cache counters on per-thread shards, see stats.h. */
+    struct memory_budget *budget;    /* Memory limit shared by the caches, indexes and copy buffers, see budget.h. */
 
     int file_descriptor;
 } __attribute__((__packed__)) GENERAL_INFORMATION;
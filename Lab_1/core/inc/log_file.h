@@ -0,0 +1,55 @@
+#ifndef SYSTEM_SOFTWARE_LOG_FILE_H
+#define SYSTEM_SOFTWARE_LOG_FILE_H
+
+#include <stdint.h>
+#include "mft.h"
+
+/**
+ * struct RESTART_PAGE_HEADER - Log file restart page header.
+ *
+ * Begins the restart area. $LogFile starts with two copies of the restart
+ * page, each one is protected by the update sequence array.
+ */
+typedef struct {
+/*Ofs*/
+/*  0	NTFS_RECORD; -- Unfolded here as gcc doesn't like unnamed structs. */
+/*  0*/    NTFS_RECORD_TYPES magic;    /* The magic is "RSTR". */
+/*  4*/    uint16_t usa_ofs;        /* See NTFS_RECORD definition in mft.h. */
+/*  6*/    uint16_t usa_count;        /* See NTFS_RECORD definition in mft.h. */
+
+/*  8*/    uint64_t chkdsk_lsn;        /* The last log file sequence number found by
+				   chkdsk. Only used when the magic is changed
+				   to "CHKD". Otherwise this is zero. */
+/* 16*/    uint32_t system_page_size;    /* Byte size of system pages when the log file
+				   was created, has to be >= 512 and a power of
+				   2. */
+/* 20*/    uint32_t log_page_size;    /* Byte size of log file pages, has to be >=
+				   512 and a power of 2. */
+/* 24*/    uint16_t restart_area_offset;/* Byte offset from the start of this header to
+				   the RESTART_AREA. */
+/* 26*/    int16_t minor_ver;        /* Log file minor version. */
+/* 28*/    int16_t major_ver;        /* Log file major version. */
+/* sizeof() = 30 (0x1e) bytes */
+} __attribute__((__packed__)) RESTART_PAGE_HEADER;
+
+/**
+ * struct RESTART_AREA - Log file restart area record (beginning only).
+ *
+ * current_lsn moves forward with every logged change of the volume, so it
+ * tells whether metadata read earlier is still current.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    uint64_t current_lsn;    /* The current, i.e. last LSN inside the log
+				   when the restart area was last written. */
+/*  8*/    uint16_t log_clients;    /* Number of log client records in the array of
+				   log client records which follows this
+				   restart area. */
+/* 10*/    uint16_t client_free_list;    /* The index of the first free log client record
+				   in the array of log client records. */
+/* 12*/    uint16_t client_in_use_list;/* The index of the first in-use log client
+				   record in the array of log client records. */
+/* 14*/    uint16_t flags;        /* Flags modifying LFS behaviour. */
+} __attribute__((__packed__)) RESTART_AREA;
+
+#endif //SYSTEM_SOFTWARE_LOG_FILE_H
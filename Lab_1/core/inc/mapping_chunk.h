@@ -2,6 +2,7 @@
 #define SYSTEM_SOFTWARE_MAPPING_CHUNK_H
 
 #include <stdint.h>
+#include "extent_map.h"
 
 // Custom structs for easier work
 
@@ -9,7 +10,7 @@
 typedef struct {
     uint64_t length;
     uint8_t *buf;
-    uint8_t current_block;
+    uint64_t current_block;
 } __attribute__((__packed__)) MAPPING_CHUNK;
 
 
@@ -18,14 +19,11 @@ typedef struct {
     uint8_t resident;
     uint64_t length;
     uint64_t blocks_count;
-    int cur_lcn;
-    int lcn_count;
     uint64_t cur_block;
     int signal;
 
     uint8_t *buf;
-    int64_t *lcns;
-    uint64_t *lengths;
+    EXTENT_MAP *map; // vcn -> lcn map of $DATA, held until free_data_chunk
 } __attribute__((__packed__)) MAPPING_CHUNK_DATA;
 
 #endif //SYSTEM_SOFTWARE_MAPPING_CHUNK_H
\ No newline at end of file
@@ -131,4 +131,7 @@ typedef struct {
  */
 } __attribute__((__packed__)) MFT_RECORD;
 
+/* Only NTFS 3.1 records store their number, older ones keep the update sequence array from offset 42. */
+#define MFT_RECORD_HAS_NUMBER(record) ((record)->usa_ofs >= sizeof(MFT_RECORD))
+
 #endif //SYSTEM_SOFTWARE_MFT_H
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SYSTEM_SOFTWARE_MFT_SCAN_H
+#define SYSTEM_SOFTWARE_MFT_SCAN_H
+
+#include <stdint.h>
+#include "mft.h"
+#include "attribute.h"
+#include "file_name_attribute.h"
+#include "general_information.h"
+
+#define MFT_SCAN_BATCH_RECORDS 1024    /* Records read from $MFT with one request. */
+#define MFT_SCAN_PARALLEL_BATCH_RECORDS 8192    /* Records decoded by all threads between two reads. */
+#define MFT_SCAN_MAX_THREADS 32
+
+/*
+ * Called for every record of $MFT that passed fixups, in mft order, including
+ * records that are not in use and extension records. Returning -1 stops the scan.
+ */
+typedef int (*MFT_SCAN_CALLBACK)(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record,
+                                 void *context);
+
+uint64_t mft_record_count(GENERAL_INFORMATION *g_info);
+
+int scan_mft(GENERAL_INFORMATION *g_info, MFT_SCAN_CALLBACK callback, void *context);
+
+int scan_mft_parallel(GENERAL_INFORMATION *g_info, MFT_SCAN_CALLBACK callback, void **contexts, uint32_t threads);
+
+uint32_t scan_threads(void);
+
+ATTR_RECORD *next_attr(GENERAL_INFORMATION *g_info, MFT_RECORD *record, ATTR_RECORD *attr, uint32_t type);
+
+#endif //SYSTEM_SOFTWARE_MFT_SCAN_H
@@ -0,0 +1,61 @@
+#ifndef SYSTEM_SOFTWARE_MIRROR_H
+#define SYSTEM_SOFTWARE_MIRROR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "general_information.h"
+#include "inode.h"
+
+#define MIRROR_MAGIC 0x524f5252494d544eULL    /* "NTMIRROR" */
+#define MIRROR_VERSION 1
+#define MIRROR_SUFFIX ".mirror"    /* Manifest of <target>/<name> is <target>/.<name>.mirror */
+#define MIRROR_BATCH_RECORDS 256    /* Records read from $MFT at once for the metadata. */
+
+/**
+ * struct MIRROR_HEADER - Start of a mirror manifest.
+ *
+ * The manifest is written next to the mirrored tree after every run and lists
+ * what the previous run copied. Entries are sorted by path, zero terminated
+ * paths relative to the target directory follow them.
+ */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t volume_serial_number;    /* Entries of another volume are never taken as unchanged. */
+    uint64_t entry_count;
+    uint64_t names_size;
+} __attribute__((__packed__)) MIRROR_HEADER;
+
+/**
+ * struct MIRROR_ENTRY - One file or directory of the mirrored tree.
+ *
+ * A file is copied again when its mft reference (record and sequence
+ * number), size or $STANDARD_INFORMATION modification time differ from the
+ * entry, or when the copy is missing or has another size.
+ */
+typedef struct {
+    uint64_t mft_reference;
+    uint64_t size;        /* Byte size of unnamed $DATA. */
+    uint64_t mtime;        /* NT time of the last data change. */
+    uint64_t path_offset;
+    uint16_t path_length;
+    uint16_t flags;        /* MFT_RECORD_IS_DIRECTORY for directories. */
+    uint32_t reserved;
+/* sizeof() = 40 bytes */
+} __attribute__((__packed__)) MIRROR_ENTRY;
+
+/**
+ * struct MIRROR_STATS - Outcome of one run.
+ */
+typedef struct {
+    uint64_t copied;
+    uint64_t unchanged;
+    uint64_t deleted;
+    uint64_t directories;
+} MIRROR_STATS;
+
+int mirror_tree(GENERAL_INFORMATION *g_info, INODE *node, const char *to_path, bool delete, uint8_t link_mode,
+                MIRROR_STATS *stats);
+
+#endif //SYSTEM_SOFTWARE_MIRROR_H
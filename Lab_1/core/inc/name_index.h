@@ -0,0 +1,57 @@
+#ifndef SYSTEM_SOFTWARE_NAME_INDEX_H
+#define SYSTEM_SOFTWARE_NAME_INDEX_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define TRIGRAM_KEYS (1 << 24)    /* Three name bytes make one key. */
+
+/**
+ * struct NAME_ENTRY - One $FILE_NAME of a file in use.
+ *
+ * DOS names are left out, the long name of the same file is indexed instead.
+ */
+typedef struct {
+    uint64_t mft_reference;    /* Record number and sequence number of the file. */
+    uint64_t parent;        /* Mft reference of the parent directory. */
+    uint32_t name_offset;    /* Zero terminated name in NAME_INDEX.names. */
+    uint16_t flags;        /* MFT_RECORD_FLAGS of the file. */
+    uint8_t name_length;
+} __attribute__((__packed__)) NAME_ENTRY;
+
+/**
+ * struct NAME_INDEX - Trigram index over all file names of the volume.
+ *
+ * Every name is folded to lower case and split into overlapping three byte
+ * trigrams. For trigram trigrams[i] the entries holding it are
+ * postings[offsets[i]] .. postings[offsets[i + 1] - 1], in ascending order,
+ * so a query intersects the lists of its trigrams and only checks the names
+ * that survive. Everything the index and its build take is charged to the
+ * budget of the volume, a build that does not fit fails.
+ */
+typedef struct name_index {
+    NAME_ENTRY *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    char *names;
+    uint64_t names_size;
+    uint64_t names_capacity;
+
+    uint32_t *trigrams;    /* Sorted keys that occur at least once. */
+    uint32_t *offsets;    /* trigram_count + 1 positions in postings. */
+    uint32_t trigram_count;
+    uint32_t *postings;    /* Entry numbers. */
+
+    struct memory_budget *budget;
+    uint64_t charged;    /* Bytes charged to BUDGET_NAME_INDEX. */
+} NAME_INDEX;
+
+NAME_INDEX *build_name_index(GENERAL_INFORMATION *g_info);
+
+NAME_INDEX *get_name_index(GENERAL_INFORMATION *g_info);
+
+int search_name_index(const NAME_INDEX *index, const char *pattern, uint32_t **matches, uint32_t *match_count);
+
+void free_name_index(NAME_INDEX *index);
+
+#endif //SYSTEM_SOFTWARE_NAME_INDEX_H
@@ -15,27 +15,58 @@
 #include "index_entry.h"
 #include "index_allocation_attribute.h"
 #include "file_name_attribute.h"
+#include "standard_information.h"
+#include "attribute_list.h"
+#include "log_file.h"
 
 #include "general_information.h"
 #include "inode.h"
 #include "mapping_chunk.h"
+#include "extent_map.h"
+#include "stats.h"
+#include "budget.h"
+
+#define NTFS_BLOCK_SIZE 512
+#define LOG_FILE_PAGE_SIZE 4096
+
+/*
+ * Called by walk_index_entries() for every entry with a key. Returns 1 when
+ * the entry is counted, 0 when it is skipped and -1 to stop the walk.
+ */
+typedef int (*INDEX_ENTRY_CALLBACK)(INDEX_ENTRY *entry, const char *file_name, uint8_t file_name_length,
+                                    void *context);
 
 GENERAL_INFORMATION *init(char *file_name);
 
+void print_g_info(const GENERAL_INFORMATION *g_info);
+
 NTFS_BOOT_SECTOR *open_NTFS_file_system(int file_descriptor);
 
 int read_directory(GENERAL_INFORMATION *g_info, INODE **inode);
 
+int walk_index_entries(uint8_t *start, const uint8_t *end, INDEX_ENTRY_CALLBACK callback, void *context,
+                       INDEX_ENTRY **last_entry);
+
 uint64_t search_mft_record(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD **mft_record);
 
+int read_mft_records(GENERAL_INFORMATION *g_info, uint64_t first, uint32_t count, uint8_t *buf);
+
 int search_attr(GENERAL_INFORMATION *g_info, uint32_t type, MFT_RECORD *mft_record, ATTR_RECORD **attr_record);
 
+int apply_fixups(uint8_t *record, uint32_t size);
+
+int read_volume_lsn(GENERAL_INFORMATION *g_info, uint64_t *lsn);
+
 int read_file_data(GENERAL_INFORMATION *g_info, INODE *inode, MAPPING_CHUNK_DATA **chunk_data);
 
 int read_block_file(GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data);
 
+uint8_t convert_file_name(char *file_name, const FILE_NAME_ATTR *attr);
+
 void free_inode(INODE *inode);
 
 int free_data_chunk(MAPPING_CHUNK_DATA *chunk_data);
 
+int free_g_info(GENERAL_INFORMATION *g_info);
+
 #endif //SYSTEM_SOFTWARE_NTFS_H
@@ -0,0 +1,83 @@
+#ifndef SYSTEM_SOFTWARE_PATH_TABLE_H
+#define SYSTEM_SOFTWARE_PATH_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "mft.h"
+#include "general_information.h"
+
+#define PATH_TABLE_MAX_DEPTH 1024    /* Deeper parent chains are treated as loops. */
+#define PATH_CACHE_SIZE 4096    /* Directory paths remembered by record_path(). */
+#define PATH_CACHE_STEP_NS 100    /* Rough cost of one step up the parents, the reload cost of a remembered path. */
+
+/**
+ * struct PATH_NODE - Parent and name of one mft record.
+ *
+ * The path of a record is the path of its parent plus its name, so the whole
+ * tree is stored once and any path is rebuilt by walking up the parents.
+ * name_length is zero for records that are not in use.
+ */
+typedef struct {
+    uint32_t parent;    /* Mft record number of the parent directory. */
+    uint32_t name_offset;    /* Name in PATH_TABLE.names. */
+    uint16_t flags;        /* MFT_RECORD_FLAGS of the record. */
+    uint8_t name_length;
+} __attribute__((__packed__)) PATH_NODE;
+
+/**
+ * struct PATH_CACHE_ENTRY - Remembered path of a directory.
+ */
+typedef struct {
+    char *path;
+    uint32_t mft_num;
+    uint32_t length;
+    uint32_t depth;    /* Steps from the root, what the path saves. */
+    uint64_t priority;    /* Eviction order, see BUDGET_EVICTOR. */
+} PATH_CACHE_ENTRY;
+
+/**
+ * struct PATH_TABLE - Mft record number -> path for the whole volume.
+ *
+ * Built from the $FILE_NAME parent references of one $MFT scan, or from the
+ * sidecar when one is open. Other scans can fill the table on the way by
+ * passing their records to add_path_record(). Files are mostly looked up
+ * with many siblings, so paths of their directories are kept in a direct
+ * mapped cache. Nodes and names are charged to the budget of the volume while
+ * the table is filled, remembered paths once the table is registered.
+ */
+typedef struct path_table {
+    PATH_NODE *nodes;
+    uint64_t node_count;
+    char *names;
+    uint64_t names_size;
+    uint64_t names_capacity;
+    uint8_t *dos_name;    /* Set while the table is filled: name of the node is a DOS name. */
+
+    PATH_CACHE_ENTRY cache[PATH_CACHE_SIZE];
+    pthread_mutex_t cache_lock;    /* Recursive, the table is shared by all sessions, record_path() updates cache. */
+
+    struct memory_budget *budget;
+    uint64_t charged;    /* Bytes of nodes and names charged to BUDGET_PATH_TABLE. */
+    uint8_t registered;    /* The budget evicts remembered paths, see register_path_cache(). */
+    uint32_t hand;    /* Next cache slot the evictor looks at. */
+    uint32_t victim;    /* Slot picked by the last lowest() of the evictor. */
+} PATH_TABLE;
+
+PATH_TABLE *build_path_table(GENERAL_INFORMATION *g_info);
+
+PATH_TABLE *get_path_table(GENERAL_INFORMATION *g_info);
+
+PATH_TABLE *create_path_table(GENERAL_INFORMATION *g_info);
+
+int add_path_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context);
+
+void finish_path_table(PATH_TABLE *table);
+
+void register_path_cache(PATH_TABLE *table);
+
+int64_t record_path(PATH_TABLE *table, uint64_t mft_num, char *buf, size_t size);
+
+void free_path_table(PATH_TABLE *table);
+
+#endif //SYSTEM_SOFTWARE_PATH_TABLE_H
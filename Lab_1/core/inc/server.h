@@ -0,0 +1,67 @@
+#ifndef SYSTEM_SOFTWARE_SERVER_H
+#define SYSTEM_SOFTWARE_SERVER_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define SERVER_BACKLOG 64
+#define SERVER_MAX_CONNECTIONS 1024    /* Clients beyond this wait in the listen backlog. */
+#define SERVER_MAX_VOLUMES 16
+#define SERVER_MAX_REQUEST 4096    /* Longest argument block of one request. */
+#define SERVER_SEND_TIMEOUT 30    /* Seconds a reply may wait for a client that doesn't read it. */
+#define SERVER_STOP_GRACE 5    /* Seconds requests in progress get to be answered on stop. */
+
+/**
+ * enum SERVER_OPCODES - Requests understood by the daemon.
+ *
+ * Arguments are zero terminated strings. Paths are relative to the working
+ * directory of the connection on that volume unless they start with '/'.
+ */
+typedef enum {
+    SERVER_LS = 1,    /* [path] -> listing as printed by ls */
+    SERVER_STAT = 2,    /* [path] -> record, sizes and times */
+    SERVER_FIND = 3,    /* pattern -> record and path of every match */
+    SERVER_CAT = 4,    /* path -> content of unnamed $DATA */
+    SERVER_CP = 5,    /* path, target directory inside the output root -> message, flags are CP_FLAGS */
+    SERVER_CD = 6,    /* path -> empty payload */
+    SERVER_PWD = 7,    /* -> working directory */
+} SERVER_OPCODES;
+
+typedef enum {
+    SERVER_OK = 0,
+    SERVER_ERROR = 1,    /* The payload is the error message. */
+} SERVER_STATUS;
+
+/**
+ * struct SERVER_REQUEST - Header of a request, followed by length bytes of arguments.
+ *
+ * A connection sends any number of requests and gets the replies in the same
+ * order. Every connection has a working directory of its own on each volume.
+ * Integers are in host byte order, clients are on the same machine.
+ */
+typedef struct {
+    uint32_t length;
+    uint8_t opcode;
+    uint8_t volume;    /* Number of the volume, in the order they were opened. */
+    uint16_t flags;
+/* sizeof() = 8 bytes */
+} __attribute__((__packed__)) SERVER_REQUEST;
+
+/**
+ * struct SERVER_REPLY - Header of a reply, followed by length bytes of payload.
+ *
+ * The payload is the text the shell prints for the command, or the data of
+ * the file for SERVER_CAT. When the data of a file can't be read to the end
+ * after the header went out the connection is closed.
+ */
+typedef struct {
+    uint64_t length;
+    uint8_t status;
+    uint8_t reserved[7];
+/* sizeof() = 16 bytes */
+} __attribute__((__packed__)) SERVER_REPLY;
+
+int serve(const char *socket_path, GENERAL_INFORMATION **volumes, uint32_t volume_count, uint32_t workers,
+          const char *output_root);
+
+#endif //SYSTEM_SOFTWARE_SERVER_H
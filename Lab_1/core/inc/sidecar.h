@@ -0,0 +1,105 @@
+#ifndef SYSTEM_SOFTWARE_SIDECAR_H
+#define SYSTEM_SOFTWARE_SIDECAR_H
+
+#include <stdint.h>
+#include "general_information.h"
+#include "extent_map.h"
+#include "usn_journal.h"
+
+#define SIDECAR_MAGIC 0x315844494653544eULL   /* "NTFSIDX1" */
+#define SIDECAR_VERSION 2
+#define SIDECAR_MAX_DEPTH 1024   /* Deeper parent chains are treated as loops. */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/**
+ * struct SIDECAR_HEADER - Beginning of a metadata sidecar file.
+ *
+ * The sidecar keeps metadata of one image between runs. It is only used when
+ * serial number, $MFT size and the $LogFile lsn still match the volume, any
+ * write to the volume moves the lsn forward. When only the lsn moved, the
+ * records named by the change journal since usn_cursor are read again and the
+ * rest is kept. Offsets are from the start of the file and 8-byte aligned.
+ */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+
+    uint64_t volume_serial_number;
+    uint64_t mft_data_size;        /* Byte size of $MFT:$DATA. */
+    uint64_t volume_lsn;        /* current_lsn of the $LogFile restart area. */
+    uint32_t record_size;
+    uint32_t cluster_size;
+
+    uint64_t mft_allocated_size;
+    uint64_t mft_initialized_size;
+    uint64_t extent_count;        /* Decoded runlist of $MFT:$DATA. */
+    uint64_t extents_offset;
+    uint64_t record_count;        /* One SIDECAR_RECORD per mft record. */
+    uint64_t records_offset;
+    uint64_t path_count;        /* SIDECAR_PATH entries sorted by hash. */
+    uint64_t paths_offset;
+    uint64_t names_size;        /* Zero terminated names, SIDECAR_RECORD and SIDECAR_PATH point here. */
+    uint64_t names_offset;
+    USN_CURSOR usn_cursor;        /* Journal position when the sidecar was written, zero without a journal. */
+} __attribute__((__packed__)) SIDECAR_HEADER;
+
+/**
+ * struct SIDECAR_RECORD - Type and size of one mft record.
+ *
+ * flags are MFT_RECORD_FLAGS of a base record in use and zero otherwise.
+ * parent and name come from the first non-DOS $FILE_NAME.
+ */
+typedef struct {
+    uint64_t parent;    /* Mft reference of the parent directory. */
+    uint64_t size;        /* Byte size of unnamed $DATA. */
+    uint32_t name_offset;
+    uint16_t flags;
+    uint16_t sequence_number;
+    uint8_t name_length;
+    uint8_t reserved[7];
+/* sizeof() = 32 bytes */
+} __attribute__((__packed__)) SIDECAR_RECORD;
+
+/**
+ * struct SIDECAR_PATH - Entry of the path -> mft record index.
+ *
+ * hash is FNV-1a of the absolute path ("/dir/file"). There is one entry for
+ * every name of a file, so hard links and DOS names are found as well.
+ */
+typedef struct {
+    uint64_t hash;
+    uint32_t mft_num;
+    uint32_t parent;    /* Mft record number of the directory holding the name. */
+    uint32_t name_offset;
+    uint8_t name_length;
+    uint8_t reserved[3];
+/* sizeof() = 24 bytes */
+} __attribute__((__packed__)) SIDECAR_PATH;
+
+/**
+ * struct SIDECAR - Sidecar file mapped into memory.
+ */
+typedef struct sidecar {
+    uint8_t *base;
+    uint64_t length;
+
+    SIDECAR_HEADER *header;
+    EXTENT *extents;
+    SIDECAR_RECORD *records;
+    SIDECAR_PATH *paths;
+    char *names;
+} SIDECAR;
+
+int open_sidecar(GENERAL_INFORMATION *g_info, const char *path);
+
+int build_sidecar(GENERAL_INFORMATION *g_info, const char *path);
+
+int64_t sidecar_lookup(SIDECAR *sidecar, const char *path);
+
+const SIDECAR_RECORD *sidecar_record(SIDECAR *sidecar, uint64_t mft_num);
+
+void close_sidecar(SIDECAR *sidecar);
+
+#endif //SYSTEM_SOFTWARE_SIDECAR_H
@@ -0,0 +1,61 @@
+#ifndef SYSTEM_SOFTWARE_STANDARD_INFORMATION_H
+#define SYSTEM_SOFTWARE_STANDARD_INFORMATION_H
+
+#include <stdint.h>
+#include "file_name_attribute.h"
+
+/**
+ * struct STANDARD_INFORMATION - Attribute: Standard information (0x10).
+ *
+ * NOTE: Always resident.
+ * NOTE: Present in all base file records on a volume.
+ * NOTE: There is conflicting information about the meaning of each of the time
+ *	 fields but the meaning as defined below has been verified to be
+ *	 correct by practical experimentation on Windows NT4 SP6a and is hence
+ *	 assumed to be the one and only correct interpretation.
+ * NOTE: Unlike the copies in FILE_NAME_ATTR, the times here are updated with
+ *	 every change of the file.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    uint64_t creation_time;        /* Time file was created. Updated when
+					   a filename is changed(?). */
+/*  8*/    uint64_t last_data_change_time;    /* Time the data attribute was last
+					   modified. */
+/* 16*/    uint64_t last_mft_change_time;    /* Time this mft record was last
+					   modified. */
+/* 24*/    uint64_t last_access_time;        /* Approximate time when the file was
+					   last accessed (obviously this is not
+					   updated on read-only volumes). */
+/* 32*/    FILE_ATTR_FLAGS file_attributes;    /* Flags describing the file. */
+/* 36*/    uint32_t maximum_versions;    /* Maximum allowed versions for
+					   file. Zero if version numbering
+					   is disabled. */
+/* 40*/    uint32_t version_number;        /* This file's version (if any).
+					   Set to zero if maximum_versions
+					   is zero. */
+/* 44*/    uint32_t class_id;            /* Class id from bidirectional
+					   class id index (?). */
+/* sizeof() = 48 bytes on NTFS 1.2, the fields below are NTFS 3.x only. */
+/* 48*/    uint32_t owner_id;            /* Owner_id of the user owning
+					   the file. Translate via $Q index
+					   in FILE_Extend/$Quota to the quota
+					   control entry for the user owning
+					   the file. Zero if quotas are
+					   disabled. */
+/* 52*/    uint32_t security_id;        /* Security_id for the file.
+					   Translate via $SII index and $SDS
+					   data stream in FILE_Secure to the
+					   security descriptor. */
+/* 56*/    uint64_t quota_charged;        /* Byte size of the charge to the
+					   quota for all streams of the file.
+					   Zero if quotas are disabled. */
+/* 64*/    uint64_t usn;            /* Last update sequence number of the
+					   file, an offset into $UsnJrnl:$J.
+					   Zero if the journal is disabled. */
+/* sizeof() = 72 bytes (NTFS 3.x) */
+} __attribute__((__packed__)) STANDARD_INFORMATION;
+
+#define STANDARD_INFORMATION_V1_SIZE 48    /* Byte size of the NTFS 1.2 attribute, enough for the times. */
+
+#endif //SYSTEM_SOFTWARE_STANDARD_INFORMATION_H
@@ -0,0 +1,133 @@
+#ifndef SYSTEM_SOFTWARE_STATS_H
+#define SYSTEM_SOFTWARE_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "general_information.h"
+
+#define STATS_SHARDS 32    /* Threads beyond this share shards. */
+#define STATS_CACHE_LINE 64
+#define STATS_SUB_BUCKET_BITS 4    /* 16 buckets per power of two, values are kept within 1/16 */
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_MAX_EXPONENT 39    /* Longer latencies (over 9 minutes) go to the last bucket. */
+#define STATS_BUCKETS (STATS_SUB_BUCKETS * (STATS_MAX_EXPONENT - STATS_SUB_BUCKET_BITS + 2))
+
+/**
+ * enum STATS_COUNTERS - I/O and cache counters of one volume.
+ */
+typedef enum {
+    STATS_READ_CALLS = 0,    /* pread() calls on the volume */
+    STATS_READ_BYTES = 1,
+    STATS_WRITE_CALLS = 2,    /* writes of copied and archived files */
+    STATS_WRITE_BYTES = 3,
+    STATS_RECORDS = 4,    /* mft records fetched */
+    STATS_MAP_HITS = 5,    /* extent maps found in the cache */
+    STATS_MAP_MISSES = 6,    /* extent maps loaded from their records */
+    STATS_INDEX_BLOCKS = 7,    /* $INDEX_ALLOCATION blocks parsed */
+    STATS_ALLOCATIONS = 8,    /* inodes, names, maps and I/O buffers allocated by the readers */
+    STATS_COUNTER_COUNT = 9,
+} STATS_COUNTERS;
+
+/**
+ * enum STATS_COMMANDS - Commands whose calls and wall time are counted.
+ */
+typedef enum {
+    STATS_LS = 0,
+    STATS_CD = 1,
+    STATS_PWD = 2,
+    STATS_CP = 3,
+    STATS_TAR = 4,
+    STATS_STAT = 5,
+    STATS_CAT = 6,
+    STATS_FIND = 7,
+    STATS_DU = 8,
+    STATS_BITMAP = 9,
+    STATS_UNDELETE = 10,
+    STATS_JOURNAL = 11,
+    STATS_COMMAND_COUNT = 12,
+} STATS_COMMANDS;
+
+/**
+ * enum STATS_LATENCIES - Operations with a latency histogram.
+ */
+typedef enum {
+    STATS_LATENCY_LS = 0,
+    STATS_LATENCY_CD = 1,
+    STATS_LATENCY_CP = 2,
+    STATS_LATENCY_RECORD = 3,    /* search_mft_record() */
+    STATS_LATENCY_READ = 4,    /* one pread() of clusters */
+    STATS_LATENCY_COUNT = 5,
+} STATS_LATENCIES;
+
+/**
+ * struct STATS_HISTOGRAM - Latencies of one operation in nanoseconds.
+ *
+ * Log-linear buckets like HdrHistogram: values below STATS_SUB_BUCKETS have
+ * a bucket each, every further power of two is split in STATS_SUB_BUCKETS
+ * equal buckets. So a bucket is at most 1/16 of its value wide and a
+ * histogram is a fixed array, recording is one atomic add.
+ */
+typedef struct {
+    uint64_t buckets[STATS_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+} STATS_HISTOGRAM;
+
+/**
+ * struct STATS_SHARD - Counters updated by the threads mapped to one shard.
+ *
+ * Every thread picks a shard on its first update and keeps it, so threads
+ * don't share cache lines until there are more of them than shards.
+ * Updates are relaxed atomic adds, a shared shard only costs contention.
+ */
+typedef struct {
+    uint64_t counters[STATS_COUNTER_COUNT];
+    uint64_t calls[STATS_COMMAND_COUNT];
+    uint64_t nanoseconds[STATS_COMMAND_COUNT];
+    STATS_HISTOGRAM latency[STATS_LATENCY_COUNT];
+} __attribute__((aligned(STATS_CACHE_LINE))) STATS_SHARD;
+
+/**
+ * struct VOLUME_STATS - Shards of one volume, created by init().
+ */
+typedef struct volume_stats {
+    STATS_SHARD shards[STATS_SHARDS];
+    uint64_t reset_time;    /* Monotonic time of init() or the last reset, ns. */
+} VOLUME_STATS;
+
+/**
+ * struct STATS_SNAPSHOT - Sum of the shards at one moment.
+ */
+typedef struct {
+    uint64_t counters[STATS_COUNTER_COUNT];
+    uint64_t calls[STATS_COMMAND_COUNT];
+    uint64_t nanoseconds[STATS_COMMAND_COUNT];
+    STATS_HISTOGRAM latency[STATS_LATENCY_COUNT];
+    uint64_t elapsed;    /* ns since init() or the last reset */
+} STATS_SNAPSHOT;
+
+VOLUME_STATS *create_stats(void);
+
+void free_stats(VOLUME_STATS *stats);
+
+uint64_t stats_clock(void);
+
+void stats_add(GENERAL_INFORMATION *g_info, STATS_COUNTERS counter, uint64_t value);
+
+int stats_command_id(const char *name);
+
+void stats_command(GENERAL_INFORMATION *g_info, STATS_COMMANDS command, uint64_t nanoseconds);
+
+void stats_latency(GENERAL_INFORMATION *g_info, STATS_LATENCIES operation, uint64_t nanoseconds);
+
+uint64_t latency_percentile(const STATS_HISTOGRAM *histogram, double percentile);
+
+void read_stats(GENERAL_INFORMATION *g_info, STATS_SNAPSHOT *snapshot);
+
+void reset_stats(GENERAL_INFORMATION *g_info);
+
+char *format_stats(const STATS_SNAPSHOT *snapshot);
+
+char *format_latency(const STATS_SNAPSHOT *snapshot, bool json);
+
+#endif //SYSTEM_SOFTWARE_STATS_H
@@ -0,0 +1,58 @@
+#ifndef SYSTEM_SOFTWARE_TAR_H
+#define SYSTEM_SOFTWARE_TAR_H
+
+#include <stdint.h>
+#include "general_information.h"
+#include "inode.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_BUFFER_SIZE (1024 * 1024)   /* Output is written to fd in pieces of up to this size. */
+#define TAR_NAME_SIZE 100
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL   /* Largest size that fits into the ustar size field. */
+#define NTFS_TIME_OFFSET 116444736000000000ULL   /* 100ns intervals between 1601 and 1970. */
+
+/**
+ * struct TAR_HEADER - POSIX ustar header block.
+ *
+ * Numeric fields are zero-padded octal strings. Names longer than 100 bytes
+ * and sizes past TAR_MAX_OCTAL_SIZE are described by a preceding pax
+ * extended header ('x'), sparse files use the pax format 1.0 of GNU tar.
+ */
+typedef struct {
+/*  0*/    char name[100];
+/*100*/    char mode[8];
+/*108*/    char uid[8];
+/*116*/    char gid[8];
+/*124*/    char size[12];
+/*136*/    char mtime[12];
+/*148*/    char checksum[8];
+/*156*/    char typeflag;
+/*157*/    char linkname[100];
+/*257*/    char magic[6];
+/*263*/    char version[2];
+/*265*/    char uname[32];
+/*297*/    char gname[32];
+/*329*/    char devmajor[8];
+/*337*/    char devminor[8];
+/*345*/    char prefix[155];
+/*500*/    char padding[12];
+/* sizeof() = 512 bytes */
+} __attribute__((__packed__)) TAR_HEADER;
+
+/**
+ * struct TAR_WRITER - Buffered output of one archive.
+ *
+ * File data is read from the cluster runs straight into buf.
+ */
+typedef struct {
+    GENERAL_INFORMATION *g_info; /* volume whose statistics count the writes */
+    int fd;
+    uint8_t *buf;
+    uint64_t used;
+    uint64_t written; /* bytes of the archive flushed to fd */
+    uint64_t size; /* size of buf, smaller than TAR_BUFFER_SIZE when the memory budget is short */
+} TAR_WRITER;
+
+int export_tar(GENERAL_INFORMATION *g_info, INODE *node, int fd);
+
+#endif //SYSTEM_SOFTWARE_TAR_H
@@ -0,0 +1,43 @@
+#ifndef SYSTEM_SOFTWARE_UNDELETE_H
+#define SYSTEM_SOFTWARE_UNDELETE_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define UNDELETE_FRAGMENT_PENALTY 4    /* Score lost by every fragment after the first one. */
+#define UNDELETE_MAX_FRAGMENT_PENALTY 40
+
+/**
+ * struct DELETED_FILE - Record of a deleted file whose data is still intact.
+ *
+ * score tells how likely the file comes back whole, from 0 to 100: resident
+ * data is kept inside the record itself, every extra fragment and a missing
+ * parent directory make recovery less certain.
+ */
+typedef struct {
+    uint32_t mft_num;
+    uint16_t sequence_number;
+    uint8_t score;
+    uint8_t resident;
+    uint32_t fragments;
+    uint64_t parent;    /* Mft reference of the directory the file was deleted from. */
+    uint64_t size;
+    char *name;
+} DELETED_FILE;
+
+/**
+ * struct DELETED_LIST - Result of one scan, sorted by descending score.
+ */
+typedef struct {
+    DELETED_FILE *files;
+    uint32_t count;
+    uint32_t capacity;
+} DELETED_LIST;
+
+int find_deleted_files(GENERAL_INFORMATION *g_info, uint32_t threads, DELETED_LIST *list);
+
+int recover_file(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *to_path);
+
+void free_deleted_list(DELETED_LIST *list);
+
+#endif //SYSTEM_SOFTWARE_UNDELETE_H
@@ -0,0 +1,159 @@
+#ifndef SYSTEM_SOFTWARE_USN_JOURNAL_H
+#define SYSTEM_SOFTWARE_USN_JOURNAL_H
+
+#include <stdint.h>
+#include "general_information.h"
+
+#define USN_JOURNAL_NAME "$UsnJrnl"
+#define USN_JOURNAL_DATA "$J"
+#define USN_JOURNAL_MAX "$Max"
+#define USN_PAGE_SIZE 4096    /* Records never cross a page, the rest of a page is zero filled. */
+#define USN_READ_SIZE (1024 * 1024)    /* $J is read in chunks of this many bytes. */
+
+/**
+ * enum USN_REASONS - Flags of USN_RECORD.reason, why the record was written.
+ *
+ * Every change of a file that is still open is or'ed into the next record of
+ * that file, USN_REASON_CLOSE marks the last record when the file is closed.
+ */
+enum {
+    USN_REASON_DATA_OVERWRITE = 0x00000001,
+    USN_REASON_DATA_EXTEND = 0x00000002,
+    USN_REASON_DATA_TRUNCATION = 0x00000004,
+    USN_REASON_NAMED_DATA_OVERWRITE = 0x00000010,
+    USN_REASON_NAMED_DATA_EXTEND = 0x00000020,
+    USN_REASON_NAMED_DATA_TRUNCATION = 0x00000040,
+    USN_REASON_FILE_CREATE = 0x00000100,
+    USN_REASON_FILE_DELETE = 0x00000200,
+    USN_REASON_EA_CHANGE = 0x00000400,
+    USN_REASON_SECURITY_CHANGE = 0x00000800,
+    USN_REASON_RENAME_OLD_NAME = 0x00001000,
+    USN_REASON_RENAME_NEW_NAME = 0x00002000,
+    USN_REASON_INDEXABLE_CHANGE = 0x00004000,
+    USN_REASON_BASIC_INFO_CHANGE = 0x00008000,
+    USN_REASON_HARD_LINK_CHANGE = 0x00010000,
+    USN_REASON_COMPRESSION_CHANGE = 0x00020000,
+    USN_REASON_ENCRYPTION_CHANGE = 0x00040000,
+    USN_REASON_OBJECT_ID_CHANGE = 0x00080000,
+    USN_REASON_REPARSE_POINT_CHANGE = 0x00100000,
+    USN_REASON_STREAM_CHANGE = 0x00200000,
+    USN_REASON_CLOSE = 0x80000000,
+
+    /* Reasons that change the entries of the parent directory as well. */
+    USN_REASON_NAMESPACE_CHANGE = USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME |
+                                  USN_REASON_RENAME_NEW_NAME | USN_REASON_HARD_LINK_CHANGE,
+};
+
+/**
+ * struct USN_RECORD_V2 - Record of the $UsnJrnl:$J change journal.
+ *
+ * - $J is a sparse stream, the update sequence number (usn) of a record is
+ * its byte offset in the stream. Old records are dropped by deallocating the
+ * beginning of the stream, so the offsets keep growing.
+ * - Records are 8-byte aligned and never cross a USN_PAGE_SIZE boundary.
+ * - Version 3 records have the same layout with 128-bit file references,
+ * see USN_RECORD_V3. Version 4 range records are skipped.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    uint32_t record_length;    /* Byte size of this record (8-byte aligned). */
+/*  4*/    uint16_t major_version;    /* 2 */
+/*  6*/    uint16_t minor_version;
+/*  8*/    uint64_t file_reference;    /* Mft reference of the changed file. */
+/* 16*/    uint64_t parent_reference;    /* Mft reference of its parent directory. */
+/* 24*/    int64_t usn;            /* Offset of this record in $J. */
+/* 32*/    int64_t time_stamp;        /* NT time of the change. */
+/* 40*/    uint32_t reason;        /* USN_REASONS. */
+/* 44*/    uint32_t source_info;
+/* 48*/    uint32_t security_id;
+/* 52*/    uint32_t file_attributes;    /* FILE_ATTR_FLAGS of the file. */
+/* 56*/    uint16_t file_name_length;    /* Byte size of the name. */
+/* 58*/    uint16_t file_name_offset;    /* Byte offset of the name from the start of this record. */
+/* 60*/    uint16_t file_name[0];    /* Name in Unicode, not zero terminated. */
+/* sizeof() = 60 (0x3c) bytes */
+} __attribute__((__packed__)) USN_RECORD_V2;
+
+/**
+ * struct USN_RECORD_V3 - Version 3 of USN_RECORD_V2.
+ *
+ * The low 64 bits of a 128-bit reference are the NTFS mft reference.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    uint32_t record_length;
+/*  4*/    uint16_t major_version;    /* 3 */
+/*  6*/    uint16_t minor_version;
+/*  8*/    uint64_t file_reference[2];
+/* 24*/    uint64_t parent_reference[2];
+/* 40*/    int64_t usn;
+/* 48*/    int64_t time_stamp;
+/* 56*/    uint32_t reason;
+/* 60*/    uint32_t source_info;
+/* 64*/    uint32_t security_id;
+/* 68*/    uint32_t file_attributes;
+/* 72*/    uint16_t file_name_length;
+/* 74*/    uint16_t file_name_offset;
+/* 76*/    uint16_t file_name[0];
+/* sizeof() = 76 (0x4c) bytes */
+} __attribute__((__packed__)) USN_RECORD_V3;
+
+/**
+ * struct USN_JOURNAL_MAX_DATA - Value of $UsnJrnl:$Max.
+ */
+typedef struct {
+/*Ofs*/
+/*  0*/    uint64_t maximum_size;    /* Byte size the journal is trimmed down to. */
+/*  8*/    uint64_t allocation_delta;    /* Bytes dropped from the start of $J at once. */
+/* 16*/    uint64_t journal_id;        /* NT time of the journal creation, changes when it is recreated. */
+/* 24*/    int64_t lowest_valid_usn;    /* Records before this usn are gone. */
+/* sizeof() = 32 (0x20) bytes */
+} __attribute__((__packed__)) USN_JOURNAL_MAX_DATA;
+
+/**
+ * struct USN_CURSOR - Position in the journal of one volume.
+ *
+ * Saved after a pass over the volume, the next pass reads only the records
+ * from next_usn on. A cursor of another journal_id is no use, the journal
+ * was deleted and created again in between.
+ */
+typedef struct {
+    uint64_t journal_id;
+    int64_t next_usn;
+} USN_CURSOR;
+
+/**
+ * struct USN_CHANGE - One changed file.
+ *
+ * reason is or'ed from all records of the file since the cursor.
+ */
+typedef struct {
+    uint64_t mft_reference;
+    uint32_t reason;
+} USN_CHANGE;
+
+/**
+ * struct USN_CHANGES - Files changed since a cursor.
+ *
+ * changes are sorted by mft record number and then sequence number, with one
+ * entry per reference. A parent directory is added as well when names in it
+ * were created, deleted or renamed. When lost is set the journal can't tell
+ * what changed since the cursor and everything has to be read again.
+ */
+typedef struct {
+    USN_CHANGE *changes;
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t lost;
+    USN_CURSOR cursor;    /* Where the next read continues. */
+    uint64_t records;    /* Journal records read. */
+} USN_CHANGES;
+
+int read_usn_cursor(GENERAL_INFORMATION *g_info, USN_CURSOR *cursor, int64_t *lowest_valid_usn);
+
+int read_usn_changes(GENERAL_INFORMATION *g_info, const USN_CURSOR *from, USN_CHANGES *changes);
+
+const USN_CHANGE *find_usn_change(const USN_CHANGES *changes, uint64_t mft_num);
+
+void free_usn_changes(USN_CHANGES *changes);
+
+#endif //SYSTEM_SOFTWARE_USN_JOURNAL_H
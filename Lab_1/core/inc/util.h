@@ -4,13 +4,54 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "ntfs.h"
+#include "extract.h"
+#include "tar.h"
+#include "sidecar.h"
+#include "name_index.h"
+#include "path_table.h"
+#include "du.h"
+#include "bitmap.h"
+#include "undelete.h"
+#include "usn_journal.h"
+#include "mirror.h"
+#include "session.h"
+#include "server.h"
 
-char *pwd(const GENERAL_INFORMATION *g_info);
+// options of cp()
+enum {
+    CP_MIRROR = 0x01,   // copy only what changed since the last mirror run
+    CP_DELETE = 0x02,   // with CP_MIRROR, remove what is gone from the volume
+    CP_REFLINK = 0x04,  // further names of a record are reflinked instead of hard linked
+};
 
-char *cd(GENERAL_INFORMATION *g_info, char *path);
+char *pwd(const SESSION *session);
 
-char *ls(GENERAL_INFORMATION *g_info, char *path);
+char *cd(SESSION *session, char *path);
 
-char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path);
+char *ls(SESSION *session, char *path);
+
+char *cp(SESSION *session, char *from_path, char *to_path, uint32_t flags);
+
+char *tar(SESSION *session, char *from_path, char *to_path);
+
+char *find(GENERAL_INFORMATION *g_info, char *pattern);
+
+char *du(SESSION *session, char *path, char *top);
+
+int resolve_path(SESSION *session, char *path, INODE *node);
+
+char *file_stat(SESSION *session, char *path);
+
+char *bitmap(GENERAL_INFORMATION *g_info);
+
+char *undelete(GENERAL_INFORMATION *g_info, char *mft, char *to_path);
+
+char *journal(GENERAL_INFORMATION *g_info, char *usn, char *journal_id);
+
+char *io_stats(GENERAL_INFORMATION *g_info, char *option);
+
+char *latency(GENERAL_INFORMATION *g_info, char *format);
+
+char *memory(GENERAL_INFORMATION *g_info, char *limit);
 
 #endif //LAB_1_UTIL_H
\ No newline at end of file
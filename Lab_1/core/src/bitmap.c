@@ -0,0 +1,280 @@
+#include "../inc/ntfs.h"
+#include "../inc/bitmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define BITMAP_X86
+
+#endif
+
+typedef uint64_t (*COUNT_BITS)(const uint8_t *data, size_t length);
+
+static COUNT_BITS count_bits_impl = NULL;
+
+static pthread_once_t count_bits_once = PTHREAD_ONCE_INIT;
+
+static uint64_t count_bits_generic(const uint8_t *data, size_t length);
+
+static void scan_free_runs(BITMAP_STATS *stats, const uint8_t *data, uint64_t bits, uint64_t *run);
+
+static void add_free_extent(BITMAP_STATS *stats, uint64_t length);
+
+/*
+ * Streams $Bitmap once: used clusters are counted per heatmap region with
+ * count_bits(), free runs are measured on the same chunk while it is hot in
+ * the cache.
+ * Returns 0 or -1.
+ */
+int bitmap_stats(GENERAL_INFORMATION *g_info, BITMAP_STATS *stats) {
+    memset(stats, 0, sizeof(BITMAP_STATS));
+    EXTENT_MAP *map = get_extent_map(g_info, FILE_Bitmap, AT_DATA);
+    if (map == NULL) {
+        return -1;
+    }
+    stats->clusters = g_info->clusters;
+    if (stats->clusters == 0 || stats->clusters > map->data_size * 8) {
+        stats->clusters = map->data_size * 8;
+    }
+    uint64_t per_region = (stats->clusters + BITMAP_REGIONS - 1) / BITMAP_REGIONS;
+    stats->region_clusters = (per_region + BITMAP_REGION_ALIGN - 1) / BITMAP_REGION_ALIGN * BITMAP_REGION_ALIGN;
+    stats->region_count = (uint32_t) ((stats->clusters + stats->region_clusters - 1) / stats->region_clusters);
+    uint64_t region_bytes = stats->region_clusters / 8;
+
+    uint8_t *buf = malloc(BITMAP_CHUNK_SIZE);
+    if (buf == NULL) {
+        put_extent_map(map);
+        return -1;
+    }
+    uint64_t bytes = (stats->clusters + 7) / 8;
+    uint64_t run = 0;
+    int result = 0;
+    for (uint64_t offset = 0; offset < bytes; offset += BITMAP_CHUNK_SIZE) {
+        uint64_t length = bytes - offset < BITMAP_CHUNK_SIZE ? bytes - offset : BITMAP_CHUNK_SIZE;
+        if (read_attr_data(g_info, map, offset, buf, length) != (int64_t) length) {
+            result = -1;
+            break;
+        }
+        uint64_t bits = stats->clusters - offset * 8 < length * 8 ? stats->clusters - offset * 8 : length * 8;
+        // bits past the last cluster are not counted
+        if (bits % 8 != 0) {
+            buf[length - 1] &= (1 << (bits % 8)) - 1;
+        }
+
+        uint64_t position = 0;
+        while (position < length) {
+            uint64_t region = (offset + position) / region_bytes;
+            uint64_t end = (region + 1) * region_bytes - offset;
+            if (end > length) {
+                end = length;
+            }
+            uint64_t used = count_bits(buf + position, end - position);
+            stats->region_used[region] += used;
+            stats->used_clusters += used;
+            position = end;
+        }
+        scan_free_runs(stats, buf, bits, &run);
+    }
+    add_free_extent(stats, run);
+    stats->free_clusters = stats->clusters - stats->used_clusters;
+
+    free(buf);
+    put_extent_map(map);
+    return result;
+}
+
+/*
+ * Reads the whole $Bitmap into memory, one bit per cluster.
+ * Returns the bitmap or NULL, clusters is set to the number of valid bits.
+ */
+uint8_t *load_bitmap(GENERAL_INFORMATION *g_info, uint64_t *clusters) {
+    EXTENT_MAP *map = get_extent_map(g_info, FILE_Bitmap, AT_DATA);
+    if (map == NULL) {
+        return NULL;
+    }
+    *clusters = g_info->clusters;
+    if (*clusters == 0 || *clusters > map->data_size * 8) {
+        *clusters = map->data_size * 8;
+    }
+    uint64_t bytes = (*clusters + 7) / 8;
+    // padded to whole words for clusters_free()
+    uint8_t *bitmap = calloc(bytes + 8, 1);
+    if (bitmap != NULL) {
+        for (uint64_t offset = 0; offset < bytes; offset += BITMAP_CHUNK_SIZE) {
+            uint64_t length = bytes - offset < BITMAP_CHUNK_SIZE ? bytes - offset : BITMAP_CHUNK_SIZE;
+            if (read_attr_data(g_info, map, offset, bitmap + offset, length) != (int64_t) length) {
+                free(bitmap);
+                bitmap = NULL;
+                break;
+            }
+        }
+    }
+    put_extent_map(map);
+    return bitmap;
+}
+
+/*
+ * Returns 1 when all clusters lcn .. lcn + length - 1 are free, 0 when any of
+ * them is in use or lies past the end of the volume.
+ */
+int clusters_free(const uint8_t *bitmap, uint64_t clusters, uint64_t lcn, uint64_t length) {
+    if (lcn >= clusters || length > clusters - lcn) {
+        return 0;
+    }
+    uint64_t bit = lcn;
+    uint64_t end = lcn + length;
+    while (bit < end && bit % 64 != 0) {
+        if (bitmap[bit / 8] & (1 << (bit % 8))) {
+            return 0;
+        }
+        bit++;
+    }
+    for (; bit + 64 <= end; bit += 64) {
+        uint64_t word;
+        memcpy(&word, bitmap + bit / 8, 8);
+        if (word != 0) {
+            return 0;
+        }
+    }
+    for (; bit < end; bit++) {
+        if (bitmap[bit / 8] & (1 << (bit % 8))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef BITMAP_X86
+
+__attribute__((target("popcnt")))
+static uint64_t count_bits_popcnt(const uint8_t *data, size_t length) {
+    uint64_t total = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        total += __builtin_popcountll(word);
+    }
+    return total + count_bits_generic(data + i, length - i);
+}
+
+/*
+ * Nibble lookup with pshufb: every byte is split into two 4-bit halves whose
+ * bit counts are looked up in a register, byte counts are summed with psadbw.
+ */
+__attribute__((target("avx2")))
+static uint64_t count_bits_avx2(const uint8_t *data, size_t length) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 32 <= length) {
+        // a byte counter holds up to 255, 31 blocks add at most 31 * 8
+        __m256i counts = zero;
+        for (uint32_t k = 0; k < 31 && i + 32 <= length; k++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *) (data + i));
+            __m256i low = _mm256_and_si256(block, low_mask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(block, 4), low_mask);
+            counts = _mm256_add_epi8(counts, _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low),
+                                                             _mm256_shuffle_epi8(lookup, high)));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_bits_popcnt(data + i, length - i);
+}
+
+#endif
+
+static void pick_count_bits(void) {
+    COUNT_BITS impl = count_bits_generic;
+#ifdef BITMAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = count_bits_avx2;
+    } else if (__builtin_cpu_supports("popcnt")) {
+        impl = count_bits_popcnt;
+    }
+#endif
+    count_bits_impl = impl;
+}
+
+/*
+ * Number of set bits. The widest kernel the cpu supports is picked on the
+ * first call.
+ */
+uint64_t count_bits(const uint8_t *data, size_t length) {
+    pthread_once(&count_bits_once, pick_count_bits);
+    return count_bits_impl(data, length);
+}
+
+static uint64_t count_bits_generic(const uint8_t *data, size_t length) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < length; i++) {
+        total += __builtin_popcount(data[i]);
+    }
+    return total;
+}
+
+/*
+ * Measures runs of clear bits. Whole words that are free or used are taken at
+ * once, mixed words jump from one change to the next with ctz.
+ * run carries the free run that is still open at the end of the chunk.
+ */
+static void scan_free_runs(BITMAP_STATS *stats, const uint8_t *data, uint64_t bits, uint64_t *run) {
+    uint64_t words = bits / 64;
+    for (uint64_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, data + i * 8, 8);
+        if (word == 0) {
+            *run += 64;
+            continue;
+        }
+        if (word == UINT64_MAX) {
+            add_free_extent(stats, *run);
+            *run = 0;
+            continue;
+        }
+        uint32_t position = 0;
+        while (position < 64) {
+            uint64_t rest = word >> position;
+            if (rest & 1) {
+                add_free_extent(stats, *run);
+                *run = 0;
+                // shifted in zeroes turn into ones, so ctz stops at the end of the word
+                position += __builtin_ctzll(~rest);
+            } else {
+                uint32_t zeroes = rest == 0 ? 64 - position : (uint32_t) __builtin_ctzll(rest);
+                *run += zeroes;
+                position += zeroes;
+            }
+        }
+    }
+    for (uint64_t bit = words * 64; bit < bits; bit++) {
+        if (data[bit / 8] & (1 << (bit % 8))) {
+            add_free_extent(stats, *run);
+            *run = 0;
+        } else {
+            (*run)++;
+        }
+    }
+}
+
+static void add_free_extent(BITMAP_STATS *stats, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    stats->free_extents++;
+    if (length > stats->largest_free_extent) {
+        stats->largest_free_extent = length;
+    }
+    uint32_t bucket = 63 - __builtin_clzll(length);
+    if (bucket >= BITMAP_HISTOGRAM_BUCKETS) {
+        bucket = BITMAP_HISTOGRAM_BUCKETS - 1;
+    }
+    stats->histogram[bucket]++;
+}
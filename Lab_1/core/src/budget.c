@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../inc/budget.h"
+
+static const char *component_names[BUDGET_COMPONENT_COUNT] = {"extent maps", "path cache", "path table",
+                                                              "name index", "copy buffers"};
+
+MEMORY_BUDGET *create_budget(uint64_t limit) {
+    MEMORY_BUDGET *budget = calloc(1, sizeof(MEMORY_BUDGET));
+    if (budget == NULL) {
+        return NULL;
+    }
+    budget->limit = limit;
+    pthread_mutex_init(&budget->lock, NULL);
+    return budget;
+}
+
+void free_budget(MEMORY_BUDGET *budget) {
+    if (budget == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&budget->lock);
+    free(budget);
+}
+
+static void raise_high_water(uint64_t *high_water, uint64_t value) {
+    uint64_t current = __atomic_load_n(high_water, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(high_water, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Evicts the cheapest entries of the registered caches until bytes more fit
+ * under the limit or nothing more can be evicted. The caller holds the lock.
+ */
+static void make_room(MEMORY_BUDGET *budget, uint64_t bytes) {
+    uint64_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    while (limit != BUDGET_UNLIMITED && __atomic_load_n(&budget->used, __ATOMIC_RELAXED) + bytes > limit) {
+        int victim = -1;
+        uint64_t lowest = 0;
+        for (int i = 0; i < BUDGET_COMPONENT_COUNT; i++) {
+            uint64_t priority;
+            if (budget->evictors[i] != NULL && budget->evictors[i]->lowest(budget->contexts[i], &priority) == 0 &&
+                (victim == -1 || priority < lowest)) {
+                victim = i;
+                lowest = priority;
+            }
+        }
+        // a cache busy in another thread is skipped, the one that changed since lowest() stops the round
+        if (victim == -1 || budget->evictors[victim]->evict(budget->contexts[victim]) == 0) {
+            return;
+        }
+        budget_evicted(budget, victim, lowest);
+    }
+}
+
+/* Takes bytes of the budget if they fit, in one step so two threads can't both take the last free bytes. */
+static int reserve(MEMORY_BUDGET *budget, uint64_t bytes) {
+    uint64_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    uint64_t used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+    do {
+        if (limit != BUDGET_UNLIMITED && used + bytes > limit) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&budget->used, &used, used + bytes, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    raise_high_water(&budget->high_water, used + bytes);
+    return 0;
+}
+
+static void account(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes) {
+    BUDGET_USAGE *usage = &budget->components[component];
+    raise_high_water(&usage->high_water, __atomic_add_fetch(&usage->used, bytes, __ATOMIC_RELAXED));
+}
+
+static int fits(const MEMORY_BUDGET *budget, uint64_t bytes) {
+    uint64_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    return limit == BUDGET_UNLIMITED || __atomic_load_n(&budget->used, __ATOMIC_RELAXED) + bytes <= limit;
+}
+
+/*
+ * Changes the limit, caches are shrunk to a lower limit right away. Memory
+ * that can't be evicted stays charged until its component frees it.
+ */
+void set_budget_limit(MEMORY_BUDGET *budget, uint64_t limit) {
+    __atomic_store_n(&budget->limit, limit, __ATOMIC_RELAXED);
+    budget_trim(budget);
+}
+
+/* Evicts cached entries until the charges fit under the limit again, after budget_force(). */
+void budget_trim(MEMORY_BUDGET *budget) {
+    if (budget == NULL || fits(budget, 0)) {
+        return;
+    }
+    pthread_mutex_lock(&budget->lock);
+    make_room(budget, 0);
+    pthread_mutex_unlock(&budget->lock);
+}
+
+/*
+ * Lets the budget evict entries of the cache of a component, context is
+ * passed to the evictor. Only one cache is registered per component.
+ */
+void budget_register(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, const BUDGET_EVICTOR *evictor,
+                     void *context) {
+    if (budget == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&budget->lock);
+    budget->evictors[component] = evictor;
+    budget->contexts[component] = context;
+    pthread_mutex_unlock(&budget->lock);
+}
+
+void budget_unregister(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component) {
+    budget_register(budget, component, NULL, NULL);
+}
+
+/*
+ * Charges bytes the component is about to allocate, evicting cached entries
+ * when they don't fit. Returns 0, or -1 when the memory is not available and
+ * the component has to do without it.
+ */
+int budget_charge(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes) {
+    if (budget == NULL || bytes == 0) {
+        return 0;
+    }
+    if (!fits(budget, bytes)) {
+        pthread_mutex_lock(&budget->lock);
+        make_room(budget, bytes);
+        pthread_mutex_unlock(&budget->lock);
+    }
+    if (reserve(budget, bytes) == -1) {
+        __atomic_add_fetch(&budget->components[component].refusals, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    account(budget, component, bytes);
+    return 0;
+}
+
+/*
+ * Charges a buffer of up to bytes, halving the size while it does not fit.
+ * minimum bytes are taken over the limit if they still don't fit, the caller
+ * can't work without them. Returns the size that was charged.
+ */
+uint64_t budget_charge_up_to(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes, uint64_t minimum) {
+    if (budget == NULL) {
+        return bytes;
+    }
+    if (!fits(budget, bytes)) {
+        pthread_mutex_lock(&budget->lock);
+        make_room(budget, bytes);
+        pthread_mutex_unlock(&budget->lock);
+    }
+    uint64_t size = bytes;
+    while (reserve(budget, size) == -1) {
+        if (size <= minimum) {
+            __atomic_add_fetch(&budget->components[component].refusals, 1, __ATOMIC_RELAXED);
+            budget_force(budget, component, minimum);
+            return minimum;
+        }
+        size = size / 2 > minimum ? size / 2 : minimum;
+    }
+    account(budget, component, size);
+    return size;
+}
+
+/*
+ * Charges memory the component needs now whatever the limit, cached entries
+ * are still evicted to make room for it.
+ */
+void budget_force(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes) {
+    if (budget == NULL || bytes == 0) {
+        return;
+    }
+    if (!fits(budget, bytes)) {
+        pthread_mutex_lock(&budget->lock);
+        make_room(budget, bytes);
+        pthread_mutex_unlock(&budget->lock);
+    }
+    raise_high_water(&budget->high_water, __atomic_add_fetch(&budget->used, bytes, __ATOMIC_RELAXED));
+    account(budget, component, bytes);
+}
+
+void budget_release(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t bytes) {
+    if (budget == NULL || bytes == 0) {
+        return;
+    }
+    __atomic_sub_fetch(&budget->components[component].used, bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts an entry of the component evicted with the given priority, the
+ * clock moves up to it. Caches call it for entries they evict on their own.
+ */
+void budget_evicted(MEMORY_BUDGET *budget, BUDGET_COMPONENTS component, uint64_t priority) {
+    if (budget == NULL) {
+        return;
+    }
+    __atomic_add_fetch(&budget->components[component].evictions, 1, __ATOMIC_RELAXED);
+    uint64_t clock = __atomic_load_n(&budget->clock, __ATOMIC_RELAXED);
+    while (priority > clock &&
+           !__atomic_compare_exchange_n(&budget->clock, &clock, priority, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Nonzero when more is charged than the limit allows, after budget_force(). */
+int budget_over(const MEMORY_BUDGET *budget) {
+    return budget != NULL && !fits(budget, 0);
+}
+
+/*
+ * Priority of a cache entry that was just loaded or used: the clock plus the
+ * cost in ns to load it again per BUDGET_PRIORITY_UNIT bytes it takes.
+ */
+uint64_t budget_priority(const MEMORY_BUDGET *budget, uint64_t cost, uint64_t size) {
+    uint64_t clock = budget != NULL ? __atomic_load_n(&budget->clock, __ATOMIC_RELAXED) : 0;
+    return clock + cost * BUDGET_PRIORITY_UNIT / (size > 0 ? size : 1);
+}
+
+/*
+ * Usage of every component and of the whole budget in KiB. Returns a malloc'd string.
+ */
+char *format_budget(const MEMORY_BUDGET *budget) {
+    size_t size = 256 + BUDGET_COMPONENT_COUNT * 96;
+    char *output = malloc(size);
+    uint64_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    size_t length;
+    if (limit == BUDGET_UNLIMITED) {
+        length = (size_t) snprintf(output, size, "limit        unlimited\n");
+    } else {
+        length = (size_t) snprintf(output, size, "limit        %lu KiB\n", limit >> 10);
+    }
+    length += (size_t) snprintf(output + length, size - length,
+                                "component    used KiB    high KiB    evictions  refused\n");
+    for (int i = 0; i < BUDGET_COMPONENT_COUNT; i++) {
+        const BUDGET_USAGE *usage = &budget->components[i];
+        length += (size_t) snprintf(output + length, size - length, "%-12s %-11lu %-11lu %-10lu %lu\n",
+                                    component_names[i], __atomic_load_n(&usage->used, __ATOMIC_RELAXED) >> 10,
+                                    __atomic_load_n(&usage->high_water, __ATOMIC_RELAXED) >> 10,
+                                    __atomic_load_n(&usage->evictions, __ATOMIC_RELAXED),
+                                    __atomic_load_n(&usage->refusals, __ATOMIC_RELAXED));
+    }
+    snprintf(output + length, size - length, "%-12s %-11lu %lu\n", "total",
+             __atomic_load_n(&budget->used, __ATOMIC_RELAXED) >> 10,
+             __atomic_load_n(&budget->high_water, __ATOMIC_RELAXED) >> 10);
+    return output;
+}
+
+/*
+ * Reads a size in bytes with an optional K, M or G suffix (powers of 1024).
+ * Returns 0 or -1 when text is not a size.
+ */
+int parse_budget_size(const char *text, uint64_t *size) {
+    char *end;
+    errno = 0;
+    uint64_t value = strtoull(text, &end, 10);
+    if (end == text || errno != 0 || text[0] == '-') {
+        return -1;
+    }
+    int shift = 0;
+    switch (*end) {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        case '\0':
+            break;
+        default:
+            return -1;
+    }
+    if (shift != 0 && *++end != '\0') {
+        return -1;
+    }
+    if (value > UINT64_MAX >> shift) {
+        return -1;
+    }
+    *size = value << shift;
+    return 0;
+}
@@ -1,50 +1,243 @@
 #include "../inc/device.h"
+#include "../inc/boot_sector.h"
+#include "../inc/mft.h"
+#include "../inc/attribute.h"
+#include "../inc/ntfs.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-int init_cache(blkid_cache *cache) {
-    int status = blkid_get_cache(cache, NULL);
-    if (status < 0) {
-        puts("ERROR: Can't get the cache");
-        return -1;
+#define SYS_BLOCK "/sys/block"
+#define MAX_RECORD_SIZE 65536
+#define SYS_PATH_MAX (sizeof(SYS_BLOCK) + 2 * DEVICE_NAME_MAX + 16)    /* /sys/block/<disk>/<partition>/<attribute> */
+
+typedef struct {
+    DEVICE_INFO *devices;
+    uint32_t count;
+    uint32_t next;    /* Index of the next device to probe, taken atomically. */
+} PROBE_QUEUE;
+
+/* Reads a decimal number from a sysfs attribute, 0 if it can't be read. */
+static uint64_t read_sys_number(const char *path) {
+    char buf[32] = {0};
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t length = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    return length > 0 ? strtoull(buf, NULL, 10) : 0;
+}
+
+/* Adds the device described by the sysfs directory dir, skips empty devices. */
+static int add_device(DEVICE_INFO **devices, uint32_t *count, uint32_t *capacity, const char *dir,
+                      const char *name, const char *parent) {
+    char path[SYS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/size", dir);
+    // sysfs counts in 512-byte sectors whatever the logical sector size is
+    uint64_t size = read_sys_number(path) * 512;
+    if (size == 0) {
+        return 0;
     }
-    puts("Successful cache read");
+
+    if (*count == *capacity) {
+        uint32_t new_capacity = *capacity ? *capacity * 2 : 16;
+        DEVICE_INFO *new_devices = realloc(*devices, new_capacity * sizeof(DEVICE_INFO));
+        if (new_devices == NULL) {
+            return -1;
+        }
+        *devices = new_devices;
+        *capacity = new_capacity;
+    }
+
+    DEVICE_INFO *device = &(*devices)[(*count)++];
+    memset(device, 0, sizeof(DEVICE_INFO));
+    strcpy(device->name, name);
+    strncpy(device->parent, parent, DEVICE_NAME_MAX - 1);
+    device->size = size;
+    snprintf(path, sizeof(path), "%s/ro", dir);
+    device->read_only = read_sys_number(path) != 0;
     return 0;
 }
 
-int probe_devices(blkid_cache *cache) {
-    int status = blkid_probe_all(*cache);
-    if (status < 0) {
-        puts("ERROR: Can't probe all block devices");
+/* Adds a disk and its partitions, which are the subdirectories holding a "partition" file. */
+static int add_disk(DEVICE_INFO **devices, uint32_t *count, uint32_t *capacity, const char *disk) {
+    char dir[SYS_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%s", SYS_BLOCK, disk);
+    if (add_device(devices, count, capacity, dir, disk, "") == -1) {
         return -1;
     }
-    puts("Successfully probed all block devices");
+
+    DIR *disk_dir = opendir(dir);
+    if (disk_dir == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    int err = 0;
+    while (err == 0 && (entry = readdir(disk_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= DEVICE_NAME_MAX) {
+            continue;
+        }
+        char partition[SYS_PATH_MAX + DEVICE_NAME_MAX + sizeof("/partition")];
+        snprintf(partition, sizeof(partition), "%s/%.*s/partition", dir, DEVICE_NAME_MAX - 1, entry->d_name);
+        if (access(partition, F_OK) == 0) {
+            snprintf(partition, sizeof(partition), "%s/%.*s", dir, DEVICE_NAME_MAX - 1, entry->d_name);
+            err = add_device(devices, count, capacity, partition, entry->d_name, disk);
+        }
+    }
+    closedir(disk_dir);
+    return err;
+}
+
+/* Copies $VOLUME_NAME of the volume into the label, the record of $Volume is in the first extent of $MFT. */
+static void read_label(int fd, DEVICE_INFO *device) {
+    if (device->mft_record_size < NTFS_BLOCK_SIZE || device->mft_record_size > MAX_RECORD_SIZE) {
+        return;
+    }
+    uint8_t *record = malloc(device->mft_record_size);
+    if (record == NULL) {
+        return;
+    }
+    off_t offset = device->mft_lcn * device->cluster_size + (uint64_t) FILE_Volume * device->mft_record_size;
+    if (pread(fd, record, device->mft_record_size, offset) != device->mft_record_size ||
+        ((MFT_RECORD *) record)->magic != magic_FILE || apply_fixups(record, device->mft_record_size) == -1) {
+        free(record);
+        return;
+    }
+
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint32_t end = header->bytes_in_use < device->mft_record_size ? header->bytes_in_use : device->mft_record_size;
+    uint32_t position = header->attrs_offset;
+    while (position + offsetof(ATTR_RECORD, resident_end) <= end) {
+        ATTR_RECORD *attr = (ATTR_RECORD *) (record + position);
+        if (attr->type == AT_END || attr->length == 0) {
+            break;
+        }
+        if (attr->type == AT_VOLUME_NAME && !attr->non_resident &&
+            position + attr->value_offset + attr->value_length <= end) {
+            const uint16_t *name = (const uint16_t *) ((uint8_t *) attr + attr->value_offset);
+            uint32_t length = attr->value_length / sizeof(uint16_t);
+            if (length >= DEVICE_LABEL_MAX) {
+                length = DEVICE_LABEL_MAX - 1;
+            }
+            // names are kept as their low bytes, see convert_file_name()
+            for (uint32_t i = 0; i < length; i++) {
+                device->label[i] = (char) name[i];
+            }
+            device->label[length] = '\0';
+            break;
+        }
+        position += attr->length;
+    }
+    free(record);
+}
+
+/*
+ * Reads the first sector of the device and fills the NTFS geometry if it holds an NTFS boot sector.
+ * Returns 0, or -1 with device->error set when the device can't be read.
+ */
+int probe_device(const char *path, DEVICE_INFO *device) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        device->error = errno;
+        return -1;
+    }
+
+    NTFS_BOOT_SECTOR boot_sector;
+    ssize_t length = pread(fd, &boot_sector, sizeof(boot_sector), 0);
+    if (length != sizeof(boot_sector)) {
+        device->error = length == -1 ? errno : EIO;
+        close(fd);
+        return -1;
+    }
+
+    device->ntfs = boot_sector.oem_id == NTFS_OEM_ID;
+    if (device->ntfs) {
+        device->bytes_per_sector = boot_sector.bpb.bytes_per_sector;
+        device->cluster_size = boot_sector.bpb.bytes_per_sector * boot_sector.bpb.sectors_per_cluster;
+        device->number_of_sectors = boot_sector.number_of_sectors;
+        device->mft_lcn = boot_sector.mft_lcn;
+        device->serial_number = boot_sector.volume_serial_number;
+        /* Negative value means the size is 2^-value bytes, as in init(). */
+        if (boot_sector.clusters_per_mft_record > 0) {
+            device->mft_record_size = boot_sector.clusters_per_mft_record * device->cluster_size;
+        } else if (boot_sector.clusters_per_mft_record > -32) {
+            device->mft_record_size = 1u << -boot_sector.clusters_per_mft_record;
+        }
+        if (boot_sector.clusters_per_index_record > 0) {
+            device->index_block_size = boot_sector.clusters_per_index_record * device->cluster_size;
+        } else if (boot_sector.clusters_per_index_record > -32) {
+            device->index_block_size = 1u << -boot_sector.clusters_per_index_record;
+        }
+        read_label(fd, device);
+    }
+    close(fd);
     return 0;
 }
 
-int iterate_devices(blkid_cache *cache) {
-    blkid_dev device;
-    blkid_dev_iterate iterator = blkid_dev_iterate_begin(*cache);
+static void *probe_worker(void *arg) {
+    PROBE_QUEUE *queue = arg;
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+        char path[DEVICE_NAME_MAX + 8];
+        snprintf(path, sizeof(path), "/dev/%s", queue->devices[i].name);
+        probe_device(path, &queue->devices[i]);
+    }
+    return NULL;
+}
+
+static int compare_devices(const void *a, const void *b) {
+    return strcmp(((const DEVICE_INFO *) a)->name, ((const DEVICE_INFO *) b)->name);
+}
 
-    puts("Partitions:\n");
-    while (blkid_dev_next(iterator, &device) == 0) {
-        const char *device_name = blkid_dev_devname(device);
-        printf("\t%s\t", device_name);
-
-        blkid_probe probe = blkid_new_probe_from_filename(device_name);
-        if (probe == NULL) {
-            fprintf(stderr, "Launch util as root to get more information!\n");
-        } else {
-            blkid_loff_t size = blkid_probe_get_size(probe);
-            size_print(size);
-
-            blkid_do_probe(probe);
-            printf("\t");
-            get_tag(&probe, "TYPE");
-            get_tag(&probe, "UUID");
-            get_tag(&probe, "LABEL");
-            printf("\t\n");
+/*
+ * Lists the disks and partitions of /sys/block with a nonzero size, sorted by name, and probes
+ * them on up to DEVICE_PROBE_THREADS threads. *devices is malloc'd, a device that can't be
+ * read is still listed with its error. Returns 0 or -1 if /sys/block can't be read.
+ */
+int list_devices(DEVICE_INFO **devices, uint32_t *count) {
+    *devices = NULL;
+    *count = 0;
+    DIR *block_dir = opendir(SYS_BLOCK);
+    if (block_dir == NULL) {
+        return -1;
+    }
+
+    uint32_t capacity = 0;
+    struct dirent *entry;
+    int err = 0;
+    while (err == 0 && (entry = readdir(block_dir)) != NULL) {
+        if (entry->d_name[0] != '.' && strlen(entry->d_name) < DEVICE_NAME_MAX) {
+            err = add_disk(devices, count, &capacity, entry->d_name);
         }
     }
-    blkid_dev_iterate_end(iterator);
+    closedir(block_dir);
+    if (err == -1) {
+        free(*devices);
+        *devices = NULL;
+        *count = 0;
+        return -1;
+    }
+
+    // a probe is one read, the time goes to waiting for the device, so the threads overlap the waits
+    PROBE_QUEUE queue = {*devices, *count, 0};
+    pthread_t threads[DEVICE_PROBE_THREADS];
+    uint32_t thread_count = *count < DEVICE_PROBE_THREADS ? *count : DEVICE_PROBE_THREADS;
+    uint32_t started = 0;
+    while (started < thread_count && pthread_create(&threads[started], NULL, probe_worker, &queue) == 0) {
+        started++;
+    }
+    probe_worker(&queue);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    qsort(*devices, *count, sizeof(DEVICE_INFO), compare_devices);
     return 0;
 }
 
@@ -62,18 +255,34 @@ void size_print(long long size) {
     }
 }
 
-void get_tag(blkid_probe *probe, char *tag_name) {
-    const char *value;
-    if (blkid_probe_has_value(*probe, tag_name) == 1) {
-        blkid_probe_lookup_value(*probe, tag_name, &value, NULL);
-        printf("%s = %s\t", tag_name, value);
+void print_device() {
+    DEVICE_INFO *devices;
+    uint32_t count;
+    if (list_devices(&devices, &count) == -1) {
+        puts("ERROR: Can't read " SYS_BLOCK);
+        return;
     }
-}
 
-void print_device() {
-    blkid_cache cache;
-    init_cache(&cache);
-    probe_devices(&cache);
-    iterate_devices(&cache);
+    puts("Partitions:\n");
+    for (uint32_t i = 0; i < count; i++) {
+        DEVICE_INFO *device = &devices[i];
+        printf("\t/dev/%s\t", device->name);
+        size_print((long long) device->size);
+        printf("\t");
+        if (device->error) {
+            printf("%s", strerror(device->error));
+            if (device->error == EACCES) {
+                fprintf(stderr, "Launch util as root to get more information!\n");
+            }
+        } else if (device->ntfs) {
+            printf("TYPE = ntfs\tLABEL = %s\tSERIAL = %016lx\tCLUSTER = %u\tMFT RECORD = %u\tMFT LCN = %lu",
+                   device->label, device->serial_number, device->cluster_size, device->mft_record_size,
+                   device->mft_lcn);
+        }
+        if (device->read_only) {
+            printf("\tro");
+        }
+        printf("\t\n");
+    }
+    free(devices);
 }
-
@@ -0,0 +1,281 @@
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/path_table.h"
+#include "../inc/du.h"
+
+#define DEPTH_UNKNOWN 0
+#define DEPTH_UNREACHABLE UINT16_MAX
+
+typedef struct {
+    uint64_t logical_size;
+    uint64_t allocated_size;
+} DU_SIZE;
+
+typedef struct {
+    DU_SIZE *sizes;
+    PATH_TABLE *table;    // filled on the way when the volume has no path table yet
+} DU_SCAN;
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context);
+
+static int compute_depths(const PATH_TABLE *table, uint16_t *depths);
+
+static void heap_add(DU_HEAP *heap, uint32_t mft_num, const DU_SIZE *size);
+
+static int compare_entries(const void *a, const void *b);
+
+/*
+ * Sums the sizes of the tree under mft_num with one scan of $MFT. Sizes of
+ * directories are built bottom-up from the deepest records, so every record
+ * is visited once. report keeps the top largest files and directories.
+ * Returns 0 or -1.
+ */
+int disk_usage(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t top, DU_REPORT *report) {
+    memset(report, 0, sizeof(DU_REPORT));
+    uint64_t count = mft_record_count(g_info);
+    if (mft_num >= count) {
+        return -1;
+    }
+    DU_SCAN scan;
+    scan.sizes = calloc(count, sizeof(DU_SIZE));
+    pthread_mutex_lock(g_info->index_lock);
+    PATH_TABLE *table = g_info->path_table;
+    pthread_mutex_unlock(g_info->index_lock);
+    scan.table = table == NULL ? create_path_table(g_info) : NULL;
+    if (scan.sizes == NULL || (table == NULL && scan.table == NULL) || scan_mft(g_info, scan_record, &scan) == -1) {
+        free(scan.sizes);
+        free_path_table(scan.table);
+        return -1;
+    }
+    if (scan.table != NULL) {
+        // another session may have built the table during the scan
+        finish_path_table(scan.table);
+        pthread_mutex_lock(g_info->index_lock);
+        if (g_info->path_table == NULL) {
+            g_info->path_table = scan.table;
+            register_path_cache(scan.table);
+            scan.table = NULL;
+        }
+        table = g_info->path_table;
+        pthread_mutex_unlock(g_info->index_lock);
+        free_path_table(scan.table);
+    }
+    DU_SIZE *sizes = scan.sizes;
+
+    // records ordered by depth, so children always come before their parents when walked backwards
+    uint16_t *depths = calloc(count, sizeof(uint16_t));
+    uint64_t *first = calloc(PATH_TABLE_MAX_DEPTH + 2, sizeof(uint64_t));
+    uint32_t *order = malloc(count * sizeof(uint32_t) + 1);
+    uint8_t *inside = calloc(count, 1);
+    report->largest_files.entries = malloc(top * sizeof(DU_ENTRY) + 1);
+    report->largest_files.capacity = top;
+    report->largest_directories.entries = malloc(top * sizeof(DU_ENTRY) + 1);
+    report->largest_directories.capacity = top;
+    int result = -1;
+    if (depths == NULL || first == NULL || order == NULL || inside == NULL || report->largest_files.entries == NULL ||
+        report->largest_directories.entries == NULL || compute_depths(table, depths) == -1) {
+        goto end;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (depths[i] != DEPTH_UNREACHABLE) {
+            first[depths[i] + 1]++;
+        }
+    }
+    for (uint32_t d = 1; d <= PATH_TABLE_MAX_DEPTH + 1; d++) {
+        first[d] += first[d - 1];
+    }
+    uint64_t ordered = first[PATH_TABLE_MAX_DEPTH + 1];
+    for (uint64_t i = 0; i < count; i++) {
+        if (depths[i] != DEPTH_UNREACHABLE) {
+            order[first[depths[i]]++] = (uint32_t) i;
+        }
+    }
+
+    // the tree under mft_num, parents are marked before their children
+    if (depths[mft_num] == DEPTH_UNREACHABLE) {
+        goto end;
+    }
+    inside[mft_num] = 1;
+    for (uint64_t i = 0; i < ordered; i++) {
+        uint32_t record = order[i];
+        if (record != FILE_root && inside[table->nodes[record].parent]) {
+            inside[record] = 1;
+        }
+    }
+
+    for (uint64_t i = ordered; i-- > 0;) {
+        uint32_t record = order[i];
+        if (!inside[record]) {
+            continue;
+        }
+        DU_SIZE *size = &sizes[record];
+        if (table->nodes[record].flags & MFT_RECORD_IS_DIRECTORY) {
+            report->directories++;
+            if (record != mft_num) {
+                heap_add(&report->largest_directories, record, size);
+            }
+        } else {
+            report->files++;
+            heap_add(&report->largest_files, record, size);
+        }
+        if (record != mft_num) {
+            sizes[table->nodes[record].parent].logical_size += size->logical_size;
+            sizes[table->nodes[record].parent].allocated_size += size->allocated_size;
+        }
+    }
+    report->logical_size = sizes[mft_num].logical_size;
+    report->allocated_size = sizes[mft_num].allocated_size;
+    qsort(report->largest_files.entries, report->largest_files.count, sizeof(DU_ENTRY), compare_entries);
+    qsort(report->largest_directories.entries, report->largest_directories.count, sizeof(DU_ENTRY),
+          compare_entries);
+    result = 0;
+
+    end:
+    if (result == -1) {
+        free_du_report(report);
+    }
+    free(sizes);
+    free(depths);
+    free(first);
+    free(order);
+    free(inside);
+    return result;
+}
+
+void free_du_report(DU_REPORT *report) {
+    free(report->largest_files.entries);
+    free(report->largest_directories.entries);
+    report->largest_files.entries = NULL;
+    report->largest_directories.entries = NULL;
+}
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context) {
+    DU_SCAN *scan = context;
+    if (scan->table != NULL && add_path_record(g_info, mft_num, record, scan->table) == -1) {
+        return -1;
+    }
+    if (!(record->flags & MFT_RECORD_IN_USE)) {
+        return 0;
+    }
+    uint64_t target = record->base_mft_record ? MREF(record->base_mft_record) : mft_num;
+    if (target >= mft_record_count(g_info)) {
+        return 0;
+    }
+    DU_SIZE *size = &scan->sizes[target];
+
+    ATTR_RECORD *attr = NULL;
+    while ((attr = next_attr(g_info, record, attr, AT_UNUSED)) != NULL) {
+        if (attr->type != AT_DATA && attr->type != AT_INDEX_ALLOCATION) {
+            continue;
+        }
+        if (!attr->non_resident) {
+            // resident values live inside the mft record and take no clusters
+            if (attr->type == AT_DATA) {
+                size->logical_size += attr->value_length;
+            }
+            continue;
+        }
+        // every extent of an attribute carries the sizes, only the first one counts
+        if (attr->lowest_vcn != 0) {
+            continue;
+        }
+        if (attr->type == AT_DATA) {
+            size->logical_size += attr->data_size;
+        }
+        if (attr->flags & (ATTR_IS_COMPRESSED | ATTR_IS_SPARSE)) {
+            size->allocated_size += attr->compressed_size;
+        } else {
+            size->allocated_size += attr->allocated_size;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Distance of every record from the root following the parents of the path
+ * table, DEPTH_UNREACHABLE for records outside of the tree.
+ */
+static int compute_depths(const PATH_TABLE *table, uint16_t *depths) {
+    uint32_t *chain = malloc(PATH_TABLE_MAX_DEPTH * sizeof(uint32_t));
+    if (chain == NULL) {
+        return -1;
+    }
+    // stored depths are shifted by one, DEPTH_UNKNOWN is zero
+    depths[FILE_root] = 1;
+    for (uint64_t i = 0; i < table->node_count; i++) {
+        uint32_t length = 0;
+        uint64_t current = i;
+        uint16_t depth = DEPTH_UNREACHABLE;
+        while (depths[current] == DEPTH_UNKNOWN) {
+            const PATH_NODE *node = &table->nodes[current];
+            if (node->name_length == 0 || node->parent >= table->node_count || length == PATH_TABLE_MAX_DEPTH) {
+                break;
+            }
+            chain[length++] = (uint32_t) current;
+            // mark the walk, a loop ends on a record of this chain
+            depths[current] = DEPTH_UNREACHABLE;
+            current = node->parent;
+        }
+        if (depths[current] != DEPTH_UNKNOWN && depths[current] != DEPTH_UNREACHABLE &&
+            depths[current] + length < PATH_TABLE_MAX_DEPTH) {
+            depth = depths[current];
+        }
+        for (uint32_t k = length; k-- > 0;) {
+            if (depth != DEPTH_UNREACHABLE) {
+                depth++;
+            }
+            depths[chain[k]] = depth;
+        }
+        if (length == 0 && depths[current] == DEPTH_UNKNOWN) {
+            depths[current] = DEPTH_UNREACHABLE;
+        }
+    }
+    for (uint64_t i = 0; i < table->node_count; i++) {
+        if (depths[i] != DEPTH_UNREACHABLE) {
+            depths[i]--;
+        }
+    }
+    free(chain);
+    return 0;
+}
+
+static void heap_add(DU_HEAP *heap, uint32_t mft_num, const DU_SIZE *size) {
+    if (heap->capacity == 0) {
+        return;
+    }
+    DU_ENTRY entry = {size->allocated_size, size->logical_size, mft_num};
+    uint32_t i;
+    if (heap->count < heap->capacity) {
+        i = heap->count++;
+        // sift up
+        while (i > 0 && heap->entries[(i - 1) / 2].allocated_size > entry.allocated_size) {
+            heap->entries[i] = heap->entries[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap->entries[i] = entry;
+        return;
+    }
+    if (entry.allocated_size <= heap->entries[0].allocated_size) {
+        return;
+    }
+    // replace the smallest and sift down
+    i = 0;
+    while (2 * i + 1 < heap->count) {
+        uint32_t child = 2 * i + 1;
+        if (child + 1 < heap->count && heap->entries[child + 1].allocated_size < heap->entries[child].allocated_size) {
+            child++;
+        }
+        if (heap->entries[child].allocated_size >= entry.allocated_size) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    heap->entries[i] = entry;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    uint64_t left = ((const DU_ENTRY *) a)->allocated_size;
+    uint64_t right = ((const DU_ENTRY *) b)->allocated_size;
+    return (left < right) - (left > right);
+}
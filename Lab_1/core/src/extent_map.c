@@ -0,0 +1,705 @@
+#include <stdbool.h>
+#include "../inc/ntfs.h"
+#include "../inc/attribute_list.h"
+#include "../inc/extent_map.h"
+
+static ATTR_RECORD *find_attr_extent(GENERAL_INFORMATION *g_info, MFT_RECORD *mft_record, uint32_t type,
+                                     const char *name, uint64_t lowest_vcn);
+
+static bool name_matches(uint32_t type, const uint16_t *name, uint8_t name_length, const char *wanted);
+
+static EXTENT_MAP *load_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD *base_record, uint32_t type,
+                            const char *name);
+
+static int fill_segment(EXTENT_MAP *map, EXTENT_SEGMENT *segment, ATTR_RECORD *attr_record);
+
+static int load_segment(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, EXTENT_SEGMENT *segment);
+
+static EXTENT_MAP *find_cached_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t type);
+
+static uint64_t map_size(const EXTENT_MAP *map);
+
+static EXTENT_MAP *cheapest_map(GENERAL_INFORMATION *g_info, EXTENT_MAP **prev);
+
+static uint64_t drop_map(GENERAL_INFORMATION *g_info, EXTENT_MAP *victim, EXTENT_MAP *prev);
+
+static int lowest_map(void *context, uint64_t *priority);
+
+static uint64_t evict_map(void *context);
+
+static const BUDGET_EVICTOR extent_map_evictor = {lowest_map, evict_map};
+
+int decode_runlist(const uint8_t *run_list, const uint8_t *end, uint64_t lowest_vcn, EXTENT **extents,
+                   uint32_t *extent_count) {
+    uint32_t buf_size = 16;
+    uint32_t cur_size = 0;
+    EXTENT *result = malloc(sizeof(EXTENT) * buf_size);
+    if (result == NULL) {
+        return -1;
+    }
+
+    uint64_t vcn = lowest_vcn;
+    int64_t lcn = 0;
+
+    while (run_list < end && *run_list) {
+        // the low nibble is the size of the length field, the high one is the size of the offset field
+        uint8_t length_size = *run_list & 0x0F;
+        uint8_t offset_size = (*run_list >> 4) & 0x0F;
+        run_list++;
+
+        if (length_size == 0 || length_size > 8 || offset_size > 8 || run_list + length_size + offset_size > end) {
+            free(result);
+            return -1;
+        }
+
+        uint64_t length = 0;
+        for (uint8_t i = 0; i < length_size; i++) {
+            length |= (uint64_t) run_list[i] << (i << 3);
+        }
+        run_list += length_size;
+
+        int64_t run_lcn = LCN_HOLE;
+        /* NTFS 3+ sparse files: a run without offset is a hole */
+        if (offset_size != 0) {
+            uint64_t delta = 0;
+            for (uint8_t i = 0; i < offset_size; i++) {
+                delta |= (uint64_t) run_list[i] << (i << 3);
+            }
+            // the offset is signed and relative to the previous run
+            if ((run_list[offset_size - 1] & 0x80) && offset_size < 8) {
+                delta |= ~0ULL << (offset_size << 3);
+            }
+            run_list += offset_size;
+            lcn += (int64_t) delta;
+            run_lcn = lcn;
+        }
+
+        if (cur_size == buf_size) {
+            EXTENT *tmp = realloc(result, sizeof(EXTENT) * buf_size * 2);
+            if (tmp == NULL) {
+                free(result);
+                return -1;
+            }
+            result = tmp;
+            buf_size *= 2;
+        }
+        result[cur_size].vcn = vcn;
+        result[cur_size].lcn = run_lcn;
+        result[cur_size].length = length;
+        cur_size++;
+        vcn += length;
+    }
+
+    *extents = result;
+    *extent_count = cur_size;
+    return 0;
+}
+
+EXTENT_MAP *load_extent_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD *base_record, uint32_t type) {
+    return load_map(g_info, mft_num, base_record, type, NULL);
+}
+
+/*
+ * Map of the named stream mft_num:name of $DATA, e.g. "$J" of $UsnJrnl.
+ * Stream maps are not cached, the caller frees them with free_extent_map().
+ */
+EXTENT_MAP *get_stream_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *name) {
+    MFT_RECORD *mft_record = malloc(g_info->mft_record_size_in_bytes);
+    if (mft_record == NULL || search_mft_record(g_info, mft_num, &mft_record) == -1) {
+        free(mft_record);
+        return NULL;
+    }
+    EXTENT_MAP *map = load_map(g_info, mft_num, mft_record, AT_DATA, name);
+    free(mft_record);
+    return map;
+}
+
+static EXTENT_MAP *load_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD *base_record, uint32_t type,
+                            const char *name) {
+    EXTENT_MAP *map = calloc(1, sizeof(EXTENT_MAP));
+    if (map == NULL) {
+        return NULL;
+    }
+    stats_add(g_info, STATS_ALLOCATIONS, 1);
+    map->mft_num = mft_num;
+    map->type = type;
+    if (name != NULL) {
+        map->name = malloc(strlen(name) + 1);
+        if (map->name == NULL) {
+            free(map);
+            return NULL;
+        }
+        strcpy(map->name, name);
+    }
+
+    ATTR_RECORD *list_attr = find_attr_extent(g_info, base_record, AT_ATTRIBUTE_LIST, NULL, 0);
+    if (list_attr == NULL) {
+        // everything lives in the base record, there is exactly one segment
+        ATTR_RECORD *attr_record = find_attr_extent(g_info, base_record, type, map->name, 0);
+        if (attr_record == NULL) {
+            free_extent_map(map);
+            return NULL;
+        }
+        map->segments = calloc(1, sizeof(EXTENT_SEGMENT));
+        if (map->segments == NULL) {
+            free_extent_map(map);
+            return NULL;
+        }
+        map->segment_count = 1;
+        map->segments[0].mft_reference = mft_num;
+        if (fill_segment(map, &map->segments[0], attr_record) == -1) {
+            free_extent_map(map);
+            return NULL;
+        }
+        map->complete = 1;
+        return map;
+    }
+
+    uint8_t *list;
+    uint64_t list_length;
+    if (read_attribute_list(g_info, list_attr, &list, &list_length) == -1) {
+        free_extent_map(map);
+        return NULL;
+    }
+
+    // only remember where every piece of the runlist is, pieces are decoded on demand
+    uint32_t buf_size = 4;
+    map->segments = malloc(sizeof(EXTENT_SEGMENT) * buf_size);
+    if (map->segments == NULL) {
+        free(list);
+        free_extent_map(map);
+        return NULL;
+    }
+    uint8_t *ptr = list;
+    while (ptr + sizeof(ATTR_LIST_ENTRY) <= list + list_length) {
+        ATTR_LIST_ENTRY *entry = (ATTR_LIST_ENTRY *) ptr;
+        if (entry->length == 0) {
+            break;
+        }
+        ptr += entry->length;
+        if (entry->type != type || entry->name_offset + entry->name_length * 2 > entry->length ||
+            !name_matches(type, (uint16_t *) ((uint8_t *) entry + entry->name_offset), entry->name_length,
+                          map->name)) {
+            continue;
+        }
+        if (map->segment_count == buf_size) {
+            EXTENT_SEGMENT *tmp = realloc(map->segments, sizeof(EXTENT_SEGMENT) * buf_size * 2);
+            if (tmp == NULL) {
+                free(list);
+                free_extent_map(map);
+                return NULL;
+            }
+            map->segments = tmp;
+            buf_size *= 2;
+        }
+        EXTENT_SEGMENT *segment = &map->segments[map->segment_count++];
+        segment->lowest_vcn = entry->lowest_vcn;
+        segment->mft_reference = MREF(entry->mft_reference);
+        segment->extents = NULL;
+        segment->extent_count = 0;
+        segment->loading = 0;
+    }
+    free(list);
+
+    if (map->segment_count == 0) {
+        free_extent_map(map);
+        return NULL;
+    }
+
+    // pieces stored in the base record are free to decode right away
+    for (uint32_t i = 0; i < map->segment_count; i++) {
+        EXTENT_SEGMENT *segment = &map->segments[i];
+        if (segment->mft_reference != mft_num) {
+            continue;
+        }
+        ATTR_RECORD *attr_record = find_attr_extent(g_info, base_record, type, map->name, segment->lowest_vcn);
+        if (attr_record == NULL || fill_segment(map, segment, attr_record) == -1) {
+            free_extent_map(map);
+            return NULL;
+        }
+    }
+
+    // the first piece carries sizes of the whole attribute
+    if (map->segments[0].extents == NULL && !map->resident && load_segment(g_info, map, &map->segments[0]) == -1) {
+        free_extent_map(map);
+        return NULL;
+    }
+    map->complete = 1;
+    for (uint32_t i = 0; i < map->segment_count; i++) {
+        if (map->segments[i].extents == NULL) {
+            map->complete = 0;
+        }
+    }
+    return map;
+}
+
+/*
+ * Cached map of an attribute, the caller releases it with put_extent_map().
+ * The map is loaded without holding the cache lock, a map another thread has
+ * cached in the meantime wins.
+ */
+EXTENT_MAP *get_extent_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t type) {
+    pthread_mutex_lock(g_info->cache_lock);
+    EXTENT_MAP *map = find_cached_map(g_info, mft_num, type);
+    pthread_mutex_unlock(g_info->cache_lock);
+    if (map != NULL) {
+        stats_add(g_info, STATS_MAP_HITS, 1);
+        return map;
+    }
+
+    stats_add(g_info, STATS_MAP_MISSES, 1);
+    uint64_t start = stats_clock();
+    MFT_RECORD *mft_record = malloc(g_info->mft_record_size_in_bytes);
+    if (mft_record == NULL || search_mft_record(g_info, mft_num, &mft_record) == -1) {
+        free(mft_record);
+        return NULL;
+    }
+    EXTENT_MAP *loaded = load_extent_map(g_info, mft_num, mft_record, type);
+    free(mft_record);
+    if (loaded == NULL) {
+        return NULL;
+    }
+
+    // the caller needs the map whatever the limit, other maps are evicted to make room for it
+    loaded->cost = stats_clock() - start;
+    loaded->charged = map_size(loaded);
+    budget_force(g_info->budget, BUDGET_EXTENT_MAPS, loaded->charged);
+
+    pthread_mutex_lock(g_info->cache_lock);
+    map = find_cached_map(g_info, mft_num, type);
+    if (map != NULL) {
+        pthread_mutex_unlock(g_info->cache_lock);
+        budget_release(g_info->budget, BUDGET_EXTENT_MAPS, loaded->charged);
+        free_extent_map(loaded);
+        return map;
+    }
+    map = loaded;
+    map->refs = 1;
+    map->lock = g_info->cache_lock;
+    map->budget = g_info->budget;
+    map->priority = budget_priority(map->budget, map->cost, map->charged);
+    map->next = g_info->extent_maps;
+    g_info->extent_maps = map;
+    g_info->extent_maps_count++;
+
+    if (g_info->extent_maps_count > EXTENT_MAP_CACHE_SIZE) {
+        // evict the map nobody holds that is the cheapest to load again
+        EXTENT_MAP *prev;
+        EXTENT_MAP *victim = cheapest_map(g_info, &prev);
+        if (victim != NULL) {
+            budget_evicted(g_info->budget, BUDGET_EXTENT_MAPS, victim->priority);
+            drop_map(g_info, victim, prev);
+        }
+    }
+    pthread_mutex_unlock(g_info->cache_lock);
+    return map;
+}
+
+void put_extent_map(EXTENT_MAP *map) {
+    if (map == NULL) {
+        return;
+    }
+    if (map->lock != NULL) {
+        pthread_mutex_lock(map->lock);
+    }
+    if (map->refs > 0) {
+        map->refs--;
+    }
+    // the map may have been taken over the limit while it was held
+    struct memory_budget *budget = map->refs == 0 ? map->budget : NULL;
+    if (map->lock != NULL) {
+        pthread_mutex_unlock(map->lock);
+    }
+    if (budget_over(budget)) {
+        budget_trim(budget);
+    }
+}
+
+/*
+ * Decodes every segment that is not loaded yet, so the map can be read
+ * without locking. Used for maps shared from the start, like the one of $MFT.
+ */
+void complete_extent_map(GENERAL_INFORMATION *g_info, EXTENT_MAP *map) {
+    for (uint32_t i = 0; i < map->segment_count; i++) {
+        if (map->segments[i].extents == NULL && load_segment(g_info, map, &map->segments[i]) == -1) {
+            return;
+        }
+    }
+    map->complete = 1;
+}
+
+int lookup_vcn(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, uint64_t vcn, EXTENT *extent) {
+    if (map->resident || map->segment_count == 0) {
+        return -1;
+    }
+
+    // last segment starting at or before vcn
+    uint32_t low = 0;
+    uint32_t high = map->segment_count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (map->segments[middle].lowest_vcn <= vcn) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    EXTENT_SEGMENT *segment = &map->segments[low];
+    if (!map->complete) {
+        // the segment is decoded once, by whichever thread needs it first
+        pthread_mutex_lock(g_info->cache_lock);
+        int err = segment->extents == NULL ? load_segment(g_info, map, segment) : 0;
+        pthread_mutex_unlock(g_info->cache_lock);
+        if (err == -1) {
+            return -1;
+        }
+    }
+    if (segment->extent_count == 0 || vcn < segment->extents[0].vcn) {
+        return -1;
+    }
+
+    // last extent starting at or before vcn
+    low = 0;
+    high = segment->extent_count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (segment->extents[middle].vcn <= vcn) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    EXTENT *found = &segment->extents[low];
+    if (vcn >= found->vcn + found->length) {
+        return -1;
+    }
+    memcpy(extent, found, sizeof(EXTENT));
+    return 0;
+}
+
+/* pread() of the volume, counted and timed in the volume statistics. */
+int64_t read_volume(GENERAL_INFORMATION *g_info, void *buf, uint64_t size, uint64_t offset) {
+    uint64_t start = stats_clock();
+    ssize_t done = pread(g_info->file_descriptor, buf, size, (off_t) offset);
+    stats_latency(g_info, STATS_LATENCY_READ, stats_clock() - start);
+    stats_add(g_info, STATS_READ_CALLS, 1);
+    stats_add(g_info, STATS_READ_BYTES, size);
+    return done;
+}
+
+int64_t read_attr_data(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, uint64_t offset, uint8_t *buf,
+                       uint64_t length) {
+    if (offset >= map->data_size) {
+        return 0;
+    }
+    if (length > map->data_size - offset) {
+        length = map->data_size - offset;
+    }
+
+    if (map->resident) {
+        memcpy(buf, map->resident_data + offset, length);
+        return (int64_t) length;
+    }
+
+    uint64_t cluster_size = g_info->cluster_size_in_bytes;
+    uint64_t done = 0;
+    EXTENT extent;
+    while (done < length) {
+        uint64_t position = offset + done;
+        if (lookup_vcn(g_info, map, position / cluster_size, &extent) == -1) {
+            return -1;
+        }
+        uint64_t run_offset = position - extent.vcn * cluster_size;
+        uint64_t size = extent.length * cluster_size - run_offset;
+        if (size > length - done) {
+            size = length - done;
+        }
+
+        if (extent.lcn == LCN_HOLE || position >= map->initialized_size) {
+            memset(buf + done, 0, size);
+        } else {
+            uint64_t disk_offset = extent.lcn * cluster_size + run_offset;
+            if (read_volume(g_info, buf + done, size, disk_offset) != (int64_t) size) {
+                return -1;
+            }
+            // the tail past initialized_size reads as zeroes
+            if (position + size > map->initialized_size) {
+                uint64_t valid = map->initialized_size - position;
+                memset(buf + done + valid, 0, size - valid);
+            }
+        }
+        done += size;
+    }
+    return (int64_t) done;
+}
+
+void free_extent_map(EXTENT_MAP *map) {
+    if (map == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < map->segment_count; i++) {
+        free(map->segments[i].extents);
+    }
+    free(map->segments);
+    free(map->resident_data);
+    free(map->name);
+    free(map);
+}
+
+/*
+ * Lets the budget of the volume evict maps nobody holds, cheapest to load again first.
+ */
+void register_extent_map_cache(GENERAL_INFORMATION *g_info) {
+    budget_register(g_info->budget, BUDGET_EXTENT_MAPS, &extent_map_evictor, g_info);
+}
+
+void free_extent_map_cache(GENERAL_INFORMATION *g_info) {
+    budget_unregister(g_info->budget, BUDGET_EXTENT_MAPS);
+    EXTENT_MAP *tmp;
+    while (g_info->extent_maps != NULL) {
+        tmp = g_info->extent_maps;
+        g_info->extent_maps = tmp->next;
+        budget_release(g_info->budget, BUDGET_EXTENT_MAPS, tmp->charged);
+        free_extent_map(tmp);
+    }
+    g_info->extent_maps_count = 0;
+}
+
+static ATTR_RECORD *find_attr_extent(GENERAL_INFORMATION *g_info, MFT_RECORD *mft_record, uint32_t type,
+                                     const char *name, uint64_t lowest_vcn) {
+    uint8_t *end = (uint8_t *) mft_record + g_info->mft_record_size_in_bytes;
+    uint8_t *ptr = (uint8_t *) mft_record + mft_record->attrs_offset;
+
+    while (ptr + sizeof(uint32_t) <= end) {
+        ATTR_RECORD *attr_record = (ATTR_RECORD *) ptr;
+        if (attr_record->type == AT_END || attr_record->length == 0 || ptr + attr_record->length > end) {
+            break;
+        }
+        if (attr_record->type == type && attr_record->name_offset + attr_record->name_length * 2 <= attr_record->length &&
+            name_matches(type, (uint16_t *) ((uint8_t *) attr_record + attr_record->name_offset),
+                         attr_record->name_length, name)) {
+            uint64_t attr_vcn = attr_record->non_resident ? attr_record->lowest_vcn : 0;
+            if (attr_vcn == lowest_vcn) {
+                return attr_record;
+            }
+        }
+        ptr += attr_record->length;
+    }
+    return NULL;
+}
+
+/*
+ * Without a wanted name $DATA has to be unnamed, it is the file content, and
+ * any name is fine for other types. A wanted name is compared as ASCII.
+ */
+static bool name_matches(uint32_t type, const uint16_t *name, uint8_t name_length, const char *wanted) {
+    if (wanted == NULL) {
+        return type != AT_DATA || name_length == 0;
+    }
+    if (strlen(wanted) != name_length) {
+        return false;
+    }
+    for (uint8_t i = 0; i < name_length; i++) {
+        if (name[i] != (uint8_t) wanted[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int fill_segment(EXTENT_MAP *map, EXTENT_SEGMENT *segment, ATTR_RECORD *attr_record) {
+    if (!attr_record->non_resident) {
+        if ((uint64_t) attr_record->value_offset + attr_record->value_length > attr_record->length) {
+            return -1;
+        }
+        map->resident = 1;
+        map->data_size = attr_record->value_length;
+        map->allocated_size = attr_record->value_length;
+        map->initialized_size = attr_record->value_length;
+        map->resident_data = malloc(attr_record->value_length + 1);
+        segment->extents = malloc(sizeof(EXTENT));
+        segment->extent_count = 0;
+        if (map->resident_data == NULL || segment->extents == NULL) {
+            return -1;
+        }
+        memcpy(map->resident_data, (uint8_t *) attr_record + attr_record->value_offset, attr_record->value_length);
+        return 0;
+    }
+
+    if (attr_record->lowest_vcn == 0) {
+        map->data_size = attr_record->data_size;
+        map->allocated_size = attr_record->allocated_size;
+        map->initialized_size = attr_record->initialized_size;
+    }
+    const uint8_t *run_list = (uint8_t *) attr_record + attr_record->mapping_pairs_offset;
+    const uint8_t *end = (uint8_t *) attr_record + attr_record->length;
+    return decode_runlist(run_list, end, attr_record->lowest_vcn, &segment->extents, &segment->extent_count);
+}
+
+static int load_segment(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, EXTENT_SEGMENT *segment) {
+    if (segment->loading) {
+        return -1;
+    }
+    segment->loading = 1;
+
+    uint64_t start = stats_clock();
+    MFT_RECORD *mft_record = malloc(g_info->mft_record_size_in_bytes);
+    int err = -1;
+    if (mft_record != NULL && search_mft_record(g_info, segment->mft_reference, &mft_record) != -1 &&
+        mft_record->base_mft_record != 0 && MREF(mft_record->base_mft_record) == map->mft_num) {
+        ATTR_RECORD *attr_record = find_attr_extent(g_info, mft_record, map->type, map->name, segment->lowest_vcn);
+        if (attr_record != NULL) {
+            err = fill_segment(map, segment, attr_record);
+        }
+    }
+
+    free(mft_record);
+    segment->loading = 0;
+
+    // a cached map grows while it is held, the segment is charged whatever the limit
+    if (err == 0 && map->budget != NULL) {
+        uint64_t size = segment->extent_count * sizeof(EXTENT);
+        map->cost += stats_clock() - start;
+        map->charged += size;
+        budget_force(map->budget, BUDGET_EXTENT_MAPS, size);
+    }
+    return err;
+}
+
+/*
+ * Cached map moved to the front of the LRU list with one more reference.
+ * The caller holds the cache lock.
+ */
+static EXTENT_MAP *find_cached_map(GENERAL_INFORMATION *g_info, uint32_t mft_num, uint32_t type) {
+    EXTENT_MAP *prev = NULL;
+    for (EXTENT_MAP *map = g_info->extent_maps; map != NULL; prev = map, map = map->next) {
+        if (map->mft_num == mft_num && map->type == type) {
+            if (prev != NULL) {
+                prev->next = map->next;
+                map->next = g_info->extent_maps;
+                g_info->extent_maps = map;
+            }
+            map->refs++;
+            map->priority = budget_priority(map->budget, map->cost, map->charged);
+            return map;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Copies the value of an $ATTRIBUTE_LIST, resident or not, into a new buffer.
+ * Returns 0 or -1.
+ */
+int read_attribute_list(GENERAL_INFORMATION *g_info, ATTR_RECORD *list_attr, uint8_t **list, uint64_t *list_length) {
+    if (!list_attr->non_resident) {
+        if ((uint64_t) list_attr->value_offset + list_attr->value_length > list_attr->length) {
+            return -1;
+        }
+        *list_length = list_attr->value_length;
+        *list = malloc(*list_length + 1);
+        if (*list == NULL) {
+            return -1;
+        }
+        memcpy(*list, (uint8_t *) list_attr + list_attr->value_offset, *list_length);
+        return 0;
+    }
+
+    // a big list is non-resident itself, but it never has a list of its own
+    EXTENT_MAP list_map;
+    EXTENT_SEGMENT list_segment;
+    memset(&list_map, 0, sizeof(EXTENT_MAP));
+    memset(&list_segment, 0, sizeof(EXTENT_SEGMENT));
+    list_map.segments = &list_segment;
+    list_map.segment_count = 1;
+    list_map.complete = 1;
+    if (fill_segment(&list_map, &list_segment, list_attr) == -1) {
+        return -1;
+    }
+
+    *list_length = list_map.data_size;
+    *list = malloc(*list_length + 1);
+    if (*list == NULL) {
+        free(list_segment.extents);
+        return -1;
+    }
+    int64_t read = read_attr_data(g_info, &list_map, 0, *list, *list_length);
+    free(list_segment.extents);
+    if (read != (int64_t) *list_length) {
+        free(*list);
+        return -1;
+    }
+    return 0;
+}
+
+/* Bytes taken by the map, its segments and the extents decoded so far. */
+static uint64_t map_size(const EXTENT_MAP *map) {
+    uint64_t size = sizeof(EXTENT_MAP) + map->segment_count * sizeof(EXTENT_SEGMENT);
+    for (uint32_t i = 0; i < map->segment_count; i++) {
+        size += map->segments[i].extent_count * sizeof(EXTENT);
+    }
+    if (map->resident_data != NULL) {
+        size += map->data_size + 1;
+    }
+    if (map->name != NULL) {
+        size += strlen(map->name) + 1;
+    }
+    return size;
+}
+
+/*
+ * Cached map with the lowest priority that nobody holds, prev is set to the
+ * map before it in the list. The caller holds the cache lock.
+ */
+static EXTENT_MAP *cheapest_map(GENERAL_INFORMATION *g_info, EXTENT_MAP **prev) {
+    EXTENT_MAP *victim = NULL;
+    EXTENT_MAP *before = NULL;
+    for (EXTENT_MAP *map = g_info->extent_maps; map != NULL; before = map, map = map->next) {
+        // the later of equal maps is the least recently used one
+        if (map->refs == 0 && (victim == NULL || map->priority <= victim->priority)) {
+            victim = map;
+            *prev = before;
+        }
+    }
+    return victim;
+}
+
+/* Removes a map from the cache and frees it. Returns the bytes given back to the budget. */
+static uint64_t drop_map(GENERAL_INFORMATION *g_info, EXTENT_MAP *victim, EXTENT_MAP *prev) {
+    if (prev != NULL) {
+        prev->next = victim->next;
+    } else {
+        g_info->extent_maps = victim->next;
+    }
+    g_info->extent_maps_count--;
+    uint64_t size = victim->charged;
+    budget_release(g_info->budget, BUDGET_EXTENT_MAPS, size);
+    free_extent_map(victim);
+    return size;
+}
+
+static int lowest_map(void *context, uint64_t *priority) {
+    GENERAL_INFORMATION *g_info = context;
+    if (pthread_mutex_trylock(g_info->cache_lock) != 0) {
+        return -1;
+    }
+    EXTENT_MAP *prev;
+    EXTENT_MAP *victim = cheapest_map(g_info, &prev);
+    if (victim != NULL) {
+        *priority = victim->priority;
+    }
+    pthread_mutex_unlock(g_info->cache_lock);
+    return victim != NULL ? 0 : -1;
+}
+
+static uint64_t evict_map(void *context) {
+    GENERAL_INFORMATION *g_info = context;
+    if (pthread_mutex_trylock(g_info->cache_lock) != 0) {
+        return 0;
+    }
+    EXTENT_MAP *prev;
+    EXTENT_MAP *victim = cheapest_map(g_info, &prev);
+    uint64_t size = victim != NULL ? drop_map(g_info, victim, prev) : 0;
+    pthread_mutex_unlock(g_info->cache_lock);
+    return size;
+}
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "../inc/ntfs.h"
+#include "../inc/extract.h"
+
+static int compare_entries(const void *a, const void *b);
+
+static int write_resident_data(GENERAL_INFORMATION *g_info, MFT_RECORD *record, const char *path);
+
+static int link_copy(const char *source, const char *path, uint8_t mode);
+
+int add_extract_entry(EXTRACT_LIST *list, uint32_t mft_num, const char *path) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+        EXTRACT_ENTRY *entries = realloc(list->entries, capacity * sizeof(EXTRACT_ENTRY));
+        if (entries == NULL) {
+            return -1;
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    EXTRACT_ENTRY *entry = &list->entries[list->count];
+    entry->mft_num = mft_num;
+    entry->path = malloc(strlen(path) + 1);
+    if (entry->path == NULL) {
+        return -1;
+    }
+    strcpy(entry->path, path);
+    list->count++;
+    return 0;
+}
+
+/*
+ * Writes one file block by block through its $DATA extent map.
+ * Returns 0 on success or -1.
+ */
+int extract_file(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *path) {
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (fd == -1) {
+        return -1;
+    }
+
+    INODE node = {mft_num, NULL, 0, NULL, NULL};
+    MAPPING_CHUNK_DATA *chunk_data = NULL;
+    if (read_file_data(g_info, &node, &chunk_data) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (chunk_data->resident) {
+        int result = pwrite(fd, chunk_data->buf, chunk_data->length, 0) == (ssize_t) chunk_data->length ? 0 : -1;
+        stats_add(g_info, STATS_WRITE_CALLS, 1);
+        stats_add(g_info, STATS_WRITE_BYTES, chunk_data->length);
+        close(fd);
+        free_data_chunk(chunk_data);
+        return result;
+    }
+
+    int64_t offset = 0;
+    uint64_t size;
+    while (read_block_file(g_info, &chunk_data) == 0) {
+        if (chunk_data->blocks_count * g_info->block_size_in_bytes > chunk_data->length) {
+            size = chunk_data->length - ((chunk_data->blocks_count - 1) * g_info->block_size_in_bytes);
+            offset += pwrite(fd, chunk_data->buf, size, offset);
+            stats_add(g_info, STATS_WRITE_CALLS, 1);
+            break;
+        } else {
+            size = g_info->block_size_in_bytes;
+        }
+        offset += pwrite(fd, chunk_data->buf, size, offset);
+        stats_add(g_info, STATS_WRITE_CALLS, 1);
+    }
+    close(fd);
+    stats_add(g_info, STATS_WRITE_BYTES, (uint64_t) offset);
+    int result = chunk_data->signal == -1 ? -1 : 0;
+    free_data_chunk(chunk_data);
+    return result;
+}
+
+/*
+ * Extracts every file of the list. Records are visited in mft order and read
+ * up to EXTRACT_BATCH_RECORDS at a time; a file whose $DATA is resident in its
+ * base record is written straight from the batch buffer, the rest go through
+ * extract_file(). Further entries of a record that was written already are
+ * linked to that copy, see EXTRACT_LINK_MODES.
+ */
+int extract_files(GENERAL_INFORMATION *g_info, EXTRACT_LIST *list) {
+    if (list->count == 0) {
+        return 0;
+    }
+    qsort(list->entries, list->count, sizeof(EXTRACT_ENTRY), compare_entries);
+
+    // a short memory budget makes the batches smaller, down to one record
+    uint32_t record_size = g_info->mft_record_size_in_bytes;
+    uint64_t batch_size = budget_charge_up_to(g_info->budget, BUDGET_COPY_BUFFERS,
+                                              (uint64_t) EXTRACT_BATCH_RECORDS * record_size, record_size);
+    uint32_t batch_records = (uint32_t) (batch_size / record_size);
+    uint8_t *batch = malloc(batch_size);
+    if (batch == NULL) {
+        budget_release(g_info->budget, BUDGET_COPY_BUFFERS, batch_size);
+        return -1;
+    }
+
+    int result = 0;
+    uint32_t written = (uint32_t) -1;   // record of the last successful copy, at source
+    const char *source = NULL;
+    uint32_t i = 0;
+    while (i < list->count) {
+        uint32_t first = list->entries[i].mft_num;
+        uint32_t j = i + 1;
+        while (j < list->count && list->entries[j].mft_num - first < batch_records &&
+               list->entries[j].mft_num - list->entries[j - 1].mft_num <= EXTRACT_MAX_GAP) {
+            j++;
+        }
+        uint32_t count = list->entries[j - 1].mft_num - first + 1;
+        int read = read_mft_records(g_info, first, count, batch);
+
+        for (uint32_t k = i; k < j; k++) {
+            EXTRACT_ENTRY *entry = &list->entries[k];
+            int err = 1;
+            // the first copy of the record is the source of the other names
+            if (written == entry->mft_num) {
+                err = link_copy(source, entry->path, list->link_mode);
+            }
+            if (err == 1 && read > 0 && entry->mft_num - first < (uint32_t) read) {
+                MFT_RECORD *record = (MFT_RECORD *) (batch + (size_t) (entry->mft_num - first) * record_size);
+                err = write_resident_data(g_info, record, entry->path);
+            }
+            // non-resident data, attribute lists and damaged records take the usual path
+            if (err == 1) {
+                err = extract_file(g_info, entry->mft_num, entry->path);
+            }
+            if (err == -1) {
+                result = -1;
+            } else if (written != entry->mft_num) {
+                written = entry->mft_num;
+                source = entry->path;
+            }
+        }
+        i = j;
+    }
+
+    free(batch);
+    budget_release(g_info->budget, BUDGET_COPY_BUFFERS, batch_size);
+    return result;
+}
+
+void free_extract_list(EXTRACT_LIST *list) {
+    for (uint32_t i = 0; i < list->count; i++) {
+        free(list->entries[i].path);
+    }
+    free(list->entries);
+    list->entries = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    uint32_t left = ((const EXTRACT_ENTRY *) a)->mft_num;
+    uint32_t right = ((const EXTRACT_ENTRY *) b)->mft_num;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Writes unnamed resident $DATA of a base record to path.
+ * Returns 0 when written, 1 when the record has to be read the usual way, -1 on error.
+ */
+static int write_resident_data(GENERAL_INFORMATION *g_info, MFT_RECORD *record, const char *path) {
+    uint32_t record_size = g_info->mft_record_size_in_bytes;
+    if (record->magic != magic_FILE || !(record->flags & MFT_RECORD_IN_USE) || record->base_mft_record != 0 ||
+        record->attrs_offset >= record_size) {
+        return 1;
+    }
+
+    uint8_t *end = (uint8_t *) record + record_size;
+    ATTR_RECORD *attr = (ATTR_RECORD *) ((uint8_t *) record + record->attrs_offset);
+    ATTR_RECORD *data = NULL;
+    while ((uint8_t *) attr + sizeof(uint32_t) <= end && attr->type != AT_END) {
+        if ((uint8_t *) attr + sizeof(ATTR_RECORD) > end || attr->length == 0 ||
+            (uint8_t *) attr + attr->length > end) {
+            return 1;
+        }
+        // $DATA may live in an extension record
+        if (attr->type == AT_ATTRIBUTE_LIST) {
+            return 1;
+        }
+        if (attr->type == AT_DATA && attr->name_length == 0) {
+            data = attr;
+            break;
+        }
+        attr = (ATTR_RECORD *) ((uint8_t *) attr + attr->length);
+    }
+    if (data == NULL || data->non_resident ||
+        (uint64_t) data->value_offset + data->value_length > data->length) {
+        return 1;
+    }
+
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t written = write(fd, (uint8_t *) data + data->value_offset, data->value_length);
+    close(fd);
+    stats_add(g_info, STATS_WRITE_CALLS, 1);
+    stats_add(g_info, STATS_WRITE_BYTES, data->value_length);
+    return written == (ssize_t) data->value_length ? 0 : -1;
+}
+
+/*
+ * Creates path as another name of the copy at source.
+ * Returns 0 when done, 1 when the destination can't link or clone and the data has to be written again.
+ */
+static int link_copy(const char *source, const char *path, uint8_t mode) {
+    if (mode == EXTRACT_LINK_HARD) {
+        if (link(source, path) == 0) {
+            return 0;
+        }
+        // left over from an earlier extraction
+        if (errno == EEXIST && unlink(path) == 0 && link(source, path) == 0) {
+            return 0;
+        }
+    }
+#ifdef FICLONE
+    int from = open(source, O_RDONLY);
+    if (from == -1) {
+        return 1;
+    }
+    int to = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    int result = to != -1 && ioctl(to, FICLONE, from) == 0 ? 0 : 1;
+    close(from);
+    if (to != -1) {
+        close(to);
+    }
+    return result;
+#else
+    return 1;
+#endif
+}
@@ -0,0 +1,233 @@
+#include <stddef.h>
+#include <pthread.h>
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+
+uint64_t mft_record_count(GENERAL_INFORMATION *g_info) {
+    return g_info->mft_map->data_size / g_info->mft_record_size_in_bytes;
+}
+
+/*
+ * Reads the whole $MFT front to back, MFT_SCAN_BATCH_RECORDS records per request,
+ * and hands every valid record to callback.
+ * Returns 0 when all records were visited or -1.
+ */
+int scan_mft(GENERAL_INFORMATION *g_info, MFT_SCAN_CALLBACK callback, void *context) {
+    uint64_t record_size = g_info->mft_record_size_in_bytes;
+    uint64_t count = mft_record_count(g_info);
+    uint8_t *batch = malloc(MFT_SCAN_BATCH_RECORDS * record_size);
+    if (batch == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    for (uint64_t first = 0; first < count && result == 0; first += MFT_SCAN_BATCH_RECORDS) {
+        uint32_t want = count - first < MFT_SCAN_BATCH_RECORDS ? (uint32_t) (count - first) : MFT_SCAN_BATCH_RECORDS;
+        int read = read_mft_records(g_info, first, want, batch);
+        if (read <= 0) {
+            result = -1;
+            break;
+        }
+        for (int i = 0; i < read; i++) {
+            MFT_RECORD *record = (MFT_RECORD *) (batch + i * record_size);
+            if (record->magic != magic_FILE) {
+                continue;
+            }
+            if (callback(g_info, first + i, record, context) == -1) {
+                result = -1;
+                break;
+            }
+        }
+    }
+
+    free(batch);
+    return result;
+}
+
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+    MFT_SCAN_CALLBACK callback;
+    void **contexts;
+    uint32_t threads;
+
+    pthread_mutex_t gate;    // held until the barriers are set up for the threads that started
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    uint8_t *batch;    // records decoded in this round
+    uint64_t first;
+    int count;
+    int stop;
+    int failed[MFT_SCAN_MAX_THREADS];
+} PARALLEL_SCAN;
+
+typedef struct {
+    PARALLEL_SCAN *scan;
+    uint32_t index;
+} SCAN_WORKER;
+
+static void *scan_worker(void *arg) {
+    SCAN_WORKER *worker = arg;
+    PARALLEL_SCAN *scan = worker->scan;
+    uint64_t record_size = scan->g_info->mft_record_size_in_bytes;
+    pthread_mutex_lock(&scan->gate);
+    pthread_mutex_unlock(&scan->gate);
+    while (1) {
+        pthread_barrier_wait(&scan->start);
+        if (scan->stop) {
+            break;
+        }
+        for (int i = (int) worker->index; i < scan->count && !scan->failed[worker->index]; i += scan->threads) {
+            MFT_RECORD *record = (MFT_RECORD *) (scan->batch + i * record_size);
+            if (record->magic == magic_FILE &&
+                scan->callback(scan->g_info, scan->first + i, record, scan->contexts[worker->index]) == -1) {
+                scan->failed[worker->index] = 1;
+            }
+        }
+        pthread_barrier_wait(&scan->done);
+    }
+    return NULL;
+}
+
+/*
+ * Same as scan_mft, but records are decoded by `threads` threads while the
+ * next batch is read. Thread t gets contexts[t] and sees every threads-th
+ * record of a batch, so records don't come in mft order. callback writes only
+ * its own context. It may read g_info and fetch maps and attribute data through
+ * get_extent_map(), which locks the cache, but must not change g_info or keep
+ * record after it returns, the batch buffer is reused.
+ * Returns 0 when all records were visited or -1.
+ */
+int scan_mft_parallel(GENERAL_INFORMATION *g_info, MFT_SCAN_CALLBACK callback, void **contexts, uint32_t threads) {
+    if (threads <= 1) {
+        return scan_mft(g_info, callback, contexts[0]);
+    }
+    if (threads > MFT_SCAN_MAX_THREADS) {
+        threads = MFT_SCAN_MAX_THREADS;
+    }
+    uint64_t record_size = g_info->mft_record_size_in_bytes;
+    uint64_t total = mft_record_count(g_info);
+    uint8_t *buffers[2];
+    buffers[0] = malloc(MFT_SCAN_PARALLEL_BATCH_RECORDS * record_size);
+    buffers[1] = malloc(MFT_SCAN_PARALLEL_BATCH_RECORDS * record_size);
+    PARALLEL_SCAN *scan = calloc(1, sizeof(PARALLEL_SCAN));
+    SCAN_WORKER *workers = calloc(threads, sizeof(SCAN_WORKER));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (buffers[0] == NULL || buffers[1] == NULL || scan == NULL || workers == NULL || ids == NULL) {
+        free(buffers[0]);
+        free(buffers[1]);
+        free(scan);
+        free(workers);
+        free(ids);
+        return -1;
+    }
+    scan->g_info = g_info;
+    scan->callback = callback;
+    scan->contexts = contexts;
+    pthread_mutex_init(&scan->gate, NULL);
+    pthread_mutex_lock(&scan->gate);
+    uint32_t started = 0;
+    for (; started < threads; started++) {
+        workers[started].scan = scan;
+        workers[started].index = started;
+        if (pthread_create(&ids[started], NULL, scan_worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+    // the calling thread reads, the workers decode
+    scan->threads = started;
+    pthread_barrier_init(&scan->start, NULL, started + 1);
+    pthread_barrier_init(&scan->done, NULL, started + 1);
+    pthread_mutex_unlock(&scan->gate);
+
+    int result = started > 0 ? 0 : -1;
+    uint32_t current = 0;
+    uint64_t first = 0;
+    int count = 0;
+    if (result == 0 && total > 0) {
+        uint32_t want = total < MFT_SCAN_PARALLEL_BATCH_RECORDS ? (uint32_t) total : MFT_SCAN_PARALLEL_BATCH_RECORDS;
+        count = read_mft_records(g_info, 0, want, buffers[0]);
+    }
+    while (result == 0 && first < total) {
+        if (count <= 0) {
+            result = -1;
+            break;
+        }
+        scan->batch = buffers[current];
+        scan->first = first;
+        scan->count = count;
+        pthread_barrier_wait(&scan->start);
+
+        uint64_t next = first + count;
+        int next_count = 0;
+        if (next < total) {
+            uint32_t want = total - next < MFT_SCAN_PARALLEL_BATCH_RECORDS ? (uint32_t) (total - next)
+                                                                          : MFT_SCAN_PARALLEL_BATCH_RECORDS;
+            next_count = read_mft_records(g_info, next, want, buffers[current ^ 1]);
+        }
+        pthread_barrier_wait(&scan->done);
+
+        for (uint32_t t = 0; t < started; t++) {
+            if (scan->failed[t]) {
+                result = -1;
+            }
+        }
+        first = next;
+        count = next_count;
+        current ^= 1;
+    }
+
+    scan->stop = 1;
+    pthread_barrier_wait(&scan->start);
+    for (uint32_t t = 0; t < started; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    pthread_barrier_destroy(&scan->start);
+    pthread_barrier_destroy(&scan->done);
+    pthread_mutex_destroy(&scan->gate);
+    free(buffers[0]);
+    free(buffers[1]);
+    free(scan);
+    free(workers);
+    free(ids);
+    return result;
+}
+
+/* Threads worth starting for a parallel scan: one per online cpu. */
+uint32_t scan_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > MFT_SCAN_MAX_THREADS ? MFT_SCAN_MAX_THREADS : (uint32_t) cpus;
+}
+
+/*
+ * Returns the attribute of `type` that follows attr (the first one when attr is
+ * NULL), AT_UNUSED matches any type. Attributes running out of the record end
+ * the walk, so damaged records are safe to pass.
+ */
+ATTR_RECORD *next_attr(GENERAL_INFORMATION *g_info, MFT_RECORD *record, ATTR_RECORD *attr, uint32_t type) {
+    uint8_t *end = (uint8_t *) record + g_info->mft_record_size_in_bytes;
+    uint8_t *ptr;
+    if (attr == NULL) {
+        if (record->attrs_offset >= g_info->mft_record_size_in_bytes) {
+            return NULL;
+        }
+        ptr = (uint8_t *) record + record->attrs_offset;
+    } else {
+        ptr = (uint8_t *) attr + attr->length;
+    }
+
+    while (ptr + sizeof(uint32_t) <= end) {
+        attr = (ATTR_RECORD *) ptr;
+        if (attr->type == AT_END || ptr + offsetof(ATTR_RECORD, resident_end) > end || attr->length == 0 ||
+            ptr + attr->length > end) {
+            return NULL;
+        }
+        if (type == AT_UNUSED || attr->type == type) {
+            return attr;
+        }
+        ptr += attr->length;
+    }
+    return NULL;
+}
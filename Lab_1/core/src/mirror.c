@@ -0,0 +1,537 @@
+#include <errno.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/extract.h"
+#include "../inc/mirror.h"
+
+// Entries of one manifest, loaded from the last run or built by this one
+typedef struct {
+    MIRROR_ENTRY *entries;
+    uint64_t count;
+    uint64_t capacity;
+    char *names;
+    uint64_t names_size;
+    uint64_t names_capacity;
+    uint64_t volume_serial_number;
+} MIRROR_LIST;
+
+// Entry with its path, for sorting before the manifest is written
+typedef struct {
+    const char *path;
+    MIRROR_ENTRY *entry;
+} MIRROR_ITEM;
+
+// Position of a file entry in mft order, for reading the records in batches
+typedef struct {
+    uint32_t mft_num;
+    uint64_t index;
+} MIRROR_RECORD;
+
+static int walk_tree(GENERAL_INFORMATION *g_info, INODE *node, const char *path, const char *to_path,
+                     const MIRROR_LIST *old, MIRROR_LIST *list);
+
+static int make_directory(const char *path, const MIRROR_LIST *old, const char *relative);
+
+static int read_metadata(GENERAL_INFORMATION *g_info, MIRROR_LIST *list);
+
+static void read_record_metadata(GENERAL_INFORMATION *g_info, MFT_RECORD *record, MIRROR_ENTRY *entry);
+
+static int add_entry(MIRROR_LIST *list, const MIRROR_ENTRY *entry, const char *path);
+
+static int64_t find_entry(const MIRROR_LIST *list, const char *path);
+
+static int load_manifest(const char *manifest, MIRROR_LIST *list);
+
+static bool relative_path(const char *path);
+
+static int write_manifest(const char *manifest, MIRROR_LIST *list);
+
+static char *join_path(const char *dir, const char *name);
+
+static void free_mirror_list(MIRROR_LIST *list);
+
+static int compare_records(const void *a, const void *b);
+
+static int compare_items(const void *a, const void *b);
+
+/*
+ * Brings to_path/<name of node> up to date with node. Only files whose mft
+ * reference, size or $STANDARD_INFORMATION modification time differ from the
+ * manifest of the last run, or whose copy is missing, are extracted again.
+ * Entries of the last run that are gone from the volume are removed when
+ * delete is set and kept in the manifest otherwise, so a later run with
+ * delete still removes them. Nothing the manifest doesn't list is deleted.
+ * Names of one record copied in the same run are linked as link_mode says.
+ * Returns 0 or -1.
+ */
+int mirror_tree(GENERAL_INFORMATION *g_info, INODE *node, const char *to_path, bool delete, uint8_t link_mode,
+                MIRROR_STATS *stats) {
+    memset(stats, 0, sizeof(MIRROR_STATS));
+    char *manifest = malloc(strlen(to_path) + strlen(node->filename) + sizeof(MIRROR_SUFFIX) + 3);
+    if (manifest == NULL) {
+        return -1;
+    }
+    sprintf(manifest, "%s/.%s%s", to_path, node->filename, MIRROR_SUFFIX);
+
+    MIRROR_LIST old;
+    MIRROR_LIST list;
+    memset(&list, 0, sizeof(MIRROR_LIST));
+    list.volume_serial_number = g_info->volume_serial_number;
+    // a missing or damaged manifest copies everything
+    if (load_manifest(manifest, &old) == -1) {
+        memset(&old, 0, sizeof(MIRROR_LIST));
+    }
+    EXTRACT_LIST extract = {NULL, 0, 0, link_mode};
+    uint64_t *copied = NULL;
+    uint8_t *seen = calloc(old.count + 1, 1);
+    int result = -1;
+    if (seen == NULL || walk_tree(g_info, node, node->filename, to_path, &old, &list) == -1 ||
+        read_metadata(g_info, &list) == -1) {
+        goto end;
+    }
+    copied = malloc((list.count + 1) * sizeof(uint64_t));
+    if (copied == NULL) {
+        goto end;
+    }
+
+    result = 0;
+    uint64_t copied_count = 0;
+    for (uint64_t i = 0; i < list.count && result == 0; i++) {
+        MIRROR_ENTRY *entry = &list.entries[i];
+        const char *relative = list.names + entry->path_offset;
+        int64_t previous = find_entry(&old, relative);
+        if (previous != -1) {
+            seen[previous] = 1;
+        }
+        if (entry->flags & MFT_RECORD_IS_DIRECTORY) {
+            stats->directories++;
+            continue;
+        }
+        char *path = join_path(to_path, relative);
+        if (path == NULL) {
+            result = -1;
+            break;
+        }
+        struct stat st;
+        const MIRROR_ENTRY *last = previous != -1 ? &old.entries[previous] : NULL;
+        if (last != NULL && old.volume_serial_number == list.volume_serial_number &&
+            !(last->flags & MFT_RECORD_IS_DIRECTORY) && last->mft_reference == entry->mft_reference &&
+            last->size == entry->size && last->mtime == entry->mtime && lstat(path, &st) == 0 &&
+            S_ISREG(st.st_mode) && (uint64_t) st.st_size == entry->size) {
+            stats->unchanged++;
+        } else {
+            result = add_extract_entry(&extract, MREF(entry->mft_reference), path);
+            copied[copied_count++] = i;
+        }
+        free(path);
+    }
+    if (result == 0 && extract_files(g_info, &extract) == -1) {
+        // some copies may be incomplete, they are taken as changed by the next run
+        for (uint64_t i = 0; i < copied_count; i++) {
+            list.entries[copied[i]].mtime = 0;
+        }
+        result = -1;
+    }
+    stats->copied = copied_count;
+
+    // sorted by path, so everything below a directory comes after it and is removed before it
+    for (uint64_t i = old.count; i-- > 0 && result == 0;) {
+        if (seen[i]) {
+            continue;
+        }
+        MIRROR_ENTRY *entry = &old.entries[i];
+        const char *relative = old.names + entry->path_offset;
+        if (!delete) {
+            result = add_entry(&list, entry, relative);
+            continue;
+        }
+        char *path = join_path(to_path, relative);
+        if (path == NULL) {
+            result = -1;
+            break;
+        }
+        // a directory still holding files that are not ours stays
+        int removed = (entry->flags & MFT_RECORD_IS_DIRECTORY) ? rmdir(path) : unlink(path);
+        if (removed == 0 || errno == ENOENT) {
+            stats->deleted++;
+        }
+        free(path);
+    }
+    if (write_manifest(manifest, &list) == -1) {
+        result = -1;
+    }
+
+    end:
+    free_extract_list(&extract);
+    free(copied);
+    free(seen);
+    free_mirror_list(&old);
+    free_mirror_list(&list);
+    free(manifest);
+    return result;
+}
+
+/* Adds node and everything below it to list, directories are created on the way. */
+static int walk_tree(GENERAL_INFORMATION *g_info, INODE *node, const char *path, const char *to_path,
+                     const MIRROR_LIST *old, MIRROR_LIST *list) {
+    MIRROR_ENTRY entry;
+    memset(&entry, 0, sizeof(MIRROR_ENTRY));
+    // the sequence number comes with the record, see read_metadata()
+    entry.mft_reference = node->mft_num;
+    entry.flags = node->type & MFT_RECORD_IS_DIRECTORY;
+    if (add_entry(list, &entry, path) == -1) {
+        return -1;
+    }
+    if (!(node->type & MFT_RECORD_IS_DIRECTORY)) {
+        return 0;
+    }
+
+    char *full_path = join_path(to_path, path);
+    if (full_path == NULL) {
+        return -1;
+    }
+    int result = make_directory(full_path, old, path);
+    free(full_path);
+    if (result == -1) {
+        return -1;
+    }
+    INODE *read_node = malloc(sizeof(INODE));
+    memcpy(read_node, node, sizeof(INODE));
+    read_node->filename = NULL;
+    read_node->next_inode = NULL;
+    if (read_directory(g_info, &read_node) == -1) {
+        free_inode(read_node);
+        return -1;
+    }
+    for (INODE *tmp = read_node->next_inode; tmp != NULL && result == 0; tmp = tmp->next_inode) {
+        char *child_path = join_path(path, tmp->filename);
+        if (child_path == NULL) {
+            result = -1;
+            break;
+        }
+        result = walk_tree(g_info, tmp, child_path, to_path, old, list);
+        free(child_path);
+    }
+    free_inode(read_node);
+    return result;
+}
+
+/*
+ * Creates the directory path unless it is there already. A file the last run
+ * copied to the same place is replaced, the volume turned it into a directory.
+ */
+static int make_directory(const char *path, const MIRROR_LIST *old, const char *relative) {
+    if (mkdir(path, 00777) == 0) {
+        return 0;
+    }
+    struct stat st;
+    if (errno != EEXIST || lstat(path, &st) == -1) {
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+    int64_t previous = find_entry(old, relative);
+    if (previous == -1 || (old->entries[previous].flags & MFT_RECORD_IS_DIRECTORY) || unlink(path) == -1) {
+        return -1;
+    }
+    return mkdir(path, 00777);
+}
+
+/*
+ * Fills sequence number, size and modification time of every file entry.
+ * Records are read in mft order up to MIRROR_BATCH_RECORDS at a time like in
+ * extract_files().
+ * Returns 0 or -1.
+ */
+static int read_metadata(GENERAL_INFORMATION *g_info, MIRROR_LIST *list) {
+    uint32_t record_size = g_info->mft_record_size_in_bytes;
+    uint64_t batch_size = budget_charge_up_to(g_info->budget, BUDGET_COPY_BUFFERS,
+                                              (uint64_t) MIRROR_BATCH_RECORDS * record_size, record_size);
+    uint32_t batch_records = (uint32_t) (batch_size / record_size);
+    MIRROR_RECORD *records = malloc((list->count + 1) * sizeof(MIRROR_RECORD));
+    uint8_t *batch = malloc(batch_size);
+    if (records == NULL || batch == NULL) {
+        free(records);
+        free(batch);
+        budget_release(g_info->budget, BUDGET_COPY_BUFFERS, batch_size);
+        return -1;
+    }
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < list->count; i++) {
+        if (!(list->entries[i].flags & MFT_RECORD_IS_DIRECTORY)) {
+            records[count].mft_num = (uint32_t) list->entries[i].mft_reference;
+            records[count].index = i;
+            count++;
+        }
+    }
+    qsort(records, count, sizeof(MIRROR_RECORD), compare_records);
+
+    uint64_t i = 0;
+    while (i < count) {
+        uint32_t first = records[i].mft_num;
+        uint64_t j = i + 1;
+        while (j < count && records[j].mft_num - first < batch_records) {
+            j++;
+        }
+        int read = read_mft_records(g_info, first, records[j - 1].mft_num - first + 1, batch);
+        for (uint64_t k = i; k < j; k++) {
+            MIRROR_ENTRY *entry = &list->entries[records[k].index];
+            // unreadable records keep sequence number and time 0 and are always copied
+            if (read > 0 && records[k].mft_num - first < (uint32_t) read) {
+                MFT_RECORD *record = (MFT_RECORD *) (batch + (size_t) (records[k].mft_num - first) * record_size);
+                read_record_metadata(g_info, record, entry);
+            }
+        }
+        i = j;
+    }
+    free(records);
+    free(batch);
+    budget_release(g_info->budget, BUDGET_COPY_BUFFERS, batch_size);
+    return 0;
+}
+
+static void read_record_metadata(GENERAL_INFORMATION *g_info, MFT_RECORD *record, MIRROR_ENTRY *entry) {
+    if (record->magic != magic_FILE || !(record->flags & MFT_RECORD_IN_USE) || record->base_mft_record != 0) {
+        return;
+    }
+    uint32_t mft_num = (uint32_t) entry->mft_reference;
+    entry->mft_reference = MK_MREF(mft_num, record->sequence_number);
+    ATTR_RECORD *attr = NULL;
+    bool data = false;
+    while ((attr = next_attr(g_info, record, attr, AT_UNUSED)) != NULL) {
+        if (attr->type == AT_STANDARD_INFORMATION && !attr->non_resident &&
+            attr->value_length >= offsetof(STANDARD_INFORMATION, last_mft_change_time) &&
+            (uint64_t) attr->value_offset + attr->value_length <= attr->length) {
+            STANDARD_INFORMATION *si = (STANDARD_INFORMATION *) ((uint8_t *) attr + attr->value_offset);
+            entry->mtime = si->last_data_change_time;
+        } else if (attr->type == AT_DATA && attr->name_length == 0) {
+            if (!attr->non_resident) {
+                entry->size = attr->value_length;
+                data = true;
+            } else if (attr->length >= offsetof(ATTR_RECORD, non_resident_end) && attr->lowest_vcn == 0) {
+                entry->size = attr->data_size;
+                data = true;
+            }
+        }
+    }
+    // $DATA moved to an extension record
+    if (!data) {
+        EXTENT_MAP *map = get_extent_map(g_info, mft_num, AT_DATA);
+        if (map != NULL) {
+            entry->size = map->data_size;
+            put_extent_map(map);
+        }
+    }
+}
+
+static int add_entry(MIRROR_LIST *list, const MIRROR_ENTRY *entry, const char *path) {
+    uint64_t length = strlen(path);
+    if (length > UINT16_MAX) {
+        return -1;
+    }
+    if (list->count == list->capacity) {
+        uint64_t capacity = list->capacity ? list->capacity * 2 : 256;
+        MIRROR_ENTRY *entries = realloc(list->entries, capacity * sizeof(MIRROR_ENTRY));
+        if (entries == NULL) {
+            return -1;
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    if (list->names_size + length + 1 > list->names_capacity) {
+        uint64_t capacity = list->names_capacity ? list->names_capacity * 2 : 64 * 1024;
+        while (capacity < list->names_size + length + 1) {
+            capacity *= 2;
+        }
+        char *names = realloc(list->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        list->names = names;
+        list->names_capacity = capacity;
+    }
+    MIRROR_ENTRY *added = &list->entries[list->count++];
+    *added = *entry;
+    added->path_offset = list->names_size;
+    added->path_length = (uint16_t) length;
+    memcpy(list->names + list->names_size, path, length + 1);
+    list->names_size += length + 1;
+    return 0;
+}
+
+/* Binary search in a list sorted by path. Returns the index of the entry or -1. */
+static int64_t find_entry(const MIRROR_LIST *list, const char *path) {
+    uint64_t low = 0;
+    uint64_t high = list->count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        int order = strcmp(list->names + list->entries[middle].path_offset, path);
+        if (order == 0) {
+            return (int64_t) middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Reads the manifest of the last run. Entries are checked to be sorted, to
+ * point inside the names and to stay below the target directory, since
+ * mirroring with delete removes them, so a damaged manifest is rejected as a
+ * whole.
+ * Returns 0 or -1.
+ */
+static int load_manifest(const char *manifest, MIRROR_LIST *list) {
+    memset(list, 0, sizeof(MIRROR_LIST));
+    int fd = open(manifest, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    MIRROR_HEADER header;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || pread(fd, &header, sizeof(MIRROR_HEADER), 0) != sizeof(MIRROR_HEADER) ||
+        header.magic != MIRROR_MAGIC || header.version != MIRROR_VERSION ||
+        header.header_size != sizeof(MIRROR_HEADER) ||
+        header.entry_count > ((uint64_t) st.st_size - sizeof(MIRROR_HEADER)) / sizeof(MIRROR_ENTRY) ||
+        sizeof(MIRROR_HEADER) + header.entry_count * sizeof(MIRROR_ENTRY) + header.names_size !=
+        (uint64_t) st.st_size) {
+        close(fd);
+        return -1;
+    }
+    list->volume_serial_number = header.volume_serial_number;
+    list->count = list->capacity = header.entry_count;
+    list->names_size = list->names_capacity = header.names_size;
+    list->entries = malloc(header.entry_count * sizeof(MIRROR_ENTRY) + 1);
+    list->names = malloc(header.names_size + 1);
+    uint64_t entries_size = header.entry_count * sizeof(MIRROR_ENTRY);
+    int result = list->entries != NULL && list->names != NULL &&
+                 pread(fd, list->entries, entries_size, sizeof(MIRROR_HEADER)) == (ssize_t) entries_size &&
+                 pread(fd, list->names, header.names_size, (off_t) (sizeof(MIRROR_HEADER) + entries_size)) ==
+                 (ssize_t) header.names_size ? 0 : -1;
+    close(fd);
+    for (uint64_t i = 0; i < list->count && result == 0; i++) {
+        MIRROR_ENTRY *entry = &list->entries[i];
+        if (entry->path_offset >= list->names_size ||
+            entry->path_length >= list->names_size - entry->path_offset ||
+            list->names[entry->path_offset + entry->path_length] != '\0' ||
+            !relative_path(list->names + entry->path_offset) ||
+            (i > 0 && strcmp(list->names + list->entries[i - 1].path_offset, list->names + entry->path_offset) >= 0)) {
+            result = -1;
+        }
+    }
+    if (result == -1) {
+        free_mirror_list(list);
+    }
+    return result;
+}
+
+/* True when path is relative and has no empty, "." or ".." components. */
+static bool relative_path(const char *path) {
+    if (path[0] == '/') {
+        return false;
+    }
+    const char *component = path;
+    while (true) {
+        const char *end = strchr(component, '/');
+        size_t length = end != NULL ? (size_t) (end - component) : strlen(component);
+        if (length == 0 || (length == 1 && component[0] == '.') ||
+            (length == 2 && component[0] == '.' && component[1] == '.')) {
+            return false;
+        }
+        if (end == NULL) {
+            return true;
+        }
+        component = end + 1;
+    }
+}
+
+/* Writes the entries sorted by path next to manifest and renames the file over it. */
+static int write_manifest(const char *manifest, MIRROR_LIST *list) {
+    MIRROR_ITEM *items = malloc((list->count + 1) * sizeof(MIRROR_ITEM));
+    MIRROR_ENTRY *entries = malloc((list->count + 1) * sizeof(MIRROR_ENTRY));
+    char *names = malloc(list->names_size + 1);
+    char *tmp_path = malloc(strlen(manifest) + 8);
+    int result = -1;
+    if (items == NULL || entries == NULL || names == NULL || tmp_path == NULL) {
+        goto end;
+    }
+    for (uint64_t i = 0; i < list->count; i++) {
+        items[i].path = list->names + list->entries[i].path_offset;
+        items[i].entry = &list->entries[i];
+    }
+    qsort(items, list->count, sizeof(MIRROR_ITEM), compare_items);
+    uint64_t names_size = 0;
+    for (uint64_t i = 0; i < list->count; i++) {
+        entries[i] = *items[i].entry;
+        entries[i].path_offset = names_size;
+        memcpy(names + names_size, items[i].path, entries[i].path_length + 1);
+        names_size += entries[i].path_length + 1;
+    }
+
+    MIRROR_HEADER header;
+    memset(&header, 0, sizeof(MIRROR_HEADER));
+    header.magic = MIRROR_MAGIC;
+    header.version = MIRROR_VERSION;
+    header.header_size = sizeof(MIRROR_HEADER);
+    header.volume_serial_number = list->volume_serial_number;
+    header.entry_count = list->count;
+    header.names_size = names_size;
+    uint64_t entries_size = list->count * sizeof(MIRROR_ENTRY);
+
+    sprintf(tmp_path, "%s.tmp", manifest);
+    int fd = open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    result = fd == -1 ? -1 : 0;
+    if (result == 0 &&
+        (pwrite(fd, &header, sizeof(MIRROR_HEADER), 0) != sizeof(MIRROR_HEADER) ||
+         pwrite(fd, entries, entries_size, sizeof(MIRROR_HEADER)) != (ssize_t) entries_size ||
+         pwrite(fd, names, names_size, (off_t) (sizeof(MIRROR_HEADER) + entries_size)) != (ssize_t) names_size)) {
+        result = -1;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (result == 0 && rename(tmp_path, manifest) == -1) {
+        result = -1;
+    }
+    if (result == -1) {
+        unlink(tmp_path);
+    }
+
+    end:
+    free(items);
+    free(entries);
+    free(names);
+    free(tmp_path);
+    return result;
+}
+
+static char *join_path(const char *dir, const char *name) {
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+static void free_mirror_list(MIRROR_LIST *list) {
+    free(list->entries);
+    free(list->names);
+    memset(list, 0, sizeof(MIRROR_LIST));
+}
+
+static int compare_records(const void *a, const void *b) {
+    uint32_t left = ((const MIRROR_RECORD *) a)->mft_num;
+    uint32_t right = ((const MIRROR_RECORD *) b)->mft_num;
+    return (left > right) - (left < right);
+}
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(((const MIRROR_ITEM *) a)->path, ((const MIRROR_ITEM *) b)->path);
+}
@@ -0,0 +1,369 @@
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/name_index.h"
+
+#define FILE_NAME_MAX_SIZE 255
+#define TRIGRAM(a, b, c) (((uint32_t) (uint8_t) (a) << 16) | ((uint32_t) (uint8_t) (b) << 8) | (uint8_t) (c))
+
+typedef struct {
+    const uint32_t *postings;
+    uint32_t count;
+} POSTING_LIST;
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context);
+
+static uint32_t name_trigrams(const char *name, uint32_t length, uint32_t *trigrams);
+
+static int find_trigram(const NAME_INDEX *index, uint32_t trigram, POSTING_LIST *list);
+
+static uint32_t intersect(uint32_t *candidates, uint32_t count, const POSTING_LIST *list);
+
+static int compare_keys(const void *a, const void *b);
+
+static int compare_lists(const void *a, const void *b);
+
+static int charge_index(NAME_INDEX *index, uint64_t bytes);
+
+/*
+ * Collects every name of the volume with one scan of $MFT and builds the
+ * trigram index over them.
+ * Returns the index or NULL.
+ */
+NAME_INDEX *build_name_index(GENERAL_INFORMATION *g_info) {
+    NAME_INDEX *index = calloc(1, sizeof(NAME_INDEX));
+    if (index != NULL) {
+        index->budget = g_info->budget;
+    }
+    if (index == NULL || scan_mft(g_info, scan_record, index) == -1) {
+        free_name_index(index);
+        return NULL;
+    }
+
+    // first pass counts the entries of every key, the second one fills the lists
+    uint64_t counts_size = TRIGRAM_KEYS * sizeof(uint32_t);
+    if (budget_charge(index->budget, BUDGET_NAME_INDEX, counts_size) == -1) {
+        free_name_index(index);
+        return NULL;
+    }
+    uint32_t *counts = calloc(TRIGRAM_KEYS, sizeof(uint32_t));
+    if (counts == NULL) {
+        budget_release(index->budget, BUDGET_NAME_INDEX, counts_size);
+        free_name_index(index);
+        return NULL;
+    }
+    uint32_t trigrams[FILE_NAME_MAX_SIZE];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < index->entry_count; i++) {
+        NAME_ENTRY *entry = &index->entries[i];
+        uint32_t count = name_trigrams(index->names + entry->name_offset, entry->name_length, trigrams);
+        for (uint32_t k = 0; k < count; k++) {
+            if (counts[trigrams[k]]++ == 0) {
+                index->trigram_count++;
+            }
+        }
+        total += count;
+    }
+
+    if (total > UINT32_MAX ||
+        charge_index(index, (2 * (uint64_t) index->trigram_count + 1 + total) * sizeof(uint32_t)) == -1) {
+        free(counts);
+        budget_release(index->budget, BUDGET_NAME_INDEX, counts_size);
+        free_name_index(index);
+        return NULL;
+    }
+    index->trigrams = malloc(index->trigram_count * sizeof(uint32_t) + 1);
+    index->offsets = malloc((index->trigram_count + 1) * sizeof(uint32_t));
+    index->postings = malloc(total * sizeof(uint32_t) + 1);
+    if (index->trigrams == NULL || index->offsets == NULL || index->postings == NULL) {
+        free(counts);
+        budget_release(index->budget, BUDGET_NAME_INDEX, counts_size);
+        free_name_index(index);
+        return NULL;
+    }
+    uint32_t position = 0;
+    uint32_t key = 0;
+    for (uint32_t trigram = 0; trigram < TRIGRAM_KEYS; trigram++) {
+        if (counts[trigram] == 0) {
+            continue;
+        }
+        index->trigrams[key] = trigram;
+        index->offsets[key] = position;
+        position += counts[trigram];
+        // counts now holds the next free slot of the key
+        counts[trigram] = index->offsets[key];
+        key++;
+    }
+    index->offsets[key] = position;
+
+    for (uint32_t i = 0; i < index->entry_count; i++) {
+        NAME_ENTRY *entry = &index->entries[i];
+        uint32_t count = name_trigrams(index->names + entry->name_offset, entry->name_length, trigrams);
+        for (uint32_t k = 0; k < count; k++) {
+            index->postings[counts[trigrams[k]]++] = i;
+        }
+    }
+    free(counts);
+    budget_release(index->budget, BUDGET_NAME_INDEX, counts_size);
+    return index;
+}
+
+/*
+ * Name index of the volume, built by the first search and shared afterwards.
+ * Returns the index or NULL.
+ */
+NAME_INDEX *get_name_index(GENERAL_INFORMATION *g_info) {
+    pthread_mutex_lock(g_info->index_lock);
+    if (g_info->name_index == NULL) {
+        g_info->name_index = build_name_index(g_info);
+    }
+    NAME_INDEX *index = g_info->name_index;
+    pthread_mutex_unlock(g_info->index_lock);
+    return index;
+}
+
+/*
+ * Finds the entries whose name contains pattern (case insensitive). Patterns
+ * with '*', '?' or '[' are globs and have to match the whole name.
+ * matches is allocated and holds entry numbers in mft order.
+ * Returns 0 or -1.
+ */
+int search_name_index(const NAME_INDEX *index, const char *pattern, uint32_t **matches, uint32_t *match_count) {
+    size_t pattern_length = strlen(pattern);
+    bool glob = strpbrk(pattern, "*?[") != NULL;
+    char *folded = malloc(pattern_length + 1);
+    for (size_t i = 0; i <= pattern_length; i++) {
+        folded[i] = (char) tolower((uint8_t) pattern[i]);
+    }
+
+    // trigrams of the literal runs between wildcards
+    POSTING_LIST *lists = malloc((pattern_length + 1) * sizeof(POSTING_LIST));
+    uint32_t list_count = 0;
+    bool empty = false;
+    size_t run = 0;
+    for (size_t i = 0; i <= pattern_length && !empty; i++) {
+        char c = folded[i];
+        // a '[' without its ']' is literal, as in fnmatch()
+        const char *close = NULL;
+        if (glob && c == '[' && folded[i + 1] != '\0') {
+            close = strchr(folded + i + 2, ']');
+        }
+        bool wildcard = glob && (c == '*' || c == '?' || close != NULL || c == '\\');
+        if (c != '\0' && !wildcard) {
+            run++;
+            continue;
+        }
+        for (size_t k = i - run; run >= 3 && k + 3 <= i; k++) {
+            if (find_trigram(index, TRIGRAM(folded[k], folded[k + 1], folded[k + 2]), &lists[list_count]) == -1) {
+                empty = true;
+                break;
+            }
+            list_count++;
+        }
+        run = 0;
+        if (close != NULL) {
+            // a bracket expression is one character of many, skip it
+            i = close - folded;
+        } else if (c == '\\' && folded[i + 1] != '\0') {
+            i++;
+        }
+    }
+
+    uint32_t count = 0;
+    uint32_t *candidates = NULL;
+    if (!empty) {
+        if (list_count == 0) {
+            // too short to narrow down, every name is a candidate
+            candidates = malloc(index->entry_count * sizeof(uint32_t) + 1);
+            for (uint32_t i = 0; i < index->entry_count; i++) {
+                candidates[i] = i;
+            }
+            count = index->entry_count;
+        } else {
+            qsort(lists, list_count, sizeof(POSTING_LIST), compare_lists);
+            candidates = malloc(lists[0].count * sizeof(uint32_t) + 1);
+            memcpy(candidates, lists[0].postings, lists[0].count * sizeof(uint32_t));
+            count = lists[0].count;
+            for (uint32_t i = 1; i < list_count && count > 0; i++) {
+                count = intersect(candidates, count, &lists[i]);
+            }
+        }
+    }
+
+    // trigrams only narrow the search down, the names are checked one by one
+    uint32_t found = 0;
+    char name[FILE_NAME_MAX_SIZE + 1];
+    for (uint32_t i = 0; i < count; i++) {
+        const NAME_ENTRY *entry = &index->entries[candidates[i]];
+        const char *src = index->names + entry->name_offset;
+        for (uint32_t k = 0; k <= entry->name_length; k++) {
+            name[k] = (char) tolower((uint8_t) src[k]);
+        }
+        bool match = glob ? fnmatch(folded, name, 0) == 0 : strstr(name, folded) != NULL;
+        if (match) {
+            candidates[found++] = candidates[i];
+        }
+    }
+
+    free(folded);
+    free(lists);
+    *matches = candidates;
+    *match_count = found;
+    return 0;
+}
+
+void free_name_index(NAME_INDEX *index) {
+    if (index == NULL) {
+        return;
+    }
+    budget_release(index->budget, BUDGET_NAME_INDEX, index->charged);
+    free(index->entries);
+    free(index->names);
+    free(index->trigrams);
+    free(index->offsets);
+    free(index->postings);
+    free(index);
+}
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context) {
+    NAME_INDEX *index = context;
+    if (!(record->flags & MFT_RECORD_IN_USE)) {
+        return 0;
+    }
+    // names kept in an extension record belong to its base record
+    uint64_t reference = record->base_mft_record ? record->base_mft_record
+                                                 : MK_MREF(mft_num, record->sequence_number);
+
+    char name[FILE_NAME_MAX_SIZE + 1];
+    ATTR_RECORD *attr = NULL;
+    while ((attr = next_attr(g_info, record, attr, AT_FILE_NAME)) != NULL) {
+        FILE_NAME_ATTR *file_name = (FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset);
+        if (attr->non_resident || (uint64_t) attr->value_offset + sizeof(FILE_NAME_ATTR) > attr->length ||
+            attr->value_offset + sizeof(FILE_NAME_ATTR) + file_name->file_name_length * 2 > attr->length ||
+            file_name->file_name_type == FILE_NAME_DOS) {
+            continue;
+        }
+        uint8_t length = convert_file_name(name, file_name) - 1;
+
+        if (index->entry_count == index->entry_capacity) {
+            uint32_t capacity = index->entry_capacity ? index->entry_capacity * 2 : 1024;
+            if (charge_index(index, (uint64_t) (capacity - index->entry_capacity) * sizeof(NAME_ENTRY)) == -1) {
+                return -1;
+            }
+            index->entry_capacity = capacity;
+            NAME_ENTRY *entries = realloc(index->entries, index->entry_capacity * sizeof(NAME_ENTRY));
+            if (entries == NULL) {
+                return -1;
+            }
+            index->entries = entries;
+        }
+        if (index->names_size + length + 1 > index->names_capacity) {
+            uint64_t capacity = index->names_capacity ? index->names_capacity * 2 : 64 * 1024;
+            if (capacity > UINT32_MAX || charge_index(index, capacity - index->names_capacity) == -1) {
+                return -1;
+            }
+            index->names_capacity = capacity;
+            char *names = realloc(index->names, index->names_capacity);
+            if (names == NULL) {
+                return -1;
+            }
+            index->names = names;
+        }
+
+        NAME_ENTRY *entry = &index->entries[index->entry_count++];
+        entry->mft_reference = reference;
+        entry->parent = file_name->parent_directory;
+        entry->name_offset = (uint32_t) index->names_size;
+        entry->flags = record->flags;
+        entry->name_length = length;
+        memcpy(index->names + index->names_size, name, length + 1);
+        index->names_size += length + 1;
+    }
+    return 0;
+}
+
+/* Distinct lower case trigrams of a name, sorted. */
+static uint32_t name_trigrams(const char *name, uint32_t length, uint32_t *trigrams) {
+    if (length < 3) {
+        return 0;
+    }
+    for (uint32_t i = 0; i + 3 <= length; i++) {
+        trigrams[i] = TRIGRAM(tolower((uint8_t) name[i]), tolower((uint8_t) name[i + 1]),
+                              tolower((uint8_t) name[i + 2]));
+    }
+    uint32_t count = length - 2;
+    qsort(trigrams, count, sizeof(uint32_t), compare_keys);
+    uint32_t unique = 1;
+    for (uint32_t i = 1; i < count; i++) {
+        if (trigrams[i] != trigrams[unique - 1]) {
+            trigrams[unique++] = trigrams[i];
+        }
+    }
+    return unique;
+}
+
+static int find_trigram(const NAME_INDEX *index, uint32_t trigram, POSTING_LIST *list) {
+    uint32_t *key = bsearch(&trigram, index->trigrams, index->trigram_count, sizeof(uint32_t), compare_keys);
+    if (key == NULL) {
+        return -1;
+    }
+    uint32_t i = key - index->trigrams;
+    list->postings = index->postings + index->offsets[i];
+    list->count = index->offsets[i + 1] - index->offsets[i];
+    return 0;
+}
+
+/*
+ * Keeps the candidates that are also in list. Both are ascending and the
+ * candidates are usually far fewer, so list is searched with galloping steps.
+ */
+static uint32_t intersect(uint32_t *candidates, uint32_t count, const POSTING_LIST *list) {
+    uint32_t kept = 0;
+    uint32_t low = 0;
+    for (uint32_t i = 0; i < count && low < list->count; i++) {
+        uint32_t step = 1;
+        uint32_t high = low;
+        while (high < list->count && list->postings[high] < candidates[i]) {
+            low = high + 1;
+            high += step;
+            step *= 2;
+        }
+        if (high > list->count) {
+            high = list->count;
+        }
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            if (list->postings[middle] < candidates[i]) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low < list->count && list->postings[low] == candidates[i]) {
+            candidates[kept++] = candidates[i];
+        }
+    }
+    return kept;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint32_t left = *(const uint32_t *) a;
+    uint32_t right = *(const uint32_t *) b;
+    return (left > right) - (left < right);
+}
+
+static int compare_lists(const void *a, const void *b) {
+    uint32_t left = ((const POSTING_LIST *) a)->count;
+    uint32_t right = ((const POSTING_LIST *) b)->count;
+    return (left > right) - (left < right);
+}
+
+static int charge_index(NAME_INDEX *index, uint64_t bytes) {
+    if (budget_charge(index->budget, BUDGET_NAME_INDEX, bytes) == -1) {
+        return -1;
+    }
+    index->charged += bytes;
+    return 0;
+}
@@ -1,7 +1,11 @@
 #include "../inc/ntfs.h"
+#include "../inc/sidecar.h"
+#include "../inc/name_index.h"
+#include "../inc/path_table.h"
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #define FILE_NAME_MAX_SIZE 255
 
@@ -9,13 +13,14 @@ extern int errno;
 
 static uint8_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry);
 
-static int
-read_clusters_to_buf(uint8_t **buf, uint64_t *buf_current_size, uint64_t *buf_size, int64_t lcn, uint64_t length,
-                     GENERAL_INFORMATION *g_info);
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+    INODE *parent;
+    INODE *current_inode;
+    MFT_RECORD *directory_entry;
+} DIRECTORY_READER;
 
-static int parse_data_run(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING_CHUNK **chunk);
-
-static int init_chunk_data(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data);
+static int add_index_entry(INDEX_ENTRY *index_entry, const char *file_name, uint8_t file_name_length, void *context);
 
 GENERAL_INFORMATION *init(char *file_name) {
     int err = 0;
@@ -29,31 +34,64 @@ GENERAL_INFORMATION *init(char *file_name) {
     if ((boot_sector = open_NTFS_file_system(file_descriptor)) == NULL) {
         return NULL;
     }
-    GENERAL_INFORMATION *g_info = malloc(sizeof(GENERAL_INFORMATION));
-    INODE *root_inode = malloc(sizeof(INODE));
+    GENERAL_INFORMATION *g_info = calloc(1, sizeof(GENERAL_INFORMATION));
 
     g_info->bytes_per_sector = boot_sector->bpb.bytes_per_sector;
     g_info->sectors_per_cluster = boot_sector->bpb.sectors_per_cluster;
     g_info->clusters_per_mft_record = boot_sector->clusters_per_mft_record;
     g_info->clusters_per_index_record = boot_sector->clusters_per_index_record;
-    g_info->mft_record_size_in_bytes =
-            g_info->clusters_per_mft_record * g_info->sectors_per_cluster * g_info->bytes_per_sector;
+    g_info->cluster_size_in_bytes = g_info->sectors_per_cluster * g_info->bytes_per_sector;
+    g_info->clusters = g_info->sectors_per_cluster ? boot_sector->number_of_sectors / g_info->sectors_per_cluster : 0;
+    /* Negative value means the size is 2^-value bytes, it is used when a record is smaller than a cluster. */
+    if (g_info->clusters_per_mft_record > 0) {
+        g_info->mft_record_size_in_bytes = g_info->clusters_per_mft_record * g_info->cluster_size_in_bytes;
+    } else {
+        g_info->mft_record_size_in_bytes = 1 << -g_info->clusters_per_mft_record;
+    }
     g_info->file_descriptor = file_descriptor;
-    g_info->cur_node = root_inode;
-    g_info->root_node = root_inode;
     g_info->mft_lcn = boot_sector->mft_lcn;
-    g_info->block_size_in_bytes =
-            g_info->clusters_per_index_record * g_info->sectors_per_cluster * g_info->bytes_per_sector;
+    g_info->volume_serial_number = boot_sector->volume_serial_number;
+    if (g_info->clusters_per_index_record > 0) {
+        g_info->block_size_in_bytes = g_info->clusters_per_index_record * g_info->cluster_size_in_bytes;
+    } else {
+        g_info->block_size_in_bytes = 1 << -g_info->clusters_per_index_record;
+    }
 
     free(boot_sector);
 
-    root_inode->mft_num = FILE_root;
-    root_inode->type = MFT_RECORD_IN_USE | MFT_RECORD_IS_DIRECTORY;
-    root_inode->parent = root_inode;
-    root_inode->next_inode = NULL;
+    // a map may be loaded again from inside of a locked section, see lookup_vcn()
+    pthread_mutexattr_t lock_attr;
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_settype(&lock_attr, PTHREAD_MUTEX_RECURSIVE);
+    g_info->cache_lock = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(g_info->cache_lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+    g_info->index_lock = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(g_info->index_lock, NULL);
+    g_info->stats = create_stats();
+    g_info->budget = create_budget(BUDGET_UNLIMITED);
+    register_extent_map_cache(g_info);
+
+    // $MFT may be fragmented, so its own data runs are needed before any other record can be found
+    MFT_RECORD *mft_record = malloc(g_info->mft_record_size_in_bytes);
+    if (search_mft_record(g_info, FILE_MFT, &mft_record) == -1 ||
+        (g_info->mft_map = load_extent_map(g_info, FILE_MFT, mft_record, AT_DATA)) == NULL) {
+        fprintf(stderr, "ERROR: Can't read $MFT record\n");
+        free(mft_record);
+        free_g_info(g_info);
+        return NULL;
+    }
+    free(mft_record);
+    // every reader goes through this map, once it is complete lookups in it never lock
+    complete_extent_map(g_info, g_info->mft_map);
+
+    return g_info;
+}
 
+void print_g_info(const GENERAL_INFORMATION *g_info) {
     printf("%s\n", "Basic information about  file system");
     printf("Cluster location of mft data: %ld\n", g_info->mft_lcn);
+    printf("Clusters: %lu\n", g_info->clusters);
     printf("Cluster per mft record: %d\n", g_info->clusters_per_mft_record);
     printf("Cluster per index_record: %d\n", g_info->clusters_per_index_record);
     printf("Bytes per sector: %u\n", g_info->bytes_per_sector);
@@ -76,16 +114,12 @@ GENERAL_INFORMATION *init(char *file_name) {
     printf("size MAPPING_CHUNK is 9 + 8 = 17 =  %lu\n", sizeof(MAPPING_CHUNK));
     printf("size MAPPING_CHUNK_DATA is 37 + 24 = 61 =  %lu\n", sizeof(MAPPING_CHUNK_DATA));
     printf("size MFT_RECORD is 48 = %lu\n", sizeof(MFT_RECORD));
-
-
-    return g_info;
 }
 
 NTFS_BOOT_SECTOR *open_NTFS_file_system(int file_descriptor) {
     NTFS_BOOT_SECTOR *boot_sector = malloc(sizeof(NTFS_BOOT_SECTOR));
     pread(file_descriptor, boot_sector, sizeof(NTFS_BOOT_SECTOR), 0);
-    uint64_t ntfs_id = 0x202020205346544e;
-    if (boot_sector->oem_id == ntfs_id) {
+    if (boot_sector->oem_id == NTFS_OEM_ID) {
         return boot_sector;
     } else {
         free(boot_sector);
@@ -97,12 +131,11 @@ NTFS_BOOT_SECTOR *open_NTFS_file_system(int file_descriptor) {
 
 int read_directory(GENERAL_INFORMATION *g_info, INODE **inode) {
     MFT_RECORD *directory_record = malloc(g_info->mft_record_size_in_bytes);
+    stats_add(g_info, STATS_ALLOCATIONS, 2);    // with the record buffer of the reader
     uint64_t offset = search_mft_record(g_info, (*inode)->mft_num, &directory_record);
     int err;
-    uint8_t file_name_length;
     INDEX_ENTRY *index_entry = NULL;
-    INODE *current_inode = *inode;
-    if (offset < 0) {
+    if (offset == -1) {
         free(directory_record);
         return -1;
     }
@@ -114,139 +147,139 @@ int read_directory(GENERAL_INFORMATION *g_info, INODE **inode) {
         return -1;
     }
 
-    char file_name[FILE_NAME_MAX_SIZE + 1];
-
-    MFT_RECORD *directory_entry = malloc(g_info->mft_record_size_in_bytes);
+    DIRECTORY_READER reader = {g_info, *inode, *inode, malloc(g_info->mft_record_size_in_bytes)};
 
-    // TODO может быть надо изменить структуру ATTR_RECORD
     INDEX_ROOT *index_root = (INDEX_ROOT *) ((uint8_t *) attr_index + attr_index->value_offset);
     uint8_t *index_entry_offset = ((uint8_t *) &index_root->index + index_root->index.entries_offset);
-    uint64_t mft_entry_offset;
-    int cnt = 0;
-    do {
-        index_entry = (INDEX_ENTRY *) index_entry_offset;
-        index_entry_offset = ((uint8_t *) index_entry + index_entry->length);
-        if (index_entry->key_length) {
-            file_name_length = file_name_convertor(file_name, index_entry);
-            if (file_name[0] != '.' && file_name[0] != '$') {
-                current_inode->next_inode = malloc(sizeof(INODE));
-                current_inode->next_inode->next_inode = NULL;
-                current_inode = current_inode->next_inode;
-                current_inode->parent = *inode;
-                current_inode->filename = malloc(file_name_length);
-                memcpy(current_inode->filename, file_name, file_name_length);
-
-                mft_entry_offset = search_mft_record(g_info, index_entry->indexed_file, &directory_entry);
-                if (mft_entry_offset == -1) {
-                    free(directory_entry);
-                    free(directory_record);
-                    return -1;
-                }
-                current_inode->type = directory_entry->flags;
-                current_inode->mft_num = directory_entry->mft_record_number;
-                cnt++;
-            }
-        }
-    } while (!(index_entry->ie_flags & INDEX_ENTRY_END));
-
-    if (!(index_entry->ie_flags & INDEX_ENTRY_NODE)) {
-        if (directory_record->magic == magic_FILE) {
-            free(directory_record);
-        }
-        free(directory_entry);
+    uint8_t *index_end = (uint8_t *) &index_root->index + index_root->index.index_length;
+    int cnt = walk_index_entries(index_entry_offset, index_end, add_index_entry, &reader, &index_entry);
+    bool large_index = cnt != -1 && (index_entry->ie_flags & INDEX_ENTRY_NODE);
+    free(directory_record);
+    if (!large_index) {
+        free(reader.directory_entry);
         return cnt;
     }
 
-    err = search_attr(g_info, AT_INDEX_ALLOCATION, directory_record, &attr_index);
-
-    if (!attr_index || err == -1) {
-        free(directory_record);
-        free(directory_entry);
+    // the index allocation may be split between several records by an attribute list
+    EXTENT_MAP *map = get_extent_map(g_info, (*inode)->mft_num, AT_INDEX_ALLOCATION);
+    if (map == NULL) {
+        free(reader.directory_entry);
         return cnt;
     }
 
-    if (!attr_index->non_resident) {
-        free(directory_record);
-        free(directory_entry);
+    if (map->resident) {
+        put_extent_map(map);
+        free(reader.directory_entry);
         return -1;
     }
 
-
     INDEX_ALLOCATION *index_allocation;
-    //TODO offset
-    uint64_t stream =
-            offset + ((uint8_t *) attr_index - (uint8_t *) directory_record) + attr_index->mapping_pairs_offset;
-    free(directory_record);
     MAPPING_CHUNK *chunk = malloc(sizeof(MAPPING_CHUNK));
     chunk->current_block = 0;
-    parse_data_run(stream, g_info, &chunk);
-
-    do {
-        if (chunk->length >= 0) {
-            index_allocation = (INDEX_ALLOCATION *) (chunk->buf + (chunk->current_block * g_info->block_size_in_bytes));
-            if (index_allocation->magic != magic_INDX) {
-                free(directory_entry);
-                free(chunk->buf);
-                free(chunk);
-                return -1;
-            }
-        } else {
-            free(directory_entry);
-            free(chunk->buf);
-            free(chunk);
-            return -1;
+    chunk->length = map->data_size;
+    chunk->buf = malloc(g_info->block_size_in_bytes);
+    stats_add(g_info, STATS_ALLOCATIONS, 2);
+
+    int added;
+    while (chunk->current_block < (chunk->length / g_info->block_size_in_bytes)) {
+        if (read_attr_data(g_info, map, chunk->current_block * g_info->block_size_in_bytes, chunk->buf,
+                           g_info->block_size_in_bytes) != g_info->block_size_in_bytes ||
+            apply_fixups(chunk->buf, g_info->block_size_in_bytes) == -1) {
+            cnt = -1;
+            break;
+        }
+        index_allocation = (INDEX_ALLOCATION *) chunk->buf;
+        if (index_allocation->magic != magic_INDX) {
+            cnt = -1;
+            break;
         }
+        stats_add(g_info, STATS_INDEX_BLOCKS, 1);
         index_entry_offset = ((uint8_t *) &index_allocation->index + index_allocation->index.entries_offset);
+        index_end = (uint8_t *) &index_allocation->index + index_allocation->index.index_length;
+        if (index_end > chunk->buf + g_info->block_size_in_bytes) {
+            index_end = chunk->buf + g_info->block_size_in_bytes;
+        }
 
-        do {
-            index_entry = (INDEX_ENTRY *) index_entry_offset;
-            index_entry_offset = ((uint8_t *) index_entry + index_entry->length);
-            if (index_entry->key_length > 0) {
-                file_name_length = file_name_convertor(file_name, index_entry);
-                if (file_name[0] != '.' && file_name[0] != '$') {
-                    current_inode->next_inode = malloc(sizeof(INODE));
-                    current_inode->next_inode->next_inode = NULL;
-                    current_inode = current_inode->next_inode;
-                    current_inode->parent = *inode;
-                    current_inode->filename = malloc(file_name_length);
-                    memcpy(current_inode->filename, &file_name[0], file_name_length);
-                    mft_entry_offset = search_mft_record(g_info, index_entry->indexed_file, &directory_entry);
-                    if (mft_entry_offset == -1) {
-                        free(directory_entry);
-                        free(chunk->buf);
-                        free(chunk);
-                    }
-                    current_inode->type = directory_entry->flags;
-                    current_inode->mft_num = index_entry->indexed_file;
-                    cnt++;
-                }
-            }
-
-        } while (index_entry_offset < (chunk->buf + chunk->length) && !(index_entry->ie_flags & INDEX_ENTRY_END));
+        added = walk_index_entries(index_entry_offset, index_end, add_index_entry, &reader, &index_entry);
+        if (added == -1) {
+            cnt = -1;
+            break;
+        }
+        cnt += added;
         chunk->current_block++;
-    } while (chunk->current_block < (chunk->length / g_info->block_size_in_bytes));
-    free(directory_entry);
+    }
+    put_extent_map(map);
+    free(reader.directory_entry);
     free(chunk->buf);
     free(chunk);
     return cnt;
 }
 
-uint64_t search_mft_record(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD **mft_record) {
-    uint64_t offset;
-    uint64_t LCN;
-    LCN = g_info->mft_lcn + (mft_num * g_info->clusters_per_mft_record);
-    offset = ((mft_num * g_info->mft_record_size_in_bytes) % (g_info->sectors_per_cluster * g_info->bytes_per_sector)) +
-             (LCN * g_info->sectors_per_cluster * g_info->bytes_per_sector);
-    while ((*mft_record)->magic != magic_FILE || (*mft_record)->mft_record_number != mft_num) {
-        pread(g_info->file_descriptor, (*mft_record), g_info->mft_record_size_in_bytes, offset);
-        offset += g_info->mft_record_size_in_bytes;
-    }
-    if ((*mft_record)->magic != magic_FILE) {
+static uint64_t fetch_mft_record(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD **mft_record) {
+    uint64_t offset = (uint64_t) mft_num * g_info->mft_record_size_in_bytes;
+    uint64_t disk_offset;
+
+    if (g_info->mft_map == NULL) {
+        // only $MFT itself is read before its data runs are known, it is always at mft_lcn
+        disk_offset = g_info->mft_lcn * g_info->cluster_size_in_bytes + offset;
+        if (read_volume(g_info, (*mft_record), g_info->mft_record_size_in_bytes, disk_offset) !=
+            g_info->mft_record_size_in_bytes) {
+            return -1;
+        }
+    } else {
+        EXTENT extent;
+        uint64_t vcn = offset / g_info->cluster_size_in_bytes;
+        if (lookup_vcn(g_info, g_info->mft_map, vcn, &extent) == -1 || extent.lcn == LCN_HOLE) {
+            return -1;
+        }
+        disk_offset = (extent.lcn + (vcn - extent.vcn)) * g_info->cluster_size_in_bytes +
+                      offset % g_info->cluster_size_in_bytes;
+        if (read_attr_data(g_info, g_info->mft_map, offset, (uint8_t *) (*mft_record),
+                           g_info->mft_record_size_in_bytes) != g_info->mft_record_size_in_bytes) {
+            return -1;
+        }
+    }
+
+    if (apply_fixups((uint8_t *) (*mft_record), g_info->mft_record_size_in_bytes) == -1 ||
+        (*mft_record)->magic != magic_FILE ||
+        (MFT_RECORD_HAS_NUMBER(*mft_record) && (*mft_record)->mft_record_number != mft_num)) {
         return -1;
     }
+    stats_add(g_info, STATS_RECORDS, 1);
 
-    return offset - g_info->mft_record_size_in_bytes;
+    return disk_offset;
+}
 
+uint64_t search_mft_record(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD **mft_record) {
+    uint64_t start = stats_clock();
+    uint64_t disk_offset = fetch_mft_record(g_info, mft_num, mft_record);
+    stats_latency(g_info, STATS_LATENCY_RECORD, stats_clock() - start);
+    return disk_offset;
+}
+
+/*
+ * Reads `count` consecutive mft records starting from `first` into buf with one
+ * read per $MFT extent. Records that fail fixups or carry another number get
+ * zero magic, so callers only have to check magic_FILE.
+ * Returns the number of records read (less than count at the end of $MFT) or -1.
+ */
+int read_mft_records(GENERAL_INFORMATION *g_info, uint64_t first, uint32_t count, uint8_t *buf) {
+    uint64_t record_size = g_info->mft_record_size_in_bytes;
+    int64_t read = read_attr_data(g_info, g_info->mft_map, first * record_size, buf, count * record_size);
+    if (read == -1) {
+        return -1;
+    }
+
+    uint32_t records = (uint32_t) (read / record_size);
+    stats_add(g_info, STATS_RECORDS, records);
+    for (uint32_t i = 0; i < records; i++) {
+        MFT_RECORD *record = (MFT_RECORD *) (buf + i * record_size);
+        if (apply_fixups((uint8_t *) record, record_size) == -1 || record->magic != magic_FILE ||
+            (MFT_RECORD_HAS_NUMBER(record) && record->mft_record_number != first + i)) {
+            record->magic = 0;
+        }
+    }
+    return (int) records;
 }
 
 int search_attr(GENERAL_INFORMATION *g_info, uint32_t type, MFT_RECORD *mft_record, ATTR_RECORD **attr_record) {
@@ -260,72 +293,107 @@ int search_attr(GENERAL_INFORMATION *g_info, uint32_t type, MFT_RECORD *mft_reco
     // TODO не уверен на счет sizeof(ATTR_RECORD). Думаю можно убрать.
     //void *end = mft_record + g_info->mft_record_size_in_bytes - sizeof(ATTR_RECORD);
 
-    void *end = mft_record + g_info->mft_record_size_in_bytes;
+    void *end = (uint8_t *) mft_record + g_info->mft_record_size_in_bytes;
 
-    while ((*attr_record)->type != AT_END && (*attr_record)->type != type && (void *) (*attr_record) < end) {
+    while ((void *) (*attr_record) < end && (*attr_record)->type != AT_END && (*attr_record)->type != type) {
         *attr_record = (ATTR_RECORD *) ((uint8_t *) (*attr_record) + (*attr_record)->length);
     }
 
-    if ((*attr_record)->type == AT_END || (void *) (*attr_record) >= end) {
-        attr_record = NULL;
+    if ((void *) (*attr_record) >= end || (*attr_record)->type == AT_END) {
+        *attr_record = NULL;
     }
 
     return 0;
 }
 
-int read_file_data(GENERAL_INFORMATION *g_info, INODE *inode, MAPPING_CHUNK_DATA **chunk_data) {
-    if (inode->type & MFT_RECORD_IS_DIRECTORY) {
+/*
+ * Reads the current lsn from the restart area of $LogFile.
+ * Returns 0 or -1 when $LogFile has no valid restart page.
+ */
+int read_volume_lsn(GENERAL_INFORMATION *g_info, uint64_t *lsn) {
+    EXTENT_MAP *map = get_extent_map(g_info, FILE_LogFile, AT_DATA);
+    if (map == NULL) {
+        return -1;
+    }
+    uint8_t *page = malloc(LOG_FILE_PAGE_SIZE);
+    int result = -1;
+    if (read_attr_data(g_info, map, 0, page, LOG_FILE_PAGE_SIZE) == LOG_FILE_PAGE_SIZE &&
+        apply_fixups(page, LOG_FILE_PAGE_SIZE) == 0) {
+        RESTART_PAGE_HEADER *header = (RESTART_PAGE_HEADER *) page;
+        if (header->magic == magic_RSTR &&
+            header->restart_area_offset + sizeof(RESTART_AREA) <= LOG_FILE_PAGE_SIZE) {
+            *lsn = ((RESTART_AREA *) (page + header->restart_area_offset))->current_lsn;
+            result = 0;
+        }
+    }
+    free(page);
+    put_extent_map(map);
+    return result;
+}
+
+int apply_fixups(uint8_t *record, uint32_t size) {
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint16_t usa_count = header->usa_count;
+    if (usa_count == 0) {
+        return 0;
+    }
+    if (header->usa_ofs + usa_count * sizeof(uint16_t) > size) {
         return -1;
     }
 
-    MFT_RECORD *mft_file_record = malloc(g_info->mft_record_size_in_bytes);
-    uint64_t offset = search_mft_record(g_info, inode->mft_num, &mft_file_record);
+    // the last two bytes of every 512-byte block were replaced by the update sequence number on write
+    uint16_t *usa = (uint16_t *) (record + header->usa_ofs);
+    uint16_t usn = usa[0];
+    for (uint16_t i = 1; i < usa_count && i * NTFS_BLOCK_SIZE <= size; i++) {
+        uint16_t *block_end = (uint16_t *) (record + i * NTFS_BLOCK_SIZE - sizeof(uint16_t));
+        if (*block_end != usn) {
+            return -1;
+        }
+        *block_end = usa[i];
+    }
+    return 0;
+}
 
-    if (offset == -1) {
-        free(mft_file_record);
+int read_file_data(GENERAL_INFORMATION *g_info, INODE *inode, MAPPING_CHUNK_DATA **chunk_data) {
+    if (inode->type & MFT_RECORD_IS_DIRECTORY) {
         return -1;
     }
 
-    ATTR_RECORD *attr_data = NULL;
-    int err = search_attr(g_info, AT_DATA, mft_file_record, &attr_data);
-    if (err == -1) {
-        free(mft_file_record);
+    // $DATA runs may be spread over extension records, the map loads them lazily
+    EXTENT_MAP *map = get_extent_map(g_info, inode->mft_num, AT_DATA);
+    if (map == NULL) {
         return -1;
     }
 
     (*chunk_data) = malloc(sizeof(MAPPING_CHUNK_DATA));
-    if (!attr_data->non_resident) {
+    stats_add(g_info, STATS_ALLOCATIONS, 2);    // with its buffer
+    (*chunk_data)->map = map;
+    (*chunk_data)->length = map->data_size;
+    (*chunk_data)->blocks_count = 0;
+    (*chunk_data)->cur_block = 0;
+    (*chunk_data)->signal = 0;
+    if (map->resident) {
         (*chunk_data)->resident = 1;
-        (*chunk_data)->length = attr_data->value_length;
-        (*chunk_data)->buf = malloc(attr_data->value_length);
-        memcpy((*chunk_data)->buf, (uint8_t *) attr_data + attr_data->value_offset, (*chunk_data)->length);
-        (*chunk_data)->lcns = NULL;
-        (*chunk_data)->lengths = NULL;
+        (*chunk_data)->buf = malloc(map->data_size + 1);
+        memcpy((*chunk_data)->buf, map->resident_data, (*chunk_data)->length);
     } else {
         (*chunk_data)->resident = 0;
-        uint64_t stream =
-                offset + ((uint8_t *) attr_data - (uint8_t *) mft_file_record) + attr_data->mapping_pairs_offset;
-        init_chunk_data(stream, g_info, &(*chunk_data));
-        (*chunk_data)->length = attr_data->data_size;
         (*chunk_data)->buf = malloc(g_info->block_size_in_bytes);
-        (*chunk_data)->blocks_count = 0;
     }
 
-    free(mft_file_record);
     return 0;
 }
 
 int read_block_file(GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data) {
-    uint64_t buf_current_size = 0;
-    uint64_t buf_size = g_info->block_size_in_bytes;
+    uint64_t offset = (*chunk_data)->cur_block * g_info->block_size_in_bytes;
 
-    if ((*chunk_data)->cur_lcn == (*chunk_data)->lcn_count) {
+    if (offset >= (*chunk_data)->length) {
         (*chunk_data)->signal = 1;
         return 1;
     }
-    int64_t LCN = (*chunk_data)->lcns[(*chunk_data)->cur_lcn] + (*chunk_data)->cur_block;
-    int err = read_clusters_to_buf(&(*chunk_data)->buf, &buf_current_size, &buf_size, LCN, 1, g_info);
-    if (err == -1) {
+    int64_t read = read_attr_data(g_info, (*chunk_data)->map, offset, (*chunk_data)->buf,
+                                  g_info->block_size_in_bytes);
+    if (read <= 0) {
         (*chunk_data)->signal = -1;
         return -1;
     }
@@ -336,6 +404,23 @@ int read_block_file(GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data
 
 }
 
+/*
+ * Converts an ntfs name to the char form used by INODE (low byte of every
+ * character). Returns the length including the terminating zero.
+ */
+uint8_t convert_file_name(char *file_name, const FILE_NAME_ATTR *attr) {
+    // read as bytes, the name inside a packed attribute may be unaligned
+    const uint8_t *filename = (const uint8_t *) attr->file_name;
+    uint8_t filename_length = attr->file_name_length;
+
+    for (uint8_t i = 0; i < filename_length; i++) {
+        file_name[i] = (char) filename[2 * i];
+    }
+    file_name[filename_length] = '\0';
+
+    return filename_length + 1;
+}
+
 void free_inode(INODE *inode) {
     INODE *tmp;
 
@@ -354,177 +439,87 @@ int free_data_chunk(MAPPING_CHUNK_DATA *chunk_data) {
         free(chunk_data->buf);
     }
 
-    if (chunk_data->lcns != NULL) {
-        free(chunk_data->lcns);
-    }
-
-    if (chunk_data->lengths != NULL) {
-        free(chunk_data->lengths);
-    }
+    put_extent_map(chunk_data->map);
 
     free(chunk_data);
     return 0;
 }
 
-
-static uint8_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry) {
-    const uint16_t *filename = index_entry->key.file_name.file_name;
-    uint8_t filename_length = index_entry->key.file_name.file_name_length;
-
-    for (uint8_t i = 0; i < filename_length; i++) {
-        file_name[i] = (char) filename[i];
-    }
-    file_name[filename_length] = '\0';
-
-    return filename_length + 1;
-}
-
-static int
-read_clusters_to_buf(uint8_t **buf, uint64_t *buf_current_size, uint64_t *buf_size, int64_t lcn, uint64_t length,
-                     GENERAL_INFORMATION *g_info) {
-    //TODO maybe need to change a way to calculate length or g_info
-    length = length * (g_info->sectors_per_cluster * g_info->bytes_per_sector);
-    uint64_t offset = lcn * (g_info->sectors_per_cluster * g_info->bytes_per_sector);
-
-    if (length > (*buf_size - *buf_current_size)) {
-        *buf = realloc(*buf, *buf_size + g_info->block_size_in_bytes);
-        if (*buf == NULL) {
-            return -1;
-        } else {
-            *buf_size += g_info->block_size_in_bytes;
-        }
-    }
-    pread(g_info->file_descriptor, *buf + *buf_current_size, length, (long) offset);
-    *buf_current_size += length;
+int free_g_info(GENERAL_INFORMATION *g_info) {
+    free_extent_map_cache(g_info);
+    free_extent_map(g_info->mft_map);
+    close_sidecar(g_info->sidecar);
+    free_name_index(g_info->name_index);
+    free_path_table(g_info->path_table);
+    close(g_info->file_descriptor);
+    pthread_mutex_destroy(g_info->cache_lock);
+    free(g_info->cache_lock);
+    pthread_mutex_destroy(g_info->index_lock);
+    free(g_info->index_lock);
+    free_stats(g_info->stats);
+    free_budget(g_info->budget);
+    free(g_info);
     return 0;
 }
 
-static int parse_data_run(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING_CHUNK **chunk) {
-    uint8_t *run_list = malloc(g_info->block_size_in_bytes);
-    pread(g_info->file_descriptor, run_list, g_info->block_size_in_bytes, (long) offset);
-    uint8_t *ptr_run_list = run_list;
-
-    int64_t LCN = 0;
 
-    uint8_t *buf = malloc(g_info->block_size_in_bytes);
-    uint64_t buf_size = g_info->block_size_in_bytes;
-    uint64_t buf_current_size = 0;
-
-    uint8_t data_run_offset_size; //размер поля смещения
-    uint8_t data_run_length_size; //размер поля длины
-
-    uint64_t data_run_length = 0; //на выходе, распакованное значение числа кластеров
-    int64_t data_run_offset = 0; //на выходе, распакованное значение кластерного смещения
-
-    do {
-        //из старшего полубайта считаем размер поля смещения
-        data_run_offset_size = (*ptr_run_list >> 4) & 0x0F;
-        //из младшего размер поля смещения
-        data_run_length_size = *ptr_run_list & 0x0F;
-
-        //указатель на сами данные
-        ptr_run_list++;
-        uint8_t i = 0;
-
-        //цикл распаковки длины отрезка, с каждой итерацией значение сдвигается на i-байт и
-        //прибавляется с длиной
-        for (i = 0; i < data_run_length_size; i++) {
-            data_run_length += *ptr_run_list << (i << 3);
-            ptr_run_list++;
-        }
-
-        /* NTFS 3+ sparse files, если файл разряжен */
-        if (data_run_offset_size == 0) {
-            data_run_offset = -1;
-        } else {
-            //цикл распаковки смещения
-            for (i = 0; i < data_run_offset_size - 1; i++) {
-                data_run_offset += *ptr_run_list << (i << 3);
-                ptr_run_list++;
-            }
-            //последний байт может быть знаковым, поэтому он обрабатывается отдельно
-            data_run_offset = ((char) (*(ptr_run_list++)) << (i << 3)) + data_run_offset;
-        }
-
-        LCN += data_run_offset;
-        int err = read_clusters_to_buf(&buf, &buf_current_size, &buf_size, LCN, data_run_length, g_info);
-        if (err == -1) {
-            free(ptr_run_list);
-            free(buf);
-            return -1;
-        }
-    } while (*ptr_run_list);
-
-    free(run_list);
-    (*chunk)->buf = buf;
-    (*chunk)->length = buf_current_size;
-    return 0;
+static uint8_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry) {
+    return convert_file_name(file_name, &index_entry->key.file_name);
 }
 
-static int init_chunk_data(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data) {
-    uint8_t *run_list = malloc(g_info->block_size_in_bytes);
-    pread(g_info->file_descriptor, run_list, g_info->block_size_in_bytes, offset);
-    uint8_t *ptr_run_list = run_list;
-
-    int64_t LCN = 0;
-
-    (*chunk_data)->lcns = malloc(sizeof(int64_t) * 16);
-    (*chunk_data)->lengths = malloc(sizeof(uint64_t) * 16);
-    int buf_size = 16;
-    int cur_size = 0;
-
-    uint8_t data_run_offset_size; //размер поля смещения
-    uint8_t data_run_length_size; //размер поля длины
-
-    uint64_t data_run_length = 0; //на выходе, распакованное значение числа кластеров
-    int64_t data_run_offset = 0; //на выходе, распакованное значение кластерного смещения
+/*
+ * Calls callback for every entry of one index node in [start, end) that has a
+ * key, with its name converted by file_name_convertor(). The walk stops after
+ * the end entry. last_entry gets the entry the walk stopped at, its flags tell
+ * whether the node has sub-nodes.
+ * Returns the sum of the callback results or -1.
+ */
+int walk_index_entries(uint8_t *start, const uint8_t *end, INDEX_ENTRY_CALLBACK callback, void *context,
+                       INDEX_ENTRY **last_entry) {
+    char file_name[FILE_NAME_MAX_SIZE + 1];
+    uint8_t file_name_length;
+    INDEX_ENTRY *index_entry;
+    uint8_t *index_entry_offset = start;
+    int cnt = 0;
 
     do {
-        //из старшего полубайта считаем размер поля смещения
-        data_run_offset_size = (*ptr_run_list >> 4) & 0x0F;
-        //из младшего размер поля смещения
-        data_run_length_size = *ptr_run_list & 0x0F;
-
-        //указатель на сами данные
-        ptr_run_list++;
-        uint8_t i = 0;
-
-        //цикл распаковки длины отрезка, с каждой итерацией значение сдвигается на i-байт и
-        //прибавляется с длиной
-        for (i = 0; i < data_run_length_size; i++) {
-            data_run_length += *ptr_run_list << (i << 3);
-            ptr_run_list++;
+        index_entry = (INDEX_ENTRY *) index_entry_offset;
+        if (index_entry->length == 0) {
+            return -1;
         }
-
-        /* NTFS 3+ sparse files, если файл разряжен */
-        if (data_run_offset_size == 0) {
-            data_run_offset = -1;
-            //TODO maybe break
-        } else {
-            //цикл распаковки смещения
-            for (i = 0; i < data_run_offset_size - 1; i++) {
-                data_run_offset += *ptr_run_list << (i << 3);
-                ptr_run_list++;
+        index_entry_offset = ((uint8_t *) index_entry + index_entry->length);
+        if (index_entry->key_length > 0 && !(index_entry->ie_flags & INDEX_ENTRY_END)) {
+            file_name_length = file_name_convertor(file_name, index_entry);
+            int added = callback(index_entry, file_name, file_name_length, context);
+            if (added == -1) {
+                return -1;
             }
-            //последний байт может быть знаковым, поэтому он обрабатывается отдельно
-            data_run_offset = ((char) (*(ptr_run_list++)) << (i << 3)) + data_run_offset;
+            cnt += added;
         }
+    } while (index_entry_offset < end && !(index_entry->ie_flags & INDEX_ENTRY_END));
 
-        if (cur_size == buf_size) {
-            (*chunk_data)->lcns = realloc((*chunk_data)->lcns, 2 * buf_size);
-            (*chunk_data)->lengths = realloc((*chunk_data)->lengths, 2 * buf_size);
-            buf_size *= 2;
-        }
-        LCN += data_run_offset;
-
-        (*chunk_data)->lcns[cur_size] = LCN;
-        (*chunk_data)->lengths[cur_size] = data_run_length;
-        cur_size++;
-    } while (*ptr_run_list);
+    *last_entry = index_entry;
+    return cnt;
+}
 
-    (*chunk_data)->cur_lcn = 0;
-    (*chunk_data)->lcn_count = cur_size;
-    (*chunk_data)->cur_block = 0;
-    free(run_list);
-    return 0;
+/* Appends the file of an entry to the inode list of read_directory(), system and dot names are skipped. */
+static int add_index_entry(INDEX_ENTRY *index_entry, const char *file_name, uint8_t file_name_length, void *context) {
+    DIRECTORY_READER *reader = context;
+    if (file_name[0] == '.' || file_name[0] == '$') {
+        return 0;
+    }
+    if (search_mft_record(reader->g_info, MREF(index_entry->indexed_file), &reader->directory_entry) == -1) {
+        return -1;
+    }
+    INODE *inode = malloc(sizeof(INODE));
+    inode->next_inode = NULL;
+    inode->parent = reader->parent;
+    inode->filename = malloc(file_name_length);
+    memcpy(inode->filename, file_name, file_name_length);
+    inode->type = reader->directory_entry->flags;
+    inode->mft_num = MREF(index_entry->indexed_file);
+    reader->current_inode->next_inode = inode;
+    reader->current_inode = inode;
+    stats_add(reader->g_info, STATS_ALLOCATIONS, 2);
+    return 1;
 }
@@ -0,0 +1,363 @@
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/sidecar.h"
+#include "../inc/path_table.h"
+
+#define FILE_NAME_MAX_SIZE 255
+
+static PATH_TABLE *new_table(GENERAL_INFORMATION *g_info);
+
+static int charge_table(PATH_TABLE *table, uint64_t bytes);
+
+static PATH_TABLE *load_from_sidecar(GENERAL_INFORMATION *g_info, SIDECAR *sidecar);
+
+static int64_t build_path(PATH_TABLE *table, uint64_t mft_num, char *buf, size_t size);
+
+static void cache_path(PATH_TABLE *table, uint32_t mft_num, const char *path, size_t length, uint32_t depth);
+
+static void clear_slot(PATH_TABLE *table, PATH_CACHE_ENTRY *entry);
+
+static int lowest_path(void *context, uint64_t *priority);
+
+static uint64_t evict_path(void *context);
+
+static const BUDGET_EVICTOR path_cache_evictor = {lowest_path, evict_path};
+
+/*
+ * Builds the table with one scan of $MFT, or straight from the sidecar.
+ * Returns the table or NULL.
+ */
+PATH_TABLE *build_path_table(GENERAL_INFORMATION *g_info) {
+    if (g_info->sidecar != NULL) {
+        return load_from_sidecar(g_info, g_info->sidecar);
+    }
+
+    PATH_TABLE *table = create_path_table(g_info);
+    if (table == NULL || scan_mft(g_info, add_path_record, table) == -1) {
+        free_path_table(table);
+        return NULL;
+    }
+    finish_path_table(table);
+    return table;
+}
+
+/*
+ * Path table of the volume, built by the first caller. Later callers wait for
+ * it instead of building their own.
+ * Returns the table or NULL.
+ */
+PATH_TABLE *get_path_table(GENERAL_INFORMATION *g_info) {
+    pthread_mutex_lock(g_info->index_lock);
+    if (g_info->path_table == NULL) {
+        g_info->path_table = build_path_table(g_info);
+        register_path_cache(g_info->path_table);
+    }
+    PATH_TABLE *table = g_info->path_table;
+    pthread_mutex_unlock(g_info->index_lock);
+    return table;
+}
+
+/*
+ * Returns an empty table for the volume, to be filled by add_path_record()
+ * and completed by finish_path_table().
+ */
+PATH_TABLE *create_path_table(GENERAL_INFORMATION *g_info) {
+    PATH_TABLE *table = new_table(g_info);
+    if (table == NULL) {
+        return NULL;
+    }
+    table->node_count = mft_record_count(g_info);
+    if (charge_table(table, table->node_count * (sizeof(PATH_NODE) + 1)) == -1) {
+        free_path_table(table);
+        return NULL;
+    }
+    table->nodes = calloc(table->node_count, sizeof(PATH_NODE));
+    table->dos_name = calloc(table->node_count, 1);
+    if (table->nodes == NULL || table->dos_name == NULL) {
+        free_path_table(table);
+        return NULL;
+    }
+    return table;
+}
+
+/*
+ * Takes parent and name of one record, a MFT_SCAN_CALLBACK.
+ */
+int add_path_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context) {
+    PATH_TABLE *table = context;
+    if (!(record->flags & MFT_RECORD_IN_USE)) {
+        return 0;
+    }
+    uint64_t target = record->base_mft_record ? MREF(record->base_mft_record) : mft_num;
+    if (target >= table->node_count) {
+        return 0;
+    }
+    PATH_NODE *node = &table->nodes[target];
+    if (record->base_mft_record == 0) {
+        node->flags = record->flags;
+    }
+
+    ATTR_RECORD *attr = NULL;
+    while ((attr = next_attr(g_info, record, attr, AT_FILE_NAME)) != NULL) {
+        FILE_NAME_ATTR *file_name = (FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset);
+        if (attr->non_resident || (uint64_t) attr->value_offset + sizeof(FILE_NAME_ATTR) > attr->length ||
+            attr->value_offset + sizeof(FILE_NAME_ATTR) + file_name->file_name_length * 2 > attr->length ||
+            file_name->file_name_length == 0) {
+            continue;
+        }
+        // the first long name wins, a DOS name is only kept when there is nothing else
+        uint8_t dos = file_name->file_name_type == FILE_NAME_DOS;
+        if (node->name_length != 0 && (!table->dos_name[target] || dos)) {
+            continue;
+        }
+        if (table->names_size + FILE_NAME_MAX_SIZE + 1 > table->names_capacity) {
+            uint64_t capacity = table->names_capacity ? table->names_capacity * 2 : 64 * 1024;
+            if (capacity > UINT32_MAX || charge_table(table, capacity - table->names_capacity) == -1) {
+                return -1;
+            }
+            table->names_capacity = capacity;
+            char *names = realloc(table->names, table->names_capacity);
+            if (names == NULL) {
+                return -1;
+            }
+            table->names = names;
+        }
+        uint8_t length = convert_file_name(table->names + table->names_size, file_name) - 1;
+        node->parent = (uint32_t) MREF(file_name->parent_directory);
+        node->name_offset = (uint32_t) table->names_size;
+        node->name_length = length;
+        table->dos_name[target] = dos;
+        table->names_size += length + 1;
+    }
+    return 0;
+}
+
+void finish_path_table(PATH_TABLE *table) {
+    if (table->dos_name != NULL) {
+        budget_release(table->budget, BUDGET_PATH_TABLE, table->node_count);
+        table->charged -= table->node_count;
+    }
+    free(table->dos_name);
+    table->dos_name = NULL;
+}
+
+/*
+ * Lets the budget evict remembered paths of the table of the volume. Paths
+ * of other tables are only charged.
+ */
+void register_path_cache(PATH_TABLE *table) {
+    if (table == NULL) {
+        return;
+    }
+    budget_register(table->budget, BUDGET_PATH_CACHE, &path_cache_evictor, table);
+    table->registered = 1;
+}
+
+/*
+ * Writes the absolute path of a record to buf, walking up the parents until
+ * the root or a remembered directory is reached.
+ * Returns the length of the path or -1 when the record has no path (not in
+ * use, parent chain broken) or buf is too small.
+ */
+int64_t record_path(PATH_TABLE *table, uint64_t mft_num, char *buf, size_t size) {
+    if (mft_num == FILE_root) {
+        if (size < 2) {
+            return -1;
+        }
+        strcpy(buf, "/");
+        return 1;
+    }
+
+    pthread_mutex_lock(&table->cache_lock);
+    int64_t length = build_path(table, mft_num, buf, size);
+    pthread_mutex_unlock(&table->cache_lock);
+    return length;
+}
+
+static int64_t build_path(PATH_TABLE *table, uint64_t mft_num, char *buf, size_t size) {
+    uint32_t chain[PATH_TABLE_MAX_DEPTH];
+    uint32_t depth = 0;
+    uint64_t current = mft_num;
+    PATH_CACHE_ENTRY *prefix = NULL;
+    while (current != FILE_root) {
+        if (current >= table->node_count || depth == PATH_TABLE_MAX_DEPTH) {
+            return -1;
+        }
+        PATH_CACHE_ENTRY *cached = &table->cache[current % PATH_CACHE_SIZE];
+        if (depth > 0 && cached->path != NULL && cached->mft_num == current) {
+            cached->priority = budget_priority(table->budget, (uint64_t) cached->depth * PATH_CACHE_STEP_NS,
+                                               cached->length);
+            prefix = cached;
+            break;
+        }
+        PATH_NODE *node = &table->nodes[current];
+        if (node->name_length == 0 || node->parent == current) {
+            return -1;
+        }
+        chain[depth++] = (uint32_t) current;
+        current = node->parent;
+    }
+
+    size_t length = 0;
+    if (prefix != NULL) {
+        if (prefix->length >= size) {
+            return -1;
+        }
+        memcpy(buf, prefix->path, prefix->length);
+        length = prefix->length;
+    }
+    for (int32_t i = (int32_t) depth - 1; i >= 0; i--) {
+        PATH_NODE *node = &table->nodes[chain[i]];
+        if (length + 1 + node->name_length >= size) {
+            return -1;
+        }
+        buf[length++] = '/';
+        memcpy(buf + length, table->names + node->name_offset, node->name_length);
+        length += node->name_length;
+
+        // the directory holding the record is likely asked for again with the next sibling
+        if (i == 1) {
+            cache_path(table, chain[1], buf, length, depth - 1 + (prefix != NULL ? prefix->depth : 0));
+        }
+    }
+    buf[length] = '\0';
+    return (int64_t) length;
+}
+
+void free_path_table(PATH_TABLE *table) {
+    if (table == NULL) {
+        return;
+    }
+    if (table->registered) {
+        budget_unregister(table->budget, BUDGET_PATH_CACHE);
+    }
+    for (uint32_t i = 0; i < PATH_CACHE_SIZE; i++) {
+        clear_slot(table, &table->cache[i]);
+    }
+    budget_release(table->budget, BUDGET_PATH_TABLE, table->charged);
+    free(table->nodes);
+    free(table->names);
+    free(table->dos_name);
+    pthread_mutex_destroy(&table->cache_lock);
+    free(table);
+}
+
+static PATH_TABLE *load_from_sidecar(GENERAL_INFORMATION *g_info, SIDECAR *sidecar) {
+    PATH_TABLE *table = new_table(g_info);
+    if (table == NULL) {
+        return NULL;
+    }
+    table->node_count = sidecar->header->record_count;
+    table->names_size = sidecar->header->names_size;
+    table->names_capacity = table->names_size;
+    if (charge_table(table, table->node_count * sizeof(PATH_NODE) + table->names_size) == -1) {
+        free_path_table(table);
+        return NULL;
+    }
+    table->nodes = malloc(table->node_count * sizeof(PATH_NODE) + 1);
+    table->names = malloc(table->names_size);
+    if (table->nodes == NULL || table->names == NULL) {
+        free_path_table(table);
+        return NULL;
+    }
+    memcpy(table->names, sidecar->names, table->names_size);
+    for (uint64_t i = 0; i < table->node_count; i++) {
+        const SIDECAR_RECORD *record = &sidecar->records[i];
+        table->nodes[i].parent = (uint32_t) MREF(record->parent);
+        table->nodes[i].name_offset = record->name_offset;
+        table->nodes[i].flags = record->flags;
+        table->nodes[i].name_length = record->flags & MFT_RECORD_IN_USE ? record->name_length : 0;
+    }
+    return table;
+}
+
+static PATH_TABLE *new_table(GENERAL_INFORMATION *g_info) {
+    PATH_TABLE *table = calloc(1, sizeof(PATH_TABLE));
+    if (table == NULL) {
+        return NULL;
+    }
+    // the budget may evict remembered paths while record_path() charges a new one
+    pthread_mutexattr_t lock_attr;
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_settype(&lock_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&table->cache_lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+    table->budget = g_info->budget;
+    return table;
+}
+
+static int charge_table(PATH_TABLE *table, uint64_t bytes) {
+    if (budget_charge(table->budget, BUDGET_PATH_TABLE, bytes) == -1) {
+        return -1;
+    }
+    table->charged += bytes;
+    return 0;
+}
+
+/*
+ * Remembers the path of a directory in its slot, unless the budget has no
+ * room for it. The caller holds the cache lock.
+ */
+static void cache_path(PATH_TABLE *table, uint32_t mft_num, const char *path, size_t length, uint32_t depth) {
+    PATH_CACHE_ENTRY *entry = &table->cache[mft_num % PATH_CACHE_SIZE];
+    clear_slot(table, entry);
+    if (budget_charge(table->budget, BUDGET_PATH_CACHE, length) == -1) {
+        return;
+    }
+    entry->path = malloc(length);
+    if (entry->path == NULL) {
+        budget_release(table->budget, BUDGET_PATH_CACHE, length);
+        return;
+    }
+    memcpy(entry->path, path, length);
+    entry->mft_num = mft_num;
+    entry->length = (uint32_t) length;
+    entry->depth = depth;
+    entry->priority = budget_priority(table->budget, (uint64_t) depth * PATH_CACHE_STEP_NS, length);
+}
+
+static void clear_slot(PATH_TABLE *table, PATH_CACHE_ENTRY *entry) {
+    if (entry->path == NULL) {
+        return;
+    }
+    budget_release(table->budget, BUDGET_PATH_CACHE, entry->length);
+    free(entry->path);
+    entry->path = NULL;
+}
+
+/*
+ * The cheapest of the next BUDGET_SAMPLE remembered paths after the hand,
+ * comparing all PATH_CACHE_SIZE slots every time would cost more than the paths.
+ */
+static int lowest_path(void *context, uint64_t *priority) {
+    PATH_TABLE *table = context;
+    if (pthread_mutex_trylock(&table->cache_lock) != 0) {
+        return -1;
+    }
+    uint32_t sampled = 0;
+    for (uint32_t i = 0; i < PATH_CACHE_SIZE && sampled < BUDGET_SAMPLE; i++) {
+        uint32_t slot = (table->hand + i) % PATH_CACHE_SIZE;
+        if (table->cache[slot].path == NULL) {
+            continue;
+        }
+        if (sampled++ == 0 || table->cache[slot].priority < *priority) {
+            table->victim = slot;
+            *priority = table->cache[slot].priority;
+        }
+    }
+    pthread_mutex_unlock(&table->cache_lock);
+    return sampled > 0 ? 0 : -1;
+}
+
+static uint64_t evict_path(void *context) {
+    PATH_TABLE *table = context;
+    if (pthread_mutex_trylock(&table->cache_lock) != 0) {
+        return 0;
+    }
+    PATH_CACHE_ENTRY *entry = &table->cache[table->victim];
+    uint64_t size = entry->path != NULL ? entry->length : 0;
+    clear_slot(table, entry);
+    table->hand = (table->victim + 1) % PATH_CACHE_SIZE;
+    pthread_mutex_unlock(&table->cache_lock);
+    return size;
+}
@@ -0,0 +1,551 @@
+#define _GNU_SOURCE    // struct ucred
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/un.h>
+#include "../inc/util.h"
+#include "../inc/server.h"
+
+/*
+ * One client. Its sessions are opened on the first request for a volume.
+ */
+typedef struct {
+    int fd;
+    SESSION **sessions;
+    bool busy;    // a worker runs its request, the dispatcher doesn't poll it
+    bool closed;    // to be freed by the dispatcher
+    SERVER_REQUEST request;    // read by the dispatcher, complete while busy
+    uint32_t received;    // bytes of request and args read so far
+    char args[SERVER_MAX_REQUEST + 1];
+} SERVER_CONNECTION;
+
+/*
+ * Shared state of the daemon. The dispatcher thread polls idle connections,
+ * reads their requests without blocking and queues the ones with a complete
+ * request. Workers take a connection, answer its request and give it back
+ * through the wake pipe. So any number of clients, idle or slow ones
+ * included, share a fixed number of workers.
+ */
+typedef struct {
+    GENERAL_INFORMATION **volumes;
+    uint32_t volume_count;
+    char *output_root;    // resolved directory cp may write into, NULL when cp is disabled
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;    // a connection was queued or the server stops
+    SERVER_CONNECTION *queue[SERVER_MAX_CONNECTIONS];
+    uint32_t head;
+    uint32_t count;
+    uint32_t active;    // requests workers are answering
+    pthread_cond_t idle;    // active dropped to zero
+    bool stopping;
+    int wake[2];    // pipe, written when a worker is done with a connection
+} SERVER;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// commands of the opcodes in statistics of the volume
+static const char *opcode_commands[] = {NULL, "ls", "stat", "find", "cat", "cp", "cd", "pwd"};
+
+static void request_stop(int signal_number);
+
+static void *run_worker(void *arg);
+
+static int serve_request(SERVER *server, SERVER_CONNECTION *connection);
+
+static int handle_request(SERVER *server, SESSION *session, SERVER_REQUEST *request, char *first, char *second,
+                          int fd);
+
+static int confine_target(SERVER *server, const char *target, char *resolved);
+
+static int send_file(SESSION *session, char *path, int fd);
+
+static int send_reply(int fd, uint8_t status, const char *payload, uint64_t length);
+
+static int send_all(int fd, const void *buf, size_t length);
+
+static int receive_request(SERVER_CONNECTION *connection);
+
+static int accept_client(int fd);
+
+static void free_connection(SERVER *server, SERVER_CONNECTION *connection);
+
+/*
+ * Serves requests for the volumes on a Unix socket at socket_path until
+ * SIGINT or SIGTERM. Volumes stay open the whole time, so their caches are
+ * shared by all connections. A stale socket file is replaced and removed
+ * again on exit. The socket is only open to the user running the daemon
+ * and root. cp writes below output_root only, and is refused when it is NULL.
+ * Returns 0 or -1.
+ */
+int serve(const char *socket_path, GENERAL_INFORMATION **volumes, uint32_t volume_count, uint32_t workers,
+          const char *output_root) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (volume_count == 0 || volume_count > SERVER_MAX_VOLUMES ||
+        strlen(socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    SERVER server;
+    memset(&server, 0, sizeof(SERVER));
+    server.volumes = volumes;
+    server.volume_count = volume_count;
+    if (output_root != NULL && (server.output_root = realpath(output_root, NULL)) == NULL) {
+        return -1;
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        free(server.output_root);
+        return -1;
+    }
+    unlink(socket_path);
+    // the socket file is created 0600, no other thread runs yet to see the umask
+    mode_t old_umask = umask(0177);
+    int bound = bind(listen_fd, (struct sockaddr *) &address, sizeof(address));
+    umask(old_umask);
+    if (bound == -1 || listen(listen_fd, SERVER_BACKLOG) == -1 || pipe(server.wake) == -1) {
+        close(listen_fd);
+        free(server.output_root);
+        return -1;
+    }
+
+    // no SA_RESTART, a signal has to interrupt poll()
+    struct sigaction action;
+    struct sigaction old_int;
+    struct sigaction old_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+    stop_requested = 0;
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    pthread_cond_init(&server.idle, NULL);
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    SERVER_CONNECTION **connections = malloc(SERVER_MAX_CONNECTIONS * sizeof(SERVER_CONNECTION *));
+    struct pollfd *polled = malloc((SERVER_MAX_CONNECTIONS + 2) * sizeof(struct pollfd));
+    SERVER_CONNECTION **owners = malloc((SERVER_MAX_CONNECTIONS + 2) * sizeof(SERVER_CONNECTION *));
+    uint32_t connection_count = 0;
+    uint32_t started = 0;
+    // workers inherit the blocked signals, so they always interrupt the dispatcher
+    sigset_t signals;
+    sigset_t old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    if (threads != NULL && connections != NULL && polled != NULL && owners != NULL) {
+        for (; started < workers; started++) {
+            if (pthread_create(&threads[started], NULL, run_worker, &server) != 0) {
+                break;
+            }
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    int result = started > 0 ? 0 : -1;
+    while (result == 0 && !stop_requested) {
+        polled[0] = (struct pollfd) {server.wake[0], POLLIN, 0};
+        polled[1] = (struct pollfd) {listen_fd, connection_count < SERVER_MAX_CONNECTIONS ? POLLIN : 0, 0};
+        nfds_t count = 2;
+        pthread_mutex_lock(&server.lock);
+        for (uint32_t i = 0; i < connection_count;) {
+            SERVER_CONNECTION *connection = connections[i];
+            if (connection->closed) {
+                free_connection(&server, connection);
+                connections[i] = connections[--connection_count];
+                continue;
+            }
+            if (!connection->busy) {
+                polled[count] = (struct pollfd) {connection->fd, POLLIN, 0};
+                owners[count++] = connection;
+            }
+            i++;
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        if (poll(polled, count, -1) == -1) {
+            if (errno != EINTR) {
+                result = -1;
+            }
+            continue;
+        }
+        if (polled[0].revents & POLLIN) {
+            char drain[64];
+            read(server.wake[0], drain, sizeof(drain));
+        }
+        if (polled[1].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd != -1 && accept_client(fd) == -1) {
+                close(fd);
+                fd = -1;
+            }
+            SERVER_CONNECTION *connection = fd != -1 ? calloc(1, sizeof(SERVER_CONNECTION)) : NULL;
+            if (connection != NULL) {
+                connection->sessions = calloc(volume_count, sizeof(SESSION *));
+                if (connection->sessions == NULL) {
+                    free(connection);
+                    connection = NULL;
+                }
+            }
+            if (connection != NULL) {
+                connection->fd = fd;
+                connections[connection_count++] = connection;
+            } else if (fd != -1) {
+                close(fd);
+            }
+        }
+        for (nfds_t i = 2; i < count; i++) {
+            int state = polled[i].revents != 0 ? receive_request(owners[i]) : 0;
+            if (state == 0) {
+                continue;
+            }
+            pthread_mutex_lock(&server.lock);
+            if (state == -1) {
+                // the client is gone, freed on the next round
+                owners[i]->closed = true;
+            } else {
+                owners[i]->busy = true;
+                server.queue[(server.head + server.count) % SERVER_MAX_CONNECTIONS] = owners[i];
+                server.count++;
+                pthread_cond_signal(&server.ready);
+            }
+            pthread_mutex_unlock(&server.lock);
+        }
+    }
+
+    // requests in progress get SERVER_STOP_GRACE seconds to be answered, queued ones are dropped
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SERVER_STOP_GRACE;
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.ready);
+    while (server.active > 0 && pthread_cond_timedwait(&server.idle, &server.lock, &deadline) == 0) {
+    }
+    pthread_mutex_unlock(&server.lock);
+    // replies still being sent fail right away, a request still running finishes without its reply
+    for (uint32_t i = 0; i < connection_count; i++) {
+        shutdown(connections[i]->fd, SHUT_RDWR);
+    }
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 0; i < connection_count; i++) {
+        free_connection(&server, connections[i]);
+    }
+
+    close(listen_fd);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    unlink(socket_path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    pthread_cond_destroy(&server.ready);
+    pthread_cond_destroy(&server.idle);
+    pthread_mutex_destroy(&server.lock);
+    free(threads);
+    free(connections);
+    free(polled);
+    free(owners);
+    free(server.output_root);
+    return result;
+}
+
+static void request_stop(int signal_number) {
+    (void) signal_number;
+    stop_requested = 1;
+}
+
+static void *run_worker(void *arg) {
+    SERVER *server = arg;
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+        while (server->count == 0 && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        SERVER_CONNECTION *connection = server->queue[server->head];
+        server->head = (server->head + 1) % SERVER_MAX_CONNECTIONS;
+        server->count--;
+        server->active++;
+        pthread_mutex_unlock(&server->lock);
+
+        int err = serve_request(server, connection);
+
+        pthread_mutex_lock(&server->lock);
+        connection->closed = err == -1;
+        connection->busy = false;
+        if (--server->active == 0) {
+            pthread_cond_signal(&server->idle);
+        }
+        pthread_mutex_unlock(&server->lock);
+        write(server->wake[1], "", 1);
+    }
+}
+
+/*
+ * Answers the request the dispatcher read for the connection.
+ * Returns 0, or -1 when the client is gone or broke the protocol.
+ */
+static int serve_request(SERVER *server, SERVER_CONNECTION *connection) {
+    int fd = connection->fd;
+    SERVER_REQUEST request = connection->request;
+    connection->received = 0;
+    if (request.length > SERVER_MAX_REQUEST) {
+        send_reply(fd, SERVER_ERROR, "Request too long\n", 17);
+        return -1;
+    }
+    char *args = connection->args;
+    args[request.length] = '\0';
+    char *end = args + request.length;
+    char *first = request.length > 0 && args[0] != '\0' ? args : NULL;
+    char *second = NULL;
+    if (first != NULL && first + strlen(first) + 1 < end) {
+        second = first + strlen(first) + 1;
+    }
+
+    if (request.volume >= server->volume_count) {
+        return send_reply(fd, SERVER_ERROR, "No such volume\n", 15);
+    }
+    SESSION **session = &connection->sessions[request.volume];
+    if (*session == NULL && (*session = open_session(server->volumes[request.volume])) == NULL) {
+        return -1;
+    }
+    uint64_t start = stats_clock();
+    int result = handle_request(server, *session, &request, first, second, fd);
+    if (request.opcode >= SERVER_LS && request.opcode <= SERVER_PWD) {
+        stats_command(server->volumes[request.volume], stats_command_id(opcode_commands[request.opcode]),
+                      stats_clock() - start);
+    }
+    return result;
+}
+
+/*
+ * Runs one request and sends its reply.
+ * Returns 0, or -1 when the connection has to be closed.
+ */
+static int handle_request(SERVER *server, SESSION *session, SERVER_REQUEST *request, char *first, char *second,
+                          int fd) {
+    char *output = NULL;
+    char target[PATH_MAX];
+    bool failed = true;
+    switch (request->opcode) {
+        case SERVER_LS:
+            output = ls(session, first);
+            if (output == NULL) {
+                return send_reply(fd, SERVER_ERROR, "No such directory\n", 18);
+            }
+            failed = false;
+            break;
+        case SERVER_STAT:
+            output = file_stat(session, first);
+            failed = strncmp(output, "record", 6) != 0;
+            break;
+        case SERVER_FIND:
+            if (first == NULL) {
+                return send_reply(fd, SERVER_ERROR, "find require pattern argument\n", 30);
+            }
+            output = find(session->g_info, first);
+            failed = strncmp(output, "ERROR", 5) == 0;
+            break;
+        case SERVER_CAT:
+            if (first == NULL) {
+                return send_reply(fd, SERVER_ERROR, "cat require path argument\n", 26);
+            }
+            return send_file(session, first, fd);
+        case SERVER_CP:
+            if (first == NULL || second == NULL) {
+                return send_reply(fd, SERVER_ERROR, "cp require from_path and to_path arguments\n", 43);
+            }
+            if (server->output_root == NULL) {
+                return send_reply(fd, SERVER_ERROR, "cp is disabled, the daemon has no output root\n", 46);
+            }
+            if (confine_target(server, second, target) == -1) {
+                return send_reply(fd, SERVER_ERROR, "Target is outside the output root\n", 34);
+            }
+            output = cp(session, first, target, request->flags & (CP_MIRROR | CP_DELETE | CP_REFLINK));
+            failed = strncmp(output, "Successfully", 12) != 0;
+            break;
+        case SERVER_CD:
+            if (first == NULL) {
+                return send_reply(fd, SERVER_ERROR, "cd require path argument\n", 25);
+            }
+            output = cd(session, first);
+            failed = output[0] != '\0';
+            break;
+        case SERVER_PWD:
+            output = pwd(session);
+            failed = false;
+            break;
+        default:
+            return send_reply(fd, SERVER_ERROR, "Wrong request\n", 14);
+    }
+    int result = send_reply(fd, failed ? SERVER_ERROR : SERVER_OK, output, strlen(output));
+    free(output);
+    return result;
+}
+
+/*
+ * Streams unnamed $DATA of the file at path block by block, the size is
+ * known before the first block is read.
+ */
+static int send_file(SESSION *session, char *path, int fd) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    INODE node;
+    if (resolve_path(session, path, &node) == -1) {
+        return send_reply(fd, SERVER_ERROR, "No such file or directory\n", 26);
+    }
+    if (node.type & MFT_RECORD_IS_DIRECTORY) {
+        return send_reply(fd, SERVER_ERROR, "It is directory\n", 16);
+    }
+    MAPPING_CHUNK_DATA *chunk_data = NULL;
+    if (read_file_data(g_info, &node, &chunk_data) == -1) {
+        return send_reply(fd, SERVER_ERROR, "ERROR: Can't read data\n", 23);
+    }
+    if (chunk_data->resident) {
+        int result = send_reply(fd, SERVER_OK, (char *) chunk_data->buf, chunk_data->length);
+        free_data_chunk(chunk_data);
+        return result;
+    }
+
+    SERVER_REPLY reply = {chunk_data->length, SERVER_OK, {0}};
+    int result = send_all(fd, &reply, sizeof(SERVER_REPLY));
+    uint64_t sent = 0;
+    while (result == 0 && sent < chunk_data->length && read_block_file(g_info, &chunk_data) == 0) {
+        uint64_t size = g_info->block_size_in_bytes;
+        if (size > chunk_data->length - sent) {
+            size = chunk_data->length - sent;
+        }
+        result = send_all(fd, chunk_data->buf, size);
+        sent += size;
+    }
+    if (sent != chunk_data->length) {
+        result = -1;
+    }
+    free_data_chunk(chunk_data);
+    return result;
+}
+
+static int send_reply(int fd, uint8_t status, const char *payload, uint64_t length) {
+    SERVER_REPLY reply = {length, status, {0}};
+    if (send_all(fd, &reply, sizeof(SERVER_REPLY)) == -1) {
+        return -1;
+    }
+    return send_all(fd, payload, length);
+}
+
+/* MSG_NOSIGNAL: a client that went away must not kill the daemon with SIGPIPE. */
+static int send_all(int fd, const void *buf, size_t length) {
+    const uint8_t *ptr = buf;
+    while (length > 0) {
+        ssize_t sent = send(fd, ptr, length, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        ptr += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+/*
+ * Resolves a cp target of a client to a directory inside the output root.
+ * The target is taken relative to the root, with or without a leading '/',
+ * and has to exist, so ".." and symbolic links can be checked after they
+ * are resolved. Returns 0, or -1 when the target is not inside the root.
+ */
+static int confine_target(SERVER *server, const char *target, char *resolved) {
+    char joined[PATH_MAX];
+    if (snprintf(joined, sizeof(joined), "%s/%s", server->output_root, target) >= (int) sizeof(joined) ||
+        realpath(joined, resolved) == NULL) {
+        return -1;
+    }
+    size_t length = strlen(server->output_root);
+    if (length == 1) {
+        return 0;    // the root is "/"
+    }
+    return strncmp(resolved, server->output_root, length) == 0 &&
+           (resolved[length] == '\0' || resolved[length] == '/') ? 0 : -1;
+}
+
+/*
+ * Lets in the user running the daemon and root only, the daemon reads every
+ * volume it serves. A client that stops reading its reply is dropped instead
+ * of holding the worker.
+ */
+static int accept_client(int fd) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == -1 ||
+        (credentials.uid != geteuid() && credentials.uid != 0)) {
+        return -1;
+    }
+    struct timeval timeout = {SERVER_SEND_TIMEOUT, 0};
+    return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void free_connection(SERVER *server, SERVER_CONNECTION *connection) {
+    for (uint32_t i = 0; connection->sessions != NULL && i < server->volume_count; i++) {
+        close_session(connection->sessions[i]);
+    }
+    free(connection->sessions);
+    close(connection->fd);
+    free(connection);
+}
+
+/*
+ * Reads what the client sent of its next request without waiting, a client
+ * that stops in the middle of a request holds no worker. Bytes of the
+ * requests after it are left in the socket.
+ * Returns 1 when the request is complete, 0 when more is to come, -1 when the client is gone.
+ */
+static int receive_request(SERVER_CONNECTION *connection) {
+    while (true) {
+        uint8_t *ptr;
+        size_t length;
+        if (connection->received < sizeof(SERVER_REQUEST)) {
+            ptr = (uint8_t *) &connection->request + connection->received;
+            length = sizeof(SERVER_REQUEST) - connection->received;
+        } else {
+            uint32_t args_received = connection->received - sizeof(SERVER_REQUEST);
+            // a request that is too long is refused by the worker without its arguments
+            if (connection->request.length > SERVER_MAX_REQUEST || args_received == connection->request.length) {
+                return 1;
+            }
+            ptr = (uint8_t *) connection->args + args_received;
+            length = connection->request.length - args_received;
+        }
+        ssize_t received = recv(connection->fd, ptr, length, MSG_DONTWAIT);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        connection->received += received;
+    }
+}
@@ -0,0 +1,700 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/sidecar.h"
+
+#define SIDECAR_MAX_COMPONENTS 256
+#define FILE_NAME_MAX_SIZE 255
+#define ALIGN_8(x) (((x) + 7) & ~7ULL)
+
+// State of one sidecar build, filled by a single scan of $MFT
+typedef struct {
+    SIDECAR_RECORD *records;
+    uint64_t record_count;
+    uint8_t *dos_name;    // primary name of the record is a DOS name, a better one may follow
+
+    SIDECAR_PATH *paths;
+    uint64_t path_count;
+    uint64_t path_capacity;
+
+    char *names;
+    uint64_t names_size;
+    uint64_t names_capacity;
+
+    uint64_t *dir_hash;
+    uint8_t *dir_state;    // 0 - not computed, 1 - dir_hash is valid, 2 - not reachable from the root
+
+    USN_CURSOR cursor;
+} SIDECAR_BUILD;
+
+static int map_sidecar(GENERAL_INFORMATION *g_info, const char *path, SIDECAR **sidecar, bool *current);
+
+static bool names_inside(const uint8_t *base, const SIDECAR_HEADER *header);
+
+static int update_sidecar(GENERAL_INFORMATION *g_info, SIDECAR *sidecar, const char *path);
+
+static int rescan_record(GENERAL_INFORMATION *g_info, SIDECAR_BUILD *build, uint64_t mft_num);
+
+static void hash_paths(SIDECAR_BUILD *build, uint64_t first);
+
+static int merge_paths(SIDECAR_BUILD *build, uint64_t sorted);
+
+static void free_build(SIDECAR_BUILD *build);
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context);
+
+static int add_name(SIDECAR_BUILD *build, const char *name, uint8_t length, uint32_t *offset);
+
+static int resolve_dir(SIDECAR_BUILD *build, uint64_t mft_num, uint32_t depth);
+
+static int write_sidecar(GENERAL_INFORMATION *g_info, SIDECAR_BUILD *build, const char *path);
+
+static int compare_paths(const void *a, const void *b);
+
+static uint64_t fnv_update(uint64_t hash, const char *data, uint64_t length);
+
+/*
+ * Maps the sidecar at path. A sidecar written before the last changes of the
+ * volume is brought up to date from the change journal, a missing one or one
+ * the journal can't update is rebuilt from one scan of $MFT first. On success
+ * g_info->sidecar is set and $MFT is read through the decoded extent map
+ * stored in the sidecar.
+ * Returns 0 or -1.
+ */
+int open_sidecar(GENERAL_INFORMATION *g_info, const char *path) {
+    SIDECAR *sidecar = NULL;
+    bool current = false;
+    if (map_sidecar(g_info, path, &sidecar, &current) == 0 && !current) {
+        int updated = update_sidecar(g_info, sidecar, path);
+        close_sidecar(sidecar);
+        sidecar = NULL;
+        if (updated == 0 && map_sidecar(g_info, path, &sidecar, &current) == 0 && !current) {
+            close_sidecar(sidecar);
+            sidecar = NULL;
+        }
+    }
+    if (sidecar == NULL) {
+        if (build_sidecar(g_info, path) == -1 || map_sidecar(g_info, path, &sidecar, &current) == -1 || !current) {
+            close_sidecar(sidecar);
+            return -1;
+        }
+    }
+
+    SIDECAR_HEADER *header = sidecar->header;
+    if (header->extent_count > 0) {
+        EXTENT_MAP *map = calloc(1, sizeof(EXTENT_MAP));
+        if (map != NULL && (map->segments = calloc(1, sizeof(EXTENT_SEGMENT))) != NULL) {
+            map->segment_count = 1;
+            map->segments[0].extents = malloc(header->extent_count * sizeof(EXTENT));
+        }
+        if (map == NULL || map->segments == NULL || map->segments[0].extents == NULL) {
+            free_extent_map(map);
+            close_sidecar(sidecar);
+            return -1;
+        }
+        map->mft_num = FILE_MFT;
+        map->type = AT_DATA;
+        map->data_size = header->mft_data_size;
+        map->allocated_size = header->mft_allocated_size;
+        map->initialized_size = header->mft_initialized_size;
+        memcpy(map->segments[0].extents, sidecar->extents, header->extent_count * sizeof(EXTENT));
+        map->segments[0].extent_count = (uint32_t) header->extent_count;
+        map->complete = 1;
+        free_extent_map(g_info->mft_map);
+        g_info->mft_map = map;
+    }
+
+    close_sidecar(g_info->sidecar);
+    g_info->sidecar = sidecar;
+    return 0;
+}
+
+/*
+ * Writes a sidecar for the volume: $MFT runlist, type and size of every record
+ * and the path index. The file is written next to path and renamed over it.
+ * Returns 0 or -1.
+ */
+int build_sidecar(GENERAL_INFORMATION *g_info, const char *path) {
+    SIDECAR_BUILD build;
+    memset(&build, 0, sizeof(SIDECAR_BUILD));
+    build.record_count = mft_record_count(g_info);
+    build.records = calloc(build.record_count, sizeof(SIDECAR_RECORD));
+    build.dos_name = calloc(build.record_count, 1);
+    build.dir_hash = calloc(build.record_count, sizeof(uint64_t));
+    build.dir_state = calloc(build.record_count, 1);
+    int result = -1;
+    if (build.records == NULL || build.dos_name == NULL || build.dir_hash == NULL || build.dir_state == NULL) {
+        goto end;
+    }
+
+    // taken before the scan, changes made during it are read again by the next update
+    if (read_usn_cursor(g_info, &build.cursor, NULL) == -1) {
+        memset(&build.cursor, 0, sizeof(USN_CURSOR));
+    }
+    if (scan_mft(g_info, scan_record, &build) == -1) {
+        goto end;
+    }
+
+    hash_paths(&build, 0);
+    qsort(build.paths, build.path_count, sizeof(SIDECAR_PATH), compare_paths);
+
+    result = write_sidecar(g_info, &build, path);
+
+    end:
+    free_build(&build);
+    return result;
+}
+
+/*
+ * Finds the mft record number of an absolute path ("/dir/file").
+ * Directories are matched by their primary names, the last component by any name.
+ * Returns the record number or -1.
+ */
+int64_t sidecar_lookup(SIDECAR *sidecar, const char *path) {
+    const char *components[SIDECAR_MAX_COMPONENTS];
+    uint32_t lengths[SIDECAR_MAX_COMPONENTS];
+    uint32_t count = 0;
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    const char *ptr = path;
+    while (*ptr != '\0') {
+        while (*ptr == '/') {
+            ptr++;
+        }
+        if (*ptr == '\0') {
+            break;
+        }
+        const char *end = strchr(ptr, '/');
+        uint32_t length = end ? (uint32_t) (end - ptr) : (uint32_t) strlen(ptr);
+        if (count == SIDECAR_MAX_COMPONENTS) {
+            return -1;
+        }
+        components[count] = ptr;
+        lengths[count] = length;
+        count++;
+        hash = fnv_update(hash, "/", 1);
+        hash = fnv_update(hash, ptr, length);
+        ptr += length;
+    }
+    if (count == 0) {
+        return FILE_root;
+    }
+
+    // lower bound of the hash
+    uint64_t low = 0;
+    uint64_t high = sidecar->header->path_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (sidecar->paths[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (uint64_t i = low; i < sidecar->header->path_count && sidecar->paths[i].hash == hash; i++) {
+        SIDECAR_PATH *entry = &sidecar->paths[i];
+        if (entry->name_length != lengths[count - 1] ||
+            memcmp(sidecar->names + entry->name_offset, components[count - 1], lengths[count - 1]) != 0) {
+            continue;
+        }
+        // walk the parents up to the root to rule out a hash collision
+        uint64_t dir = entry->parent;
+        bool match = true;
+        for (int32_t k = (int32_t) count - 2; k >= 0 && match; k--) {
+            const SIDECAR_RECORD *record = sidecar_record(sidecar, dir);
+            if (record == NULL || record->name_length != lengths[k] ||
+                memcmp(sidecar->names + record->name_offset, components[k], lengths[k]) != 0) {
+                match = false;
+                break;
+            }
+            dir = MREF(record->parent);
+        }
+        if (match && dir == FILE_root) {
+            return entry->mft_num;
+        }
+    }
+    return -1;
+}
+
+const SIDECAR_RECORD *sidecar_record(SIDECAR *sidecar, uint64_t mft_num) {
+    if (sidecar == NULL || mft_num >= sidecar->header->record_count) {
+        return NULL;
+    }
+    return &sidecar->records[mft_num];
+}
+
+void close_sidecar(SIDECAR *sidecar) {
+    if (sidecar == NULL) {
+        return;
+    }
+    munmap(sidecar->base, sidecar->length);
+    free(sidecar);
+}
+
+/* Every name of the records and paths ends inside the names section, before its last zero. */
+static bool names_inside(const uint8_t *base, const SIDECAR_HEADER *header) {
+    const SIDECAR_RECORD *records = (const SIDECAR_RECORD *) (base + header->records_offset);
+    const SIDECAR_PATH *paths = (const SIDECAR_PATH *) (base + header->paths_offset);
+    for (uint64_t i = 0; i < header->record_count; i++) {
+        if ((uint64_t) records[i].name_offset + records[i].name_length >= header->names_size) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->path_count; i++) {
+        if ((uint64_t) paths[i].name_offset + paths[i].name_length >= header->names_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Maps a sidecar of this volume. current is cleared when the volume was
+ * written since, the sidecar is mapped all the same.
+ */
+static int map_sidecar(GENERAL_INFORMATION *g_info, const char *path, SIDECAR **sidecar, bool *current) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (uint64_t) st.st_size < sizeof(SIDECAR_HEADER)) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    uint64_t length = st.st_size;
+    SIDECAR_HEADER *header = (SIDECAR_HEADER *) base;
+    uint64_t lsn = 0;
+    read_volume_lsn(g_info, &lsn);
+    bool valid = header->magic == SIDECAR_MAGIC && header->version == SIDECAR_VERSION &&
+                 header->header_size == sizeof(SIDECAR_HEADER) &&
+                 header->volume_serial_number == g_info->volume_serial_number &&
+                 header->mft_data_size == g_info->mft_map->data_size &&
+                 header->record_size == g_info->mft_record_size_in_bytes &&
+                 header->cluster_size == g_info->cluster_size_in_bytes &&
+                 header->record_count == mft_record_count(g_info);
+    // sections must lie inside the file, counts are compared by division so huge ones can't wrap
+    valid = valid && header->extents_offset <= length &&
+            header->extent_count <= (length - header->extents_offset) / sizeof(EXTENT) &&
+            header->records_offset <= length &&
+            header->record_count <= (length - header->records_offset) / sizeof(SIDECAR_RECORD) &&
+            header->paths_offset <= length &&
+            header->path_count <= (length - header->paths_offset) / sizeof(SIDECAR_PATH) &&
+            header->names_size > 0 && header->names_offset <= length &&
+            header->names_size <= length - header->names_offset &&
+            base[header->names_offset + header->names_size - 1] == '\0';
+    valid = valid && names_inside(base, header);
+    if (!valid) {
+        munmap(base, length);
+        return -1;
+    }
+
+    *sidecar = malloc(sizeof(SIDECAR));
+    if (*sidecar == NULL) {
+        munmap(base, length);
+        return -1;
+    }
+    *current = header->volume_lsn == lsn;
+    (*sidecar)->base = base;
+    (*sidecar)->length = length;
+    (*sidecar)->header = header;
+    (*sidecar)->extents = (EXTENT *) (base + header->extents_offset);
+    (*sidecar)->records = (SIDECAR_RECORD *) (base + header->records_offset);
+    (*sidecar)->paths = (SIDECAR_PATH *) (base + header->paths_offset);
+    (*sidecar)->names = (char *) (base + header->names_offset);
+    return 0;
+}
+
+/*
+ * Writes the sidecar again with the records changed since its journal cursor
+ * read from the volume and everything else taken over. Paths are hashed again
+ * only for the changed records, unless a directory changed.
+ * Returns 0, or -1 when the journal can't tell what changed.
+ */
+static int update_sidecar(GENERAL_INFORMATION *g_info, SIDECAR *sidecar, const char *path) {
+    SIDECAR_HEADER *header = sidecar->header;
+    // copied out of the packed header, the journal reader wants an aligned cursor
+    USN_CURSOR cursor = header->usn_cursor;
+    USN_CHANGES changes;
+    if (cursor.journal_id == 0 || read_usn_changes(g_info, &cursor, &changes) == -1) {
+        return -1;
+    }
+    if (changes.lost) {
+        free_usn_changes(&changes);
+        return -1;
+    }
+
+    SIDECAR_BUILD build;
+    memset(&build, 0, sizeof(SIDECAR_BUILD));
+    build.cursor = changes.cursor;
+    build.record_count = header->record_count;
+    build.records = malloc(build.record_count * sizeof(SIDECAR_RECORD));
+    build.dos_name = calloc(build.record_count, 1);
+    build.dir_hash = calloc(build.record_count, sizeof(uint64_t));
+    build.dir_state = calloc(build.record_count, 1);
+    build.names_capacity = header->names_size + 64 * 1024;
+    build.names = malloc(build.names_capacity);
+    build.path_capacity = header->path_count + 1024;
+    build.paths = malloc(build.path_capacity * sizeof(SIDECAR_PATH));
+    int result = -1;
+    if (build.records == NULL || build.dos_name == NULL || build.dir_hash == NULL || build.dir_state == NULL ||
+        build.names == NULL || build.paths == NULL) {
+        goto end;
+    }
+    memcpy(build.records, sidecar->records, build.record_count * sizeof(SIDECAR_RECORD));
+    memcpy(build.names, sidecar->names, header->names_size);
+    build.names_size = header->names_size;
+    // names of the changed records are added again by their scan, the rest keeps its place in the hash order
+    for (uint64_t i = 0; i < header->path_count; i++) {
+        if (find_usn_change(&changes, sidecar->paths[i].mft_num) == NULL) {
+            build.paths[build.path_count++] = sidecar->paths[i];
+        }
+    }
+    uint64_t sorted = build.path_count;
+
+    bool directories = false;
+    for (uint32_t i = 0; i < changes.count; i++) {
+        uint64_t mft_num = MREF(changes.changes[i].mft_reference);
+        if (i > 0 && mft_num == MREF(changes.changes[i - 1].mft_reference)) {
+            continue;
+        }
+        if (mft_num >= build.record_count) {
+            goto end;
+        }
+        directories = directories || (build.records[mft_num].flags & MFT_RECORD_IS_DIRECTORY);
+        memset(&build.records[mft_num], 0, sizeof(SIDECAR_RECORD));
+        if (rescan_record(g_info, &build, mft_num) == -1) {
+            goto end;
+        }
+        directories = directories || (build.records[mft_num].flags & MFT_RECORD_IS_DIRECTORY);
+    }
+
+    if (directories) {
+        // paths below a renamed or moved directory change as well
+        hash_paths(&build, 0);
+        qsort(build.paths, build.path_count, sizeof(SIDECAR_PATH), compare_paths);
+    } else {
+        hash_paths(&build, sorted);
+        if (merge_paths(&build, sorted) == -1) {
+            goto end;
+        }
+    }
+    result = write_sidecar(g_info, &build, path);
+
+    end:
+    free_build(&build);
+    free_usn_changes(&changes);
+    return result;
+}
+
+/* Passes a base record and the extension records of its attribute list to scan_record(). */
+static int rescan_record(GENERAL_INFORMATION *g_info, SIDECAR_BUILD *build, uint64_t mft_num) {
+    MFT_RECORD *record = malloc(g_info->mft_record_size_in_bytes);
+    if (record == NULL) {
+        return -1;
+    }
+    ATTR_RECORD *list_attr = NULL;
+    if (search_mft_record(g_info, (uint32_t) mft_num, &record) == -1 ||
+        scan_record(g_info, mft_num, record, build) == -1) {
+        free(record);
+        return -1;
+    }
+    // a record that is not in use or has no list is done
+    if (!(record->flags & MFT_RECORD_IN_USE) || record->base_mft_record != 0 ||
+        search_attr(g_info, AT_ATTRIBUTE_LIST, record, &list_attr) == -1 || list_attr == NULL) {
+        free(record);
+        return 0;
+    }
+    uint8_t *list;
+    uint64_t list_length;
+    if (read_attribute_list(g_info, list_attr, &list, &list_length) == -1) {
+        free(record);
+        return -1;
+    }
+    int result = 0;
+    uint64_t previous = mft_num;
+    uint8_t *ptr = list;
+    while (ptr + sizeof(ATTR_LIST_ENTRY) <= list + list_length && result == 0) {
+        ATTR_LIST_ENTRY *entry = (ATTR_LIST_ENTRY *) ptr;
+        if (entry->length == 0) {
+            break;
+        }
+        ptr += entry->length;
+        uint64_t extension = MREF(entry->mft_reference);
+        // entries of one extension record follow each other, the list is sorted by type
+        if (extension == mft_num || extension == previous) {
+            continue;
+        }
+        bool seen = false;
+        for (ATTR_LIST_ENTRY *other = (ATTR_LIST_ENTRY *) list; other != entry && !seen;
+             other = (ATTR_LIST_ENTRY *) ((uint8_t *) other + other->length)) {
+            seen = MREF(other->mft_reference) == extension;
+        }
+        previous = extension;
+        if (seen) {
+            continue;
+        }
+        if (search_mft_record(g_info, (uint32_t) extension, &record) == -1) {
+            result = -1;
+        } else if (MREF(record->base_mft_record) == mft_num) {
+            result = scan_record(g_info, extension, record, build);
+        }
+    }
+    free(list);
+    free(record);
+    return result;
+}
+
+/* Gives entries from first on the hash of their absolute path, names outside of the tree are dropped. */
+static void hash_paths(SIDECAR_BUILD *build, uint64_t first) {
+    uint64_t kept = first;
+    for (uint64_t i = first; i < build->path_count; i++) {
+        SIDECAR_PATH *entry = &build->paths[i];
+        if (entry->parent >= build->record_count || resolve_dir(build, entry->parent, 0) == -1) {
+            continue;
+        }
+        uint64_t hash = fnv_update(build->dir_hash[entry->parent], "/", 1);
+        entry->hash = fnv_update(hash, build->names + entry->name_offset, entry->name_length);
+        build->paths[kept++] = *entry;
+    }
+    build->path_count = kept;
+}
+
+/* Sorts the entries from sorted on and merges them with the sorted ones before. */
+static int merge_paths(SIDECAR_BUILD *build, uint64_t sorted) {
+    uint64_t added = build->path_count - sorted;
+    if (added == 0) {
+        return 0;
+    }
+    qsort(build->paths + sorted, added, sizeof(SIDECAR_PATH), compare_paths);
+    SIDECAR_PATH *paths = malloc(build->path_count * sizeof(SIDECAR_PATH));
+    if (paths == NULL) {
+        return -1;
+    }
+    uint64_t left = 0;
+    uint64_t right = sorted;
+    for (uint64_t i = 0; i < build->path_count; i++) {
+        if (right == build->path_count || (left < sorted && build->paths[left].hash <= build->paths[right].hash)) {
+            paths[i] = build->paths[left++];
+        } else {
+            paths[i] = build->paths[right++];
+        }
+    }
+    free(build->paths);
+    build->paths = paths;
+    build->path_capacity = build->path_count;
+    return 0;
+}
+
+static void free_build(SIDECAR_BUILD *build) {
+    free(build->records);
+    free(build->dos_name);
+    free(build->paths);
+    free(build->names);
+    free(build->dir_hash);
+    free(build->dir_state);
+}
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context) {
+    SIDECAR_BUILD *build = context;
+    if (!(record->flags & MFT_RECORD_IN_USE)) {
+        return 0;
+    }
+    // attributes of extension records belong to their base record
+    uint64_t target = record->base_mft_record ? MREF(record->base_mft_record) : mft_num;
+    if (target >= build->record_count) {
+        return 0;
+    }
+    SIDECAR_RECORD *entry = &build->records[target];
+    if (record->base_mft_record == 0) {
+        entry->flags = record->flags;
+        entry->sequence_number = record->sequence_number;
+    }
+
+    char name[FILE_NAME_MAX_SIZE + 1];
+    ATTR_RECORD *attr = NULL;
+    while ((attr = next_attr(g_info, record, attr, AT_UNUSED)) != NULL) {
+        if (attr->type == AT_FILE_NAME && !attr->non_resident) {
+            FILE_NAME_ATTR *file_name = (FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset);
+            if ((uint64_t) attr->value_offset + sizeof(FILE_NAME_ATTR) > attr->length ||
+                attr->value_offset + sizeof(FILE_NAME_ATTR) + file_name->file_name_length * 2 > attr->length) {
+                continue;
+            }
+            uint8_t length = convert_file_name(name, file_name) - 1;
+            uint32_t offset;
+            if (add_name(build, name, length, &offset) == -1) {
+                return -1;
+            }
+            bool dos = file_name->file_name_type == FILE_NAME_DOS;
+            if (entry->name_length == 0 || (build->dos_name[target] && !dos)) {
+                entry->parent = file_name->parent_directory;
+                entry->name_offset = offset;
+                entry->name_length = length;
+                build->dos_name[target] = dos;
+            }
+            // names hidden by read_directory are not indexed either
+            if (length == 0 || name[0] == '.' || name[0] == '$') {
+                continue;
+            }
+            if (build->path_count == build->path_capacity) {
+                build->path_capacity = build->path_capacity ? build->path_capacity * 2 : 1024;
+                SIDECAR_PATH *paths = realloc(build->paths, build->path_capacity * sizeof(SIDECAR_PATH));
+                if (paths == NULL) {
+                    return -1;
+                }
+                build->paths = paths;
+            }
+            SIDECAR_PATH *path = &build->paths[build->path_count++];
+            memset(path, 0, sizeof(SIDECAR_PATH));
+            path->mft_num = (uint32_t) target;
+            path->parent = (uint32_t) MREF(file_name->parent_directory);
+            path->name_offset = offset;
+            path->name_length = length;
+        } else if (attr->type == AT_DATA && attr->name_length == 0) {
+            if (!attr->non_resident) {
+                entry->size = attr->value_length;
+            } else if (attr->lowest_vcn == 0) {
+                entry->size = attr->data_size;
+            }
+        }
+    }
+    return 0;
+}
+
+static int add_name(SIDECAR_BUILD *build, const char *name, uint8_t length, uint32_t *offset) {
+    if (build->names_size + length + 1 > build->names_capacity) {
+        uint64_t capacity = build->names_capacity ? build->names_capacity * 2 : 64 * 1024;
+        char *names = realloc(build->names, capacity);
+        if (names == NULL || capacity > UINT32_MAX) {
+            return -1;
+        }
+        build->names = names;
+        build->names_capacity = capacity;
+    }
+    *offset = (uint32_t) build->names_size;
+    memcpy(build->names + build->names_size, name, length);
+    build->names[build->names_size + length] = '\0';
+    build->names_size += length + 1;
+    return 0;
+}
+
+/* Computes the path hash of a directory from the hashes of its parents. */
+static int resolve_dir(SIDECAR_BUILD *build, uint64_t mft_num, uint32_t depth) {
+    if (build->dir_state[mft_num] != 0) {
+        return build->dir_state[mft_num] == 1 ? 0 : -1;
+    }
+    if (mft_num == FILE_root) {
+        build->dir_hash[mft_num] = FNV_OFFSET_BASIS;
+        build->dir_state[mft_num] = 1;
+        return 0;
+    }
+
+    SIDECAR_RECORD *record = &build->records[mft_num];
+    uint64_t parent = MREF(record->parent);
+    if (depth > SIDECAR_MAX_DEPTH || !(record->flags & MFT_RECORD_IS_DIRECTORY) || record->name_length == 0 ||
+        parent >= build->record_count || parent == mft_num || resolve_dir(build, parent, depth + 1) == -1) {
+        build->dir_state[mft_num] = 2;
+        return -1;
+    }
+    uint64_t hash = fnv_update(build->dir_hash[parent], "/", 1);
+    build->dir_hash[mft_num] = fnv_update(hash, build->names + record->name_offset, record->name_length);
+    build->dir_state[mft_num] = 1;
+    return 0;
+}
+
+static int write_sidecar(GENERAL_INFORMATION *g_info, SIDECAR_BUILD *build, const char *path) {
+    // decoded runlist of $MFT, segments split by an attribute list are loaded here
+    uint64_t cluster_size = g_info->cluster_size_in_bytes;
+    uint64_t clusters = (g_info->mft_map->allocated_size + cluster_size - 1) / cluster_size;
+    uint64_t extent_count = 0;
+    uint64_t extent_capacity = 16;
+    EXTENT *extents = malloc(extent_capacity * sizeof(EXTENT));
+    EXTENT extent;
+    for (uint64_t vcn = 0; vcn < clusters; vcn = extent.vcn + extent.length) {
+        if (lookup_vcn(g_info, g_info->mft_map, vcn, &extent) == -1) {
+            break;
+        }
+        if (extent_count == extent_capacity) {
+            extent_capacity *= 2;
+            extents = realloc(extents, extent_capacity * sizeof(EXTENT));
+        }
+        extents[extent_count++] = extent;
+    }
+
+    SIDECAR_HEADER header;
+    memset(&header, 0, sizeof(SIDECAR_HEADER));
+    header.magic = SIDECAR_MAGIC;
+    header.version = SIDECAR_VERSION;
+    header.header_size = sizeof(SIDECAR_HEADER);
+    header.volume_serial_number = g_info->volume_serial_number;
+    header.mft_data_size = g_info->mft_map->data_size;
+    uint64_t lsn = 0;
+    read_volume_lsn(g_info, &lsn);
+    header.volume_lsn = lsn;
+    header.record_size = g_info->mft_record_size_in_bytes;
+    header.cluster_size = g_info->cluster_size_in_bytes;
+    header.mft_allocated_size = g_info->mft_map->allocated_size;
+    header.mft_initialized_size = g_info->mft_map->initialized_size;
+    header.extent_count = extent_count;
+    header.extents_offset = ALIGN_8(sizeof(SIDECAR_HEADER));
+    header.record_count = build->record_count;
+    header.records_offset = ALIGN_8(header.extents_offset + extent_count * sizeof(EXTENT));
+    header.path_count = build->path_count;
+    header.paths_offset = ALIGN_8(header.records_offset + build->record_count * sizeof(SIDECAR_RECORD));
+    header.names_size = build->names_size ? build->names_size : 1;
+    header.names_offset = ALIGN_8(header.paths_offset + build->path_count * sizeof(SIDECAR_PATH));
+    header.usn_cursor = build->cursor;
+
+    char *tmp_path = malloc(strlen(path) + 8);
+    sprintf(tmp_path, "%s.tmp", path);
+    int fd = open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    int result = fd == -1 ? -1 : 0;
+    char zero = '\0';
+    if (result == 0 &&
+        (pwrite(fd, &header, sizeof(SIDECAR_HEADER), 0) != sizeof(SIDECAR_HEADER) ||
+         pwrite(fd, extents, extent_count * sizeof(EXTENT), (off_t) header.extents_offset) !=
+         (ssize_t) (extent_count * sizeof(EXTENT)) ||
+         pwrite(fd, build->records, build->record_count * sizeof(SIDECAR_RECORD), (off_t) header.records_offset) !=
+         (ssize_t) (build->record_count * sizeof(SIDECAR_RECORD)) ||
+         pwrite(fd, build->paths, build->path_count * sizeof(SIDECAR_PATH), (off_t) header.paths_offset) !=
+         (ssize_t) (build->path_count * sizeof(SIDECAR_PATH)) ||
+         pwrite(fd, build->names_size ? build->names : &zero, header.names_size, (off_t) header.names_offset) !=
+         (ssize_t) header.names_size)) {
+        result = -1;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (result == 0 && rename(tmp_path, path) == -1) {
+        result = -1;
+    }
+    if (result == -1) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(extents);
+    return result;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    uint64_t left = ((const SIDECAR_PATH *) a)->hash;
+    uint64_t right = ((const SIDECAR_PATH *) b)->hash;
+    return (left > right) - (left < right);
+}
+
+static uint64_t fnv_update(uint64_t hash, const char *data, uint64_t length) {
+    for (uint64_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../inc/stats.h"
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {"read calls", "read bytes", "write calls", "write bytes",
+                                                         "records", "map hits", "map misses", "index blocks",
+                                                         "allocations"};
+
+static const char *command_names[STATS_COMMAND_COUNT] = {"ls", "cd", "pwd", "cp", "tar", "stat", "cat", "find", "du",
+                                                         "bitmap", "undelete", "journal"};
+
+static const char *latency_names[STATS_LATENCY_COUNT] = {"ls", "cd", "cp", "record", "read"};
+
+/* Commands with a latency histogram of their own, -1 for the others. */
+static const int command_latencies[STATS_COMMAND_COUNT] = {STATS_LATENCY_LS, STATS_LATENCY_CD, -1, STATS_LATENCY_CP,
+                                                           -1, -1, -1, -1, -1, -1, -1, -1};
+
+static uint32_t next_shard = 0;
+static __thread uint32_t thread_shard = 0;    // shard number + 1, 0 until the first update
+
+VOLUME_STATS *create_stats(void) {
+    VOLUME_STATS *stats = aligned_alloc(STATS_CACHE_LINE, sizeof(VOLUME_STATS));
+    if (stats == NULL) {
+        return NULL;
+    }
+    memset(stats, 0, sizeof(VOLUME_STATS));
+    stats->reset_time = stats_clock();
+    return stats;
+}
+
+void free_stats(VOLUME_STATS *stats) {
+    free(stats);
+}
+
+/* Monotonic time in nanoseconds. */
+uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static STATS_SHARD *own_shard(VOLUME_STATS *stats) {
+    if (thread_shard == 0) {
+        thread_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % STATS_SHARDS + 1;
+    }
+    return &stats->shards[thread_shard - 1];
+}
+
+void stats_add(GENERAL_INFORMATION *g_info, STATS_COUNTERS counter, uint64_t value) {
+    if (g_info->stats == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&own_shard(g_info->stats)->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/* Number of a counted command, -1 for commands that are not counted. */
+int stats_command_id(const char *name) {
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++) {
+        if (strcmp(name, command_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Bucket of a latency: exact below STATS_SUB_BUCKETS, then STATS_SUB_BUCKETS per power of two. */
+static uint32_t latency_bucket(uint64_t nanoseconds) {
+    if (nanoseconds < STATS_SUB_BUCKETS) {
+        return (uint32_t) nanoseconds;
+    }
+    uint32_t exponent = 63 - (uint32_t) __builtin_clzll(nanoseconds);
+    if (exponent > STATS_MAX_EXPONENT) {
+        return STATS_BUCKETS - 1;
+    }
+    uint32_t sub_bucket = (uint32_t) (nanoseconds >> (exponent - STATS_SUB_BUCKET_BITS)) - STATS_SUB_BUCKETS;
+    return STATS_SUB_BUCKETS + (exponent - STATS_SUB_BUCKET_BITS) * STATS_SUB_BUCKETS + sub_bucket;
+}
+
+/* Largest latency that falls in a bucket. */
+static uint64_t bucket_limit(uint32_t bucket) {
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint32_t exponent = (bucket - STATS_SUB_BUCKETS) / STATS_SUB_BUCKETS + STATS_SUB_BUCKET_BITS;
+    uint64_t sub_bucket = bucket % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS;
+    return ((sub_bucket + 1) << (exponent - STATS_SUB_BUCKET_BITS)) - 1;
+}
+
+void stats_latency(GENERAL_INFORMATION *g_info, STATS_LATENCIES operation, uint64_t nanoseconds) {
+    if (g_info->stats == NULL) {
+        return;
+    }
+    STATS_HISTOGRAM *histogram = &own_shard(g_info->stats)->latency[operation];
+    __atomic_fetch_add(&histogram->buckets[latency_bucket(nanoseconds)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, nanoseconds, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (nanoseconds > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, nanoseconds, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_command(GENERAL_INFORMATION *g_info, STATS_COMMANDS command, uint64_t nanoseconds) {
+    if (g_info->stats == NULL) {
+        return;
+    }
+    STATS_SHARD *shard = own_shard(g_info->stats);
+    __atomic_fetch_add(&shard->calls[command], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->nanoseconds[command], nanoseconds, __ATOMIC_RELAXED);
+    if (command_latencies[command] != -1) {
+        stats_latency(g_info, command_latencies[command], nanoseconds);
+    }
+}
+
+static uint64_t latency_count(const STATS_HISTOGRAM *histogram) {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++) {
+        count += histogram->buckets[i];
+    }
+    return count;
+}
+
+/*
+ * Latency below which the given percent of the values are, as the upper
+ * bound of its bucket but never above the largest value. 0 when empty.
+ */
+uint64_t latency_percentile(const STATS_HISTOGRAM *histogram, double percentile) {
+    uint64_t count = latency_count(histogram);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+ * Sums the shards. Threads may update them meanwhile, every counter is read
+ * atomically but the snapshot as a whole is not.
+ */
+void read_stats(GENERAL_INFORMATION *g_info, STATS_SNAPSHOT *snapshot) {
+    memset(snapshot, 0, sizeof(STATS_SNAPSHOT));
+    VOLUME_STATS *stats = g_info->stats;
+    if (stats == NULL) {
+        return;
+    }
+    for (uint32_t s = 0; s < STATS_SHARDS; s++) {
+        STATS_SHARD *shard = &stats->shards[s];
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            snapshot->counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < STATS_COMMAND_COUNT; i++) {
+            snapshot->calls[i] += __atomic_load_n(&shard->calls[i], __ATOMIC_RELAXED);
+            snapshot->nanoseconds[i] += __atomic_load_n(&shard->nanoseconds[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < STATS_LATENCY_COUNT; i++) {
+            STATS_HISTOGRAM *histogram = &shard->latency[i];
+            for (uint32_t b = 0; b < STATS_BUCKETS; b++) {
+                snapshot->latency[i].buckets[b] += __atomic_load_n(&histogram->buckets[b], __ATOMIC_RELAXED);
+            }
+            snapshot->latency[i].sum += __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+            uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+            if (max > snapshot->latency[i].max) {
+                snapshot->latency[i].max = max;
+            }
+        }
+    }
+    snapshot->elapsed = stats_clock() - __atomic_load_n(&stats->reset_time, __ATOMIC_RELAXED);
+}
+
+void reset_stats(GENERAL_INFORMATION *g_info) {
+    VOLUME_STATS *stats = g_info->stats;
+    if (stats == NULL) {
+        return;
+    }
+    for (uint32_t s = 0; s < STATS_SHARDS; s++) {
+        STATS_SHARD *shard = &stats->shards[s];
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            __atomic_store_n(&shard->counters[i], 0, __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < STATS_COMMAND_COUNT; i++) {
+            __atomic_store_n(&shard->calls[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&shard->nanoseconds[i], 0, __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < STATS_LATENCY_COUNT; i++) {
+            STATS_HISTOGRAM *histogram = &shard->latency[i];
+            for (uint32_t b = 0; b < STATS_BUCKETS; b++) {
+                __atomic_store_n(&histogram->buckets[b], 0, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&histogram->sum, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&histogram->max, 0, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&stats->reset_time, stats_clock(), __ATOMIC_RELAXED);
+}
+
+/*
+ * Text of a snapshot: every counter, then calls, total and average wall time
+ * of the commands that ran. Returns a malloc'd string.
+ */
+char *format_stats(const STATS_SNAPSHOT *snapshot) {
+    size_t size = 128 + (STATS_COUNTER_COUNT + STATS_COMMAND_COUNT) * 96;
+    char *output = malloc(size);
+    size_t length = (size_t) snprintf(output, size, "since reset  %.3f s\n", (double) snapshot->elapsed / 1e9);
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        length += (size_t) snprintf(output + length, size - length, "%-12s %lu\n", counter_names[i],
+                                    snapshot->counters[i]);
+    }
+    uint64_t lookups = snapshot->counters[STATS_MAP_HITS] + snapshot->counters[STATS_MAP_MISSES];
+    if (lookups > 0) {
+        length += (size_t) snprintf(output + length, size - length, "map hit rate %.1f%%\n",
+                                    100.0 * (double) snapshot->counters[STATS_MAP_HITS] / (double) lookups);
+    }
+    bool header = false;
+    for (int i = 0; i < STATS_COMMAND_COUNT; i++) {
+        if (snapshot->calls[i] == 0) {
+            continue;
+        }
+        if (!header) {
+            length += (size_t) snprintf(output + length, size - length, "command      calls     total ms    avg ms\n");
+            header = true;
+        }
+        length += (size_t) snprintf(output + length, size - length, "%-12s %-9lu %-11.3f %.3f\n", command_names[i],
+                                    snapshot->calls[i], (double) snapshot->nanoseconds[i] / 1e6,
+                                    (double) snapshot->nanoseconds[i] / 1e6 / (double) snapshot->calls[i]);
+    }
+    return output;
+}
+
+/*
+ * Percentiles of every operation that ran, in microseconds, or as JSON with
+ * nanoseconds and the non empty buckets as [upper bound, count] pairs.
+ * Returns a malloc'd string.
+ */
+char *format_latency(const STATS_SNAPSHOT *snapshot, bool json) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    static const char *percentile_names[] = {"p50", "p90", "p99", "p99.9"};
+    size_t size = 256 + STATS_LATENCY_COUNT * 256;
+    if (json) {
+        for (int i = 0; i < STATS_LATENCY_COUNT; i++) {
+            for (uint32_t b = 0; b < STATS_BUCKETS; b++) {
+                size += snapshot->latency[i].buckets[b] > 0 ? 48 : 0;
+            }
+        }
+    }
+    char *output = malloc(size);
+    size_t length = 0;
+    if (!json) {
+        length += (size_t) snprintf(output + length, size - length,
+                                    "operation  count      mean us   p50 us    p90 us    p99 us    p99.9 us  max us\n");
+    } else {
+        length += (size_t) snprintf(output + length, size - length, "{");
+    }
+    bool first = true;
+    for (int i = 0; i < STATS_LATENCY_COUNT; i++) {
+        const STATS_HISTOGRAM *histogram = &snapshot->latency[i];
+        uint64_t count = latency_count(histogram);
+        if (count == 0) {
+            continue;
+        }
+        bool comma = !first;
+        first = false;
+        if (!json) {
+            length += (size_t) snprintf(output + length, size - length, "%-10s %-10lu %-9.1f", latency_names[i], count,
+                                        (double) histogram->sum / 1e3 / (double) count);
+            for (int p = 0; p < 4; p++) {
+                length += (size_t) snprintf(output + length, size - length, " %-9.1f",
+                                            (double) latency_percentile(histogram, percentiles[p]) / 1e3);
+            }
+            length += (size_t) snprintf(output + length, size - length, " %.1f\n", (double) histogram->max / 1e3);
+            continue;
+        }
+        length += (size_t) snprintf(output + length, size - length, "%s\"%s\":{\"count\":%lu,\"min\":%lu,\"mean\":%lu",
+                                    comma ? "," : "", latency_names[i], count, latency_percentile(histogram, 0),
+                                    histogram->sum / count);
+        for (int p = 0; p < 4; p++) {
+            length += (size_t) snprintf(output + length, size - length, ",\"%s\":%lu", percentile_names[p],
+                                        latency_percentile(histogram, percentiles[p]));
+        }
+        length += (size_t) snprintf(output + length, size - length, ",\"max\":%lu,\"buckets\":[", histogram->max);
+        bool first_bucket = true;
+        for (uint32_t b = 0; b < STATS_BUCKETS; b++) {
+            if (histogram->buckets[b] > 0) {
+                length += (size_t) snprintf(output + length, size - length, "%s[%lu,%lu]", first_bucket ? "" : ",",
+                                            bucket_limit(b), histogram->buckets[b]);
+                first_bucket = false;
+            }
+        }
+        length += (size_t) snprintf(output + length, size - length, "]}");
+    }
+    if (json) {
+        snprintf(output + length, size - length, "}");
+    } else if (first) {
+        snprintf(output, size, "no operations since reset\n");
+    }
+    return output;
+}
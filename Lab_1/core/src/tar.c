@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <stdbool.h>
+#include "../inc/ntfs.h"
+#include "../inc/tar.h"
+#include "../inc/mft_scan.h"
+
+// Part of a sparse file that is stored in the archive
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} TAR_REGION;
+
+static int export_node(GENERAL_INFORMATION *g_info, INODE *node, const char *path, TAR_WRITER *writer);
+
+static int export_data(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, const char *path, uint64_t mtime,
+                       TAR_WRITER *writer);
+
+static int write_header(TAR_WRITER *writer, const char *path, char type, uint64_t size, uint64_t mtime,
+                        const char *pax, uint64_t pax_length);
+
+static int add_pax_record(char **records, uint64_t *length, const char *key, const char *value);
+
+static uint32_t find_regions(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, TAR_REGION **regions);
+
+static uint64_t read_mtime(GENERAL_INFORMATION *g_info, uint32_t mft_num);
+
+static int tar_write(TAR_WRITER *writer, const void *data, uint64_t length);
+
+static int tar_pad(TAR_WRITER *writer);
+
+static int tar_flush(TAR_WRITER *writer);
+
+/*
+ * Streams node and everything below it to fd as a POSIX pax archive.
+ * Names in the archive start with the name of node.
+ * Returns 0 on success or -1.
+ */
+int export_tar(GENERAL_INFORMATION *g_info, INODE *node, int fd) {
+    uint64_t size = budget_charge_up_to(g_info->budget, BUDGET_COPY_BUFFERS, TAR_BUFFER_SIZE, TAR_BLOCK_SIZE);
+    TAR_WRITER writer = {g_info, fd, malloc(size), 0, 0, size};
+    if (writer.buf == NULL) {
+        budget_release(g_info->budget, BUDGET_COPY_BUFFERS, size);
+        return -1;
+    }
+
+    int result = export_node(g_info, node, node->filename, &writer);
+    if (result == 0) {
+        // end of archive is marked by two zero blocks
+        uint8_t zero[2 * TAR_BLOCK_SIZE] = {0};
+        result = tar_write(&writer, zero, sizeof(zero));
+    }
+    if (result == 0) {
+        result = tar_flush(&writer);
+    }
+    free(writer.buf);
+    budget_release(g_info->budget, BUDGET_COPY_BUFFERS, size);
+    return result;
+}
+
+static int export_node(GENERAL_INFORMATION *g_info, INODE *node, const char *path, TAR_WRITER *writer) {
+    uint64_t mtime = read_mtime(g_info, node->mft_num);
+
+    if (!(node->type & MFT_RECORD_IS_DIRECTORY)) {
+        EXTENT_MAP *map = get_extent_map(g_info, node->mft_num, AT_DATA);
+        if (map == NULL) {
+            return -1;
+        }
+        int result = export_data(g_info, map, path, mtime, writer);
+        put_extent_map(map);
+        return result;
+    }
+
+    char *dir_path = malloc(strlen(path) + 2);
+    sprintf(dir_path, "%s/", path);
+    int result = write_header(writer, dir_path, '5', 0, mtime, NULL, 0);
+    free(dir_path);
+    if (result == -1) {
+        return -1;
+    }
+
+    INODE *read_node = malloc(sizeof(INODE));
+    memcpy(read_node, node, sizeof(INODE));
+    read_node->filename = NULL;
+    read_node->next_inode = NULL;
+    if (read_directory(g_info, &read_node) == -1) {
+        free_inode(read_node);
+        return -1;
+    }
+    INODE *tmp = read_node->next_inode;
+    while (tmp != NULL && result == 0) {
+        char *child_path = malloc(strlen(path) + strlen(tmp->filename) + 2);
+        sprintf(child_path, "%s/%s", path, tmp->filename);
+        result = export_node(g_info, tmp, child_path, writer);
+        free(child_path);
+        tmp = tmp->next_inode;
+    }
+    free_inode(read_node);
+    return result;
+}
+
+static int export_data(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, const char *path, uint64_t mtime,
+                       TAR_WRITER *writer) {
+    TAR_REGION *regions = NULL;
+    uint32_t region_count = 0;
+    bool sparse = false;
+    if (!map->resident) {
+        region_count = find_regions(g_info, map, &regions);
+        if (region_count == (uint32_t) -1) {
+            return -1;
+        }
+        sparse = region_count != 1 || regions[0].offset != 0 || regions[0].length != map->data_size;
+    }
+
+    char *pax = NULL;
+    uint64_t pax_length = 0;
+    char *sparse_map = NULL;
+    uint64_t map_length = 0;
+    uint64_t stored = map->data_size;
+    char *name = (char *) path;
+    int result = 0;
+
+    if (sparse) {
+        // GNU sparse format 1.0: the data starts with a block-aligned decimal map of the stored regions
+        char number[64];
+        uint64_t capacity = TAR_BLOCK_SIZE + (uint64_t) region_count * 2 * 21;
+        sparse_map = calloc(1, capacity + TAR_BLOCK_SIZE);
+        map_length = sprintf(sparse_map, "%u\n", region_count);
+        stored = 0;
+        for (uint32_t i = 0; i < region_count; i++) {
+            map_length += sprintf(sparse_map + map_length, "%lu\n%lu\n", regions[i].offset, regions[i].length);
+            stored += regions[i].length;
+        }
+        map_length = (map_length + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        stored += map_length;
+
+        const char *base = strrchr(path, '/');
+        base = base ? base + 1 : path;
+        name = malloc(strlen(path) + 32);
+        sprintf(name, "%.*sGNUSparseFile.0/%s", (int) (base - path), path, base);
+
+        sprintf(number, "%lu", map->data_size);
+        result |= add_pax_record(&pax, &pax_length, "GNU.sparse.major", "1");
+        result |= add_pax_record(&pax, &pax_length, "GNU.sparse.minor", "0");
+        result |= add_pax_record(&pax, &pax_length, "GNU.sparse.name", path);
+        result |= add_pax_record(&pax, &pax_length, "GNU.sparse.realsize", number);
+    }
+
+    if (result == 0) {
+        result = write_header(writer, name, '0', stored, mtime, pax, pax_length);
+    }
+    if (result == 0 && sparse) {
+        result = tar_write(writer, sparse_map, map_length);
+    }
+
+    if (result == 0 && map->resident) {
+        result = tar_write(writer, map->resident_data, map->data_size);
+    }
+    for (uint32_t i = 0; i < region_count && result == 0; i++) {
+        uint64_t offset = regions[i].offset;
+        uint64_t end = regions[i].offset + regions[i].length;
+        while (offset < end) {
+            if (writer->used == writer->size && tar_flush(writer) == -1) {
+                result = -1;
+                break;
+            }
+            uint64_t size = writer->size - writer->used;
+            if (size > end - offset) {
+                size = end - offset;
+            }
+            if (read_attr_data(g_info, map, offset, writer->buf + writer->used, size) != (int64_t) size) {
+                result = -1;
+                break;
+            }
+            writer->used += size;
+            offset += size;
+        }
+    }
+    if (result == 0) {
+        result = tar_pad(writer);
+    }
+
+    if (name != path) {
+        free(name);
+    }
+    free(sparse_map);
+    free(pax);
+    free(regions);
+    return result;
+}
+
+static int write_header(TAR_WRITER *writer, const char *path, char type, uint64_t size, uint64_t mtime,
+                        const char *pax, uint64_t pax_length) {
+    char *records = NULL;
+    uint64_t records_length = 0;
+    if (pax_length > 0) {
+        records = malloc(pax_length);
+        memcpy(records, pax, pax_length);
+        records_length = pax_length;
+    }
+    if (strlen(path) >= TAR_NAME_SIZE && add_pax_record(&records, &records_length, "path", path) == -1) {
+        free(records);
+        return -1;
+    }
+    if (size > TAR_MAX_OCTAL_SIZE) {
+        char number[32];
+        sprintf(number, "%lu", size);
+        if (add_pax_record(&records, &records_length, "size", number) == -1) {
+            free(records);
+            return -1;
+        }
+    }
+
+    int result = 0;
+    if (records_length > 0) {
+        const char *base = strrchr(path, '/');
+        base = (base && base[1] != '\0') ? base + 1 : path;
+        char pax_name[TAR_NAME_SIZE];
+        snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", base);
+        result = write_header(writer, pax_name, 'x', records_length, mtime, NULL, 0);
+        if (result == 0) {
+            result = tar_write(writer, records, records_length);
+        }
+        if (result == 0) {
+            result = tar_pad(writer);
+        }
+    }
+    free(records);
+    if (result == -1) {
+        return -1;
+    }
+
+    TAR_HEADER header;
+    memset(&header, 0, sizeof(TAR_HEADER));
+    // a long path is in the pax header, readers without pax support get the beginning of it
+    strncpy(header.name, path, TAR_NAME_SIZE);
+    sprintf(header.mode, "%07o", type == '5' ? 0755 : 0644);
+    sprintf(header.uid, "%07o", 0);
+    sprintf(header.gid, "%07o", 0);
+    sprintf(header.size, "%011lo", size > TAR_MAX_OCTAL_SIZE ? 0 : size);
+    sprintf(header.mtime, "%011lo", mtime);
+    header.typeflag = type;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    uint32_t checksum = 0;
+    for (uint32_t i = 0; i < sizeof(TAR_HEADER); i++) {
+        checksum += ((uint8_t *) &header)[i];
+    }
+    sprintf(header.checksum, "%06o", checksum);
+    header.checksum[7] = ' ';
+
+    return tar_write(writer, &header, sizeof(TAR_HEADER));
+}
+
+/* Appends "<length> key=value\n", the length counts its own digits. */
+static int add_pax_record(char **records, uint64_t *length, const char *key, const char *value) {
+    uint64_t base = strlen(key) + strlen(value) + 3;
+    uint64_t size = base + 1;
+    char digits[32];
+    while (sprintf(digits, "%lu", size), base + strlen(digits) != size) {
+        size = base + strlen(digits);
+    }
+
+    char *result = realloc(*records, *length + size + 1);
+    if (result == NULL) {
+        return -1;
+    }
+    sprintf(result + *length, "%lu %s=%s\n", size, key, value);
+    *records = result;
+    *length += size;
+    return 0;
+}
+
+/*
+ * Collects the parts of a non-resident attribute that are not holes, clipped to
+ * data_size. A trailing hole is stored as an empty region at the end of the file.
+ * Returns the number of regions or (uint32_t) -1.
+ */
+static uint32_t find_regions(GENERAL_INFORMATION *g_info, EXTENT_MAP *map, TAR_REGION **regions) {
+    uint64_t cluster_size = g_info->cluster_size_in_bytes;
+    uint64_t clusters = (map->data_size + cluster_size - 1) / cluster_size;
+    uint32_t count = 0;
+    uint32_t capacity = 8;
+    *regions = malloc(capacity * sizeof(TAR_REGION));
+
+    uint64_t vcn = 0;
+    EXTENT extent;
+    while (vcn < clusters) {
+        if (lookup_vcn(g_info, map, vcn, &extent) == -1) {
+            free(*regions);
+            *regions = NULL;
+            return (uint32_t) -1;
+        }
+        uint64_t end = extent.vcn + extent.length;
+        if (extent.lcn != LCN_HOLE) {
+            uint64_t offset = vcn * cluster_size;
+            uint64_t length = (end > clusters ? clusters : end) * cluster_size - offset;
+            if (offset + length > map->data_size) {
+                length = map->data_size - offset;
+            }
+            if (count > 0 && (*regions)[count - 1].offset + (*regions)[count - 1].length == offset) {
+                (*regions)[count - 1].length += length;
+            } else {
+                if (count + 1 >= capacity) {
+                    capacity *= 2;
+                    *regions = realloc(*regions, capacity * sizeof(TAR_REGION));
+                }
+                (*regions)[count].offset = offset;
+                (*regions)[count].length = length;
+                count++;
+            }
+        }
+        vcn = end;
+    }
+
+    if (count == 0 || (*regions)[count - 1].offset + (*regions)[count - 1].length < map->data_size) {
+        (*regions)[count].offset = map->data_size;
+        (*regions)[count].length = 0;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Modification time in unix seconds from $STANDARD_INFORMATION, the copy in
+ * $FILE_NAME is only updated on rename and is the fallback. 0 if unknown.
+ */
+static uint64_t read_mtime(GENERAL_INFORMATION *g_info, uint32_t mft_num) {
+    MFT_RECORD *record = malloc(g_info->mft_record_size_in_bytes);
+    uint64_t time = 0;
+    if (search_mft_record(g_info, mft_num, &record) == -1) {
+        free(record);
+        return 0;
+    }
+    ATTR_RECORD *attr = next_attr(g_info, record, NULL, AT_STANDARD_INFORMATION);
+    if (attr != NULL && !attr->non_resident && attr->value_length >= STANDARD_INFORMATION_V1_SIZE &&
+        (uint64_t) attr->value_offset + attr->value_length <= attr->length) {
+        time = ((STANDARD_INFORMATION *) ((uint8_t *) attr + attr->value_offset))->last_data_change_time;
+    } else if ((attr = next_attr(g_info, record, NULL, AT_FILE_NAME)) != NULL && !attr->non_resident &&
+               (uint64_t) attr->value_offset + sizeof(FILE_NAME_ATTR) <= attr->length) {
+        time = ((FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset))->last_data_change_time;
+    }
+    free(record);
+    return time > NTFS_TIME_OFFSET ? (time - NTFS_TIME_OFFSET) / 10000000 : 0;
+}
+
+static int tar_write(TAR_WRITER *writer, const void *data, uint64_t length) {
+    const uint8_t *ptr = data;
+    while (length > 0) {
+        if (writer->used == writer->size && tar_flush(writer) == -1) {
+            return -1;
+        }
+        uint64_t size = writer->size - writer->used;
+        if (size > length) {
+            size = length;
+        }
+        memcpy(writer->buf + writer->used, ptr, size);
+        writer->used += size;
+        ptr += size;
+        length -= size;
+    }
+    return 0;
+}
+
+static int tar_pad(TAR_WRITER *writer) {
+    uint64_t position = writer->written + writer->used;
+    uint8_t zero[TAR_BLOCK_SIZE] = {0};
+    if (position % TAR_BLOCK_SIZE == 0) {
+        return 0;
+    }
+    return tar_write(writer, zero, TAR_BLOCK_SIZE - position % TAR_BLOCK_SIZE);
+}
+
+static int tar_flush(TAR_WRITER *writer) {
+    uint64_t done = 0;
+    while (done < writer->used) {
+        ssize_t written = write(writer->fd, writer->buf + done, writer->used - done);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += written;
+        stats_add(writer->g_info, STATS_WRITE_CALLS, 1);
+        stats_add(writer->g_info, STATS_WRITE_BYTES, (uint64_t) written);
+    }
+    writer->written += writer->used;
+    writer->used = 0;
+    return 0;
+}
@@ -0,0 +1,287 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "../inc/ntfs.h"
+#include "../inc/mft_scan.h"
+#include "../inc/bitmap.h"
+#include "../inc/extract.h"
+#include "../inc/undelete.h"
+
+#define FILE_NAME_MAX_SIZE 255
+
+// read only while the threads run, except dir_sequence where every thread writes its own records
+typedef struct {
+    const uint8_t *bitmap;
+    uint64_t clusters;
+    uint32_t cluster_size;
+    uint32_t *dir_sequence;    // sequence number + 1 of directories in use, 0 otherwise
+    uint64_t record_count;
+} UNDELETE_SHARED;
+
+typedef struct {
+    UNDELETE_SHARED *shared;
+    DELETED_LIST list;
+} UNDELETE_CONTEXT;
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context);
+
+static ATTR_RECORD *read_names(GENERAL_INFORMATION *g_info, MFT_RECORD *record, char *name, uint64_t *parent);
+
+static int check_data(const UNDELETE_SHARED *shared, ATTR_RECORD *data, DELETED_FILE *file);
+
+static int add_deleted_file(DELETED_LIST *list, const DELETED_FILE *file);
+
+static int compare_files(const void *a, const void *b);
+
+/*
+ * Streams $MFT and collects deleted files whose $DATA is resident or lies in
+ * clusters that are all still free in $Bitmap. Records are decoded by threads
+ * (scan_threads() when threads is 0) while the next batch is read.
+ * list is sorted by score, then by size.
+ * Returns 0 or -1.
+ */
+int find_deleted_files(GENERAL_INFORMATION *g_info, uint32_t threads, DELETED_LIST *list) {
+    memset(list, 0, sizeof(DELETED_LIST));
+    if (threads == 0) {
+        threads = scan_threads();
+    }
+    if (threads > MFT_SCAN_MAX_THREADS) {
+        threads = MFT_SCAN_MAX_THREADS;
+    }
+    UNDELETE_SHARED shared;
+    shared.cluster_size = g_info->cluster_size_in_bytes;
+    shared.record_count = mft_record_count(g_info);
+    shared.bitmap = load_bitmap(g_info, &shared.clusters);
+    shared.dir_sequence = calloc(shared.record_count, sizeof(uint32_t));
+    UNDELETE_CONTEXT *contexts = calloc(threads, sizeof(UNDELETE_CONTEXT));
+    void **pointers = calloc(threads, sizeof(void *));
+    int result = -1;
+    if (shared.bitmap == NULL || shared.dir_sequence == NULL || contexts == NULL || pointers == NULL) {
+        goto end;
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        contexts[t].shared = &shared;
+        pointers[t] = &contexts[t];
+    }
+    result = scan_mft_parallel(g_info, scan_record, pointers, threads);
+
+    for (uint32_t t = 0; t < threads; t++) {
+        DELETED_LIST *part = &contexts[t].list;
+        for (uint32_t i = 0; i < part->count && result == 0; i++) {
+            DELETED_FILE *file = &part->files[i];
+            // the directory is gone or now holds something else
+            uint64_t parent = MREF(file->parent);
+            if (file->name != NULL &&
+                (parent >= shared.record_count || shared.dir_sequence[parent] != MSEQNO(file->parent) + 1u)) {
+                file->score = file->score > 20 ? file->score - 20 : 0;
+            }
+            if (add_deleted_file(list, file) == -1) {
+                result = -1;
+                break;
+            }
+            file->name = NULL;
+        }
+        for (uint32_t i = 0; i < part->count; i++) {
+            free(part->files[i].name);
+        }
+        free(part->files);
+    }
+    if (result == 0) {
+        qsort(list->files, list->count, sizeof(DELETED_FILE), compare_files);
+    } else {
+        free_deleted_list(list);
+    }
+
+    end:
+    free((void *) shared.bitmap);
+    free(shared.dir_sequence);
+    free(contexts);
+    free(pointers);
+    return result;
+}
+
+/*
+ * Writes the data of a deleted record into the directory to_path under its
+ * last name, or mft_<number> when it has none, through the same extraction
+ * path as cp. The record must still be a deleted base record.
+ * Returns 0 or -1.
+ */
+int recover_file(GENERAL_INFORMATION *g_info, uint32_t mft_num, const char *to_path) {
+    MFT_RECORD *record = malloc(g_info->mft_record_size_in_bytes);
+    if (record == NULL) {
+        return -1;
+    }
+    char name[FILE_NAME_MAX_SIZE + 1];
+    uint64_t parent = 0;
+    if (search_mft_record(g_info, mft_num, &record) == (uint64_t) -1 || (record->flags & MFT_RECORD_IN_USE) ||
+        (record->flags & MFT_RECORD_IS_DIRECTORY) || record->base_mft_record != 0 ||
+        read_names(g_info, record, name, &parent) == NULL) {
+        free(record);
+        return -1;
+    }
+    free(record);
+    if (parent == 0) {
+        sprintf(name, "mft_%u", mft_num);
+    }
+    char *path = malloc(strlen(to_path) + strlen(name) + 2);
+    if (path == NULL) {
+        return -1;
+    }
+    sprintf(path, "%s/%s", to_path, name);
+
+    EXTRACT_LIST list = {NULL, 0, 0};
+    int result = add_extract_entry(&list, mft_num, path);
+    if (result == 0) {
+        result = extract_files(g_info, &list);
+    }
+    free_extract_list(&list);
+    free(path);
+    return result;
+}
+
+void free_deleted_list(DELETED_LIST *list) {
+    for (uint32_t i = 0; i < list->count; i++) {
+        free(list->files[i].name);
+    }
+    free(list->files);
+    list->files = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static int scan_record(GENERAL_INFORMATION *g_info, uint64_t mft_num, MFT_RECORD *record, void *context) {
+    UNDELETE_CONTEXT *undelete = context;
+    UNDELETE_SHARED *shared = undelete->shared;
+    if (record->flags & MFT_RECORD_IN_USE) {
+        if ((record->flags & MFT_RECORD_IS_DIRECTORY) && record->base_mft_record == 0 &&
+            mft_num < shared->record_count) {
+            shared->dir_sequence[mft_num] = record->sequence_number + 1u;
+        }
+        return 0;
+    }
+    if (record->base_mft_record != 0 || (record->flags & MFT_RECORD_IS_DIRECTORY)) {
+        return 0;
+    }
+
+    DELETED_FILE file;
+    memset(&file, 0, sizeof(DELETED_FILE));
+    file.mft_num = (uint32_t) mft_num;
+    file.sequence_number = record->sequence_number;
+    char name[FILE_NAME_MAX_SIZE + 1];
+    ATTR_RECORD *data = read_names(g_info, record, name, &file.parent);
+    // without unnamed $DATA in the base record the runs sat in extension records, likely reused by now
+    if (data == NULL || check_data(shared, data, &file) == -1) {
+        return 0;
+    }
+
+    uint32_t penalty = file.fragments > 1 ? (file.fragments - 1) * UNDELETE_FRAGMENT_PENALTY : 0;
+    file.score = 100 - (penalty > UNDELETE_MAX_FRAGMENT_PENALTY ? UNDELETE_MAX_FRAGMENT_PENALTY : penalty);
+    if (file.parent != 0) {
+        file.name = malloc(strlen(name) + 1);
+        if (file.name == NULL) {
+            return -1;
+        }
+        strcpy(file.name, name);
+    } else {
+        file.score -= 20;
+    }
+    return add_deleted_file(&undelete->list, &file);
+}
+
+/*
+ * Copies the long name of the record into name and its parent reference into
+ * parent, which stays 0 without a name. A DOS name is only used when there is
+ * no other one.
+ * Returns the unnamed $DATA attribute or NULL.
+ */
+static ATTR_RECORD *read_names(GENERAL_INFORMATION *g_info, MFT_RECORD *record, char *name, uint64_t *parent) {
+    bool dos = false;
+    ATTR_RECORD *data = NULL;
+    ATTR_RECORD *attr = NULL;
+    while ((attr = next_attr(g_info, record, attr, AT_UNUSED)) != NULL) {
+        if (attr->type == AT_FILE_NAME && !attr->non_resident) {
+            FILE_NAME_ATTR *file_name = (FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset);
+            if ((uint64_t) attr->value_offset + sizeof(FILE_NAME_ATTR) > attr->length ||
+                attr->value_offset + sizeof(FILE_NAME_ATTR) + file_name->file_name_length * 2 > attr->length ||
+                file_name->file_name_length == 0 ||
+                (*parent != 0 && (!dos || file_name->file_name_type == FILE_NAME_DOS))) {
+                continue;
+            }
+            convert_file_name(name, file_name);
+            *parent = file_name->parent_directory;
+            dos = file_name->file_name_type == FILE_NAME_DOS;
+        } else if (attr->type == AT_DATA && attr->name_length == 0) {
+            data = attr;
+        }
+    }
+    return data;
+}
+
+/*
+ * Fills size, fragments and resident of the file.
+ * Returns 0 when the whole value can still be read or -1.
+ */
+static int check_data(const UNDELETE_SHARED *shared, ATTR_RECORD *data, DELETED_FILE *file) {
+    if (!data->non_resident) {
+        if ((uint64_t) data->value_offset + data->value_length > data->length) {
+            return -1;
+        }
+        file->resident = 1;
+        file->size = data->value_length;
+        return 0;
+    }
+    if (data->length < offsetof(ATTR_RECORD, non_resident_end) || data->lowest_vcn != 0 ||
+        data->mapping_pairs_offset >= data->length) {
+        return -1;
+    }
+    // the runlist has to cover the whole allocation, otherwise it continued in an extension record
+    uint64_t clusters = (data->allocated_size + shared->cluster_size - 1) / shared->cluster_size;
+    if (clusters > 0 && data->highest_vcn + 1 < clusters) {
+        return -1;
+    }
+    EXTENT *extents;
+    uint32_t count;
+    if (decode_runlist((uint8_t *) data + data->mapping_pairs_offset, (uint8_t *) data + data->length, 0, &extents,
+                       &count) == -1) {
+        return -1;
+    }
+    int result = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (extents[i].lcn == LCN_HOLE) {
+            continue;
+        }
+        file->fragments++;
+        if (!clusters_free(shared->bitmap, shared->clusters, (uint64_t) extents[i].lcn, extents[i].length)) {
+            result = -1;
+            break;
+        }
+    }
+    free(extents);
+    file->size = data->data_size;
+    return result;
+}
+
+static int add_deleted_file(DELETED_LIST *list, const DELETED_FILE *file) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+        DELETED_FILE *files = realloc(list->files, capacity * sizeof(DELETED_FILE));
+        if (files == NULL) {
+            return -1;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+    list->files[list->count++] = *file;
+    return 0;
+}
+
+static int compare_files(const void *a, const void *b) {
+    const DELETED_FILE *left = a;
+    const DELETED_FILE *right = b;
+    if (left->score != right->score) {
+        return left->score > right->score ? -1 : 1;
+    }
+    if (left->size != right->size) {
+        return left->size > right->size ? -1 : 1;
+    }
+    return (left->mft_num > right->mft_num) - (left->mft_num < right->mft_num);
+}
@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "../inc/ntfs.h"
+#include "../inc/usn_journal.h"
+
+typedef struct {
+    EXTENT_MAP *data;    // $J
+    USN_JOURNAL_MAX_DATA max;
+} USN_JOURNAL;
+
+static int open_journal(GENERAL_INFORMATION *g_info, USN_JOURNAL *journal);
+
+static int64_t find_entry(const uint8_t *ptr, const uint8_t *end, const char *name);
+
+static int parse_records(const uint8_t *buf, uint64_t length, uint64_t from, USN_CHANGES *changes);
+
+static int add_change(USN_CHANGES *changes, uint64_t mft_reference, uint32_t reason);
+
+static void merge_changes(USN_CHANGES *changes);
+
+static int compare_changes(const void *a, const void *b);
+
+/*
+ * Current position of the change journal: journal id and the usn the next
+ * record will get. Records before lowest_valid_usn (may be NULL) are gone.
+ * Returns 0 or -1 when the volume has no journal.
+ */
+int read_usn_cursor(GENERAL_INFORMATION *g_info, USN_CURSOR *cursor, int64_t *lowest_valid_usn) {
+    USN_JOURNAL journal;
+    if (open_journal(g_info, &journal) == -1) {
+        return -1;
+    }
+    cursor->journal_id = journal.max.journal_id;
+    cursor->next_usn = (int64_t) journal.data->data_size;
+    if (lowest_valid_usn != NULL) {
+        *lowest_valid_usn = journal.max.lowest_valid_usn;
+    }
+    free_extent_map(journal.data);
+    return 0;
+}
+
+/*
+ * Collects the files changed since the cursor from. Only the part of $J
+ * written after from is read, holes of the sparse stream are skipped.
+ * changes->cursor is where the next call should start.
+ * Returns 0 or -1.
+ */
+int read_usn_changes(GENERAL_INFORMATION *g_info, const USN_CURSOR *from, USN_CHANGES *changes) {
+    memset(changes, 0, sizeof(USN_CHANGES));
+    USN_JOURNAL journal;
+    if (open_journal(g_info, &journal) == -1) {
+        return -1;
+    }
+    EXTENT_MAP *data = journal.data;
+    changes->cursor.journal_id = journal.max.journal_id;
+    changes->cursor.next_usn = (int64_t) data->data_size;
+    if (from->journal_id != journal.max.journal_id || from->next_usn < journal.max.lowest_valid_usn ||
+        from->next_usn < 0 || (uint64_t) from->next_usn > data->data_size) {
+        changes->lost = 1;
+        free_extent_map(data);
+        return 0;
+    }
+
+    uint8_t *buf = malloc(USN_READ_SIZE);
+    if (buf == NULL) {
+        free_extent_map(data);
+        return -1;
+    }
+    uint64_t cluster_size = g_info->cluster_size_in_bytes;
+    uint64_t offset = (uint64_t) from->next_usn;
+    int result = 0;
+    while (offset < data->data_size) {
+        EXTENT extent;
+        if (lookup_vcn(g_info, data, offset / cluster_size, &extent) == -1) {
+            result = -1;
+            break;
+        }
+        if (extent.lcn == LCN_HOLE) {
+            offset = (extent.vcn + extent.length) * cluster_size;
+            continue;
+        }
+        // chunks start at a page, so no record is cut in two
+        uint64_t start = offset / USN_PAGE_SIZE * USN_PAGE_SIZE;
+        uint64_t length = data->data_size - start < USN_READ_SIZE ? data->data_size - start : USN_READ_SIZE;
+        if (read_attr_data(g_info, data, start, buf, length) != (int64_t) length ||
+            parse_records(buf, length, offset - start, changes) == -1) {
+            result = -1;
+            break;
+        }
+        offset = start + length;
+    }
+    free(buf);
+    free_extent_map(data);
+    if (result == -1) {
+        free_usn_changes(changes);
+        return -1;
+    }
+    merge_changes(changes);
+    return 0;
+}
+
+/*
+ * Returns the first change of record mft_num, whatever its sequence number,
+ * or NULL when the record did not change.
+ */
+const USN_CHANGE *find_usn_change(const USN_CHANGES *changes, uint64_t mft_num) {
+    uint32_t low = 0;
+    uint32_t high = changes->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (MREF(changes->changes[middle].mft_reference) < mft_num) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < changes->count && MREF(changes->changes[low].mft_reference) == mft_num) {
+        return &changes->changes[low];
+    }
+    return NULL;
+}
+
+void free_usn_changes(USN_CHANGES *changes) {
+    free(changes->changes);
+    changes->changes = NULL;
+    changes->count = 0;
+    changes->capacity = 0;
+}
+
+/* Finds $Extend/$UsnJrnl and loads $J and $Max. */
+static int open_journal(GENERAL_INFORMATION *g_info, USN_JOURNAL *journal) {
+    MFT_RECORD *record = malloc(g_info->mft_record_size_in_bytes);
+    if (record == NULL) {
+        return -1;
+    }
+    ATTR_RECORD *attr = NULL;
+    if (search_mft_record(g_info, FILE_Extend, &record) == -1 ||
+        search_attr(g_info, AT_INDEX_ROOT, record, &attr) == -1 || attr == NULL ||
+        (uint64_t) attr->value_offset + sizeof(INDEX_ROOT) > attr->length) {
+        free(record);
+        return -1;
+    }
+    INDEX_ROOT *index_root = (INDEX_ROOT *) ((uint8_t *) attr + attr->value_offset);
+    uint8_t *end = (uint8_t *) attr + attr->length;
+    uint8_t *index_end = (uint8_t *) &index_root->index + index_root->index.index_length;
+    int64_t mft_reference = find_entry((uint8_t *) &index_root->index + index_root->index.entries_offset,
+                                       index_end < end ? index_end : end, USN_JOURNAL_NAME);
+    bool large_index = index_root->index.ih_flags & LARGE_INDEX;
+    free(record);
+
+    // $Extend holds a handful of files, the index blocks are walked in order
+    if (mft_reference == -1 && large_index) {
+        EXTENT_MAP *map = get_extent_map(g_info, FILE_Extend, AT_INDEX_ALLOCATION);
+        uint8_t *block = map != NULL ? malloc(g_info->block_size_in_bytes) : NULL;
+        for (uint64_t offset = 0; block != NULL && offset + g_info->block_size_in_bytes <= map->data_size &&
+                                  mft_reference == -1; offset += g_info->block_size_in_bytes) {
+            if (read_attr_data(g_info, map, offset, block, g_info->block_size_in_bytes) !=
+                g_info->block_size_in_bytes || apply_fixups(block, g_info->block_size_in_bytes) == -1) {
+                continue;
+            }
+            INDEX_ALLOCATION *index_allocation = (INDEX_ALLOCATION *) block;
+            if (index_allocation->magic != magic_INDX) {
+                continue;
+            }
+            stats_add(g_info, STATS_INDEX_BLOCKS, 1);
+            index_end = (uint8_t *) &index_allocation->index + index_allocation->index.index_length;
+            end = block + g_info->block_size_in_bytes;
+            mft_reference = find_entry((uint8_t *) &index_allocation->index + index_allocation->index.entries_offset,
+                                       index_end < end ? index_end : end, USN_JOURNAL_NAME);
+        }
+        free(block);
+        put_extent_map(map);
+    }
+    if (mft_reference == -1) {
+        return -1;
+    }
+
+    EXTENT_MAP *max = get_stream_map(g_info, (uint32_t) MREF(mft_reference), USN_JOURNAL_MAX);
+    journal->data = get_stream_map(g_info, (uint32_t) MREF(mft_reference), USN_JOURNAL_DATA);
+    int result = max != NULL && journal->data != NULL && !journal->data->resident &&
+                 read_attr_data(g_info, max, 0, (uint8_t *) &journal->max, sizeof(USN_JOURNAL_MAX_DATA)) ==
+                 sizeof(USN_JOURNAL_MAX_DATA) ? 0 : -1;
+    free_extent_map(max);
+    if (result == -1) {
+        free_extent_map(journal->data);
+    }
+    return result;
+}
+
+/* Returns the mft reference of the index entry with the name or -1. */
+static int64_t find_entry(const uint8_t *ptr, const uint8_t *end, const char *name) {
+    size_t length = strlen(name);
+    while (ptr + offsetof(INDEX_ENTRY, key) <= end) {
+        const INDEX_ENTRY *entry = (const INDEX_ENTRY *) ptr;
+        if (entry->length == 0 || ptr + entry->length > end || (entry->ie_flags & INDEX_ENTRY_END)) {
+            break;
+        }
+        const FILE_NAME_ATTR *file_name = &entry->key.file_name;
+        if (entry->key_length >= sizeof(FILE_NAME_ATTR) && file_name->file_name_length == length &&
+            sizeof(FILE_NAME_ATTR) + length * 2 <= entry->key_length) {
+            bool match = true;
+            for (size_t i = 0; i < length && match; i++) {
+                match = file_name->file_name[i] == (uint8_t) name[i];
+            }
+            if (match) {
+                return (int64_t) entry->indexed_file;
+            }
+        }
+        ptr += entry->length;
+    }
+    return -1;
+}
+
+/* Adds the records of buf from offset from on, a zero length ends the records of a page. */
+static int parse_records(const uint8_t *buf, uint64_t length, uint64_t from, USN_CHANGES *changes) {
+    uint64_t position = from;
+    while (position + sizeof(uint32_t) <= length) {
+        uint64_t page_end = (position / USN_PAGE_SIZE + 1) * USN_PAGE_SIZE;
+        uint32_t record_length;
+        memcpy(&record_length, buf + position, sizeof(uint32_t));
+        if (record_length == 0 || record_length % 8 != 0 || position + record_length > page_end ||
+            position + record_length > length) {
+            // padding at the end of a page, or a damaged record: the next page starts clean
+            position = page_end;
+            continue;
+        }
+        const USN_RECORD_V2 *v2 = (const USN_RECORD_V2 *) (buf + position);
+        const USN_RECORD_V3 *v3 = (const USN_RECORD_V3 *) (buf + position);
+        uint64_t file = 0;
+        uint64_t parent = 0;
+        uint32_t reason = 0;
+        if (v2->major_version == 2 && record_length >= sizeof(USN_RECORD_V2)) {
+            file = v2->file_reference;
+            parent = v2->parent_reference;
+            reason = v2->reason;
+        } else if (v2->major_version == 3 && record_length >= sizeof(USN_RECORD_V3)) {
+            file = v3->file_reference[0];
+            parent = v3->parent_reference[0];
+            reason = v3->reason;
+        }
+        if (reason != 0) {
+            changes->records++;
+            if (add_change(changes, file, reason) == -1 ||
+                ((reason & USN_REASON_NAMESPACE_CHANGE) &&
+                 add_change(changes, parent, reason & USN_REASON_NAMESPACE_CHANGE) == -1)) {
+                return -1;
+            }
+        }
+        position += record_length;
+    }
+    return 0;
+}
+
+static int add_change(USN_CHANGES *changes, uint64_t mft_reference, uint32_t reason) {
+    // a file usually gets several records in a row
+    if (changes->count > 0 && changes->changes[changes->count - 1].mft_reference == mft_reference) {
+        changes->changes[changes->count - 1].reason |= reason;
+        return 0;
+    }
+    if (changes->count == changes->capacity) {
+        uint32_t capacity = changes->capacity ? changes->capacity * 2 : 1024;
+        USN_CHANGE *buf = realloc(changes->changes, capacity * sizeof(USN_CHANGE));
+        if (buf == NULL) {
+            return -1;
+        }
+        changes->changes = buf;
+        changes->capacity = capacity;
+    }
+    changes->changes[changes->count].mft_reference = mft_reference;
+    changes->changes[changes->count].reason = reason;
+    changes->count++;
+    return 0;
+}
+
+/* Sorts the changes and leaves one entry per reference. */
+static void merge_changes(USN_CHANGES *changes) {
+    if (changes->count == 0) {
+        return;
+    }
+    qsort(changes->changes, changes->count, sizeof(USN_CHANGE), compare_changes);
+    uint32_t kept = 0;
+    for (uint32_t i = 1; i < changes->count; i++) {
+        if (changes->changes[i].mft_reference == changes->changes[kept].mft_reference) {
+            changes->changes[kept].reason |= changes->changes[i].reason;
+        } else {
+            changes->changes[++kept] = changes->changes[i];
+        }
+    }
+    changes->count = kept + 1;
+}
+
+static int compare_changes(const void *a, const void *b) {
+    uint64_t left = ((const USN_CHANGE *) a)->mft_reference;
+    uint64_t right = ((const USN_CHANGE *) b)->mft_reference;
+    if (MREF(left) != MREF(right)) {
+        return MREF(left) < MREF(right) ? -1 : 1;
+    }
+    return (MSEQNO(left) > MSEQNO(right)) - (MSEQNO(left) < MSEQNO(right));
+}
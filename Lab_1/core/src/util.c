@@ -1,20 +1,97 @@
 #include <stdbool.h>
+#include <time.h>
 #include "../inc/util.h"
+#include "../inc/mft_scan.h"
 
 static int count_nodes(char *path) {
     char path_buf[512];
     strcpy(path_buf, path);
     int result = 0;
     char sep[2] = "/";
-    char *sub_dir = strtok(path_buf, sep);
+    char *save;
+    char *sub_dir = strtok_r(path_buf, sep, &save);
     while (sub_dir != NULL) {
         result++;
-        sub_dir = strtok(NULL, sep);
+        sub_dir = strtok_r(NULL, sep, &save);
     }
     return result;
 }
 
-static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **start_node, FIND_INFO **result) {
+/*
+ * Same result as find_node_by_name, but every component is looked up in the
+ * sidecar path index instead of reading the directories on the way.
+ */
+static int find_node_by_index(SESSION *session, char *path, INODE **start_node, FIND_INFO **result) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char abs_path[1024];
+    size_t length = 0;
+    abs_path[0] = '\0';
+    if (*start_node != session->root_node) {
+        for (INODE *node = session->root_node->next_inode; node != NULL; node = node->next_inode) {
+            length += snprintf(abs_path + length, sizeof(abs_path) - length, "/%s", node->filename);
+            if (length >= sizeof(abs_path)) {
+                return -1;
+            }
+            if (node == *start_node) {
+                break;
+            }
+        }
+    }
+
+    INODE *result_node = malloc(sizeof(INODE));
+    memcpy(result_node, *start_node, sizeof(INODE));
+    result_node->filename = NULL;
+    result_node->next_inode = NULL;
+    INODE *start_result_node = result_node;
+    char sep[2] = "/";
+    char path_buf[512];
+    strcpy(path_buf, path);
+    char *save;
+    char *sub_dir = strtok_r(path_buf, sep, &save);
+    while (sub_dir != NULL) {
+        if (!(result_node->type & MFT_RECORD_IS_DIRECTORY)) {
+            break;
+        }
+        length += snprintf(abs_path + length, sizeof(abs_path) - length, "/%s", sub_dir);
+        if (length >= sizeof(abs_path)) {
+            break;
+        }
+        int64_t mft_num = sidecar_lookup(g_info->sidecar, abs_path);
+        const SIDECAR_RECORD *record = sidecar_record(g_info->sidecar, mft_num);
+        if (mft_num == -1 || record == NULL) {
+            break;
+        }
+        INODE *node = malloc(sizeof(INODE));
+        node->mft_num = (uint32_t) mft_num;
+        node->filename = malloc(strlen(sub_dir) + 1);
+        strcpy(node->filename, sub_dir);
+        node->type = record->flags;
+        node->parent = result_node;
+        node->next_inode = NULL;
+        result_node->next_inode = node;
+        result_node = node;
+
+        sub_dir = strtok_r(NULL, sep, &save);
+        if (sub_dir == NULL) {
+            *result = malloc(sizeof(FIND_INFO));
+            (*result)->start = start_result_node;
+            (*result)->result = result_node;
+            return 0;
+        }
+    }
+    free_inode(start_result_node);
+    return -1;
+}
+
+static int find_node_by_name(SESSION *session, char *path, INODE **start_node, FIND_INFO **result) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    // paths are split in a buffer of 512 bytes, they may come from a socket
+    if (strlen(path) >= 512) {
+        return -1;
+    }
+    if (g_info->sidecar != NULL) {
+        return find_node_by_index(session, path, start_node, result);
+    }
     INODE *result_node = malloc(sizeof(INODE));
     INODE *head;
     memcpy(result_node, *start_node, sizeof(INODE));
@@ -25,7 +102,8 @@ static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **st
     char path_buf[512];
     strcpy(path_buf, path);
     int count = count_nodes(path);
-    char *sub_dir = strtok(path_buf, sep);
+    char *save;
+    char *sub_dir = strtok_r(path_buf, sep, &save);
     int err;
     while (sub_dir != NULL) {
         found = false;
@@ -69,56 +147,22 @@ static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **st
         } else {
             count--;
         }
-        sub_dir = strtok(NULL, sep);
+        sub_dir = strtok_r(NULL, sep, &save);
     }
     return -1;
 }
 
-static int copy(GENERAL_INFORMATION *g_info, INODE *node, char *to_path) {
+static int collect(GENERAL_INFORMATION *g_info, INODE *node, char *to_path, EXTRACT_LIST *list) {
     char *node_path = malloc(strlen(to_path) + strlen((node->filename)) + 2);
     strcpy(node_path, to_path);
     strcat(node_path, "/");
     strcat(node_path, node->filename);
 
     if (!(node->type & MFT_RECORD_IS_DIRECTORY)) {
-        int fd = open(node_path, O_CREAT | O_WRONLY | O_TRUNC);
-        if (fd == -1) {
-            free(node_path);
-            close(fd);
-            return -1;
-        }
-
-        MAPPING_CHUNK_DATA *chunk_data = NULL;
-        int err = read_file_data(g_info, node, &chunk_data);
-        if (err == -1) {
-            free(node_path);
-            close(fd);
-        }
-        if (chunk_data->resident) {
-            pwrite(fd, chunk_data->buf, chunk_data->length, 0);
-            close(fd);
-            free(node_path);
-            free_data_chunk(chunk_data);
-            return 1;
-        } else {
-            int64_t offset = 0;
-            uint64_t size;
-            while (read_block_file(g_info, &chunk_data) == 0) {
-                if (chunk_data->blocks_count * g_info->block_size_in_bytes > chunk_data->length) {
-                    size = chunk_data->length - ((chunk_data->blocks_count - 1) * g_info->block_size_in_bytes);
-                    offset += pwrite(fd, chunk_data->buf, size, offset);
-                    break;
-                } else {
-                    size = g_info->block_size_in_bytes;
-                }
-                offset += pwrite(fd, chunk_data->buf, size, offset);
-            }
-            close(fd);
-            int result = chunk_data->signal;
-            free_data_chunk(chunk_data);
-            free(node_path);
-            return result;
-        }
+        // files are written later in mft order, see extract_files()
+        int err = add_extract_entry(list, node->mft_num, node_path);
+        free(node_path);
+        return err;
     } else {
         if (mkdir(node_path, 00777) != 0) {
             free(node_path);
@@ -136,7 +180,7 @@ static int copy(GENERAL_INFORMATION *g_info, INODE *node, char *to_path) {
         }
         INODE *tmp = read_node->next_inode;
         while (tmp != NULL) {
-            if (copy(g_info, tmp, node_path) == -1) {
+            if (collect(g_info, tmp, node_path, list) == -1) {
                 free(node_path);
                 free_inode(read_node);
                 return -1;
@@ -149,13 +193,23 @@ static int copy(GENERAL_INFORMATION *g_info, INODE *node, char *to_path) {
     return 0;
 }
 
-char *pwd(const GENERAL_INFORMATION *const g_info) {
-    uint64_t size = 2;   // for 0x20 and 0x00
-    uint16_t current_size = 256;
+static int copy(GENERAL_INFORMATION *g_info, INODE *node, char *to_path, uint8_t link_mode) {
+    EXTRACT_LIST list = {NULL, 0, 0, link_mode};
+    int err = collect(g_info, node, to_path, &list);
+    if (err != -1) {
+        err = extract_files(g_info, &list);
+    }
+    free_extract_list(&list);
+    return err;
+}
+
+char *pwd(const SESSION *session) {
+    uint64_t size = 3;   // for '/', 0x20 and 0x00
+    uint64_t current_size = size;
     uint32_t name_length;
     char *result = malloc(size);
     result[0] = '\0';
-    INODE *current_inode = g_info->root_node->next_inode;
+    INODE *current_inode = session->root_node->next_inode;
     if (current_inode == NULL) {
         strcat((char *) result, "/");
 
@@ -175,35 +229,35 @@ char *pwd(const GENERAL_INFORMATION *const g_info) {
     return result;
 }
 
-char *cd(GENERAL_INFORMATION *g_info, char *path) {
-    char *output = malloc(16);
+char *cd(SESSION *session, char *path) {
+    char *output = malloc(32);
     output[0] = '\0';
     char *message;
 
     if (strcmp(path, ".") == 0) {
         return output;
     } else if (strcmp(path, "..") == 0) {
-        if (g_info->cur_node->mft_num == FILE_root) {
+        if (session->cur_node->mft_num == FILE_root) {
             return output;
         }
-        INODE *tmp = g_info->cur_node->parent;
-        free_inode(g_info->cur_node);
-        g_info->cur_node = tmp;
-        g_info->cur_node->next_inode = NULL;
+        INODE *tmp = session->cur_node->parent;
+        free_inode(session->cur_node);
+        session->cur_node = tmp;
+        session->cur_node->next_inode = NULL;
         return output;
     }
 
     FIND_INFO *result;
     int err;
     if (path[0] == '/') {
-        err = find_node_by_name(g_info, path, &(g_info->root_node), &result);
+        err = find_node_by_name(session, path, &(session->root_node), &result);
         if (err == -1) {
             goto error;
         }
         if (result->result->type & MFT_RECORD_IS_DIRECTORY) {
-            g_info->root_node->next_inode = result->start->next_inode;
-            result->start->next_inode->parent = g_info->root_node;
-            g_info->cur_node = result->result;
+            session->root_node->next_inode = result->start->next_inode;
+            result->start->next_inode->parent = session->root_node;
+            session->cur_node = result->result;
             result->start->next_inode = NULL;
             free_inode((result->start));
             free(result);
@@ -212,12 +266,12 @@ char *cd(GENERAL_INFORMATION *g_info, char *path) {
             goto is_file;
         }
     } else {
-        err = find_node_by_name(g_info, path, &(g_info->cur_node), &result);
+        err = find_node_by_name(session, path, &(session->cur_node), &result);
         if (err == -1) goto error;
         if (result->result->type & MFT_RECORD_IS_DIRECTORY) {
-            g_info->cur_node->next_inode = result->start->next_inode;
-            result->start->next_inode->parent = g_info->cur_node;
-            g_info->cur_node = result->result;
+            session->cur_node->next_inode = result->start->next_inode;
+            result->start->next_inode->parent = session->cur_node;
+            session->cur_node = result->result;
             result->start->next_inode = NULL;
             free_inode((result->start));
             free(result);
@@ -241,41 +295,47 @@ char *cd(GENERAL_INFORMATION *g_info, char *path) {
     return output;
 }
 
-char *ls(GENERAL_INFORMATION *g_info, char *path) {
+char *ls(SESSION *session, char *path) {
+    GENERAL_INFORMATION *g_info = session->g_info;
     FIND_INFO *find_result;
     int error = 0;
     bool current_path = false;
     bool parent_path = false;
     if (path == NULL || strcmp(path, ".") == 0) {
         find_result = malloc(sizeof(FIND_INFO));
-        find_result->result = g_info->cur_node;
+        find_result->result = session->cur_node;
         current_path = true;
         goto parse;
     }
 
     if (strcmp(path, "..") == 0) {
         find_result = malloc(sizeof(FIND_INFO));
-        find_result->result = g_info->cur_node->parent;
+        find_result->result = session->cur_node->parent;
         current_path = true;
         parent_path = true;
         goto parse;
     }
 
     if (path[0] == '/') {
-        error = find_node_by_name(g_info, path, &g_info->root_node, &find_result);
+        error = find_node_by_name(session, path, &session->root_node, &find_result);
     } else {
-        error = find_node_by_name(g_info, path, &g_info->cur_node, &find_result);
+        error = find_node_by_name(session, path, &session->cur_node, &find_result);
     }
 
     parse:
     if (error != -1) {
         int err = read_directory(g_info, &(find_result->result));
         if (err == -1) {
+            if (!current_path) {
+                free_inode(find_result->start);
+            }
+            free(find_result);
             return NULL;
         }
         INODE *tmp = find_result->result->next_inode;
         char *result[256];
-        char *output = malloc(err * 256);
+        // "DIRECTORY:\t" + name of up to 255 characters + "\n"
+        char *output = malloc(err * (256 + 16) + 1);
         output[0] = '\0';
         while (tmp != NULL) {
             if (tmp->type & MFT_RECORD_IS_DIRECTORY) {
@@ -293,18 +353,24 @@ char *ls(GENERAL_INFORMATION *g_info, char *path) {
             free_inode((find_result->start));
         }
         if (parent_path) {
-            g_info->cur_node->parent->next_inode = g_info->cur_node;
+            session->cur_node->parent->next_inode = session->cur_node;
         }
 
-        find_result->result = NULL;
-        find_result->start = NULL;
+        free(find_result);
         return output;
     }
     return NULL;
 }
 
-char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path) {
-    char *output = malloc(32);
+/*
+ * Copies from_path into the directory to_path, the data of a record with
+ * several names is copied once. With CP_MIRROR only files changed since the
+ * last mirror run are copied, CP_DELETE also removes what is gone from the
+ * volume, see mirror_tree().
+ */
+char *cp(SESSION *session, char *from_path, char *to_path, uint32_t flags) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char *output = malloc(96);
     output[0] = '\0';
     if (strcmp(from_path, ".") == 0 || strcmp(from_path, "..") == 0) {
         sprintf(output, "ERROR: Incompatible file path\n");
@@ -314,22 +380,476 @@ char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path) {
     INODE *start_node;
     char *message;
     if (from_path[0] == '/') {
-        start_node = g_info->root_node;
+        start_node = session->root_node;
     } else {
-        start_node = g_info->cur_node;
+        start_node = session->cur_node;
     }
-    int err = find_node_by_name(g_info, from_path, &start_node, &result);
+    int err = find_node_by_name(session, from_path, &start_node, &result);
     if (err == -1) {
         message = "No such file or directory";
         sprintf(output, "%s\n", message);
         return output;
-    } else if (copy(g_info, result->result, to_path) != -1) {
-        message = "Successfully copied";
-        sprintf(output, "%s\n", message);
+    }
+    uint8_t link_mode = (flags & CP_REFLINK) ? EXTRACT_LINK_REFLINK : EXTRACT_LINK_HARD;
+    if (flags & CP_MIRROR) {
+        MIRROR_STATS stats;
+        if (mirror_tree(g_info, result->result, to_path, flags & CP_DELETE, link_mode, &stats) != -1) {
+            sprintf(output, "Successfully mirrored: %lu copied, %lu unchanged, %lu deleted\n", stats.copied,
+                    stats.unchanged, stats.deleted);
+        } else {
+            sprintf(output, "ERROR: Mirror failed\n");
+        }
+        free_inode(result->start);
+        free(result);
         return output;
+    }
+    if (copy(g_info, result->result, to_path, link_mode) != -1) {
+        message = "Successfully copied";
     } else {
         message = "ERROR: ERROR";
-        sprintf(output, "%s\n", message);
+    }
+    sprintf(output, "%s\n", message);
+    free_inode(result->start);
+    free(result);
+    return output;
+}
+
+char *tar(SESSION *session, char *from_path, char *to_path) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char *output = malloc(64);
+    output[0] = '\0';
+    if (strcmp(from_path, ".") == 0 || strcmp(from_path, "..") == 0) {
+        sprintf(output, "ERROR: Incompatible file path\n");
+        return output;
+    }
+    FIND_INFO *result;
+    INODE *start_node;
+    if (from_path[0] == '/') {
+        start_node = session->root_node;
+    } else {
+        start_node = session->cur_node;
+    }
+    if (find_node_by_name(session, from_path, &start_node, &result) == -1) {
+        sprintf(output, "No such file or directory\n");
         return output;
     }
-}
\ No newline at end of file
+
+    // "-" streams the archive to stdout
+    int fd;
+    if (strcmp(to_path, "-") == 0) {
+        fflush(stdout);
+        fd = STDOUT_FILENO;
+    } else {
+        fd = open(to_path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    }
+    if (fd == -1) {
+        sprintf(output, "ERROR: Can't open %s\n", strlen(to_path) < 32 ? to_path : "archive");
+    } else if (export_tar(g_info, result->result, fd) == -1) {
+        sprintf(output, "ERROR: Export failed\n");
+    } else {
+        sprintf(output, "Successfully exported\n");
+    }
+    if (fd != -1 && fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    free_inode(result->start);
+    free(result);
+    return output;
+}
+
+/*
+ * Lists record number and absolute path of every file whose name matches
+ * pattern, see search_name_index(). The name index and the path table are
+ * built by the first search. Names outside of the tree are listed as "?/name".
+ */
+char *find(GENERAL_INFORMATION *g_info, char *pattern) {
+    char *output;
+    NAME_INDEX *index = get_name_index(g_info);
+    PATH_TABLE *table = get_path_table(g_info);
+    if (index == NULL || table == NULL) {
+        output = malloc(32);
+        sprintf(output, "ERROR: Can't read names\n");
+        return output;
+    }
+    uint32_t *matches;
+    uint32_t count;
+    search_name_index(index, pattern, &matches, &count);
+
+    size_t size = 4096;
+    size_t length = 0;
+    output = malloc(size);
+    output[0] = '\0';
+    char path[4096];
+    for (uint32_t i = 0; i < count; i++) {
+        NAME_ENTRY *entry = &index->entries[matches[i]];
+        // the path goes through the parent of this name, so every hard link shows up under its own path
+        int64_t path_length = record_path(table, MREF(entry->parent), path, sizeof(path));
+        if (path_length == -1) {
+            strcpy(path, "?");
+        } else if (path_length == 1) {
+            path[0] = '\0';
+        }
+        // record number of up to 20 digits + "\t" + path + "/" + name + "\n"
+        size_t line = 24 + strlen(path) + entry->name_length;
+        if (length + line > size) {
+            size = (length + line) * 2;
+            output = realloc(output, size);
+        }
+        length += sprintf(output + length, "%lu\t%s/%s\n", MREF(entry->mft_reference), path,
+                          index->names + entry->name_offset);
+    }
+    free(matches);
+    return output;
+}
+
+static size_t print_du_heap(PATH_TABLE *table, const char *title, const DU_HEAP *heap, char *output) {
+    char path[4096];
+    size_t length = sprintf(output, "%s\n", title);
+    for (uint32_t i = 0; i < heap->count; i++) {
+        if (record_path(table, heap->entries[i].mft_num, path, sizeof(path)) == -1) {
+            strcpy(path, "?");
+        }
+        length += sprintf(output + length, "%lu\t%lu\t%s\n", heap->entries[i].allocated_size,
+                          heap->entries[i].logical_size, path);
+    }
+    return length;
+}
+
+/*
+ * Prints allocated and logical size of a directory tree (working directory by
+ * default) and its largest files and directories, see disk_usage().
+ */
+char *du(SESSION *session, char *path, char *top) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char *output;
+    uint32_t mft_num;
+    if (path == NULL || strcmp(path, ".") == 0) {
+        mft_num = session->cur_node->mft_num;
+    } else if (strcmp(path, "..") == 0) {
+        mft_num = session->cur_node->parent->mft_num;
+    } else {
+        FIND_INFO *result;
+        INODE *start_node = path[0] == '/' ? session->root_node : session->cur_node;
+        if (find_node_by_name(session, path, &start_node, &result) == -1) {
+            output = malloc(32);
+            sprintf(output, "No such file or directory\n");
+            return output;
+        }
+        mft_num = result->result->mft_num;
+        free_inode(result->start);
+        free(result);
+    }
+    uint32_t count = top != NULL ? (uint32_t) strtoul(top, NULL, 10) : DU_DEFAULT_TOP;
+
+    DU_REPORT report;
+    if (disk_usage(g_info, mft_num, count, &report) == -1) {
+        output = malloc(32);
+        sprintf(output, "ERROR: Can't read sizes\n");
+        return output;
+    }
+    // every line: two sizes of up to 20 digits, tabs and a path of up to 4095 characters
+    output = malloc(256 + (size_t) (report.largest_files.count + report.largest_directories.count) * 4140);
+    size_t length = sprintf(output, "logical: %lu\nallocated: %lu\nfiles: %lu\ndirectories: %lu\n",
+                            report.logical_size, report.allocated_size, report.files, report.directories);
+    // disk_usage() leaves the path table of the volume built
+    PATH_TABLE *table = get_path_table(g_info);
+    length += print_du_heap(table, "largest directories (allocated, logical, path):", &report.largest_directories,
+                            output + length);
+    print_du_heap(table, "largest files (allocated, logical, path):", &report.largest_files, output + length);
+    free_du_report(&report);
+    return output;
+}
+
+/*
+ * Looks path up from the root or the working directory of the session and
+ * copies record number and type of what it names to node.
+ * Returns 0 or -1.
+ */
+int resolve_path(SESSION *session, char *path, INODE *node) {
+    FIND_INFO *result = NULL;
+    INODE *found;
+    if (path == NULL || strcmp(path, ".") == 0) {
+        found = session->cur_node;
+    } else if (strcmp(path, "..") == 0) {
+        found = session->cur_node->parent;
+    } else if (strspn(path, "/") == strlen(path)) {
+        found = session->root_node;
+    } else {
+        INODE *start_node = path[0] == '/' ? session->root_node : session->cur_node;
+        if (find_node_by_name(session, path, &start_node, &result) == -1) {
+            return -1;
+        }
+        found = result->result;
+    }
+    node->mft_num = found->mft_num;
+    node->filename = NULL;
+    node->type = found->type;
+    node->parent = NULL;
+    node->next_inode = NULL;
+    if (result != NULL) {
+        free_inode(result->start);
+        free(result);
+    }
+    return 0;
+}
+
+static size_t print_time(char *output, const char *title, uint64_t nt_time) {
+    time_t seconds = nt_time > NTFS_TIME_OFFSET ? (time_t) ((nt_time - NTFS_TIME_OFFSET) / 10000000) : 0;
+    struct tm tm;
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", gmtime_r(&seconds, &tm));
+    return sprintf(output, "%s: %s\n", title, text);
+}
+
+/*
+ * Prints record, type, link count, $DATA sizes and $STANDARD_INFORMATION
+ * times (UTC) of a file or directory, the working directory by default.
+ */
+char *file_stat(SESSION *session, char *path) {
+    GENERAL_INFORMATION *g_info = session->g_info;
+    char *output = malloc(512);
+    INODE node;
+    if (resolve_path(session, path, &node) == -1) {
+        sprintf(output, "No such file or directory\n");
+        return output;
+    }
+    MFT_RECORD *record = malloc(g_info->mft_record_size_in_bytes);
+    if (search_mft_record(g_info, node.mft_num, &record) == -1) {
+        free(record);
+        sprintf(output, "ERROR: Can't read record %u\n", node.mft_num);
+        return output;
+    }
+    size_t length = sprintf(output, "record: %u\nsequence: %u\ntype: %s\nlinks: %u\n", node.mft_num,
+                            record->sequence_number, record->flags & MFT_RECORD_IS_DIRECTORY ? "directory" : "file",
+                            record->link_count);
+    if (!(record->flags & MFT_RECORD_IS_DIRECTORY)) {
+        EXTENT_MAP *map = get_extent_map(g_info, node.mft_num, AT_DATA);
+        if (map != NULL) {
+            length += sprintf(output + length, "size: %lu\nallocated: %lu\n", map->data_size,
+                              map->resident ? 0 : map->allocated_size);
+            put_extent_map(map);
+        }
+    }
+    ATTR_RECORD *attr = next_attr(g_info, record, NULL, AT_STANDARD_INFORMATION);
+    if (attr != NULL && !attr->non_resident && attr->value_length >= STANDARD_INFORMATION_V1_SIZE &&
+        (uint64_t) attr->value_offset + attr->value_length <= attr->length) {
+        STANDARD_INFORMATION *si = (STANDARD_INFORMATION *) ((uint8_t *) attr + attr->value_offset);
+        length += print_time(output + length, "created", si->creation_time);
+        length += print_time(output + length, "modified", si->last_data_change_time);
+        length += print_time(output + length, "changed", si->last_mft_change_time);
+        print_time(output + length, "accessed", si->last_access_time);
+    }
+    free(record);
+    return output;
+}
+
+/*
+ * Prints cluster usage of the volume from $Bitmap: totals, histogram of free
+ * extents and a heatmap with one character per region, ' ' for an empty
+ * region up to '@' for a full one.
+ */
+char *bitmap(GENERAL_INFORMATION *g_info) {
+    const char *levels = " .:-=+*#%@";
+    BITMAP_STATS stats;
+    char *output = malloc(4096);
+    if (bitmap_stats(g_info, &stats) == -1) {
+        sprintf(output, "ERROR: Can't read $Bitmap\n");
+        return output;
+    }
+    size_t length = sprintf(output, "clusters: %lu\ncluster size: %u\nused: %lu (%.1f%%)\nfree: %lu\n"
+                                    "free extents: %lu\nlargest free extent: %lu\n"
+                                    "free extents by length (clusters, extents):\n",
+                            stats.clusters, g_info->cluster_size_in_bytes, stats.used_clusters,
+                            stats.clusters ? 100.0 * (double) stats.used_clusters / (double) stats.clusters : 0.0,
+                            stats.free_clusters, stats.free_extents, stats.largest_free_extent);
+    for (uint32_t i = 0; i < BITMAP_HISTOGRAM_BUCKETS; i++) {
+        if (stats.histogram[i] != 0) {
+            length += sprintf(output + length, "%lu-%lu\t%lu\n", 1UL << i, (2UL << i) - 1, stats.histogram[i]);
+        }
+    }
+    length += sprintf(output + length, "allocation by region of %lu clusters:\n[", stats.region_clusters);
+    for (uint32_t i = 0; i < stats.region_count; i++) {
+        uint64_t size = stats.region_clusters;
+        if ((i + 1) * stats.region_clusters > stats.clusters) {
+            size = stats.clusters - i * stats.region_clusters;
+        }
+        output[length++] = levels[stats.region_used[i] * 9 / size];
+    }
+    sprintf(output + length, "]\n");
+    return output;
+}
+
+/*
+ * Without a record lists deleted files that can still be recovered, best
+ * candidates first. With one writes that record into the directory to_path.
+ */
+char *undelete(GENERAL_INFORMATION *g_info, char *mft, char *to_path) {
+    char *output;
+    if (mft != NULL) {
+        // the record is printed as parsed, so the message fits whatever the argument
+        uint32_t mft_num = (uint32_t) strtoul(mft, NULL, 10);
+        output = malloc(48);
+        if (to_path == NULL) {
+            sprintf(output, "ERROR: No target directory\n");
+        } else if (recover_file(g_info, mft_num, to_path) == -1) {
+            sprintf(output, "ERROR: Can't recover record %u\n", mft_num);
+        } else {
+            sprintf(output, "Successfully recovered\n");
+        }
+        return output;
+    }
+    PATH_TABLE *table = get_path_table(g_info);
+    DELETED_LIST list;
+    if (table == NULL || find_deleted_files(g_info, 0, &list) == -1) {
+        output = malloc(32);
+        sprintf(output, "ERROR: Can't read $MFT\n");
+        return output;
+    }
+    size_t size = 4096;
+    size_t length = sprintf(output = malloc(size), "score\tmft\tsize\tpath\n");
+    char path[4096];
+    for (uint32_t i = 0; i < list.count; i++) {
+        DELETED_FILE *file = &list.files[i];
+        int64_t path_length = -1;
+        if (file->name != NULL) {
+            path_length = record_path(table, MREF(file->parent), path, sizeof(path));
+        }
+        if (path_length == -1) {
+            strcpy(path, "?");
+        } else if (path_length == 1) {
+            path[0] = '\0';
+        }
+        // score, record number and size of up to 20 digits + tabs + path + "/" + name + "\n"
+        size_t line = 64 + strlen(path) + (file->name != NULL ? strlen(file->name) : 0);
+        if (length + line > size) {
+            size = (length + line) * 2;
+            output = realloc(output, size);
+        }
+        length += sprintf(output + length, "%u\t%u\t%lu\t%s/%s\n", file->score, file->mft_num, file->size, path,
+                          file->name != NULL ? file->name : "");
+    }
+    free_deleted_list(&list);
+    return output;
+}
+
+/*
+ * Without a usn prints the position of the change journal, the cursor for a
+ * later call. With one lists the records changed since that usn: reasons,
+ * record number and path.
+ */
+char *journal(GENERAL_INFORMATION *g_info, char *usn, char *journal_id) {
+    char *output;
+    USN_CURSOR cursor;
+    int64_t lowest_valid_usn;
+    if (read_usn_cursor(g_info, &cursor, &lowest_valid_usn) == -1) {
+        output = malloc(32);
+        sprintf(output, "ERROR: No change journal\n");
+        return output;
+    }
+    if (usn == NULL) {
+        output = malloc(128);
+        sprintf(output, "journal id: %lu\nfirst usn: %ld\nnext usn: %ld\n", cursor.journal_id, lowest_valid_usn,
+                cursor.next_usn);
+        return output;
+    }
+    USN_CURSOR from = {journal_id != NULL ? strtoull(journal_id, NULL, 10) : cursor.journal_id,
+                       strtoll(usn, NULL, 10)};
+    PATH_TABLE *table = get_path_table(g_info);
+    USN_CHANGES changes;
+    if (table == NULL || read_usn_changes(g_info, &from, &changes) == -1) {
+        output = malloc(32);
+        sprintf(output, "ERROR: Can't read journal\n");
+        return output;
+    }
+    if (changes.lost) {
+        output = malloc(64);
+        sprintf(output, "ERROR: Journal doesn't reach back to %ld\n", from.next_usn);
+        return output;
+    }
+    size_t size = 4096;
+    size_t length = sprintf(output = malloc(size), "next usn: %ld\nrecords: %lu\nchanged: %u\n",
+                            changes.cursor.next_usn, changes.records, changes.count);
+    char path[4096];
+    for (uint32_t i = 0; i < changes.count; i++) {
+        USN_CHANGE *change = &changes.changes[i];
+        if (record_path(table, MREF(change->mft_reference), path, sizeof(path)) == -1) {
+            strcpy(path, "?");
+        }
+        // reasons, record number and sequence number + tabs + path + "\n"
+        size_t line = 48 + strlen(path);
+        if (length + line > size) {
+            size = (length + line) * 2;
+            output = realloc(output, size);
+        }
+        length += sprintf(output + length, "%08x\t%lu\t%u\t%s\n", change->reason, MREF(change->mft_reference),
+                          MSEQNO(change->mft_reference), path);
+    }
+    free_usn_changes(&changes);
+    return output;
+}
+
+/*
+ * I/O and cache counters of the volume since it was opened or reset, with
+ * calls and wall time of every command. "reset" starts them from zero.
+ */
+char *io_stats(GENERAL_INFORMATION *g_info, char *option) {
+    if (option != NULL) {
+        char *output = malloc(64);
+        if (strcmp(option, "reset") == 0) {
+            reset_stats(g_info);
+            sprintf(output, "Statistics are reset\n");
+        } else {
+            sprintf(output, "ERROR: stats option is reset\n");
+        }
+        return output;
+    }
+    STATS_SNAPSHOT *snapshot = malloc(sizeof(STATS_SNAPSHOT));
+    read_stats(g_info, snapshot);
+    char *output = format_stats(snapshot);
+    free(snapshot);
+    return output;
+}
+
+/*
+ * Latency percentiles of ls, cd, cp, record fetches and cluster reads since
+ * the volume was opened or its stats were reset, "json" for the histograms.
+ */
+char *latency(GENERAL_INFORMATION *g_info, char *format) {
+    if (format != NULL && strcmp(format, "json") != 0) {
+        char *output = malloc(64);
+        sprintf(output, "ERROR: latency format is json\n");
+        return output;
+    }
+    STATS_SNAPSHOT *snapshot = malloc(sizeof(STATS_SNAPSHOT));
+    read_stats(g_info, snapshot);
+    char *output = format_latency(snapshot, format != NULL);
+    free(snapshot);
+    if (format != NULL) {
+        size_t length = strlen(output);
+        output = realloc(output, length + 2);
+        strcpy(output + length, "\n");
+    }
+    return output;
+}
+
+/*
+ * Memory used by the caches, indexes and copy buffers of the volume with its
+ * high-water marks, or sets the limit of the budget (0 removes it).
+ */
+char *memory(GENERAL_INFORMATION *g_info, char *limit) {
+    if (limit == NULL) {
+        return format_budget(g_info->budget);
+    }
+    char *output = malloc(96);
+    uint64_t size;
+    if (parse_budget_size(limit, &size) == -1) {
+        sprintf(output, "ERROR: memory limit is a size like 512M, or 0 for none\n");
+    } else if (size == BUDGET_UNLIMITED) {
+        set_budget_limit(g_info->budget, size);
+        sprintf(output, "Memory limit is removed\n");
+    } else {
+        set_budget_limit(g_info->budget, size);
+        sprintf(output, "Memory limit is set to %lu KiB\n", size >> 10);
+    }
+    return output;
+}
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../core/inc/util.h"
+
+/*
+ * Searches of the name index on an image made by
+ * ntfs_gen -n 100 -z, its files are file_00000000.dat .. file_00000099.dat.
+ */
+typedef struct {
+    const char *pattern;
+    uint32_t expected;
+} SEARCH_CASE;
+
+static const SEARCH_CASE cases[] = {
+        {"file_00000042.dat",      1},
+        {"FILE_0000004",           10},
+        {"file_0000001[0-9].dat",  10},
+        {"file_0000001[!0-4].dat", 5},
+        {"*_0000009?.dat",         10},
+        // a '[' without its ']' is a literal character
+        {"file_0000001[",          0},
+        {"ab[",                    0},
+        {"[",                      0},
+        {"file_0000001[0-9",       0},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "name_index_test image\n");
+        return 1;
+    }
+    GENERAL_INFORMATION *g_info = init(argv[1]);
+    if (g_info == NULL) {
+        fprintf(stderr, "ERROR: Can't open %s\n", argv[1]);
+        return 1;
+    }
+    NAME_INDEX *index = get_name_index(g_info);
+    if (index == NULL) {
+        fprintf(stderr, "ERROR: Can't build the name index\n");
+        free_g_info(g_info);
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        uint32_t *matches;
+        uint32_t count;
+        if (search_name_index(index, cases[i].pattern, &matches, &count) == -1) {
+            count = UINT32_MAX;
+            matches = NULL;
+        }
+        if (count != cases[i].expected) {
+            printf("FAIL %s: %u matches, expected %u\n", cases[i].pattern, count, cases[i].expected);
+            failed++;
+        }
+        free(matches);
+    }
+    printf("%zu searches, %d failed\n", sizeof(cases) / sizeof(cases[0]), failed);
+    free_g_info(g_info);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,605 @@
+#define _XOPEN_SOURCE 700
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "../../core/inc/util.h"
+
+/*
+ * End-to-end benchmark of the shell commands.
+ *
+ * Every scenario runs once on a freshly opened volume with the image dropped
+ * from the page cache (cold) and then several times on the same volume (warm).
+ * Every measurement is one JSON object on its own line, so runs against the
+ * same image with different builds, backends or machines can be compared with
+ * any tool that reads JSON Lines.
+ */
+
+#define BENCH_MAX_SCENARIOS 64
+#define BENCH_SMALL_FILE (64 * 1024)    // "many small files" are files up to this size
+#define BENCH_PATH_MAX 4096
+
+typedef enum {
+    BENCH_LS,       // items are entries printed
+    BENCH_CD,       // items are resolved paths
+    BENCH_FIND,     // items are matches
+    BENCH_CP,       // items are files copied, bytes are their size
+} BENCH_KIND;
+
+static const char *kind_names[] = {"ls", "cd", "find", "cp"};
+
+typedef struct {
+    char *name;
+    BENCH_KIND kind;
+    char *arg;
+} BENCH_SCENARIO;
+
+typedef struct {
+    char *image;
+    char *index;
+    char *listing;
+    char *tag;
+    char *target;
+    char *output;
+    uint32_t runs;
+    uint32_t resolutions;
+} BENCH_OPTIONS;
+
+typedef struct {
+    uint64_t read_calls;    // syscr of /proc/self/io, read(2) family
+    uint64_t write_calls;    // syscw of /proc/self/io, write(2) family
+    uint64_t read_bytes;    // bytes fetched from the storage layer
+} BENCH_IO;
+
+typedef struct {
+    uint64_t runs;
+    uint64_t items;
+    uint64_t bytes;
+    double seconds;
+    BENCH_IO io;
+    uint64_t peak_rss_kb;
+    char *error;
+} BENCH_RESULT;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void read_io(BENCH_IO *io) {
+    memset(io, 0, sizeof(BENCH_IO));
+    FILE *file = fopen("/proc/self/io", "r");
+    if (file == NULL) {
+        return;
+    }
+    char key[64];
+    unsigned long long value;
+    while (fscanf(file, "%63[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) {
+            io->read_calls = value;
+        } else if (strcmp(key, "syscw") == 0) {
+            io->write_calls = value;
+        } else if (strcmp(key, "read_bytes") == 0) {
+            io->read_bytes = value;
+        }
+    }
+    fclose(file);
+}
+
+/* Starts a new peak of the resident set, the process peak is used where the kernel can't reset it. */
+static void reset_peak_rss(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd != -1) {
+        if (write(fd, "5", 1) != 1) {
+            // keep the process peak
+        }
+        close(fd);
+    }
+}
+
+static uint64_t peak_rss(void) {
+    FILE *file = fopen("/proc/self/status", "r");
+    char line[256];
+    uint64_t kb = 0;
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtoull(line + 6, NULL, 10);
+            break;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (kb == 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kb = (uint64_t) usage.ru_maxrss;
+    }
+    return kb;
+}
+
+/* Drops clean pages of the image from the page cache, so the next volume starts cold. */
+static void drop_cache(const char *image) {
+    int fd = open(image, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static GENERAL_INFORMATION *open_volume(BENCH_OPTIONS *opt) {
+    GENERAL_INFORMATION *g_info = init(opt->image);
+    if (g_info != NULL && opt->index != NULL && open_sidecar(g_info, opt->index) == -1) {
+        fprintf(stderr, "WARNING: Can't use index %s\n", opt->index);
+    }
+    return g_info;
+}
+
+/* ---------------------------------------------------------------- copy target */
+
+static uint64_t tree_files;
+static uint64_t tree_bytes;
+
+static int count_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    if (type == FTW_F) {
+        tree_files++;
+        tree_bytes += (uint64_t) st->st_size;
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    if (ftw->level > 0) {
+        remove(path);
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------- scenarios */
+
+static uint64_t count_lines(const char *text) {
+    uint64_t lines = 0;
+    for (; *text != '\0'; text++) {
+        lines += *text == '\n';
+    }
+    return lines;
+}
+
+static char *error_line(const char *text) {
+    size_t length = strcspn(text, "\n");
+    char *error = malloc(length + 1);
+    memcpy(error, text, length);
+    error[length] = '\0';
+    return error;
+}
+
+/*
+ * Runs the command of the scenario once, count times for cd.
+ * Returns -1 with result->error set when the command failed.
+ */
+static int run_once(GENERAL_INFORMATION *g_info, BENCH_SCENARIO *scenario, BENCH_OPTIONS *opt, uint32_t count,
+                    BENCH_RESULT *result) {
+    char arg[BENCH_PATH_MAX];
+    char target[BENCH_PATH_MAX];
+    char *output = NULL;
+    int status = 0;
+    double start;
+
+    if (scenario->kind == BENCH_CP) {
+        snprintf(target, sizeof(target), "%s/ntfs_bench.XXXXXX", opt->target);
+        if (mkdtemp(target) == NULL) {
+            result->error = strdup("can't create the copy target");
+            return -1;
+        }
+    }
+    // commands may cut their arguments
+    snprintf(arg, sizeof(arg), "%s", scenario->arg);
+
+    SESSION *session = open_session(g_info);
+    switch (scenario->kind) {
+        case BENCH_LS:
+            start = now();
+            output = ls(session, arg);
+            result->seconds += now() - start;
+            if (output == NULL) {
+                result->error = strdup("No such directory");
+                status = -1;
+                break;
+            }
+            result->items += count_lines(output);
+            break;
+        case BENCH_CD:
+            // every resolution starts from the root like a new client would
+            start = now();
+            for (uint32_t i = 0; i < count && status == 0; i++) {
+                snprintf(arg, sizeof(arg), "%s", scenario->arg);
+                SESSION *walker = open_session(g_info);
+                output = cd(walker, arg);
+                close_session(walker);
+                if (output[0] != '\0') {
+                    result->error = error_line(output);
+                    status = -1;
+                }
+                free(output);
+                output = NULL;
+                result->items++;
+            }
+            result->seconds += now() - start;
+            break;
+        case BENCH_FIND:
+            start = now();
+            output = find(g_info, arg);
+            result->seconds += now() - start;
+            if (strncmp(output, "ERROR", 5) == 0) {
+                result->error = error_line(output);
+                status = -1;
+                break;
+            }
+            result->items += count_lines(output);
+            break;
+        case BENCH_CP:
+            start = now();
+            output = cp(session, arg, target, 0);
+            result->seconds += now() - start;
+            if (strncmp(output, "Successfully", 12) != 0) {
+                result->error = error_line(output);
+                status = -1;
+            }
+            tree_files = 0;
+            tree_bytes = 0;
+            nftw(target, count_entry, 64, FTW_PHYS);
+            result->items += tree_files;
+            result->bytes += tree_bytes;
+            nftw(target, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+            rmdir(target);
+            break;
+    }
+    close_session(session);
+    free(output);
+    result->runs++;
+    return status;
+}
+
+static void print_string(FILE *out, const char *value) {
+    fputc('"', out);
+    for (; *value != '\0'; value++) {
+        unsigned char c = (unsigned char) *value;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_result(FILE *out, BENCH_OPTIONS *opt, BENCH_SCENARIO *scenario, const char *cache,
+                         BENCH_RESULT *result) {
+    double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+    fputs("{\"scenario\":", out);
+    print_string(out, scenario->name);
+    fprintf(out, ",\"command\":\"%s\",\"arg\":", kind_names[scenario->kind]);
+    print_string(out, scenario->arg);
+    fputs(",\"image\":", out);
+    print_string(out, opt->image);
+    fputs(",\"tag\":", out);
+    print_string(out, opt->tag);
+    fprintf(out, ",\"backend\":\"pread\",\"index\":%s,\"cache\":\"%s\",\"runs\":%lu,\"items\":%lu,\"bytes\":%lu,"
+                 "\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f,\"syscalls\":%lu,\"read_syscalls\":%lu,"
+                 "\"write_syscalls\":%lu,\"read_bytes\":%lu,\"peak_rss_kb\":%lu,\"error\":",
+            opt->index != NULL ? "true" : "false", cache, result->runs, result->items, result->bytes,
+            result->seconds, (double) result->items / seconds, (double) result->bytes / seconds / (1024 * 1024),
+            result->io.read_calls + result->io.write_calls, result->io.read_calls, result->io.write_calls,
+            result->io.read_bytes, result->peak_rss_kb);
+    if (result->error != NULL) {
+        print_string(out, result->error);
+    } else {
+        fputs("null", out);
+    }
+    fputs("}\n", out);
+    fflush(out);
+}
+
+/*
+ * Measures runs of the scenario between two samples of the process counters.
+ * Returns -1 when a run failed.
+ */
+static int measure(GENERAL_INFORMATION *g_info, BENCH_SCENARIO *scenario, BENCH_OPTIONS *opt, uint32_t runs,
+                   uint32_t count, BENCH_RESULT *result) {
+    BENCH_IO before;
+    BENCH_IO after;
+    memset(result, 0, sizeof(BENCH_RESULT));
+    reset_peak_rss();
+    read_io(&before);
+    int status = 0;
+    for (uint32_t i = 0; i < runs && status == 0; i++) {
+        status = run_once(g_info, scenario, opt, count, result);
+    }
+    read_io(&after);
+    result->io.read_calls = after.read_calls - before.read_calls;
+    result->io.write_calls = after.write_calls - before.write_calls;
+    result->io.read_bytes = after.read_bytes - before.read_bytes;
+    result->peak_rss_kb = peak_rss();
+    return status;
+}
+
+/* Cold run on a new volume, then warm runs on the same volume. Returns -1 when the scenario failed. */
+static int run_scenario(BENCH_SCENARIO *scenario, BENCH_OPTIONS *opt, FILE *out) {
+    drop_cache(opt->image);
+    GENERAL_INFORMATION *g_info = open_volume(opt);
+    if (g_info == NULL) {
+        fprintf(stderr, "No NTFS file system detected on %s\n", opt->image);
+        return -1;
+    }
+    BENCH_RESULT result;
+    int status = measure(g_info, scenario, opt, 1, 1, &result);
+    print_result(out, opt, scenario, "cold", &result);
+    free(result.error);
+    if (status == 0 && opt->runs > 0) {
+        status = measure(g_info, scenario, opt, opt->runs, opt->resolutions, &result);
+        print_result(out, opt, scenario, "warm", &result);
+        free(result.error);
+    }
+    free_g_info(g_info);
+    return status;
+}
+
+/* ---------------------------------------------------------------- listing */
+
+typedef struct {
+    char *path;
+    size_t parent_length;    // path[0 .. parent_length) is the directory
+    uint64_t size;
+    char kind;
+} BENCH_ENTRY;
+
+static int compare_parents(const void *a, const void *b) {
+    const BENCH_ENTRY *x = a;
+    const BENCH_ENTRY *y = b;
+    size_t length = x->parent_length < y->parent_length ? x->parent_length : y->parent_length;
+    int diff = memcmp(x->path, y->path, length);
+    if (diff != 0) {
+        return diff;
+    }
+    return x->parent_length < y->parent_length ? -1 : x->parent_length > y->parent_length;
+}
+
+static char *copy_prefix(const char *text, size_t length) {
+    char *copy = malloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static void add_scenario(BENCH_SCENARIO *scenarios, uint32_t *count, const char *name, BENCH_KIND kind, char *arg) {
+    if (*count == BENCH_MAX_SCENARIOS || arg == NULL) {
+        free(arg);
+        return;
+    }
+    scenarios[*count].name = strdup(name);
+    scenarios[*count].kind = kind;
+    scenarios[*count].arg = arg;
+    (*count)++;
+}
+
+/*
+ * Picks the standard scenarios from a listing written by ntfs_gen -l:
+ * the directory with most files, the deepest directory, the directory with
+ * most small files and the largest regular file, which has the most fragments
+ * when the image was generated with -x. The root directory is not used. Returns -1 when the listing can't be read.
+ */
+static int plan_from_listing(const char *listing, BENCH_SCENARIO *scenarios, uint32_t *count) {
+    FILE *file = fopen(listing, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    BENCH_ENTRY *entries = NULL;
+    size_t entry_count = 0;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        unsigned mft_num;
+        unsigned long size;
+        char kind;
+        int offset = 0;
+        if (sscanf(line, "%u %lu %c %n", &mft_num, &size, &kind, &offset) != 3 || offset == 0 ||
+            kind == 'd' || kind == 'o') {
+            continue;
+        }
+        char *path = line + offset;
+        path[strcspn(path, "\n")] = '\0';
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || slash == path) {
+            continue;
+        }
+        if (entry_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            entries = realloc(entries, capacity * sizeof(BENCH_ENTRY));
+        }
+        entries[entry_count].path = strdup(path);
+        entries[entry_count].parent_length = (size_t) (slash - path);
+        entries[entry_count].size = size;
+        entries[entry_count].kind = kind;
+        entry_count++;
+    }
+    free(line);
+    fclose(file);
+
+    qsort(entries, entry_count, sizeof(BENCH_ENTRY), compare_parents);
+    BENCH_ENTRY *huge = NULL;
+    BENCH_ENTRY *small = NULL;
+    BENCH_ENTRY *deep = NULL;
+    BENCH_ENTRY *large = NULL;
+    size_t huge_files = 0;
+    size_t small_files = 0;
+    size_t deep_levels = 0;
+    for (size_t i = 0, next; i < entry_count; i = next) {
+        size_t small_count = 0;
+        for (next = i; next < entry_count && compare_parents(&entries[i], &entries[next]) == 0; next++) {
+            small_count += entries[next].size <= BENCH_SMALL_FILE;
+            if (entries[next].kind == '-' && (large == NULL || entries[next].size > large->size)) {
+                large = &entries[next];
+            }
+        }
+        size_t levels = 0;
+        for (size_t j = 0; j < entries[i].parent_length; j++) {
+            levels += entries[i].path[j] == '/';
+        }
+        if (next - i > huge_files) {
+            huge_files = next - i;
+            huge = &entries[i];
+        }
+        if (small_count > small_files) {
+            small_files = small_count;
+            small = &entries[i];
+        }
+        if (levels > deep_levels) {
+            deep_levels = levels;
+            deep = &entries[i];
+        }
+    }
+
+    if (huge != NULL) {
+        add_scenario(scenarios, count, "huge-directory-ls", BENCH_LS, copy_prefix(huge->path, huge->parent_length));
+    }
+    if (deep != NULL) {
+        add_scenario(scenarios, count, "deep-path-cd", BENCH_CD, copy_prefix(deep->path, deep->parent_length));
+        add_scenario(scenarios, count, "name-find", BENCH_FIND, strdup(deep->path + deep->parent_length + 1));
+    }
+    if (small != NULL) {
+        add_scenario(scenarios, count, "small-files-cp", BENCH_CP, copy_prefix(small->path, small->parent_length));
+    }
+    if (large != NULL) {
+        add_scenario(scenarios, count, "large-fragmented-file-cp", BENCH_CP, strdup(large->path));
+    }
+    for (size_t i = 0; i < entry_count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+    return 0;
+}
+
+/* Scenario given as command:argument, e.g. ls:/dir_00001 or cp:/dir_00001/file_00000001.dat */
+static int parse_scenario(const char *spec, BENCH_SCENARIO *scenarios, uint32_t *count) {
+    const char *colon = strchr(spec, ':');
+    if (colon == NULL || colon[1] == '\0') {
+        return -1;
+    }
+    for (uint32_t kind = BENCH_LS; kind <= BENCH_CP; kind++) {
+        if (strlen(kind_names[kind]) == (size_t) (colon - spec) && strncmp(spec, kind_names[kind], colon - spec) == 0) {
+            add_scenario(scenarios, count, spec, kind, strdup(colon + 1));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void help(void) {
+    puts("ntfs_bench -i image [options] [command:argument ...] - measure ls, cd, find and cp on an image\n"
+         "\t-i, --image PATH           image or device to read\n"
+         "\t-x, --index PATH           metadata sidecar of the image\n"
+         "\t-l, --list PATH            listing of ntfs_gen, picks the standard scenarios\n"
+         "\t-r, --runs N               warm runs of every scenario (default 5)\n"
+         "\t-n, --resolutions N        path resolutions per run of a cd scenario (default 1000)\n"
+         "\t-t, --target DIR           directory for the copies of cp scenarios (default /tmp)\n"
+         "\t-T, --tag TEXT             label of the run, e.g. the build or the backend\n"
+         "\t-o, --output PATH          JSON Lines result file (default stdout)\n"
+         "\tcommands are ls, cd, find and cp, e.g. ls:/dir_00001 cd:/dir_00001/dir_00005 find:file_0000012");
+}
+
+int main(int argc, char *argv[]) {
+    BENCH_OPTIONS opt = {NULL, NULL, NULL, "", "/tmp", NULL, 5, 1000};
+
+    const char *short_flags = "i:x:l:r:n:t:T:o:h";
+    const struct option long_flags[] = {
+            {"image",       1, NULL, 'i'},
+            {"index",       1, NULL, 'x'},
+            {"list",        1, NULL, 'l'},
+            {"runs",        1, NULL, 'r'},
+            {"resolutions", 1, NULL, 'n'},
+            {"target",      1, NULL, 't'},
+            {"tag",         1, NULL, 'T'},
+            {"output",      1, NULL, 'o'},
+            {"help",        0, NULL, 'h'},
+            {0,             0, 0,    0}
+    };
+
+    int rez;
+    int long_id = 0;
+    while ((rez = getopt_long(argc, argv, short_flags, long_flags, &long_id)) != -1) {
+        switch (rez) {
+            case 'i':
+                opt.image = optarg;
+                break;
+            case 'x':
+                opt.index = optarg;
+                break;
+            case 'l':
+                opt.listing = optarg;
+                break;
+            case 'r':
+                opt.runs = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                opt.resolutions = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                opt.target = optarg;
+                break;
+            case 'T':
+                opt.tag = optarg;
+                break;
+            case 'o':
+                opt.output = optarg;
+                break;
+            default:
+                help();
+                return rez == 'h' ? 0 : 1;
+        }
+    }
+
+    BENCH_SCENARIO scenarios[BENCH_MAX_SCENARIOS];
+    uint32_t count = 0;
+    if (opt.listing != NULL && plan_from_listing(opt.listing, scenarios, &count) == -1) {
+        fprintf(stderr, "ERROR: Can't read listing %s\n", opt.listing);
+        return 1;
+    }
+    for (int i = optind; i < argc; i++) {
+        if (parse_scenario(argv[i], scenarios, &count) == -1) {
+            fprintf(stderr, "ERROR: Wrong scenario %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (opt.image == NULL || count == 0 || opt.resolutions == 0) {
+        help();
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (opt.output != NULL && (out = fopen(opt.output, "w")) == NULL) {
+        fprintf(stderr, "ERROR: Can't create %s\n", opt.output);
+        return 1;
+    }
+    int failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        failed |= run_scenario(&scenarios[i], &opt, out) != 0;
+        free(scenarios[i].name);
+        free(scenarios[i].arg);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    return failed;
+}
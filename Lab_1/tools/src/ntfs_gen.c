@@ -0,0 +1,2021 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../core/inc/ntfs.h"
+#include "../../core/inc/usn_journal.h"
+
+/*
+ * Deterministic generator of synthetic NTFS images.
+ *
+ * The same options and seed always produce the same image, so every reader
+ * change can be measured against identical inputs. Content of every file is
+ * gen_pattern_byte(mft_num, offset), zeroes inside sparse holes.
+ */
+
+#define GEN_RECORD_SIZE 1024
+#define GEN_INDEX_BLOCK_SIZE 4096
+#define GEN_BOOT_SIZE 8192
+#define GEN_LOG_FILE_SIZE (64 * 1024)
+#define GEN_UPCASE_SIZE (65536 * 2)
+#define GEN_BASE_TIME 132000000000000000ULL
+#define GEN_FIRST_USER_RECORD 24
+#define GEN_SYSTEM_NODES FILE_reserved12 // system files that have a name in the root directory
+#define GEN_NAME_MAX 255
+#define GEN_RESIDENT_MAX 700
+#define GEN_FILE_NAME_MIN 19           // "file_%08u.dat" of any file number
+#define GEN_LINK_DATA_MAX 104          // non-resident $DATA or attribute list in the base record of a linked file
+#define GEN_RESIDENT_BITMAP 256        // longer $I30 bitmaps are stored non-resident
+#define GEN_WRITE_CHUNK (1024 * 1024)
+#define GEN_USN_RECORD 16              // $Extend/$UsnJrnl
+#define GEN_USN_HOLE (1024 * 1024)     // $J starts with a hole, as if older records were dropped
+
+#define ALIGN8(x) (((x) + 7) & ~7ULL)
+
+enum {
+    NODE_DIRECTORY = 0x01,
+    NODE_SPARSE = 0x02,
+    NODE_RESIDENT = 0x04,
+    NODE_DELETED = 0x08,
+    NODE_OVERWRITTEN = 0x10,
+    NODE_SYSTEM = 0x20,
+    NODE_JOURNAL = 0x40,
+    NODE_LINK = 0x80,     // another name of the file `link`, it has no record of its own
+};
+
+typedef struct {
+    uint32_t parent;      // index of the parent node
+    uint32_t mft_num;
+    uint32_t number;      // used to build the name
+    uint32_t flags;
+    uint16_t fragments;   // planned number of data fragments
+    uint64_t size;
+    uint64_t allocated;
+    uint64_t modified;    // nt time of the last data change
+    uint32_t link;        // NODE_LINK: index of the file; file: number of extra names
+} __attribute__((__packed__)) GEN_NODE;
+
+typedef struct {
+    uint64_t lcn;
+    uint64_t length;
+} GEN_RANGE;
+
+typedef struct {
+    char *output;
+    char *listing;
+    uint64_t seed;
+    uint32_t cluster_size;
+    uint32_t files;
+    uint32_t fanout;
+    uint32_t depth;
+    uint32_t huge_dir;
+    uint64_t min_size;
+    uint64_t max_size;
+    uint32_t resident_percent;
+    uint32_t sparse_percent;
+    uint32_t max_fragments;
+    uint32_t mft_fragments;
+    uint32_t deleted;
+    uint32_t name_length;
+    uint64_t lsn;
+    bool journal;
+    uint64_t journal_id;
+    uint32_t changes;
+    uint32_t links;
+    bool no_data;
+    bool quiet;
+} GEN_OPTIONS;
+
+typedef struct {
+    GEN_OPTIONS *opt;
+    int fd;
+    uint64_t rng;
+
+    GEN_NODE *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t *children;        // node indexes grouped by parent
+    uint32_t *children_start;  // children of node i are children[start[i] .. start[i + 1])
+
+    uint32_t record_count;     // records in $MFT including the extension pool
+    uint32_t next_extension;   // next free record of the extension pool
+    uint32_t extension_limit;
+
+    EXTENT *mft_runs;
+    uint32_t mft_run_count;
+    GEN_RANGE *reserved;       // clusters taken by $MFT, skipped by the allocator
+    uint32_t reserved_count;
+
+    uint64_t next_lcn;
+    uint64_t total_clusters;
+    uint8_t *bitmap;
+    uint64_t bitmap_size;
+    uint8_t *mft_bitmap;
+
+    uint64_t mft_mirr_lcn;
+    uint64_t bitmap_lcn;
+    uint64_t bitmap_clusters;
+
+    uint8_t *usn;              // records of $UsnJrnl:$J after the leading hole
+    uint64_t usn_size;
+    uint64_t usn_capacity;
+    uint64_t usn_events;
+} GEN_STATE;
+
+static uint64_t gen_random(GEN_STATE *state) {
+    // xorshift64*
+    state->rng ^= state->rng >> 12;
+    state->rng ^= state->rng << 25;
+    state->rng ^= state->rng >> 27;
+    return state->rng * 2685821657736338717ULL;
+}
+
+static uint64_t gen_range(GEN_STATE *state, uint64_t low, uint64_t high) {
+    if (high <= low) {
+        return low;
+    }
+    return low + gen_random(state) % (high - low + 1);
+}
+
+uint8_t gen_pattern_byte(uint64_t mft_num, uint64_t offset) {
+    return (uint8_t) ((offset ^ (offset >> 8) ^ (mft_num * 131)) + (offset >> 16));
+}
+
+static void die(const char *message) {
+    fprintf(stderr, "ERROR: %s\n", message);
+    exit(1);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (ptr == NULL && count && size) {
+        die("out of memory");
+    }
+    return ptr;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (result == NULL && size) {
+        die("out of memory");
+    }
+    return result;
+}
+
+static void write_at(GEN_STATE *state, const void *buf, uint64_t length, uint64_t offset) {
+    if (pwrite(state->fd, buf, length, (off_t) offset) != (ssize_t) length) {
+        die("can't write image");
+    }
+}
+
+static uint64_t cluster_offset(GEN_STATE *state, uint64_t lcn) {
+    return lcn * state->opt->cluster_size;
+}
+
+/* ---------------------------------------------------------------- names */
+
+static const char *system_names[] = {"$MFT", "$MFTMirr", "$LogFile", "$Volume", "$AttrDef", ".", "$Bitmap",
+                                     "$Boot", "$BadClus", "$Secure", "$UpCase", "$Extend"};
+
+static uint8_t node_name(GEN_STATE *state, uint32_t index, char *name) {
+    GEN_NODE *node = &state->nodes[index];
+    int length;
+    if (node->flags & NODE_JOURNAL) {
+        length = sprintf(name, "%s", USN_JOURNAL_NAME);
+    } else if (node->flags & NODE_SYSTEM) {
+        length = sprintf(name, "%s", system_names[node->mft_num]);
+    } else if (node->flags & NODE_DIRECTORY) {
+        length = sprintf(name, "dir_%05u", node->number);
+    } else {
+        length = sprintf(name, "file_%08u.dat", node->number);
+    }
+    // long names exercise readers and archivers with names past 100 bytes
+    uint32_t pad = state->opt->name_length;
+    if (!(node->flags & NODE_SYSTEM) && pad > (uint32_t) length) {
+        if (pad > GEN_NAME_MAX) {
+            pad = GEN_NAME_MAX;
+        }
+        name[length++] = '_';
+        while ((uint32_t) length < pad) {
+            name[length] = (char) ('a' + (node->number + length) % 26);
+            length++;
+        }
+        name[length] = '\0';
+    }
+    return (uint8_t) length;
+}
+
+/* Bytes a resident attribute with a value of length bytes takes in a record. */
+static uint32_t resident_size(uint32_t length) {
+    return (uint32_t) ALIGN8(24 + length);
+}
+
+/*
+ * Bytes the base record of a file with a second name takes besides $DATA:
+ * header, $STANDARD_INFORMATION, both names padded to name_length and the end.
+ */
+static uint32_t linked_record_size(uint32_t name_length) {
+    if (name_length > GEN_NAME_MAX) {
+        name_length = GEN_NAME_MAX;
+    }
+    if (name_length < GEN_FILE_NAME_MIN) {
+        name_length = GEN_FILE_NAME_MIN;
+    }
+    uint32_t usa_count = GEN_RECORD_SIZE / NTFS_BLOCK_SIZE + 1;
+    return (uint32_t) ALIGN8(sizeof(MFT_RECORD) + usa_count * 2) + resident_size(sizeof(STANDARD_INFORMATION)) +
+           2 * resident_size(sizeof(FILE_NAME_ATTR) + name_length * 2) + 8;
+}
+
+static int collate_names(const char *a, const char *b) {
+    // $I30 indexes are sorted by upcased names first
+    for (size_t i = 0;; i++) {
+        unsigned char ca = (unsigned char) a[i];
+        unsigned char cb = (unsigned char) b[i];
+        unsigned char ua = (ca >= 'a' && ca <= 'z') ? ca - 32 : ca;
+        unsigned char ub = (cb >= 'a' && cb <= 'z') ? cb - 32 : cb;
+        if (ua != ub) {
+            return ua < ub ? -1 : 1;
+        }
+        if (ca == 0) {
+            break;
+        }
+    }
+    return strcmp(a, b);
+}
+
+static GEN_STATE *sort_state;
+
+static int compare_children(const void *a, const void *b) {
+    char name_a[GEN_NAME_MAX + 1];
+    char name_b[GEN_NAME_MAX + 1];
+    node_name(sort_state, *(const uint32_t *) a, name_a);
+    node_name(sort_state, *(const uint32_t *) b, name_b);
+    return collate_names(name_a, name_b);
+}
+
+/* ------------------------------------------------------------- planning */
+
+static uint32_t add_node(GEN_STATE *state, uint32_t parent, uint32_t flags, uint32_t number) {
+    if (state->node_count == state->node_capacity) {
+        state->node_capacity = state->node_capacity ? state->node_capacity * 2 : 1024;
+        state->nodes = xrealloc(state->nodes, sizeof(GEN_NODE) * state->node_capacity);
+    }
+    GEN_NODE *node = &state->nodes[state->node_count];
+    memset(node, 0, sizeof(GEN_NODE));
+    node->parent = parent;
+    node->flags = flags;
+    node->number = number;
+    node->modified = GEN_BASE_TIME + (uint64_t) state->node_count * 10000000ULL;
+    return state->node_count++;
+}
+
+static void plan_file(GEN_STATE *state, GEN_NODE *node) {
+    GEN_OPTIONS *opt = state->opt;
+    uint64_t cluster = opt->cluster_size;
+
+    // log-uniform distribution between min and max size
+    double low = opt->min_size ? (double) opt->min_size : 1.0;
+    double high = (double) opt->max_size;
+    double fraction = (double) (gen_random(state) % 1000000) / 1000000.0;
+    node->size = (uint64_t) (low * __builtin_pow(high / low, fraction));
+    if (node->size < opt->min_size) {
+        node->size = opt->min_size;
+    }
+
+    if (gen_range(state, 1, 100) <= opt->resident_percent) {
+        node->flags |= NODE_RESIDENT;
+        // the value has to fit next to $STANDARD_INFORMATION and a name of up to name_length characters
+        uint32_t name_length = opt->name_length > 20 ? opt->name_length : 20;
+        if (name_length > GEN_NAME_MAX) {
+            name_length = GEN_NAME_MAX;
+        }
+        node->size = node->size % (GEN_RESIDENT_MAX - name_length * 2);
+        node->allocated = ALIGN8(node->size);
+        return;
+    }
+    if (node->size == 0) {
+        node->size = 1;
+    }
+    node->allocated = (node->size + cluster - 1) / cluster * cluster;
+    uint64_t clusters = node->allocated / cluster;
+    if (gen_range(state, 1, 100) <= opt->sparse_percent && clusters >= 4) {
+        node->flags |= NODE_SPARSE;
+    }
+    uint64_t fragments = gen_range(state, 1, opt->max_fragments);
+    if (fragments > clusters) {
+        fragments = clusters;
+    }
+    node->fragments = (uint16_t) fragments;
+}
+
+static void plan_tree(GEN_STATE *state, uint32_t parent, uint32_t level, uint32_t *dir_number) {
+    for (uint32_t i = 0; i < state->opt->fanout && level + 1 < state->opt->depth; i++) {
+        uint32_t child = add_node(state, parent, NODE_DIRECTORY, (*dir_number)++);
+        plan_tree(state, child, level + 1, dir_number);
+    }
+}
+
+/* Spreads files evenly over the tree, every directory gets a contiguous range of records. */
+static void plan_files(GEN_STATE *state, uint32_t first_dir, uint32_t *file_number) {
+    uint32_t dir_end = state->node_count;
+    uint32_t dirs = 1 + dir_end - first_dir;
+    uint32_t files = state->opt->files;
+    for (uint32_t d = 0; d < dirs; d++) {
+        uint32_t parent = d == 0 ? FILE_root : first_dir + d - 1;
+        uint32_t count = (uint32_t) ((uint64_t) files * (d + 1) / dirs - (uint64_t) files * d / dirs);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t child = add_node(state, parent, 0, (*file_number)++);
+            plan_file(state, &state->nodes[child]);
+        }
+    }
+}
+
+static uint16_t node_sequence(GEN_STATE *state, uint32_t index);
+
+static uint64_t node_reference(GEN_STATE *state, uint32_t index);
+
+static uint32_t node_attributes(GEN_NODE *node);
+
+/* Appends a $J record about the node, records never cross a page. */
+static void add_usn_event(GEN_STATE *state, uint32_t index, uint32_t reason) {
+    GEN_NODE *node = &state->nodes[index];
+    char name[GEN_NAME_MAX + 1];
+    uint8_t name_length = node_name(state, index, name);
+    uint32_t length = (uint32_t) ALIGN8(sizeof(USN_RECORD_V2) + name_length * 2);
+    uint64_t page_left = USN_PAGE_SIZE - state->usn_size % USN_PAGE_SIZE;
+    uint64_t need = state->usn_size + page_left + length;
+    if (need > state->usn_capacity) {
+        uint64_t capacity = state->usn_capacity ? state->usn_capacity : 64 * 1024;
+        while (capacity < need) {
+            capacity *= 2;
+        }
+        state->usn = xrealloc(state->usn, capacity);
+        memset(state->usn + state->usn_capacity, 0, capacity - state->usn_capacity);
+        state->usn_capacity = capacity;
+    }
+    if (length > page_left) {
+        state->usn_size += page_left;
+    }
+    USN_RECORD_V2 *record = (USN_RECORD_V2 *) (state->usn + state->usn_size);
+    record->record_length = length;
+    record->major_version = 2;
+    record->file_reference = node_reference(state, index);
+    record->parent_reference = node_reference(state, node->parent);
+    record->usn = (int64_t) (GEN_USN_HOLE + state->usn_size);
+    record->time_stamp = (int64_t) (GEN_BASE_TIME + state->usn_events++ * 10000000ULL);
+    record->reason = reason;
+    record->file_attributes = node_attributes(node);
+    record->file_name_length = (uint16_t) (name_length * 2);
+    record->file_name_offset = sizeof(USN_RECORD_V2);
+    for (uint8_t i = 0; i < name_length; i++) {
+        record->file_name[i] = (uint16_t) (unsigned char) name[i];
+    }
+    state->usn_size += length;
+}
+
+/*
+ * Renames, rewrites, deletes and creates files after the journal got the
+ * records of the planned volume. Changes draw from their own random stream
+ * and new files take records from the top of the extension pool, so every
+ * record that is not changed stays the same as without changes.
+ */
+static void apply_changes(GEN_STATE *state, uint32_t file_number) {
+    GEN_OPTIONS *opt = state->opt;
+    uint64_t saved = state->rng;
+    state->rng = opt->seed * 0x2545f4914f6cdd1dULL + 7;
+    uint32_t planned = state->node_count;
+    uint32_t next_number = file_number;
+    for (uint32_t c = 0; c < opt->changes; c++) {
+        if (c % 4 == 3) {
+            uint32_t parent = (uint32_t) gen_range(state, GEN_SYSTEM_NODES, planned - 1);
+            while (parent >= GEN_SYSTEM_NODES && !(state->nodes[parent].flags & NODE_DIRECTORY)) {
+                parent = state->nodes[parent].parent;
+            }
+            if (parent < GEN_SYSTEM_NODES) {
+                parent = FILE_root;
+            }
+            if (state->extension_limit <= state->next_extension + 1) {
+                die("extension record pool is exhausted");
+            }
+            uint32_t child = add_node(state, parent, 0, next_number++);
+            plan_file(state, &state->nodes[child]);
+            state->nodes[child].mft_num = --state->extension_limit;
+            add_usn_event(state, child, USN_REASON_FILE_CREATE | USN_REASON_DATA_EXTEND | USN_REASON_CLOSE);
+            continue;
+        }
+        uint32_t index;
+        uint32_t tries = 0;
+        do {
+            index = (uint32_t) gen_range(state, GEN_SYSTEM_NODES, planned - 1);
+        } while ((state->nodes[index].flags & (NODE_DIRECTORY | NODE_DELETED)) && ++tries < 1000);
+        GEN_NODE *node = &state->nodes[index];
+        if (node->flags & (NODE_DIRECTORY | NODE_DELETED)) {
+            continue;
+        }
+        if (c % 4 == 0) {
+            add_usn_event(state, index, USN_REASON_RENAME_OLD_NAME);
+            node->number = next_number++;
+            add_usn_event(state, index, USN_REASON_RENAME_NEW_NAME | USN_REASON_CLOSE);
+        } else if (c % 4 == 1) {
+            // the allocation stays, so do the clusters of every other file
+            node->size = (node->flags & NODE_RESIDENT) ? node->size / 2 : gen_range(state, 1, node->allocated);
+            if (node->flags & NODE_RESIDENT) {
+                node->allocated = ALIGN8(node->size);
+            }
+            node->modified += 86400ULL * 10000000ULL;
+            add_usn_event(state, index, USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_TRUNCATION | USN_REASON_CLOSE);
+        } else {
+            add_usn_event(state, index, USN_REASON_FILE_DELETE | USN_REASON_CLOSE);
+            node->flags |= NODE_DELETED;
+        }
+    }
+    state->rng = saved;
+}
+
+/* Gives live files a second name in a random directory. */
+static void plan_links(GEN_STATE *state, uint32_t number) {
+    uint32_t planned = state->node_count;
+    // the second $FILE_NAME has to fit into the base record next to $DATA
+    uint32_t data_space = GEN_RECORD_SIZE - linked_record_size(state->opt->name_length);
+    for (uint32_t l = 0; l < state->opt->links; l++) {
+        uint32_t index;
+        uint32_t tries = 0;
+        do {
+            index = (uint32_t) gen_range(state, GEN_SYSTEM_NODES, planned - 1);
+        } while ((state->nodes[index].flags & (NODE_DIRECTORY | NODE_DELETED | NODE_SYSTEM) ||
+                  state->nodes[index].link != 0 ||
+                  ((state->nodes[index].flags & NODE_RESIDENT) ? resident_size((uint32_t) state->nodes[index].size)
+                                                               : GEN_LINK_DATA_MAX) > data_space) &&
+                 ++tries < 1000);
+        if (tries == 1000) {
+            break;
+        }
+        uint32_t parent = (uint32_t) gen_range(state, GEN_SYSTEM_NODES, planned - 1);
+        while (parent >= GEN_SYSTEM_NODES && !(state->nodes[parent].flags & NODE_DIRECTORY)) {
+            parent = state->nodes[parent].parent;
+        }
+        if (parent < GEN_SYSTEM_NODES || (state->nodes[parent].flags & NODE_SYSTEM)) {
+            parent = FILE_root;
+        }
+        uint32_t link = add_node(state, parent, 0, number++);
+        GEN_NODE *file = &state->nodes[index];
+        GEN_NODE *node = &state->nodes[link];
+        node->flags = NODE_LINK | (file->flags & (NODE_RESIDENT | NODE_SPARSE));
+        node->mft_num = file->mft_num;
+        node->size = file->size;
+        node->allocated = file->allocated;
+        node->modified = file->modified;
+        node->link = index;
+        file->link++;
+    }
+}
+
+static void plan(GEN_STATE *state) {
+    GEN_OPTIONS *opt = state->opt;
+
+    for (uint32_t i = 0; i < GEN_SYSTEM_NODES; i++) {
+        uint32_t flags = NODE_SYSTEM;
+        if (i == FILE_root || i == FILE_Extend) {
+            flags |= NODE_DIRECTORY;
+        }
+        uint32_t index = add_node(state, FILE_root, flags, i);
+        state->nodes[index].mft_num = i;
+    }
+
+    uint32_t dir_number = 0;
+    uint32_t file_number = 0;
+    if (opt->huge_dir > 0) {
+        uint32_t huge = add_node(state, FILE_root, NODE_DIRECTORY, dir_number++);
+        for (uint32_t i = 0; i < opt->huge_dir; i++) {
+            uint32_t child = add_node(state, huge, 0, file_number++);
+            plan_file(state, &state->nodes[child]);
+        }
+    }
+    uint32_t first_dir = state->node_count;
+    plan_tree(state, FILE_root, 0, &dir_number);
+    plan_files(state, first_dir, &file_number);
+
+    for (uint32_t i = 0; i < opt->deleted; i++) {
+        uint32_t parent = (uint32_t) gen_range(state, GEN_SYSTEM_NODES, state->node_count - 1);
+        while (parent >= GEN_SYSTEM_NODES && !(state->nodes[parent].flags & NODE_DIRECTORY)) {
+            parent = state->nodes[parent].parent;
+        }
+        if (parent < GEN_SYSTEM_NODES) {
+            parent = FILE_root;
+        }
+        uint32_t child = add_node(state, parent, NODE_DELETED, file_number++);
+        plan_file(state, &state->nodes[child]);
+        state->nodes[child].flags &= ~(NODE_RESIDENT | NODE_SPARSE);
+        if (state->nodes[child].allocated == 0 || state->nodes[child].fragments == 0) {
+            state->nodes[child].size = opt->cluster_size;
+            state->nodes[child].allocated = opt->cluster_size;
+            state->nodes[child].fragments = 1;
+        }
+        if (gen_range(state, 1, 100) <= 30) {
+            state->nodes[child].flags |= NODE_OVERWRITTEN;
+        }
+    }
+
+    uint32_t next_record = GEN_FIRST_USER_RECORD;
+    for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+        state->nodes[i].mft_num = next_record++;
+    }
+
+    // every heavily fragmented file may need extension records for its runlist
+    uint64_t extensions = 0;
+    uint32_t runs_per_record = (GEN_RECORD_SIZE - 256) / 20;
+    for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+        extensions += state->nodes[i].fragments * 2 / runs_per_record + 1;
+    }
+    extensions += state->node_count / 64 + 4;
+    if (opt->journal) {
+        // room for files created by changes, the same with and without them so $MFT keeps its size
+        extensions += state->node_count / 8 + 16;
+    }
+    state->next_extension = next_record;
+    state->extension_limit = (uint32_t) (next_record + extensions);
+    state->record_count = state->extension_limit;
+
+    if (opt->journal) {
+        // the volume as planned so far is what every change applies to
+        for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+            add_usn_event(state, i, USN_REASON_FILE_CREATE | USN_REASON_CLOSE);
+            if (state->nodes[i].flags & NODE_DELETED) {
+                add_usn_event(state, i, USN_REASON_FILE_DELETE | USN_REASON_CLOSE);
+            }
+        }
+        apply_changes(state, file_number);
+        uint32_t journal = add_node(state, FILE_Extend, NODE_SYSTEM | NODE_JOURNAL, 0);
+        state->nodes[journal].mft_num = GEN_USN_RECORD;
+    }
+    plan_links(state, file_number + opt->changes);
+
+    // group children by parent
+    state->children_start = xcalloc(state->node_count + 1, sizeof(uint32_t));
+    state->children = xcalloc(state->node_count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        if (i == FILE_root || (state->nodes[i].flags & NODE_DELETED)) {
+            continue;
+        }
+        state->children_start[state->nodes[i].parent + 1]++;
+    }
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        state->children_start[i + 1] += state->children_start[i];
+    }
+    uint32_t *fill = xcalloc(state->node_count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        if (i == FILE_root || (state->nodes[i].flags & NODE_DELETED)) {
+            continue;
+        }
+        uint32_t parent = state->nodes[i].parent;
+        state->children[state->children_start[parent] + fill[parent]++] = i;
+    }
+    free(fill);
+    // "." is the root directory itself
+    for (uint32_t i = state->children_start[FILE_root]; i < state->children_start[FILE_root + 1]; i++) {
+        if (state->children[i] == FILE_root) {
+            break;
+        }
+    }
+    sort_state = state;
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        uint32_t count = state->children_start[i + 1] - state->children_start[i];
+        if (count > 1) {
+            qsort(&state->children[state->children_start[i]], count, sizeof(uint32_t), compare_children);
+        }
+    }
+}
+
+/* ------------------------------------------------------------ allocator */
+
+static void mark_clusters(GEN_STATE *state, uint64_t lcn, uint64_t length) {
+    uint64_t need = (lcn + length + 7) / 8;
+    if (need > state->bitmap_size) {
+        uint64_t size = state->bitmap_size ? state->bitmap_size : 4096;
+        while (size < need) {
+            size *= 2;
+        }
+        state->bitmap = xrealloc(state->bitmap, size);
+        memset(state->bitmap + state->bitmap_size, 0, size - state->bitmap_size);
+        state->bitmap_size = size;
+    }
+    for (uint64_t i = lcn; i < lcn + length; i++) {
+        state->bitmap[i >> 3] |= (uint8_t) (1 << (i & 7));
+    }
+}
+
+static void alloc_run(GEN_STATE *state, uint64_t want, uint64_t *lcn, uint64_t *got) {
+    for (;;) {
+        bool moved = false;
+        for (uint32_t i = 0; i < state->reserved_count; i++) {
+            GEN_RANGE *range = &state->reserved[i];
+            if (state->next_lcn >= range->lcn && state->next_lcn < range->lcn + range->length) {
+                state->next_lcn = range->lcn + range->length;
+                moved = true;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+    }
+    uint64_t limit = want;
+    for (uint32_t i = 0; i < state->reserved_count; i++) {
+        GEN_RANGE *range = &state->reserved[i];
+        if (range->lcn > state->next_lcn && range->lcn - state->next_lcn < limit) {
+            limit = range->lcn - state->next_lcn;
+        }
+    }
+    *lcn = state->next_lcn;
+    *got = limit;
+    state->next_lcn += limit;
+}
+
+static uint32_t alloc_runs(GEN_STATE *state, uint64_t clusters, uint32_t fragments, bool sparse, bool mark,
+                           EXTENT **runs) {
+    uint32_t capacity = fragments * 2 + 8;
+    uint32_t count = 0;
+    *runs = xcalloc(capacity, sizeof(EXTENT));
+    uint64_t vcn = 0;
+    uint64_t piece = fragments ? clusters / fragments : clusters;
+    if (piece == 0) {
+        piece = 1;
+    }
+
+    while (vcn < clusters) {
+        uint64_t want = piece;
+        if (want > clusters - vcn) {
+            want = clusters - vcn;
+        }
+        if (count + 2 >= capacity) {
+            capacity *= 2;
+            *runs = xrealloc(*runs, capacity * sizeof(EXTENT));
+        }
+        // every other piece of a sparse file is a hole
+        if (sparse && count % 2 == 1) {
+            (*runs)[count].vcn = vcn;
+            (*runs)[count].lcn = LCN_HOLE;
+            (*runs)[count].length = want;
+            count++;
+            vcn += want;
+            continue;
+        }
+        uint64_t lcn;
+        uint64_t got;
+        alloc_run(state, want, &lcn, &got);
+        if (count > 0 && (*runs)[count - 1].lcn != LCN_HOLE &&
+            (uint64_t) (*runs)[count - 1].lcn + (*runs)[count - 1].length == lcn) {
+            (*runs)[count - 1].length += got;
+        } else {
+            (*runs)[count].vcn = vcn;
+            (*runs)[count].lcn = (int64_t) lcn;
+            (*runs)[count].length = got;
+            count++;
+        }
+        if (mark) {
+            mark_clusters(state, lcn, got);
+        }
+        vcn += got;
+        // leave a free gap so that the next piece is a separate fragment
+        if (fragments > 1 && vcn < clusters) {
+            state->next_lcn += gen_range(state, 1, 4);
+        }
+    }
+    return count;
+}
+
+/* -------------------------------------------------------------- runlists */
+
+static uint8_t signed_size(int64_t value) {
+    uint8_t size = 1;
+    while (size < 8) {
+        int64_t min = -(1LL << (size * 8 - 1));
+        int64_t max = (1LL << (size * 8 - 1)) - 1;
+        if (value >= min && value <= max) {
+            break;
+        }
+        size++;
+    }
+    return size;
+}
+
+static uint8_t unsigned_size(uint64_t value) {
+    uint8_t size = 1;
+    while (size < 8 && (value >> (size * 8)) != 0) {
+        size++;
+    }
+    return size;
+}
+
+/* Encodes runs[from..to) into buf, returns the number of bytes without the terminator. */
+static uint32_t encode_runs(const EXTENT *runs, uint32_t from, uint32_t to, uint8_t *buf, uint32_t capacity,
+                            uint32_t *encoded) {
+    uint32_t used = 0;
+    int64_t prev_lcn = 0;
+    uint32_t i;
+    for (i = from; i < to; i++) {
+        uint8_t length_size = unsigned_size(runs[i].length);
+        uint8_t offset_size = 0;
+        int64_t delta = 0;
+        if (runs[i].lcn != LCN_HOLE) {
+            delta = runs[i].lcn - prev_lcn;
+            offset_size = signed_size(delta);
+        }
+        if (used + 1 + length_size + offset_size + 1 > capacity) {
+            break;
+        }
+        if (buf != NULL) {
+            buf[used] = (uint8_t) ((offset_size << 4) | length_size);
+            for (uint8_t b = 0; b < length_size; b++) {
+                buf[used + 1 + b] = (uint8_t) (runs[i].length >> (b * 8));
+            }
+            for (uint8_t b = 0; b < offset_size; b++) {
+                buf[used + 1 + length_size + b] = (uint8_t) ((uint64_t) delta >> (b * 8));
+            }
+        }
+        used += 1 + length_size + offset_size;
+        if (runs[i].lcn != LCN_HOLE) {
+            prev_lcn = runs[i].lcn;
+        }
+    }
+    if (buf != NULL) {
+        buf[used] = 0;
+    }
+    *encoded = i - from;
+    return used;
+}
+
+/* --------------------------------------------------------------- records */
+
+static void record_init(uint8_t *record, uint32_t mft_num, uint16_t sequence, uint16_t flags, uint64_t base,
+                        uint64_t lsn) {
+    memset(record, 0, GEN_RECORD_SIZE);
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    header->magic = magic_FILE;
+    header->usa_ofs = sizeof(MFT_RECORD);
+    header->usa_count = GEN_RECORD_SIZE / NTFS_BLOCK_SIZE + 1;
+    header->lsn = lsn;
+    header->sequence_number = sequence;
+    header->link_count = base ? 0 : 1;
+    header->attrs_offset = (uint16_t) ALIGN8(header->usa_ofs + header->usa_count * 2);
+    header->flags = flags;
+    header->bytes_in_use = header->attrs_offset + 8;
+    header->bytes_allocated = GEN_RECORD_SIZE;
+    header->base_mft_record = base;
+    header->mft_record_number = mft_num;
+    *(uint32_t *) (record + header->attrs_offset) = AT_END;
+}
+
+static uint32_t record_free_space(const uint8_t *record) {
+    const MFT_RECORD *header = (const MFT_RECORD *) record;
+    return GEN_RECORD_SIZE - header->bytes_in_use;
+}
+
+static ATTR_RECORD *record_append(uint8_t *record, uint32_t length) {
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint32_t offset = header->bytes_in_use - 8;
+    length = (uint32_t) ALIGN8(length);
+    if (offset + length + 8 > GEN_RECORD_SIZE) {
+        die("attribute does not fit into the mft record");
+    }
+    ATTR_RECORD *attr = (ATTR_RECORD *) (record + offset);
+    memset(attr, 0, length);
+    attr->length = length;
+    attr->instance = header->next_attr_instance++;
+    header->bytes_in_use += length;
+    *(uint32_t *) (record + header->bytes_in_use - 8) = AT_END;
+    return attr;
+}
+
+static void set_attr_name(ATTR_RECORD *attr, uint16_t name_offset, const char *name) {
+    if (name == NULL) {
+        attr->name_offset = name_offset;
+        return;
+    }
+    attr->name_length = (uint8_t) strlen(name);
+    attr->name_offset = name_offset;
+    uint16_t *dst = (uint16_t *) ((uint8_t *) attr + name_offset);
+    for (uint8_t i = 0; i < attr->name_length; i++) {
+        dst[i] = (uint16_t) name[i];
+    }
+}
+
+static uint16_t add_resident(uint8_t *record, uint32_t type, const char *name, const void *value, uint32_t length,
+                             uint8_t resident_flags) {
+    uint32_t name_bytes = name ? (uint32_t) ALIGN8(strlen(name) * 2) : 0;
+    ATTR_RECORD *attr = record_append(record, 24 + name_bytes + length);
+    attr->type = type;
+    set_attr_name(attr, 24, name);
+    attr->value_length = length;
+    attr->value_offset = (uint16_t) (24 + name_bytes);
+    attr->resident_flags = resident_flags;
+    if (value != NULL) {
+        memcpy((uint8_t *) attr + attr->value_offset, value, length);
+    }
+    return attr->instance;
+}
+
+static uint32_t nonresident_header_size(const char *name, bool sparse) {
+    uint32_t name_bytes = name ? (uint32_t) ALIGN8(strlen(name) * 2) : 0;
+    return (sparse ? 72 : 64) + name_bytes;
+}
+
+/* Adds runs[from..) as one attribute extent, returns the number of runs stored. */
+static uint32_t add_nonresident(uint8_t *record, uint32_t type, const char *name, const EXTENT *runs,
+                                uint32_t from, uint32_t to, uint64_t total_clusters, uint64_t data_size,
+                                uint64_t allocated, bool sparse, uint16_t *instance) {
+    uint32_t header_size = nonresident_header_size(name, sparse);
+    uint32_t space = record_free_space(record);
+    if (space < header_size + 8) {
+        return 0;
+    }
+    uint32_t encoded;
+    uint32_t runs_size = encode_runs(runs, from, to, NULL, space - header_size - 1, &encoded);
+    if (encoded == 0 && to > from) {
+        return 0;
+    }
+    ATTR_RECORD *attr = record_append(record, header_size + runs_size + 1);
+    attr->type = type;
+    attr->non_resident = 1;
+    set_attr_name(attr, sparse ? 72 : 64, name);
+    attr->flags = sparse ? ATTR_IS_SPARSE : 0;
+    attr->lowest_vcn = from < to ? runs[from].vcn : 0;
+    uint64_t end_vcn = (from + encoded < to) ? runs[from + encoded].vcn : total_clusters;
+    attr->highest_vcn = end_vcn ? end_vcn - 1 : (uint64_t) -1;
+    attr->mapping_pairs_offset = (uint16_t) header_size;
+    if (attr->lowest_vcn == 0) {
+        attr->allocated_size = allocated;
+        attr->data_size = data_size;
+        attr->initialized_size = data_size;
+        if (sparse) {
+            uint64_t used = 0;
+            for (uint32_t i = 0; i < to; i++) {
+                if (runs[i].lcn != LCN_HOLE) {
+                    used += runs[i].length;
+                }
+            }
+            attr->compressed_size = used * (allocated / (total_clusters ? total_clusters : 1));
+        }
+    }
+    encode_runs(runs, from, to, (uint8_t *) attr + header_size, space - header_size - 1, &encoded);
+    if (instance != NULL) {
+        *instance = attr->instance;
+    }
+    return encoded;
+}
+
+static void protect(uint8_t *record, uint32_t size, uint16_t usn) {
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint16_t *usa = (uint16_t *) (record + header->usa_ofs);
+    usa[0] = usn;
+    for (uint32_t i = 1; i < header->usa_count && i * NTFS_BLOCK_SIZE <= size; i++) {
+        uint16_t *block_end = (uint16_t *) (record + i * NTFS_BLOCK_SIZE - 2);
+        usa[i] = *block_end;
+        *block_end = usn;
+    }
+}
+
+static uint64_t mft_record_offset(GEN_STATE *state, uint32_t mft_num) {
+    uint64_t offset = (uint64_t) mft_num * GEN_RECORD_SIZE;
+    uint64_t cluster = state->opt->cluster_size;
+    for (uint32_t i = 0; i < state->mft_run_count; i++) {
+        EXTENT *run = &state->mft_runs[i];
+        if (offset < (run->vcn + run->length) * cluster) {
+            return (uint64_t) run->lcn * cluster + offset - run->vcn * cluster;
+        }
+    }
+    die("record is outside of $MFT");
+    return 0;
+}
+
+static void write_record(GEN_STATE *state, uint8_t *record) {
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint32_t mft_num = header->mft_record_number;
+    if (header->flags & MFT_RECORD_IN_USE) {
+        state->mft_bitmap[mft_num >> 3] |= (uint8_t) (1 << (mft_num & 7));
+    }
+    protect(record, GEN_RECORD_SIZE, (uint16_t) (1 + mft_num % 0xfffe));
+    uint64_t cluster = state->opt->cluster_size;
+    uint64_t offset = (uint64_t) mft_num * GEN_RECORD_SIZE;
+    // a record may cross a fragment border when clusters are smaller than records
+    for (uint32_t done = 0; done < GEN_RECORD_SIZE;) {
+        uint64_t disk = mft_record_offset(state, (uint32_t) ((offset + done) / GEN_RECORD_SIZE)) +
+                        (offset + done) % GEN_RECORD_SIZE;
+        uint32_t chunk = (uint32_t) (cluster - (offset + done) % cluster);
+        if (chunk > GEN_RECORD_SIZE - done) {
+            chunk = GEN_RECORD_SIZE - done;
+        }
+        write_at(state, record + done, chunk, disk);
+        done += chunk;
+    }
+}
+
+static uint32_t node_attributes(GEN_NODE *node) {
+    uint32_t attributes = 0;
+    if (node->flags & NODE_SYSTEM) {
+        attributes |= FILE_ATTR_HIDDEN | FILE_ATTR_SYSTEM;
+    }
+    if (node->flags & NODE_SPARSE) {
+        attributes |= FILE_ATTR_SPARSE_FILE;
+    }
+    if (!(node->flags & NODE_DIRECTORY) && attributes == 0) {
+        attributes = FILE_ATTR_ARCHIVE;
+    }
+    return attributes;
+}
+
+static void add_standard_information(uint8_t *record, GEN_NODE *node) {
+    STANDARD_INFORMATION si;
+    memset(&si, 0, sizeof(si));
+    si.creation_time = GEN_BASE_TIME;
+    si.last_data_change_time = node->modified;
+    si.last_mft_change_time = node->modified;
+    si.last_access_time = node->modified;
+    si.file_attributes = node_attributes(node);
+    si.security_id = 0x100;
+    add_resident(record, AT_STANDARD_INFORMATION, NULL, &si, sizeof(si), 0);
+}
+
+static uint32_t build_file_name(GEN_STATE *state, uint32_t index, uint8_t *buf) {
+    GEN_NODE *node = &state->nodes[index];
+    GEN_NODE *parent = &state->nodes[node->parent];
+    char name[GEN_NAME_MAX + 1];
+    uint8_t length = node_name(state, index, name);
+
+    FILE_NAME_ATTR *file_name = (FILE_NAME_ATTR *) buf;
+    memset(file_name, 0, sizeof(FILE_NAME_ATTR));
+    uint16_t parent_sequence = parent->mft_num < FILE_first_user ? (uint16_t) parent->mft_num : 1;
+    if (parent->mft_num == FILE_MFT) {
+        parent_sequence = 1;
+    }
+    file_name->parent_directory = parent->mft_num | ((uint64_t) parent_sequence << 48);
+    file_name->creation_time = GEN_BASE_TIME;
+    file_name->last_data_change_time = node->modified;
+    file_name->last_mft_change_time = node->modified;
+    file_name->last_access_time = node->modified;
+    file_name->allocated_size = node->allocated;
+    file_name->data_size = node->size;
+    file_name->file_attributes = node_attributes(node);
+    if (node->flags & NODE_DIRECTORY) {
+        file_name->file_attributes |= FILE_ATTR_I30_INDEX_PRESENT;
+        file_name->allocated_size = 0;
+        file_name->data_size = 0;
+    }
+    file_name->file_name_length = length;
+    file_name->file_name_type = FILE_NAME_POSIX;
+    for (uint8_t i = 0; i < length; i++) {
+        file_name->file_name[i] = (uint16_t) (unsigned char) name[i];
+    }
+    return sizeof(FILE_NAME_ATTR) + length * 2;
+}
+
+static uint16_t node_sequence(GEN_STATE *state, uint32_t index) {
+    GEN_NODE *node = &state->nodes[index];
+    if (node->mft_num == FILE_MFT) {
+        return 1;
+    }
+    if (node->mft_num < FILE_first_user) {
+        return (uint16_t) node->mft_num;
+    }
+    return (node->flags & NODE_DELETED) ? 2 : 1;
+}
+
+static uint64_t node_reference(GEN_STATE *state, uint32_t index) {
+    return state->nodes[index].mft_num | ((uint64_t) node_sequence(state, index) << 48);
+}
+
+/*
+ * Writes a base record with attribute `type` described by runs. When the
+ * runlist doesn't fit, it is split over extension records and an attribute
+ * list is placed in the base record.
+ */
+static void write_nonresident_record(GEN_STATE *state, uint8_t *record, uint32_t type, const char *name,
+                                     EXTENT *runs, uint32_t run_count, uint64_t total_clusters,
+                                     uint64_t data_size, uint64_t allocated, bool sparse) {
+    uint8_t saved[GEN_RECORD_SIZE];
+    memcpy(saved, record, GEN_RECORD_SIZE);
+    uint32_t stored = add_nonresident(record, type, name, runs, 0, run_count, total_clusters, data_size, allocated,
+                                      sparse, NULL);
+    if (stored == run_count) {
+        write_record(state, record);
+        return;
+    }
+
+    // rebuild with an attribute list: every extent of the runlist goes to its own extension record
+    memcpy(record, saved, GEN_RECORD_SIZE);
+    MFT_RECORD *base = (MFT_RECORD *) record;
+    uint64_t base_reference = base->mft_record_number | ((uint64_t) base->sequence_number << 48);
+
+    uint32_t list_capacity = 4096;
+    uint32_t list_length = 0;
+    uint8_t *list = xcalloc(1, list_capacity);
+
+    // entries for the attributes already present in the base record
+    uint8_t *ptr = record + base->attrs_offset;
+    while (*(uint32_t *) ptr != AT_END) {
+        ATTR_RECORD *attr = (ATTR_RECORD *) ptr;
+        ATTR_LIST_ENTRY *entry = (ATTR_LIST_ENTRY *) (list + list_length);
+        entry->type = attr->type;
+        entry->length = 32;
+        entry->name_offset = 26;
+        entry->mft_reference = base_reference;
+        entry->instance = attr->instance;
+        list_length += 32;
+        ptr += attr->length;
+    }
+
+    uint8_t extension[GEN_RECORD_SIZE];
+    uint32_t from = 0;
+    uint32_t name_bytes = name ? (uint32_t) strlen(name) * 2 : 0;
+    while (from < run_count) {
+        if (state->next_extension >= state->extension_limit) {
+            die("extension record pool is exhausted");
+        }
+        uint32_t mft_num = state->next_extension++;
+        record_init(extension, mft_num, 1, MFT_RECORD_IN_USE, base_reference, state->opt->lsn);
+        uint16_t instance;
+        uint32_t count = add_nonresident(extension, type, name, runs, from, run_count, total_clusters, data_size,
+                                         allocated, sparse, &instance);
+        if (count == 0) {
+            die("runlist does not fit into an extension record");
+        }
+        write_record(state, extension);
+
+        uint32_t entry_length = (uint32_t) ALIGN8(26 + name_bytes);
+        if (list_length + entry_length > list_capacity) {
+            list_capacity *= 2;
+            list = xrealloc(list, list_capacity);
+        }
+        ATTR_LIST_ENTRY *entry = (ATTR_LIST_ENTRY *) (list + list_length);
+        memset(entry, 0, entry_length);
+        entry->type = type;
+        entry->length = (uint16_t) entry_length;
+        entry->name_length = name ? (uint8_t) strlen(name) : 0;
+        entry->name_offset = 26;
+        entry->lowest_vcn = runs[from].vcn;
+        entry->mft_reference = mft_num | (1ULL << 48);
+        entry->instance = runs[from].vcn == 0 ? instance : 0;
+        for (uint32_t i = 0; name && i < entry->name_length; i++) {
+            entry->name[i] = (uint16_t) name[i];
+        }
+        list_length += entry_length;
+        from += count;
+    }
+
+    // the list goes right after $STANDARD_INFORMATION, a long list is stored non-resident
+    uint8_t rebuilt[GEN_RECORD_SIZE];
+    record_init(rebuilt, base->mft_record_number, base->sequence_number, base->flags, 0, base->lsn);
+    ptr = record + base->attrs_offset;
+    ATTR_RECORD *standard_information = (ATTR_RECORD *) ptr;
+    memcpy(record_append(rebuilt, standard_information->length), standard_information,
+           standard_information->length);
+    ((MFT_RECORD *) rebuilt)->next_attr_instance = 1;
+    // a resident list also has to leave room for the attributes that stay, names above all
+    uint32_t rest = 0;
+    for (ptr += standard_information->length; *(uint32_t *) ptr != AT_END; ptr += ((ATTR_RECORD *) ptr)->length) {
+        rest += ((ATTR_RECORD *) ptr)->length;
+    }
+    ptr = record + base->attrs_offset;
+    if (list_length + 24 + 200 < GEN_RECORD_SIZE / 2 &&
+        resident_size(list_length) + rest <= record_free_space(rebuilt)) {
+        add_resident(rebuilt, AT_ATTRIBUTE_LIST, NULL, list, list_length, 0);
+    } else {
+        uint64_t clusters = (list_length + state->opt->cluster_size - 1) / state->opt->cluster_size;
+        EXTENT *list_runs;
+        uint32_t list_run_count = alloc_runs(state, clusters, 1, false, true, &list_runs);
+        uint8_t *list_buf = xcalloc(clusters, state->opt->cluster_size);
+        memcpy(list_buf, list, list_length);
+        write_at(state, list_buf, clusters * state->opt->cluster_size, cluster_offset(state, list_runs[0].lcn));
+        add_nonresident(rebuilt, AT_ATTRIBUTE_LIST, NULL, list_runs, 0, list_run_count, clusters, list_length,
+                        clusters * state->opt->cluster_size, false, NULL);
+        free(list_buf);
+        free(list_runs);
+    }
+    ptr += standard_information->length;
+    while (*(uint32_t *) ptr != AT_END) {
+        ATTR_RECORD *attr = (ATTR_RECORD *) ptr;
+        ATTR_RECORD *copy = record_append(rebuilt, attr->length);
+        uint16_t instance = copy->instance;
+        memcpy(copy, attr, attr->length);
+        copy->instance = instance;
+        ptr += attr->length;
+    }
+    memcpy(record, rebuilt, GEN_RECORD_SIZE);
+    free(list);
+    write_record(state, record);
+}
+
+/* ----------------------------------------------------------------- data */
+
+static void write_pattern(GEN_STATE *state, uint64_t mft_num, EXTENT *runs, uint32_t run_count, uint64_t size) {
+    if (state->opt->no_data) {
+        return;
+    }
+    uint64_t cluster = state->opt->cluster_size;
+    uint8_t *buf = malloc(GEN_WRITE_CHUNK);
+    for (uint32_t i = 0; i < run_count; i++) {
+        if (runs[i].lcn == LCN_HOLE) {
+            continue;
+        }
+        uint64_t start = runs[i].vcn * cluster;
+        uint64_t end = start + runs[i].length * cluster;
+        for (uint64_t offset = start; offset < end; offset += GEN_WRITE_CHUNK) {
+            uint64_t chunk = end - offset < GEN_WRITE_CHUNK ? end - offset : GEN_WRITE_CHUNK;
+            for (uint64_t b = 0; b < chunk; b++) {
+                buf[b] = offset + b < size ? gen_pattern_byte(mft_num, offset + b) : 0;
+            }
+            write_at(state, buf, chunk, cluster_offset(state, runs[i].lcn) + offset - start);
+        }
+    }
+    free(buf);
+}
+
+static void write_file(GEN_STATE *state, uint32_t index) {
+    GEN_NODE *node = &state->nodes[index];
+    uint8_t record[GEN_RECORD_SIZE];
+    bool deleted = node->flags & NODE_DELETED;
+    record_init(record, node->mft_num, node_sequence(state, index), deleted ? 0 : MFT_RECORD_IN_USE, 0,
+                state->opt->lsn);
+    add_standard_information(record, node);
+    uint8_t file_name[sizeof(FILE_NAME_ATTR) + GEN_NAME_MAX * 2];
+    uint32_t file_name_length = build_file_name(state, index, file_name);
+    add_resident(record, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+    for (uint32_t i = index + 1; node->link != 0 && i < state->node_count; i++) {
+        if ((state->nodes[i].flags & NODE_LINK) && state->nodes[i].link == index) {
+            file_name_length = build_file_name(state, i, file_name);
+            add_resident(record, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+            ((MFT_RECORD *) record)->link_count++;
+        }
+    }
+
+    if (node->flags & NODE_RESIDENT) {
+        uint8_t data[GEN_RESIDENT_MAX];
+        for (uint64_t i = 0; i < node->size; i++) {
+            data[i] = gen_pattern_byte(node->mft_num, i);
+        }
+        add_resident(record, AT_DATA, NULL, data, (uint32_t) node->size, 0);
+        write_record(state, record);
+        return;
+    }
+
+    uint64_t clusters = node->allocated / state->opt->cluster_size;
+    EXTENT *runs;
+    uint32_t run_count;
+    if (deleted && (node->flags & NODE_OVERWRITTEN) && state->next_lcn > clusters + 64) {
+        // points into clusters that were reused by a live file
+        run_count = 1;
+        runs = xcalloc(1, sizeof(EXTENT));
+        runs[0].lcn = (int64_t) gen_range(state, 64, state->next_lcn - clusters - 1);
+        runs[0].length = clusters;
+    } else {
+        run_count = alloc_runs(state, clusters, node->fragments, node->flags & NODE_SPARSE, !deleted, &runs);
+        write_pattern(state, node->mft_num, runs, run_count, node->size);
+    }
+    write_nonresident_record(state, record, AT_DATA, NULL, runs, run_count, clusters, node->size, node->allocated,
+                             node->flags & NODE_SPARSE);
+    free(runs);
+}
+
+/* ---------------------------------------------------------------- index */
+
+typedef struct {
+    uint32_t node;
+    int64_t child_vcn;   // -1 when the entry has no sub-node
+} GEN_ITEM;
+
+typedef struct {
+    uint8_t *blocks;
+    uint32_t count;
+    uint32_t capacity;
+} GEN_BLOCKS;
+
+static uint32_t entry_size(GEN_STATE *state, GEN_ITEM *item) {
+    char name[GEN_NAME_MAX + 1];
+    uint32_t size = (uint32_t) ALIGN8(16 + sizeof(FILE_NAME_ATTR) + node_name(state, item->node, name) * 2);
+    return item->child_vcn >= 0 ? size + 8 : size;
+}
+
+static uint32_t put_entries(GEN_STATE *state, uint8_t *dst, GEN_ITEM *items, uint32_t count, int64_t end_vcn) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        INDEX_ENTRY *entry = (INDEX_ENTRY *) (dst + used);
+        uint32_t size = entry_size(state, &items[i]);
+        memset(entry, 0, size);
+        entry->indexed_file = node_reference(state, items[i].node);
+        entry->length = (uint16_t) size;
+        entry->key_length = (uint16_t) build_file_name(state, items[i].node, (uint8_t *) &entry->key.file_name);
+        if (items[i].child_vcn >= 0) {
+            entry->ie_flags = INDEX_ENTRY_NODE;
+            *(int64_t *) ((uint8_t *) entry + size - 8) = items[i].child_vcn;
+        }
+        used += size;
+    }
+    INDEX_ENTRY *end = (INDEX_ENTRY *) (dst + used);
+    uint32_t size = end_vcn >= 0 ? 24 : 16;
+    memset(end, 0, size);
+    end->length = (uint16_t) size;
+    end->ie_flags = INDEX_ENTRY_END;
+    if (end_vcn >= 0) {
+        end->ie_flags |= INDEX_ENTRY_NODE;
+        *(int64_t *) ((uint8_t *) end + 16) = end_vcn;
+    }
+    return used + size;
+}
+
+static uint32_t block_entries_offset(void) {
+    uint32_t usa_count = GEN_INDEX_BLOCK_SIZE / NTFS_BLOCK_SIZE + 1;
+    return (uint32_t) ALIGN8(0x28 + usa_count * 2);
+}
+
+static int64_t index_vcn(GEN_STATE *state, uint32_t block) {
+    uint64_t unit = GEN_INDEX_BLOCK_SIZE >= state->opt->cluster_size ? state->opt->cluster_size : NTFS_BLOCK_SIZE;
+    return (int64_t) ((uint64_t) block * GEN_INDEX_BLOCK_SIZE / unit);
+}
+
+static int64_t emit_block(GEN_STATE *state, GEN_BLOCKS *blocks, GEN_ITEM *items, uint32_t count, int64_t end_vcn) {
+    if (blocks->count == blocks->capacity) {
+        blocks->capacity = blocks->capacity ? blocks->capacity * 2 : 4;
+        blocks->blocks = xrealloc(blocks->blocks, (size_t) blocks->capacity * GEN_INDEX_BLOCK_SIZE);
+    }
+    uint8_t *block = blocks->blocks + (size_t) blocks->count * GEN_INDEX_BLOCK_SIZE;
+    memset(block, 0, GEN_INDEX_BLOCK_SIZE);
+    INDEX_BLOCK *header = (INDEX_BLOCK *) block;
+    header->magic = magic_INDX;
+    header->usa_ofs = 0x28;
+    header->usa_count = GEN_INDEX_BLOCK_SIZE / NTFS_BLOCK_SIZE + 1;
+    header->lsn = state->opt->lsn;
+    header->index_block_vcn = (uint64_t) index_vcn(state, blocks->count);
+    uint32_t offset = block_entries_offset();
+    uint32_t used = put_entries(state, block + offset, items, count, end_vcn);
+    header->index.entries_offset = offset - 0x18;
+    header->index.index_length = offset - 0x18 + used;
+    header->index.allocated_size = GEN_INDEX_BLOCK_SIZE - 0x18;
+    header->index.ih_flags = end_vcn >= 0 ? INDEX_NODE : LEAF_NODE;
+    return index_vcn(state, blocks->count++);
+}
+
+/*
+ * Builds the $I30 B+tree bottom-up: items of one level are packed into index
+ * blocks and the entry between two neighbour blocks moves one level up.
+ */
+static void build_index(GEN_STATE *state, GEN_ITEM *items, uint32_t count, int64_t tail_vcn, uint32_t root_capacity,
+                        GEN_BLOCKS *blocks, GEN_ITEM **root_items, uint32_t *root_count, int64_t *root_tail) {
+    for (;;) {
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            total += entry_size(state, &items[i]);
+        }
+        if (total + 24 <= root_capacity) {
+            *root_items = items;
+            *root_count = count;
+            *root_tail = tail_vcn;
+            return;
+        }
+
+        uint32_t capacity = GEN_INDEX_BLOCK_SIZE - block_entries_offset() - 24;
+        GEN_ITEM *upper = xcalloc(count / 2 + 2, sizeof(GEN_ITEM));
+        uint32_t upper_count = 0;
+        int64_t upper_tail = -1;
+        uint32_t i = 0;
+        while (i < count) {
+            uint32_t j = i;
+            uint32_t size = 0;
+            while (j < count && size + entry_size(state, &items[j]) <= capacity) {
+                size += entry_size(state, &items[j]);
+                j++;
+            }
+            if (j == i) {
+                j = i + 1;
+            }
+            if (j >= count) {
+                upper_tail = emit_block(state, blocks, &items[i], count - i, tail_vcn);
+                break;
+            }
+            if (j + 1 == count && j - 1 > i) {
+                j--;
+            }
+            // items[j] becomes the separator, its left subtree closes this block
+            int64_t vcn = emit_block(state, blocks, &items[i], j - i, items[j].child_vcn);
+            upper[upper_count].node = items[j].node;
+            upper[upper_count].child_vcn = vcn;
+            upper_count++;
+            i = j + 1;
+            if (i == count) {
+                upper_tail = tail_vcn;
+            }
+        }
+        if (items != NULL && tail_vcn != -2) {
+            // the first level belongs to the caller
+        }
+        items = upper;
+        count = upper_count;
+        tail_vcn = upper_tail;
+    }
+}
+
+/* Size of the $I30 $BITMAP attribute of a directory with `blocks` index blocks. */
+static uint32_t bitmap_attr_size(uint32_t blocks) {
+    uint64_t length = ALIGN8((blocks + 7) / 8);
+    return length <= GEN_RESIDENT_BITMAP ? (uint32_t) (24 + 8 + length) : 64 + 8 + 16;
+}
+
+static void write_directory(GEN_STATE *state, uint32_t index) {
+    GEN_NODE *node = &state->nodes[index];
+    uint8_t record[GEN_RECORD_SIZE];
+    record_init(record, node->mft_num, node_sequence(state, index), MFT_RECORD_IN_USE | MFT_RECORD_IS_DIRECTORY, 0,
+                state->opt->lsn);
+    add_standard_information(record, node);
+    uint8_t file_name[sizeof(FILE_NAME_ATTR) + GEN_NAME_MAX * 2];
+    uint32_t file_name_length = build_file_name(state, index, file_name);
+    add_resident(record, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+
+    uint32_t count = state->children_start[index + 1] - state->children_start[index];
+    GEN_ITEM *items = xcalloc(count + 1, sizeof(GEN_ITEM));
+    for (uint32_t i = 0; i < count; i++) {
+        items[i].node = state->children[state->children_start[index] + i];
+        items[i].child_vcn = -1;
+    }
+
+    // room left for INDEX_ROOT entries, allocation and bitmap attributes have to fit as well. The bitmap
+    // grows with the number of blocks, which grows when the root gets smaller, so repeat until it fits.
+    uint32_t root_capacity = record_free_space(record) - (24 + 8 + 32) - (64 + 8 + 24) - 16;
+    uint32_t bitmap_reserve = bitmap_attr_size(1);
+    GEN_BLOCKS blocks = {NULL, 0, 0};
+    GEN_ITEM *root_items;
+    uint32_t root_count;
+    int64_t root_tail;
+    for (;;) {
+        build_index(state, items, count, -1, root_capacity - bitmap_reserve, &blocks, &root_items, &root_count,
+                    &root_tail);
+        uint32_t needed = blocks.count ? bitmap_attr_size(blocks.count) : 0;
+        if (needed <= bitmap_reserve) {
+            break;
+        }
+        free(blocks.blocks);
+        memset(&blocks, 0, sizeof(blocks));
+        if (root_items != items) {
+            free(root_items);
+        }
+        bitmap_reserve = needed;
+    }
+
+    uint8_t value[GEN_RECORD_SIZE];
+    memset(value, 0, sizeof(value));
+    INDEX_ROOT *index_root = (INDEX_ROOT *) value;
+    index_root->type = AT_FILE_NAME;
+    index_root->collation_rule = COLLATION_FILE_NAME;
+    index_root->index_block_size = GEN_INDEX_BLOCK_SIZE;
+    if (GEN_INDEX_BLOCK_SIZE >= state->opt->cluster_size) {
+        index_root->clusters_per_index_block = (int8_t) (GEN_INDEX_BLOCK_SIZE / state->opt->cluster_size);
+    } else {
+        index_root->clusters_per_index_block = (int8_t) (GEN_INDEX_BLOCK_SIZE / NTFS_BLOCK_SIZE);
+    }
+    uint32_t used = put_entries(state, value + sizeof(INDEX_ROOT), root_items, root_count, root_tail);
+    index_root->index.entries_offset = 16;
+    index_root->index.index_length = 16 + used;
+    index_root->index.allocated_size = 16 + used;
+    index_root->index.ih_flags = blocks.count ? LARGE_INDEX : SMALL_INDEX;
+    add_resident(record, AT_INDEX_ROOT, "$I30", value, sizeof(INDEX_ROOT) + used, 0);
+
+    if (blocks.count > 0) {
+        for (uint32_t i = 0; i < blocks.count; i++) {
+            uint8_t *block = blocks.blocks + (size_t) i * GEN_INDEX_BLOCK_SIZE;
+            protect(block, GEN_INDEX_BLOCK_SIZE, (uint16_t) (1 + i % 0xfffe));
+        }
+        uint64_t bytes = (uint64_t) blocks.count * GEN_INDEX_BLOCK_SIZE;
+        uint64_t clusters = (bytes + state->opt->cluster_size - 1) / state->opt->cluster_size;
+        EXTENT *runs;
+        uint32_t run_count = alloc_runs(state, clusters, 1, false, true, &runs);
+        uint64_t done = 0;
+        for (uint32_t i = 0; i < run_count; i++) {
+            uint64_t length = runs[i].length * state->opt->cluster_size;
+            if (length > bytes - done) {
+                length = bytes - done;
+            }
+            write_at(state, blocks.blocks + done, length, cluster_offset(state, runs[i].lcn));
+            done += length;
+        }
+        uint64_t bitmap_length = ALIGN8((blocks.count + 7) / 8);
+        uint8_t *bitmap = xcalloc(1, bitmap_length);
+        for (uint32_t i = 0; i < blocks.count; i++) {
+            bitmap[i >> 3] |= (uint8_t) (1 << (i & 7));
+        }
+        uint64_t allocated = clusters * state->opt->cluster_size;
+        if (bitmap_length <= GEN_RESIDENT_BITMAP) {
+            add_resident(record, AT_BITMAP, "$I30", bitmap, (uint32_t) bitmap_length, 0);
+            write_nonresident_record(state, record, AT_INDEX_ALLOCATION, "$I30", runs, run_count, clusters, bytes,
+                                     allocated, false);
+        } else {
+            uint64_t bitmap_clusters = (bitmap_length + state->opt->cluster_size - 1) / state->opt->cluster_size;
+            EXTENT *bitmap_runs;
+            uint32_t bitmap_run_count = alloc_runs(state, bitmap_clusters, 1, false, true, &bitmap_runs);
+            uint8_t *bitmap_buf = xcalloc(bitmap_clusters, state->opt->cluster_size);
+            memcpy(bitmap_buf, bitmap, bitmap_length);
+            write_at(state, bitmap_buf, bitmap_clusters * state->opt->cluster_size,
+                     cluster_offset(state, bitmap_runs[0].lcn));
+            add_nonresident(record, AT_BITMAP, "$I30", bitmap_runs, 0, bitmap_run_count, bitmap_clusters,
+                            bitmap_length, bitmap_clusters * state->opt->cluster_size, false, NULL);
+            write_nonresident_record(state, record, AT_INDEX_ALLOCATION, "$I30", runs, run_count, clusters, bytes,
+                                     allocated, false);
+            free(bitmap_buf);
+            free(bitmap_runs);
+        }
+        free(bitmap);
+        free(runs);
+    } else {
+        write_record(state, record);
+    }
+    free(blocks.blocks);
+    if (root_items != items) {
+        free(root_items);
+    }
+    free(items);
+}
+
+/* --------------------------------------------------------- system files */
+
+static void write_system_data(GEN_STATE *state, uint32_t index, const uint8_t *data, uint64_t size,
+                              EXTENT *runs, uint32_t run_count) {
+    GEN_NODE *node = &state->nodes[index];
+    uint8_t record[GEN_RECORD_SIZE];
+    record_init(record, node->mft_num, node_sequence(state, index), MFT_RECORD_IN_USE, 0, state->opt->lsn);
+    add_standard_information(record, node);
+    uint8_t file_name[sizeof(FILE_NAME_ATTR) + GEN_NAME_MAX * 2];
+    uint32_t file_name_length = build_file_name(state, index, file_name);
+    add_resident(record, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+
+    if (runs == NULL) {
+        add_resident(record, AT_DATA, NULL, data, (uint32_t) size, 0);
+        write_record(state, record);
+        return;
+    }
+    uint64_t clusters = 0;
+    for (uint32_t i = 0; i < run_count; i++) {
+        clusters += runs[i].length;
+    }
+    if (data != NULL) {
+        uint64_t done = 0;
+        for (uint32_t i = 0; i < run_count && done < size; i++) {
+            uint64_t length = runs[i].length * state->opt->cluster_size;
+            if (length > size - done) {
+                length = size - done;
+            }
+            write_at(state, data + done, length, cluster_offset(state, runs[i].lcn));
+            done += length;
+        }
+    }
+    if (node->mft_num == FILE_MFT) {
+        // $MFT also carries the bitmap of records in use
+        uint64_t bitmap_length = ALIGN8((state->record_count + 7) / 8);
+        uint64_t bitmap_clusters = (bitmap_length + state->opt->cluster_size - 1) / state->opt->cluster_size;
+        EXTENT *bitmap_runs;
+        uint32_t bitmap_run_count = alloc_runs(state, bitmap_clusters, 1, false, true, &bitmap_runs);
+        uint8_t *bitmap_buf = xcalloc(bitmap_clusters, state->opt->cluster_size);
+        memcpy(bitmap_buf, state->mft_bitmap, (state->record_count + 7) / 8);
+        write_at(state, bitmap_buf, bitmap_clusters * state->opt->cluster_size,
+                 cluster_offset(state, bitmap_runs[0].lcn));
+        add_nonresident(record, AT_DATA, NULL, runs, 0, run_count, clusters, size,
+                        clusters * state->opt->cluster_size, false, NULL);
+        add_nonresident(record, AT_BITMAP, NULL, bitmap_runs, 0, bitmap_run_count, bitmap_clusters, bitmap_length,
+                        bitmap_clusters * state->opt->cluster_size, false, NULL);
+        write_record(state, record);
+        free(bitmap_buf);
+        free(bitmap_runs);
+        return;
+    }
+    write_nonresident_record(state, record, AT_DATA, NULL, runs, run_count, clusters, size,
+                             clusters * state->opt->cluster_size, false);
+}
+
+static void place_mft(GEN_STATE *state, uint64_t estimate) {
+    GEN_OPTIONS *opt = state->opt;
+    uint64_t cluster = opt->cluster_size;
+    uint64_t clusters = ((uint64_t) state->record_count * GEN_RECORD_SIZE + cluster - 1) / cluster;
+    uint32_t fragments = opt->mft_fragments ? opt->mft_fragments : 1;
+    if (fragments > clusters / 4) {
+        fragments = (uint32_t) (clusters / 4) ? (uint32_t) (clusters / 4) : 1;
+    }
+
+    // the first fragment holds all system records, including the ones describing $MFT itself
+    uint64_t first = (uint64_t) GEN_FIRST_USER_RECORD * GEN_RECORD_SIZE / cluster + 1;
+    uint64_t piece = clusters / fragments;
+    if (piece < first) {
+        piece = first;
+    }
+    state->mft_runs = xcalloc(fragments + 1, sizeof(EXTENT));
+    state->reserved = xcalloc(fragments + 1, sizeof(GEN_RANGE));
+    uint64_t start = state->next_lcn;
+    uint64_t stride = fragments > 1 ? (estimate - start) / fragments : 0;
+    uint64_t vcn = 0;
+    for (uint32_t i = 0; i < fragments && vcn < clusters; i++) {
+        uint64_t length = (i + 1 == fragments) ? clusters - vcn : piece;
+        if (length > clusters - vcn) {
+            length = clusters - vcn;
+        }
+        uint64_t lcn = start + i * (stride > length ? stride : length + 1);
+        state->mft_runs[state->mft_run_count].vcn = vcn;
+        state->mft_runs[state->mft_run_count].lcn = (int64_t) lcn;
+        state->mft_runs[state->mft_run_count].length = length;
+        state->mft_run_count++;
+        state->reserved[state->reserved_count].lcn = lcn;
+        state->reserved[state->reserved_count].length = length;
+        state->reserved_count++;
+        mark_clusters(state, lcn, length);
+        vcn += length;
+    }
+}
+
+static void write_log_file(GEN_STATE *state, uint8_t *log) {
+    // two restart pages, the restart area keeps the current lsn of the volume
+    memset(log, 0xff, GEN_LOG_FILE_SIZE);
+    for (uint32_t page = 0; page < 2; page++) {
+        uint8_t *ptr = log + page * 4096;
+        memset(ptr, 0, 4096);
+        *(uint32_t *) ptr = magic_RSTR;
+        *(uint16_t *) (ptr + 4) = 0x1e;
+        *(uint16_t *) (ptr + 6) = 4096 / NTFS_BLOCK_SIZE + 1;
+        *(uint32_t *) (ptr + 16) = 4096;
+        *(uint32_t *) (ptr + 20) = 4096;
+        *(uint16_t *) (ptr + 24) = 0x30;
+        *(int16_t *) (ptr + 26) = 1;
+        *(int16_t *) (ptr + 28) = 1;
+        *(uint64_t *) (ptr + 0x30) = state->opt->lsn;
+        protect(ptr, 4096, 1);
+    }
+}
+
+static void write_boot(GEN_STATE *state, uint64_t total_clusters) {
+    GEN_OPTIONS *opt = state->opt;
+    uint8_t *boot = xcalloc(1, GEN_BOOT_SIZE);
+    NTFS_BOOT_SECTOR *sector = (NTFS_BOOT_SECTOR *) boot;
+    sector->jump[0] = 0xeb;
+    sector->jump[1] = 0x52;
+    sector->jump[2] = 0x90;
+    sector->oem_id = 0x202020205346544eULL;
+    sector->bpb.bytes_per_sector = NTFS_BLOCK_SIZE;
+    sector->bpb.sectors_per_cluster = (uint8_t) (opt->cluster_size / NTFS_BLOCK_SIZE);
+    sector->bpb.media_type = 0xf8;
+    sector->bpb.sectors_per_track = 63;
+    sector->bpb.heads = 255;
+    sector->physical_drive = 0x80;
+    sector->extended_boot_signature = 0x80;
+    sector->number_of_sectors = total_clusters * (opt->cluster_size / NTFS_BLOCK_SIZE) - 1;
+    sector->mft_lcn = (uint64_t) state->mft_runs[0].lcn;
+    sector->mftmirr_lcn = state->mft_mirr_lcn;
+    if (GEN_RECORD_SIZE >= opt->cluster_size) {
+        sector->clusters_per_mft_record = (int8_t) (GEN_RECORD_SIZE / opt->cluster_size);
+    } else {
+        sector->clusters_per_mft_record = (int8_t) -__builtin_ctz(GEN_RECORD_SIZE);
+    }
+    if (GEN_INDEX_BLOCK_SIZE >= opt->cluster_size) {
+        sector->clusters_per_index_record = (int8_t) (GEN_INDEX_BLOCK_SIZE / opt->cluster_size);
+    } else {
+        sector->clusters_per_index_record = (int8_t) -__builtin_ctz(GEN_INDEX_BLOCK_SIZE);
+    }
+    sector->volume_serial_number = opt->seed * 0x9e3779b97f4a7c15ULL + 0x1234;
+    sector->end_of_sector_marker = 0xaa55;
+    write_at(state, boot, GEN_BOOT_SIZE, 0);
+    // backup boot sector lives in the last sector of the volume
+    write_at(state, boot, NTFS_BLOCK_SIZE, total_clusters * opt->cluster_size - NTFS_BLOCK_SIZE);
+    free(boot);
+}
+
+/* $UsnJrnl with a sparse $J of all records and $Max. */
+static void write_usn_journal(GEN_STATE *state, uint32_t index) {
+    uint64_t cluster = state->opt->cluster_size;
+    uint64_t hole = GEN_USN_HOLE / cluster;
+    uint64_t clusters = (state->usn_size + cluster - 1) / cluster;
+    EXTENT *data_runs;
+    uint32_t data_run_count = alloc_runs(state, clusters ? clusters : 1, 1, false, true, &data_runs);
+    EXTENT *runs = xcalloc(data_run_count + 1, sizeof(EXTENT));
+    runs[0].lcn = LCN_HOLE;
+    runs[0].length = hole;
+    for (uint32_t i = 0; i < data_run_count; i++) {
+        runs[i + 1] = data_runs[i];
+        runs[i + 1].vcn += hole;
+    }
+    uint8_t *data = xcalloc(clusters ? clusters : 1, cluster);
+    memcpy(data, state->usn, state->usn_size);
+    uint64_t done = 0;
+    for (uint32_t i = 0; i < data_run_count; i++) {
+        write_at(state, data + done * cluster, data_runs[i].length * cluster, cluster_offset(state, data_runs[i].lcn));
+        done += data_runs[i].length;
+    }
+
+    GEN_NODE *node = &state->nodes[index];
+    uint8_t record[GEN_RECORD_SIZE];
+    record_init(record, node->mft_num, node_sequence(state, index), MFT_RECORD_IN_USE, 0, state->opt->lsn);
+    add_standard_information(record, node);
+    uint8_t file_name[sizeof(FILE_NAME_ATTR) + GEN_NAME_MAX * 2];
+    uint32_t file_name_length = build_file_name(state, index, file_name);
+    add_resident(record, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+    USN_JOURNAL_MAX_DATA max = {32 * 1024 * 1024, 4 * 1024 * 1024, state->opt->journal_id, GEN_USN_HOLE};
+    add_resident(record, AT_DATA, USN_JOURNAL_MAX, &max, sizeof(max), 0);
+    write_nonresident_record(state, record, AT_DATA, USN_JOURNAL_DATA, runs, data_run_count + 1,
+                             hole + (clusters ? clusters : 1), GEN_USN_HOLE + state->usn_size,
+                             (hole + (clusters ? clusters : 1)) * cluster, true);
+    free(data);
+    free(runs);
+    free(data_runs);
+}
+
+static void generate(GEN_STATE *state) {
+    GEN_OPTIONS *opt = state->opt;
+    uint64_t cluster = opt->cluster_size;
+
+    plan(state);
+    state->mft_bitmap = xcalloc(1, (state->record_count + 7) / 8 + 8);
+
+    // rough volume size, $MFT fragments are spread over it
+    uint64_t estimate = GEN_BOOT_SIZE / cluster + 1;
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        estimate += state->nodes[i].allocated / cluster + state->nodes[i].fragments * 3;
+    }
+    estimate += (uint64_t) state->node_count * 128 / cluster;
+
+    state->next_lcn = (GEN_BOOT_SIZE + cluster - 1) / cluster;
+    mark_clusters(state, 0, state->next_lcn);
+    place_mft(state, estimate);
+
+    // $MFTMirr, $LogFile and $UpCase come first, like on a fresh volume
+    uint64_t mirror_clusters = (4 * GEN_RECORD_SIZE + cluster - 1) / cluster;
+    EXTENT *mirror_runs;
+    uint32_t mirror_run_count = alloc_runs(state, mirror_clusters, 1, false, true, &mirror_runs);
+    state->mft_mirr_lcn = (uint64_t) mirror_runs[0].lcn;
+
+    uint8_t *log = xcalloc(1, GEN_LOG_FILE_SIZE);
+    write_log_file(state, log);
+    EXTENT *log_runs;
+    uint32_t log_run_count = alloc_runs(state, GEN_LOG_FILE_SIZE / cluster ? GEN_LOG_FILE_SIZE / cluster : 1, 1,
+                                        false, true, &log_runs);
+
+    uint16_t *upcase = xcalloc(65536, sizeof(uint16_t));
+    for (uint32_t i = 0; i < 65536; i++) {
+        upcase[i] = (uint16_t) ((i >= 'a' && i <= 'z') ? i - 32 : i);
+    }
+    EXTENT *upcase_runs;
+    uint32_t upcase_run_count = alloc_runs(state, (GEN_UPCASE_SIZE + cluster - 1) / cluster, 1, false, true,
+                                           &upcase_runs);
+
+    for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+        if (!(state->nodes[i].flags & (NODE_DIRECTORY | NODE_SYSTEM | NODE_LINK))) {
+            write_file(state, i);
+        }
+        if (!opt->quiet && i % 100000 == 0) {
+            fprintf(stderr, "\r%u / %u records", i, state->node_count);
+        }
+    }
+    for (uint32_t i = 0; i < state->node_count; i++) {
+        if (state->nodes[i].flags & NODE_DIRECTORY) {
+            write_directory(state, i);
+        }
+    }
+
+    // every record that was not used stays a free, but formatted, record
+    uint8_t record[GEN_RECORD_SIZE];
+    for (uint32_t i = GEN_SYSTEM_NODES; i < GEN_FIRST_USER_RECORD; i++) {
+        record_init(record, i, 1, 0, 0, 0);
+        write_record(state, record);
+    }
+    for (uint32_t i = state->next_extension; i < state->extension_limit; i++) {
+        record_init(record, i, 1, 0, 0, 0);
+        write_record(state, record);
+    }
+    for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+        if (state->nodes[i].flags & NODE_JOURNAL) {
+            write_usn_journal(state, i);
+        }
+    }
+
+    // $Bitmap has to describe itself, so its size is settled in a loop
+    uint64_t total = state->next_lcn;
+    for (uint32_t i = 0; i < state->reserved_count; i++) {
+        if (state->reserved[i].lcn + state->reserved[i].length > total) {
+            total = state->reserved[i].lcn + state->reserved[i].length;
+        }
+    }
+    uint64_t bitmap_clusters = 0;
+    uint64_t bitmap_lcn = total;
+    for (;;) {
+        uint64_t volume = bitmap_lcn + bitmap_clusters + 1;
+        uint64_t need = (ALIGN8((volume + 7) / 8) + cluster - 1) / cluster;
+        if (need <= bitmap_clusters) {
+            break;
+        }
+        bitmap_clusters = need;
+    }
+    state->next_lcn = bitmap_lcn;
+    EXTENT *bitmap_runs;
+    uint32_t bitmap_run_count = alloc_runs(state, bitmap_clusters, 1, false, true, &bitmap_runs);
+    uint64_t total_clusters = bitmap_lcn + bitmap_clusters + 1;
+    mark_clusters(state, total_clusters - 1, 1);
+    uint64_t bitmap_length = ALIGN8((total_clusters + 7) / 8);
+    uint8_t *bitmap = xcalloc(bitmap_clusters, cluster);
+    memcpy(bitmap, state->bitmap, (total_clusters + 7) / 8 < state->bitmap_size ? (total_clusters + 7) / 8
+                                                                                 : state->bitmap_size);
+    state->total_clusters = total_clusters;
+
+    // system records, $MFT last so that its bitmap is complete
+    uint8_t volume_info[12] = {0};
+    volume_info[8] = 3;
+    volume_info[9] = 1;
+    for (uint32_t i = FILE_MFTMirr; i < GEN_SYSTEM_NODES; i++) {
+        GEN_NODE *node = &state->nodes[i];
+        if (node->flags & NODE_DIRECTORY) {
+            continue;
+        }
+        switch (i) {
+            case FILE_MFTMirr:
+                write_system_data(state, i, NULL, 4 * GEN_RECORD_SIZE, mirror_runs, mirror_run_count);
+                break;
+            case FILE_LogFile:
+                write_system_data(state, i, log, GEN_LOG_FILE_SIZE, log_runs, log_run_count);
+                break;
+            case FILE_Volume: {
+                uint8_t vol[GEN_RECORD_SIZE];
+                record_init(vol, FILE_Volume, FILE_Volume, MFT_RECORD_IN_USE, 0, opt->lsn);
+                add_standard_information(vol, node);
+                uint8_t file_name[sizeof(FILE_NAME_ATTR) + GEN_NAME_MAX * 2];
+                uint32_t file_name_length = build_file_name(state, i, file_name);
+                add_resident(vol, AT_FILE_NAME, NULL, file_name, file_name_length, RESIDENT_ATTR_IS_INDEXED);
+                uint16_t label[8] = {'G', 'E', 'N', 'N', 'T', 'F', 'S', 0};
+                add_resident(vol, AT_VOLUME_NAME, NULL, label, 14, 0);
+                add_resident(vol, AT_VOLUME_INFORMATION, NULL, volume_info, sizeof(volume_info), 0);
+                add_resident(vol, AT_DATA, NULL, NULL, 0, 0);
+                write_record(state, vol);
+                break;
+            }
+            case FILE_Bitmap:
+                break;
+            case FILE_Boot: {
+                EXTENT boot_run = {0, 0, (GEN_BOOT_SIZE + cluster - 1) / cluster};
+                write_system_data(state, i, NULL, GEN_BOOT_SIZE, &boot_run, 1);
+                break;
+            }
+            case FILE_UpCase:
+                write_system_data(state, i, (uint8_t *) upcase, GEN_UPCASE_SIZE, upcase_runs, upcase_run_count);
+                break;
+            default:
+                write_system_data(state, i, NULL, 0, NULL, 0);
+                break;
+        }
+    }
+    write_system_data(state, FILE_Bitmap, bitmap, bitmap_length, bitmap_runs, bitmap_run_count);
+
+    uint64_t mft_size = (uint64_t) state->record_count * GEN_RECORD_SIZE;
+    write_system_data(state, FILE_MFT, NULL, mft_size, state->mft_runs, state->mft_run_count);
+
+    // $MFTMirr keeps copies of the first four records
+    uint8_t mirror[4 * GEN_RECORD_SIZE];
+    for (uint32_t i = 0; i < 4; i++) {
+        if (pread(state->fd, mirror + i * GEN_RECORD_SIZE, GEN_RECORD_SIZE, (off_t) mft_record_offset(state, i)) !=
+            GEN_RECORD_SIZE) {
+            die("can't read back $MFT");
+        }
+    }
+    write_at(state, mirror, sizeof(mirror), cluster_offset(state, state->mft_mirr_lcn));
+
+    write_boot(state, total_clusters);
+    if (ftruncate(state->fd, (off_t) (total_clusters * cluster)) == -1) {
+        die("can't set image size");
+    }
+
+    if (!opt->quiet) {
+        fprintf(stderr, "\r%u records, %lu clusters of %u bytes, $MFT in %u fragments\n", state->node_count,
+                total_clusters, opt->cluster_size, state->mft_run_count);
+    }
+
+    free(bitmap);
+    free(bitmap_runs);
+    free(mirror_runs);
+    free(log_runs);
+    free(log);
+    free(upcase_runs);
+    free(upcase);
+}
+
+static void node_path(GEN_STATE *state, uint32_t index, char *path) {
+    if (index == FILE_root) {
+        path[0] = '\0';
+        return;
+    }
+    node_path(state, state->nodes[index].parent, path);
+    size_t length = strlen(path);
+    path[length] = '/';
+    node_name(state, index, path + length + 1);
+}
+
+/* One line per name of a live file: mft record number, data size, kind (resident, sparse, hard link, -) and path. */
+static void write_listing(GEN_STATE *state) {
+    FILE *listing = fopen(state->opt->listing, "w");
+    if (listing == NULL) {
+        die("can't create listing");
+    }
+    char *path = malloc(4096 + GEN_NAME_MAX);
+    for (uint32_t i = GEN_SYSTEM_NODES; i < state->node_count; i++) {
+        GEN_NODE *node = &state->nodes[i];
+        if (node->flags & (NODE_DIRECTORY | NODE_SYSTEM)) {
+            continue;
+        }
+        node_path(state, i, path);
+        char kind = (node->flags & NODE_RESIDENT) ? 'r' : (node->flags & NODE_SPARSE) ? 's' : '-';
+        if (node->flags & NODE_DELETED) {
+            kind = (node->flags & NODE_OVERWRITTEN) ? 'o' : 'd';
+        } else if (node->flags & NODE_LINK) {
+            kind = 'h';
+        }
+        fprintf(listing, "%u %lu %c %s\n", node->mft_num, node->size, kind, path);
+    }
+    free(path);
+    fclose(listing);
+}
+
+static void help(void) {
+    puts("ntfs_gen -o image [options] - generate a synthetic NTFS image\n"
+         "\t-o, --output PATH          image to write\n"
+         "\t-l, --list PATH            write mft number, size, kind and path of every file\n"
+         "\t-s, --seed N               random seed (default 1)\n"
+         "\t-c, --cluster-size BYTES   cluster size, 512..65536 (default 4096)\n"
+         "\t-n, --files N              number of files in the tree (default 1000)\n"
+         "\t-f, --fanout N             subdirectories per directory (default 4)\n"
+         "\t-d, --depth N              directory depth (default 3)\n"
+         "\t-H, --huge-dir N           additional directory with N files\n"
+         "\t-m, --min-size BYTES       smallest file (default 0)\n"
+         "\t-M, --max-size BYTES       largest file (default 65536)\n"
+         "\t-r, --resident PERCENT     share of resident files (default 30)\n"
+         "\t-p, --sparse PERCENT       share of sparse files (default 5)\n"
+         "\t-x, --fragments N          max fragments per file (default 1)\n"
+         "\t-X, --mft-fragments N      fragments of $MFT (default 1)\n"
+         "\t-u, --deleted N            deleted records with data left behind\n"
+         "\t-k, --links N              second names of N files in random directories\n"
+         "\t-N, --name-length N        pad names to N characters\n"
+         "\t-L, --lsn N                current $LogFile sequence number\n"
+         "\t-j, --journal              add $Extend/$UsnJrnl with a record for every file\n"
+         "\t-J, --journal-id N         journal id of $UsnJrnl (default derived from the seed)\n"
+         "\t-C, --changes N            rename, rewrite, delete and create N files after the journal\n"
+         "\t                           records of the volume, with records of their own\n"
+         "\t-z, --no-data              don't write file contents\n"
+         "\t-q, --quiet                no progress output");
+}
+
+int main(int argc, char *argv[]) {
+    GEN_OPTIONS opt = {NULL, NULL, 1, 4096, 1000, 4, 3, 0, 0, 65536, 30, 5, 1, 1, 0, 0, 0x100000, false, 0, 0, 0, false, false};
+
+    const char *short_flags = "o:l:s:c:n:f:d:H:m:M:r:p:x:X:u:k:N:L:jJ:C:zqh";
+    const struct option long_flags[] = {
+            {"output",        1, NULL, 'o'},
+            {"list",          1, NULL, 'l'},
+            {"seed",          1, NULL, 's'},
+            {"cluster-size",  1, NULL, 'c'},
+            {"files",         1, NULL, 'n'},
+            {"fanout",        1, NULL, 'f'},
+            {"depth",         1, NULL, 'd'},
+            {"huge-dir",      1, NULL, 'H'},
+            {"min-size",      1, NULL, 'm'},
+            {"max-size",      1, NULL, 'M'},
+            {"resident",      1, NULL, 'r'},
+            {"sparse",        1, NULL, 'p'},
+            {"fragments",     1, NULL, 'x'},
+            {"mft-fragments", 1, NULL, 'X'},
+            {"deleted",       1, NULL, 'u'},
+            {"links",         1, NULL, 'k'},
+            {"name-length",   1, NULL, 'N'},
+            {"lsn",           1, NULL, 'L'},
+            {"journal",       0, NULL, 'j'},
+            {"journal-id",    1, NULL, 'J'},
+            {"changes",       1, NULL, 'C'},
+            {"no-data",       0, NULL, 'z'},
+            {"quiet",         0, NULL, 'q'},
+            {"help",          0, NULL, 'h'},
+            {0,               0, 0,    0}
+    };
+
+    int rez;
+    int long_id = 0;
+    while ((rez = getopt_long(argc, argv, short_flags, long_flags, &long_id)) != -1) {
+        switch (rez) {
+            case 'o':
+                opt.output = optarg;
+                break;
+            case 'l':
+                opt.listing = optarg;
+                break;
+            case 's':
+                opt.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                opt.cluster_size = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                opt.files = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                opt.fanout = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                opt.depth = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'H':
+                opt.huge_dir = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                opt.min_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'M':
+                opt.max_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                opt.resident_percent = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                opt.sparse_percent = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                opt.max_fragments = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'X':
+                opt.mft_fragments = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                opt.links = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                opt.deleted = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'N':
+                opt.name_length = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'L':
+                opt.lsn = strtoull(optarg, NULL, 0);
+                break;
+            case 'j':
+                opt.journal = true;
+                break;
+            case 'J':
+                opt.journal_id = strtoull(optarg, NULL, 0);
+                break;
+            case 'C':
+                opt.changes = (uint32_t) strtoul(optarg, NULL, 0);
+                opt.journal = true;
+                break;
+            case 'z':
+                opt.no_data = true;
+                break;
+            case 'q':
+                opt.quiet = true;
+                break;
+            default:
+                help();
+                return rez == 'h' ? 0 : 1;
+        }
+    }
+
+    if (opt.output == NULL || opt.cluster_size < NTFS_BLOCK_SIZE || opt.cluster_size > 65536 ||
+        (opt.cluster_size & (opt.cluster_size - 1)) || opt.depth == 0 || opt.max_size < opt.min_size) {
+        help();
+        return 1;
+    }
+    if (opt.links > 0 && linked_record_size(opt.name_length) + GEN_LINK_DATA_MAX > GEN_RECORD_SIZE) {
+        uint32_t longest = opt.name_length;
+        while (longest > GEN_FILE_NAME_MIN && linked_record_size(longest) + GEN_LINK_DATA_MAX > GEN_RECORD_SIZE) {
+            longest--;
+        }
+        fprintf(stderr, "ERROR: two names of %u characters don't fit into one mft record, "
+                        "use -N %u or less with -k\n", opt.name_length, longest);
+        return 1;
+    }
+    if (opt.max_fragments == 0) {
+        opt.max_fragments = 1;
+    }
+    if (opt.journal_id == 0) {
+        opt.journal_id = GEN_BASE_TIME + opt.seed;
+    }
+
+    GEN_STATE state;
+    memset(&state, 0, sizeof(state));
+    state.opt = &opt;
+    state.rng = opt.seed * 0x9e3779b97f4a7c15ULL + 1;
+    state.fd = open(opt.output, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (state.fd == -1) {
+        die("can't create image");
+    }
+
+    generate(&state);
+    if (opt.listing != NULL) {
+        write_listing(&state);
+    }
+
+    close(state.fd);
+    free(state.nodes);
+    free(state.children);
+    free(state.children_start);
+    free(state.mft_runs);
+    free(state.reserved);
+    free(state.bitmap);
+    free(state.mft_bitmap);
+    free(state.usn);
+    return 0;
+}
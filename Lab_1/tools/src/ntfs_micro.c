@@ -0,0 +1,495 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../../core/inc/ntfs.h"
+#include "../../core/inc/mft_scan.h"
+
+/*
+ * Micro-benchmarks of the parsing kernels.
+ *
+ * Records, runlists, index nodes and names are read from an image once and
+ * kept in memory, then every kernel runs over them in a loop, so the numbers
+ * carry no disk or page cache noise. Results are JSON Lines like ntfs_bench.
+ * Hardware counters come from perf_event_open and are null where the kernel
+ * or the machine doesn't provide them.
+ */
+
+#define MICRO_MAX_INDEX_BLOCKS 8192    // index blocks kept in the corpus by default
+#define MICRO_MIN_TIME 0.3    // seconds every kernel runs for at least
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *end;
+    uint64_t lowest_vcn;
+} MICRO_RUNLIST;
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *end;
+} MICRO_NODE;
+
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+
+    uint8_t *records;
+    MFT_RECORD **in_use;    // records in use, pointing into records
+    uint32_t in_use_count;
+
+    MICRO_RUNLIST *runlists;
+    uint32_t runlist_count;
+
+    FILE_NAME_ATTR **names;
+    uint32_t name_count;
+
+    uint8_t *blocks;    // $INDEX_ALLOCATION blocks with fixups applied
+    MICRO_NODE *nodes;    // index roots followed by the blocks
+    uint32_t node_count;
+} MICRO_CORPUS;
+
+typedef struct {
+    const char *name;
+    uint64_t (*pass)(MICRO_CORPUS *corpus);    // runs the kernel over the corpus once, returns the ops done
+} MICRO_KERNEL;
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_CACHE_MISSES,
+    COUNTER_COUNT,
+};
+
+static const uint64_t counter_configs[COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+
+static volatile uint64_t sink;    // keeps the results of the kernels alive
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* ---------------------------------------------------------------- kernels */
+
+static uint64_t pass_decode_runlist(MICRO_CORPUS *corpus) {
+    for (uint32_t i = 0; i < corpus->runlist_count; i++) {
+        MICRO_RUNLIST *runlist = &corpus->runlists[i];
+        EXTENT *extents;
+        uint32_t extent_count;
+        if (decode_runlist(runlist->start, runlist->end, runlist->lowest_vcn, &extents, &extent_count) == 0) {
+            sink += extent_count;
+            free(extents);
+        }
+    }
+    return corpus->runlist_count;
+}
+
+static uint64_t pass_search_attr(MICRO_CORPUS *corpus) {
+    for (uint32_t i = 0; i < corpus->in_use_count; i++) {
+        MFT_RECORD *record = corpus->in_use[i];
+        uint32_t type = (record->flags & MFT_RECORD_IS_DIRECTORY) ? AT_INDEX_ROOT : AT_DATA;
+        ATTR_RECORD *attr;
+        search_attr(corpus->g_info, type, record, &attr);
+        sink += attr != NULL;
+    }
+    return corpus->in_use_count;
+}
+
+static uint64_t pass_next_attr(MICRO_CORPUS *corpus) {
+    uint64_t attrs = 0;
+    for (uint32_t i = 0; i < corpus->in_use_count; i++) {
+        MFT_RECORD *record = corpus->in_use[i];
+        for (ATTR_RECORD *attr = next_attr(corpus->g_info, record, NULL, AT_UNUSED); attr != NULL;
+             attr = next_attr(corpus->g_info, record, attr, AT_UNUSED)) {
+            attrs++;
+        }
+    }
+    sink += attrs;
+    return attrs;
+}
+
+static int count_entry(INDEX_ENTRY *entry, const char *file_name, uint8_t file_name_length, void *context) {
+    *(uint64_t *) context += file_name_length;
+    return 1;
+}
+
+static uint64_t pass_walk_index_entries(MICRO_CORPUS *corpus) {
+    uint64_t entries = 0;
+    uint64_t name_bytes = 0;
+    for (uint32_t i = 0; i < corpus->node_count; i++) {
+        INDEX_ENTRY *last;
+        int cnt = walk_index_entries(corpus->nodes[i].start, corpus->nodes[i].end, count_entry, &name_bytes, &last);
+        if (cnt > 0) {
+            entries += (uint64_t) cnt;
+        }
+    }
+    sink += name_bytes;
+    return entries;
+}
+
+static uint64_t pass_convert_file_name(MICRO_CORPUS *corpus) {
+    char file_name[256];
+    for (uint32_t i = 0; i < corpus->name_count; i++) {
+        sink += convert_file_name(file_name, corpus->names[i]);
+    }
+    return corpus->name_count;
+}
+
+static MICRO_KERNEL kernels[] = {
+        {"decode_runlist",     pass_decode_runlist},
+        {"search_attr",        pass_search_attr},
+        {"next_attr",          pass_next_attr},
+        {"walk_index_entries", pass_walk_index_entries},
+        {"convert_file_name",  pass_convert_file_name},
+};
+
+/* ---------------------------------------------------------------- corpus */
+
+static void *grow(void *array, uint32_t count, size_t size) {
+    // capacity doubles at every power of two
+    if (count == 0 || (count & (count - 1)) == 0) {
+        array = realloc(array, (count ? count * 2 : 16) * size);
+    }
+    return array;
+}
+
+/* Keeps the index blocks of a directory, at most *budget of them. */
+static void load_index_blocks(MICRO_CORPUS *corpus, uint32_t mft_num, uint32_t *blocks, uint32_t *budget) {
+    GENERAL_INFORMATION *g_info = corpus->g_info;
+    EXTENT_MAP *map = get_extent_map(g_info, mft_num, AT_INDEX_ALLOCATION);
+    if (map == NULL) {
+        return;
+    }
+    uint32_t block_size = g_info->block_size_in_bytes;
+    for (uint64_t offset = 0; !map->resident && offset + block_size <= map->data_size && *budget > 0;
+         offset += block_size) {
+        uint8_t *block = corpus->blocks + (size_t) *blocks * block_size;
+        if (read_attr_data(g_info, map, offset, block, block_size) != block_size ||
+            apply_fixups(block, block_size) == -1 || ((INDEX_ALLOCATION *) block)->magic != magic_INDX) {
+            continue;
+        }
+        (*blocks)++;
+        (*budget)--;
+    }
+    put_extent_map(map);
+}
+
+/*
+ * Reads up to max_records records of $MFT and collects the inputs of every
+ * kernel. Returns -1 when $MFT can't be read.
+ */
+static int load_corpus(MICRO_CORPUS *corpus, uint64_t max_records, uint32_t max_blocks) {
+    GENERAL_INFORMATION *g_info = corpus->g_info;
+    uint64_t record_size = g_info->mft_record_size_in_bytes;
+    uint64_t count = mft_record_count(g_info);
+    if (count > max_records) {
+        count = max_records;
+    }
+    corpus->records = malloc(count * record_size);
+    corpus->blocks = malloc((size_t) max_blocks * g_info->block_size_in_bytes);
+    if (corpus->records == NULL || corpus->blocks == NULL) {
+        return -1;
+    }
+    uint64_t loaded = 0;
+    while (loaded < count) {
+        uint32_t batch = count - loaded > MFT_SCAN_BATCH_RECORDS ? MFT_SCAN_BATCH_RECORDS : (uint32_t) (count - loaded);
+        int read = read_mft_records(g_info, loaded, batch, corpus->records + loaded * record_size);
+        if (read <= 0) {
+            break;
+        }
+        loaded += (uint64_t) read;
+    }
+    if (loaded == 0) {
+        return -1;
+    }
+
+    // index roots point into the records, blocks are added when their buffer is complete
+    uint32_t block_count = 0;
+    uint32_t budget = max_blocks;
+    for (uint64_t i = 0; i < loaded; i++) {
+        MFT_RECORD *record = (MFT_RECORD *) (corpus->records + i * record_size);
+        if (record->magic != magic_FILE || !(record->flags & MFT_RECORD_IN_USE)) {
+            continue;
+        }
+        corpus->in_use = grow(corpus->in_use, corpus->in_use_count, sizeof(MFT_RECORD *));
+        corpus->in_use[corpus->in_use_count++] = record;
+
+        for (ATTR_RECORD *attr = next_attr(g_info, record, NULL, AT_UNUSED); attr != NULL;
+             attr = next_attr(g_info, record, attr, AT_UNUSED)) {
+            if (attr->non_resident) {
+                if (attr->mapping_pairs_offset >= attr->length) {
+                    continue;
+                }
+                corpus->runlists = grow(corpus->runlists, corpus->runlist_count, sizeof(MICRO_RUNLIST));
+                MICRO_RUNLIST *runlist = &corpus->runlists[corpus->runlist_count++];
+                runlist->start = (uint8_t *) attr + attr->mapping_pairs_offset;
+                runlist->end = (uint8_t *) attr + attr->length;
+                runlist->lowest_vcn = attr->lowest_vcn;
+            } else if (attr->type == AT_FILE_NAME) {
+                corpus->names = grow(corpus->names, corpus->name_count, sizeof(FILE_NAME_ATTR *));
+                corpus->names[corpus->name_count++] = (FILE_NAME_ATTR *) ((uint8_t *) attr + attr->value_offset);
+            } else if (attr->type == AT_INDEX_ROOT) {
+                INDEX_ROOT *index_root = (INDEX_ROOT *) ((uint8_t *) attr + attr->value_offset);
+                corpus->nodes = grow(corpus->nodes, corpus->node_count, sizeof(MICRO_NODE));
+                MICRO_NODE *node = &corpus->nodes[corpus->node_count++];
+                node->start = (uint8_t *) &index_root->index + index_root->index.entries_offset;
+                node->end = (uint8_t *) &index_root->index + index_root->index.index_length;
+                if (index_root->index.ih_flags & LARGE_INDEX) {
+                    load_index_blocks(corpus, (uint32_t) i, &block_count, &budget);
+                }
+            }
+        }
+    }
+    for (uint32_t i = 0; i < block_count; i++) {
+        INDEX_ALLOCATION *block = (INDEX_ALLOCATION *) (corpus->blocks + (size_t) i * g_info->block_size_in_bytes);
+        corpus->nodes = grow(corpus->nodes, corpus->node_count, sizeof(MICRO_NODE));
+        MICRO_NODE *node = &corpus->nodes[corpus->node_count++];
+        node->start = (uint8_t *) &block->index + block->index.entries_offset;
+        node->end = (uint8_t *) &block->index + block->index.index_length;
+        if (node->end > (uint8_t *) block + g_info->block_size_in_bytes) {
+            node->end = (uint8_t *) block + g_info->block_size_in_bytes;
+        }
+    }
+    return 0;
+}
+
+static void free_corpus(MICRO_CORPUS *corpus) {
+    free(corpus->records);
+    free(corpus->in_use);
+    free(corpus->runlists);
+    free(corpus->names);
+    free(corpus->blocks);
+    free(corpus->nodes);
+}
+
+/* ---------------------------------------------------------------- counters */
+
+static int open_counter(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Value of the counter scaled for the time it was multiplexed out, -1 when it didn't count. */
+static double read_counter(int fd) {
+    uint64_t values[3];
+    if (fd == -1 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return -1;
+    }
+    return (double) values[0] * (double) values[1] / (double) values[2];
+}
+
+static void control_counters(const int *fds, unsigned long request) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] != -1) {
+            ioctl(fds[i], request, 0);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- report */
+
+static void print_string(FILE *out, const char *value) {
+    fputc('"', out);
+    for (; *value != '\0'; value++) {
+        unsigned char c = (unsigned char) *value;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_per_op(FILE *out, const char *key, double value, uint64_t ops) {
+    if (value < 0) {
+        fprintf(out, ",\"%s\":null", key);
+    } else {
+        fprintf(out, ",\"%s\":%.3f", key, value / (double) ops);
+    }
+}
+
+/* Runs the kernel for at least min_time seconds after one warm-up pass. */
+static void measure(FILE *out, MICRO_KERNEL *kernel, MICRO_CORPUS *corpus, const int *fds, double min_time,
+                    const char *image, const char *tag) {
+    uint64_t size = kernel->pass(corpus);
+    uint64_t ops = 0;
+    uint64_t passes = 0;
+    control_counters(fds, PERF_EVENT_IOC_RESET);
+    control_counters(fds, PERF_EVENT_IOC_ENABLE);
+    double start = now();
+    double seconds;
+    do {
+        ops += kernel->pass(corpus);
+        passes++;
+        seconds = now() - start;
+    } while (seconds < min_time);
+    control_counters(fds, PERF_EVENT_IOC_DISABLE);
+
+    double counters[COUNTER_COUNT];
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters[i] = read_counter(fds[i]);
+    }
+    if (ops == 0) {
+        ops = 1;
+    }
+    fprintf(out, "{\"kernel\":\"%s\",\"image\":", kernel->name);
+    print_string(out, image);
+    fputs(",\"tag\":", out);
+    print_string(out, tag);
+    fprintf(out, ",\"corpus\":%lu,\"passes\":%lu,\"ops\":%lu,\"seconds\":%.6f,\"ns_per_op\":%.3f", size, passes, ops,
+            seconds, seconds * 1e9 / (double) ops);
+    print_per_op(out, "cycles_per_op", counters[COUNTER_CYCLES], ops);
+    print_per_op(out, "instructions_per_op", counters[COUNTER_INSTRUCTIONS], ops);
+    if (counters[COUNTER_CYCLES] > 0 && counters[COUNTER_INSTRUCTIONS] >= 0) {
+        fprintf(out, ",\"ipc\":%.3f", counters[COUNTER_INSTRUCTIONS] / counters[COUNTER_CYCLES]);
+    } else {
+        fputs(",\"ipc\":null", out);
+    }
+    print_per_op(out, "branch_misses_per_op", counters[COUNTER_BRANCH_MISSES], ops);
+    print_per_op(out, "cache_misses_per_op", counters[COUNTER_CACHE_MISSES], ops);
+    fputs("}\n", out);
+    fflush(out);
+}
+
+static void help(void) {
+    puts("ntfs_micro -i image [options] [kernel ...] - measure the parsing kernels on records of an image\n"
+         "\t-i, --image PATH           image or device the corpus is read from\n"
+         "\t-n, --records N            records of $MFT in the corpus (default all)\n"
+         "\t-b, --blocks N             index blocks in the corpus (default 8192)\n"
+         "\t-t, --time MS              minimal run time of every kernel (default 300)\n"
+         "\t-T, --tag TEXT             label of the run, e.g. the build\n"
+         "\t-o, --output PATH          JSON Lines result file (default stdout)\n"
+         "\tkernels are decode_runlist, search_attr, next_attr, walk_index_entries and convert_file_name,\n"
+         "\tall of them by default");
+}
+
+int main(int argc, char *argv[]) {
+    char *image = NULL;
+    char *tag = "";
+    char *output = NULL;
+    uint64_t max_records = UINT64_MAX;
+    uint32_t max_blocks = MICRO_MAX_INDEX_BLOCKS;
+    double min_time = MICRO_MIN_TIME;
+
+    const char *short_flags = "i:n:b:t:T:o:h";
+    const struct option long_flags[] = {
+            {"image",   1, NULL, 'i'},
+            {"records", 1, NULL, 'n'},
+            {"blocks",  1, NULL, 'b'},
+            {"time",    1, NULL, 't'},
+            {"tag",     1, NULL, 'T'},
+            {"output",  1, NULL, 'o'},
+            {"help",    0, NULL, 'h'},
+            {0,         0, 0,    0}
+    };
+
+    int rez;
+    int long_id = 0;
+    while ((rez = getopt_long(argc, argv, short_flags, long_flags, &long_id)) != -1) {
+        switch (rez) {
+            case 'i':
+                image = optarg;
+                break;
+            case 'n':
+                max_records = strtoull(optarg, NULL, 0);
+                break;
+            case 'b':
+                max_blocks = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                min_time = strtod(optarg, NULL) / 1000;
+                break;
+            case 'T':
+                tag = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                help();
+                return rez == 'h' ? 0 : 1;
+        }
+    }
+    uint32_t kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+    for (int i = optind; i < argc; i++) {
+        uint32_t k = 0;
+        while (k < kernel_count && strcmp(argv[i], kernels[k].name) != 0) {
+            k++;
+        }
+        if (k == kernel_count) {
+            fprintf(stderr, "ERROR: Unknown kernel %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (image == NULL) {
+        help();
+        return 1;
+    }
+
+    MICRO_CORPUS corpus;
+    memset(&corpus, 0, sizeof(corpus));
+    corpus.g_info = init(image);
+    if (corpus.g_info == NULL) {
+        fprintf(stderr, "No NTFS file system detected on %s\n", image);
+        return 1;
+    }
+    if (load_corpus(&corpus, max_records, max_blocks) == -1) {
+        fprintf(stderr, "ERROR: Can't read $MFT of %s\n", image);
+        free_corpus(&corpus);
+        free_g_info(corpus.g_info);
+        return 1;
+    }
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "ERROR: Can't create %s\n", output);
+        free_corpus(&corpus);
+        free_g_info(corpus.g_info);
+        return 1;
+    }
+
+    int fds[COUNTER_COUNT];
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fds[i] = open_counter(counter_configs[i]);
+    }
+    for (uint32_t k = 0; k < kernel_count; k++) {
+        bool selected = optind == argc;
+        for (int i = optind; i < argc && !selected; i++) {
+            selected = strcmp(argv[i], kernels[k].name) == 0;
+        }
+        if (selected) {
+            measure(out, &kernels[k], &corpus, fds, min_time, image, tag);
+        }
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    free_corpus(&corpus);
+    free_g_info(corpus.g_info);
+    return 0;
+}
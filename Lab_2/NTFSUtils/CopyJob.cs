@@ -0,0 +1,94 @@
+using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace NTFSUtils
+{
+    public enum CopyStatus : uint
+    {
+        Running = 0,
+        Done = 1,
+        Failed = 2,
+        Cancelled = 3
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 1)]
+    public readonly struct CopyProgress
+    {
+        public readonly ulong FilesDone;
+        public readonly ulong FilesFound;
+        public readonly ulong BytesDone;
+        public readonly ulong BytesFound;
+        public readonly double BytesPerSecond;
+        public readonly CopyStatus Status;
+        private readonly uint _scanComplete;
+
+        // files and bytes found are totals once the scan is complete
+        public bool ScanComplete => _scanComplete != 0;
+    }
+
+    // Copy of a file or a tree from the image running on native worker threads,
+    // progress is reported from a native thread every 200 ms and at the end.
+    public static class CopyJob
+    {
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void ProgressCallback(in CopyProgress progress, IntPtr context);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern IntPtr ntfs_start_copy(IntPtr session, [MarshalAs(UnmanagedType.LPStr)] string fromPath,
+            [MarshalAs(UnmanagedType.LPStr)] string toPath, uint workers, ProgressCallback callback, IntPtr context);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern void ntfs_cancel_copy(IntPtr job);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern void ntfs_free_copy(IntPtr job);
+
+        // Copies fromPath into the directory toPath. Cancelling the token stops the
+        // workers, files being copied at that moment are left partly written.
+        public static async Task<CopyProgress> CopyAsync(IntPtr session, string fromPath, string toPath,
+            IProgress<CopyProgress> progress = null, CancellationToken cancellationToken = default, uint workers = 0)
+        {
+            cancellationToken.ThrowIfCancellationRequested();
+
+            // the last callback comes from the native reporter thread, which is joined
+            // by ntfs_free_copy(), so the continuation must not run on it
+            var completion = new TaskCompletionSource<CopyProgress>(TaskCreationOptions.RunContinuationsAsynchronously);
+            ProgressCallback callback = (in CopyProgress state, IntPtr context) =>
+            {
+                progress?.Report(state);
+                if (state.Status != CopyStatus.Running)
+                {
+                    completion.TrySetResult(state);
+                }
+            };
+
+            IntPtr job = ntfs_start_copy(session, fromPath, toPath, workers, callback, IntPtr.Zero);
+            if (job == default)
+            {
+                throw new FileNotFoundException("No such file or directory", fromPath);
+            }
+
+            CopyProgress result;
+            using (cancellationToken.Register(() => ntfs_cancel_copy(job)))
+            {
+                result = await completion.Task.ConfigureAwait(false);
+            }
+
+            ntfs_free_copy(job);
+            GC.KeepAlive(callback);
+
+            switch (result.Status)
+            {
+                case CopyStatus.Cancelled:
+                    throw new OperationCanceledException(cancellationToken);
+                case CopyStatus.Failed:
+                    throw new IOException($"Copy of {fromPath} failed");
+                default:
+                    return result;
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+using System;
+using System.Runtime.InteropServices;
+
+namespace NTFSUtils
+{
+    [StructLayout(LayoutKind.Sequential, Pack = 1, CharSet = CharSet.Ansi)]
+    public struct DeviceInfo
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Name;
+
+        // disk of a partition, empty for a whole disk
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Parent;
+
+        public ulong Size;
+        public int Error;
+        private byte _ntfs;
+        private byte _readOnly;
+        public ushort BytesPerSector;
+        public uint ClusterSize;
+        public ulong NumberOfSectors;
+        public ulong MftLcn;
+        public uint MftRecordSize;
+        public uint IndexBlockSize;
+        public ulong SerialNumber;
+
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 128)]
+        public string Label;
+
+        public bool IsNtfs => _ntfs != 0;
+        public bool ReadOnly => _readOnly != 0;
+        public string Path => "/dev/" + Name;
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern int ntfs_list_devices([Out] DeviceInfo[] devices, uint capacity);
+
+        // Block devices of /sys/block, probed in parallel by the native side.
+        public static DeviceInfo[] List()
+        {
+            var devices = new DeviceInfo[64];
+            int count;
+            while ((count = ntfs_list_devices(devices, (uint) devices.Length)) > devices.Length)
+            {
+                devices = new DeviceInfo[count];
+            }
+
+            if (count == -1)
+            {
+                throw new InvalidOperationException("Can't read /sys/block");
+            }
+
+            Array.Resize(ref devices, count);
+            return devices;
+        }
+    }
+}
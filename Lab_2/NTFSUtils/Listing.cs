@@ -0,0 +1,120 @@
+using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace NTFSUtils
+{
+    [StructLayout(LayoutKind.Sequential, Pack = 1)]
+    public readonly struct LsHeader
+    {
+        public readonly uint Count;
+        public readonly uint NamesOffset;
+        public readonly uint NamesSize;
+        public readonly uint Reserved;
+        public readonly ulong Cursor;
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 1)]
+    public readonly struct LsEntry
+    {
+        public readonly uint MftNum;
+        public readonly uint NameOffset;
+        public readonly ushort NameLength;
+        public readonly ushort Type;
+    }
+
+    // Pages of a directory listing read by ls_bulk() into one reused buffer,
+    // entries and names are read in place without allocating per entry. The
+    // directory is opened once and every page continues from the native handle.
+    public class Listing : IDisposable
+    {
+        public const uint Utf8 = 0;
+        public const uint Utf16 = 1;
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern IntPtr ls_open(IntPtr session, [MarshalAs(UnmanagedType.LPStr)] string path);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern int ls_bulk(IntPtr dir, uint encoding, [Out] byte[] buffer, uint size);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern void ls_close(IntPtr dir);
+
+        private IntPtr _dir;
+        private readonly uint _encoding;
+        private readonly byte[] _buffer;
+        private bool _done;
+
+        public Listing(IntPtr session, string path, uint encoding = Utf8, int bufferSize = 64 * 1024)
+        {
+            _dir = ls_open(session, path);
+            if (_dir == default)
+            {
+                throw new DirectoryNotFoundException("No such directory: " + path);
+            }
+
+            _encoding = encoding;
+            _buffer = new byte[bufferSize];
+        }
+
+        ~Listing()
+        {
+            Dispose(false);
+        }
+
+        public LsHeader Header => MemoryMarshal.Read<LsHeader>(_buffer);
+
+        public ReadOnlySpan<LsEntry> Entries => MemoryMarshal.Cast<byte, LsEntry>(
+            new ReadOnlySpan<byte>(_buffer, Marshal.SizeOf<LsHeader>(), (int) Header.Count * Marshal.SizeOf<LsEntry>()));
+
+        // Reads the next page, false when the listing is complete.
+        public bool Next()
+        {
+            if (_dir == default)
+            {
+                throw new ObjectDisposedException(nameof(Listing));
+            }
+
+            if (_done)
+            {
+                return false;
+            }
+
+            if (ls_bulk(_dir, _encoding, _buffer, (uint) _buffer.Length) == -1)
+            {
+                throw new ArgumentException("The buffer can't hold the next entry");
+            }
+
+            _done = Header.Cursor == 0;
+            return true;
+        }
+
+        public ReadOnlySpan<byte> NameBytes(in LsEntry entry)
+        {
+            return new ReadOnlySpan<byte>(_buffer, (int) entry.NameOffset, entry.NameLength);
+        }
+
+        public string Name(in LsEntry entry)
+        {
+            return _encoding == Utf16
+                ? Encoding.Unicode.GetString(NameBytes(entry))
+                : Encoding.UTF8.GetString(NameBytes(entry));
+        }
+
+        public void Dispose()
+        {
+            Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (_dir != default)
+            {
+                ls_close(_dir);
+                _dir = default;
+            }
+        }
+    }
+}
@@ -0,0 +1,133 @@
+using System;
+using System.IO;
+using System.Runtime.InteropServices;
+
+namespace NTFSUtils
+{
+    // Read-only, seekable stream over the unnamed $DATA of a file in the image.
+    // Reads go straight into the caller's buffer, pinned for the call; small
+    // reads are served from the native readahead window of the handle.
+    public class NtfsFileStream : Stream
+    {
+        [DllImport("libntfsutil.so.0.0")]
+        static extern IntPtr ntfs_open_file(IntPtr session, [MarshalAs(UnmanagedType.LPStr)] string path);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern long ntfs_read_file(IntPtr handle, ref byte buffer, ulong length, ulong offset);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern ulong ntfs_file_size(IntPtr handle);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern int ntfs_set_readahead(IntPtr handle, uint size);
+
+        [DllImport("libntfsutil.so.0.0")]
+        static extern void ntfs_close_file(IntPtr handle);
+
+        private IntPtr _handle;
+        private readonly long _length;
+        private long _position;
+
+        public NtfsFileStream(IntPtr session, string path, int readahead = 256 * 1024)
+        {
+            _handle = ntfs_open_file(session, path);
+            if (_handle == default)
+            {
+                throw new FileNotFoundException("No such file", path);
+            }
+
+            _length = (long) ntfs_file_size(_handle);
+            if (ntfs_set_readahead(_handle, (uint) readahead) == -1)
+            {
+                Dispose();
+                throw new OutOfMemoryException("Can't allocate the readahead window");
+            }
+        }
+
+        ~NtfsFileStream()
+        {
+            Dispose(false);
+        }
+
+        public override bool CanRead => _handle != default;
+        public override bool CanSeek => _handle != default;
+        public override bool CanWrite => false;
+        public override long Length => _length;
+
+        public override long Position
+        {
+            get => _position;
+            set => Seek(value, SeekOrigin.Begin);
+        }
+
+        public override int Read(byte[] buffer, int offset, int count)
+        {
+            return Read(new Span<byte>(buffer, offset, count));
+        }
+
+        public override int Read(Span<byte> buffer)
+        {
+            if (_handle == default)
+            {
+                throw new ObjectDisposedException(nameof(NtfsFileStream));
+            }
+
+            if (buffer.IsEmpty || _position >= _length)
+            {
+                return 0;
+            }
+
+            long read = ntfs_read_file(_handle, ref MemoryMarshal.GetReference(buffer), (ulong) buffer.Length,
+                (ulong) _position);
+            if (read < 0)
+            {
+                throw new IOException("Can't read the image");
+            }
+
+            _position += read;
+            return (int) read;
+        }
+
+        public override long Seek(long offset, SeekOrigin origin)
+        {
+            long position = origin switch
+            {
+                SeekOrigin.Begin => offset,
+                SeekOrigin.Current => _position + offset,
+                _ => _length + offset
+            };
+            if (position < 0)
+            {
+                throw new IOException("Seek before the start of the file");
+            }
+
+            _position = position;
+            return _position;
+        }
+
+        public override void Flush()
+        {
+        }
+
+        public override void SetLength(long value)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override void Write(byte[] buffer, int offset, int count)
+        {
+            throw new NotSupportedException();
+        }
+
+        protected override void Dispose(bool disposing)
+        {
+            if (_handle != default)
+            {
+                ntfs_close_file(_handle);
+                _handle = default;
+            }
+
+            base.Dispose(disposing);
+        }
+    }
+}
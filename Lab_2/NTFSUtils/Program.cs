@@ -1,5 +1,7 @@
 using System;
+using System.IO;
 using System.Runtime.InteropServices;
+using System.Threading;
 
 namespace NTFSUtils
 {
@@ -12,32 +14,84 @@ namespace NTFSUtils
         static extern int ntfs_close(IntPtr gInfo);
 
         [DllImport("libntfsutil.so.0.0")]
-        static extern int free_ls_info(IntPtr first);
+        static extern IntPtr ntfs_open_session(IntPtr gInfo);
 
-        [return: MarshalAs(UnmanagedType.LPStr)]
         [DllImport("libntfsutil.so.0.0")]
-        static extern string pwd(IntPtr gInfo);
+        static extern void ntfs_close_session(IntPtr session);
 
         [return: MarshalAs(UnmanagedType.LPStr)]
         [DllImport("libntfsutil.so.0.0")]
-        static extern string cd(IntPtr gInfo, [MarshalAs(UnmanagedType.LPStr)] string toPath);
-
-        [DllImport("libntfsutil.so.0.0")]
-        static extern IntPtr ls(IntPtr gInfo, [MarshalAs(UnmanagedType.LPStr)] string toPath);
+        static extern string pwd(IntPtr session);
 
         [return: MarshalAs(UnmanagedType.LPStr)]
         [DllImport("libntfsutil.so.0.0")]
-        static extern string cp(IntPtr gInfo, [MarshalAs(UnmanagedType.LPStr)] string fromPath,
-            [MarshalAs(UnmanagedType.LPStr)] string toPath);
+        static extern string cd(IntPtr session, [MarshalAs(UnmanagedType.LPStr)] string toPath);
 
-        [DllImport("ntfsutil.so.0.0")]
-        static extern void print_device();
+        // prints progress on the native reporter thread, before the copy completes
+        private class ConsoleProgress : IProgress<CopyProgress>
+        {
+            public void Report(CopyProgress progress)
+            {
+                Console.Write("\r{0}/{1} files, {2} MB, {3:F1} MB/s ", progress.FilesDone, progress.FilesFound,
+                    progress.BytesDone >> 20, progress.BytesPerSecond / 1e6);
+            }
+        }
+
+        // copies on native worker threads, Ctrl+C cancels the copy instead of the shell
+        static string Copy(IntPtr session, string fromPath, string toPath)
+        {
+            using var cancel = new CancellationTokenSource();
+            ConsoleCancelEventHandler onCancel = (sender, e) =>
+            {
+                e.Cancel = true;
+                cancel.Cancel();
+            };
+            Console.CancelKeyPress += onCancel;
+            try
+            {
+                CopyJob.CopyAsync(session, fromPath, toPath, new ConsoleProgress(), cancel.Token)
+                    .GetAwaiter().GetResult();
+                return "\nSuccessfully copied";
+            }
+            catch (OperationCanceledException)
+            {
+                return "\nCopy cancelled";
+            }
+            catch (FileNotFoundException)
+            {
+                return "No such file or directory";
+            }
+            catch (IOException)
+            {
+                return "\nERROR: ERROR";
+            }
+            finally
+            {
+                Console.CancelKeyPress -= onCancel;
+            }
+        }
 
         static void Main(string[] args)
         {
             if (args.Length >= 1 && args[0].Equals("list"))
             {
-                Program.print_device();
+                foreach (var device in DeviceInfo.List())
+                {
+                    Console.Write("{0}\t{1} MiB", device.Path, device.Size >> 20);
+                    if (device.Error != 0)
+                    {
+                        Console.Write("\terror {0}", device.Error);
+                    }
+                    else if (device.IsNtfs)
+                    {
+                        Console.Write("\tntfs\tlabel {0}\tcluster {1}\tmft record {2}", device.Label,
+                            device.ClusterSize, device.MftRecordSize);
+                    }
+
+                    Console.WriteLine(device.ReadOnly ? "\tro" : "");
+                }
+
+                return;
             }
 
             if (args.Length >= 2 && args[0].Equals("shell"))
@@ -53,15 +107,17 @@ namespace NTFSUtils
                     Console.WriteLine("NTFS filesystem detected");
                 }
 
+                // the volume can be shared, every shell navigates in its own session
+                IntPtr session = ntfs_open_session(gInfo);
+
                 bool exit = false;
                 String pwd;
                 String[] input;
                 String output;
-                IntPtr intPtr = default;
 
                 while (!exit)
                 {
-                    pwd = Program.pwd(gInfo);
+                    pwd = Program.pwd(session);
                     Console.Write("{0} > ", pwd);
                     input = Console.ReadLine()?.Split(" ");
 
@@ -77,55 +133,44 @@ namespace NTFSUtils
                                 Console.WriteLine("pwd - print working directory");
                                 Console.WriteLine(
                                     "cp [directory] [target directory] - copy dir or file from file system");
+                                Console.WriteLine("cat [file] - print content of a file");
                                 Console.WriteLine("help - list of commands");
                                 Console.WriteLine("exit - terminate");
                                 break;
                             case "ls":
                                 var path = input.Length >= 2 ? input[1] : ".";
-                                LsInfo lsInfo;
-                                if ((intPtr = Program.ls(gInfo, path)) != default)
+                                Listing listing;
+                                try
                                 {
-                                    lsInfo = (LsInfo) Marshal.PtrToStructure(intPtr, typeof(LsInfo));
-                                    if (lsInfo != default)
-                                    {
-                                        lsInfo = (LsInfo) Marshal.PtrToStructure(lsInfo.Ptr, typeof(LsInfo));
-                                    }
-                                    else
-                                    {
-                                        break;
-                                    }
+                                    listing = new Listing(session, path);
                                 }
-                                else
+                                catch (DirectoryNotFoundException)
                                 {
+                                    Console.WriteLine("No such directory");
                                     break;
                                 }
 
-                                while (lsInfo != null && lsInfo.Ptr != default)
+                                using (listing)
                                 {
-                                    switch (lsInfo.Type)
+                                    while (listing.Next())
                                     {
-                                        case 1:
-                                            Console.WriteLine("Dir: {0}", lsInfo.Filename);
-                                            break;
-                                        default:
-                                            Console.WriteLine("File: {0}", lsInfo.Filename);
-                                            break;
+                                        foreach (var entry in listing.Entries)
+                                        {
+                                            Console.WriteLine(entry.Type == 1 ? "Dir: {0}" : "File: {0}",
+                                                listing.Name(entry));
+                                        }
                                     }
-
-                                    lsInfo = (LsInfo) Marshal.PtrToStructure(lsInfo.Ptr, typeof(LsInfo));
                                 }
 
-                                //IntPtr info = Program.ls(g_info, path);
-                                //TODO
                                 break;
                             case "pwd":
-                                output = Program.pwd(gInfo);
+                                output = Program.pwd(session);
                                 Console.WriteLine(output);
                                 break;
                             case "cd":
                                 if (input.Length >= 2)
                                 {
-                                    output = Program.cd(gInfo, input[1]);
+                                    output = Program.cd(session, input[1]);
                                     Console.WriteLine(output);
                                 }
                                 else
@@ -133,13 +178,31 @@ namespace NTFSUtils
                                     Console.WriteLine("cd command require path argument");
                                 }
 
+                                break;
+                            case "cat":
+                                if (input.Length < 2)
+                                {
+                                    Console.WriteLine("cat command require path argument");
+                                    break;
+                                }
+
+                                try
+                                {
+                                    using var file = new NtfsFileStream(session, input[1]);
+                                    using var stdout = Console.OpenStandardOutput();
+                                    file.CopyTo(stdout);
+                                }
+                                catch (FileNotFoundException)
+                                {
+                                    Console.WriteLine("No such file or directory");
+                                }
+
                                 break;
                             case "cp":
                                 switch (input.Length)
                                 {
                                     case 3:
-                                        output = Program.cp(gInfo, input[1], input[2]);
-                                        Console.WriteLine(output);
+                                        Console.WriteLine(Copy(session, input[1], input[2]));
                                         break;
                                     case 2:
                                         Console.WriteLine("cp command requires \"out_path\" argument");
@@ -155,11 +218,8 @@ namespace NTFSUtils
                                 break;
                         }
                 }
+                ntfs_close_session(session);
                 ntfs_close(gInfo);
-                if (intPtr != default)
-                {
-                    free_ls_info(intPtr);
-                }
                 return;
             }
             Console.WriteLine("Incorrect command line arguments. Run with \"help\" argument to get help");
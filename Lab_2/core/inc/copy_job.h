@@ -0,0 +1,101 @@
+#ifndef SYSTEM_SOFTWARE_COPY_JOB_H
+#define SYSTEM_SOFTWARE_COPY_JOB_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "general_information.h"
+#include "inode.h"
+#include "file_handle.h"
+
+#define COPY_JOB_WORKERS 4    /* Default number of copying threads. */
+#define COPY_JOB_MAX_WORKERS 64
+#define COPY_JOB_QUEUE 1024    /* Files found ahead of the workers, the scan waits beyond this. */
+#define COPY_JOB_BUFFER (1024 * 1024)    /* Read buffer of every worker. */
+#define COPY_JOB_INTERVAL_MS 200    /* Time between two progress callbacks. */
+
+typedef enum {
+    COPY_JOB_RUNNING = 0,
+    COPY_JOB_DONE = 1,
+    COPY_JOB_FAILED = 2,
+    COPY_JOB_CANCELLED = 3,
+} COPY_JOB_STATUS;
+
+/**
+ * struct COPY_PROGRESS - State of a copy job passed to its progress callback.
+ *
+ * Files and bytes found grow while the tree is scanned, they are totals once
+ * scan_complete is set. The last callback of a job has a status other than
+ * COPY_JOB_RUNNING.
+ */
+typedef struct {
+    uint64_t files_done;
+    uint64_t files_found;
+    uint64_t bytes_done;
+    uint64_t bytes_found;
+    double bytes_per_second;    /* Average since the start of the job. */
+    uint32_t status;    /* COPY_JOB_STATUS */
+    uint32_t scan_complete;
+/* sizeof() = 48 bytes */
+} __attribute__((__packed__)) COPY_PROGRESS;
+
+typedef void (*COPY_PROGRESS_CALLBACK)(const COPY_PROGRESS *progress, void *context);
+
+// file waiting for a worker
+typedef struct copy_task {
+    FILE_HANDLE *handle;
+    char *path;
+    struct copy_task *next;
+} COPY_TASK;
+
+/**
+ * struct COPY_JOB - Copy of a file or a tree from the volume running on its own threads.
+ *
+ * A scanner thread walks the tree, creates the directories and queues the
+ * files, worker threads copy the queued files, and a reporter thread calls
+ * the progress callback every COPY_JOB_INTERVAL_MS and once more when the job
+ * ends. The callback is only called from the reporter, one call at a time.
+ */
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+    INODE source;    /* Copy of the node to copy, filename is owned by the job. */
+    char *target;
+    COPY_PROGRESS_CALLBACK callback;
+    void *context;
+
+    pthread_t scanner;
+    pthread_t reporter;
+    pthread_t workers[COPY_JOB_MAX_WORKERS];
+    uint32_t worker_count;
+    uint32_t active_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queue_changed;    /* A task was queued or taken, or the scan ended. */
+    pthread_cond_t finished_changed;
+    COPY_TASK *head;
+    COPY_TASK *tail;
+    uint32_t queued;
+    int scan_complete;
+    int finished;
+    int failed;
+    int cancelled;
+    int joined;
+
+    uint64_t files_done;
+    uint64_t files_found;
+    uint64_t bytes_done;
+    uint64_t bytes_found;
+    uint64_t start_time;    /* Monotonic time of the start, ns. */
+} COPY_JOB;
+
+COPY_JOB *start_copy_job(GENERAL_INFORMATION *g_info, INODE *source, const char *target, uint32_t workers,
+                         COPY_PROGRESS_CALLBACK callback, void *context);
+
+void cancel_copy_job(COPY_JOB *job);
+
+void copy_job_progress(COPY_JOB *job, COPY_PROGRESS *progress);
+
+COPY_JOB_STATUS wait_copy_job(COPY_JOB *job);
+
+void free_copy_job(COPY_JOB *job);
+
+#endif //SYSTEM_SOFTWARE_COPY_JOB_H
@@ -0,0 +1,39 @@
+#ifndef SYSTEM_SOFTWARE_FILE_HANDLE_H
+#define SYSTEM_SOFTWARE_FILE_HANDLE_H
+
+#include <stdint.h>
+#include "general_information.h"
+#include "inode.h"
+#include "mapping_chunk.h"
+
+#define FILE_HANDLE_READAHEAD (256 * 1024)    /* Default readahead window in bytes. */
+
+/**
+ * struct FILE_HANDLE - Unnamed $DATA of one file opened for positional reads.
+ *
+ * The runs of the file are decoded once by open_file_handle(). Reads smaller
+ * than the readahead window are served from a window of the file read ahead
+ * in one pread() per run, larger reads go to the caller buffer directly. Like a
+ * session, a handle is used by one thread at a time and closed before the
+ * volume is freed.
+ */
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+    MAPPING_CHUNK_DATA *data;    /* Resident content or the runs of the file. */
+    uint64_t size;
+
+    uint8_t *window;
+    uint32_t window_size;    /* 0 turns readahead off. */
+    uint64_t window_offset;    /* Offset of the window in the file. */
+    uint64_t window_length;    /* Valid bytes in the window. */
+} FILE_HANDLE;
+
+FILE_HANDLE *open_file_handle(GENERAL_INFORMATION *g_info, INODE *inode, uint32_t readahead);
+
+int64_t read_file_handle(FILE_HANDLE *handle, uint8_t *buf, uint64_t length, uint64_t offset);
+
+int set_readahead(FILE_HANDLE *handle, uint32_t size);
+
+void close_file_handle(FILE_HANDLE *handle);
+
+#endif //SYSTEM_SOFTWARE_FILE_HANDLE_H
@@ -2,10 +2,11 @@
 #define SYSTEM_SOFTWARE_GENERAL_INFORMATION_H
 
 #include <stdint.h>
-#include "inode.h"
 
 /**
  * Basic information collected from different structures to facilitate the work
+ *
+ * Written once by init() and shared by all sessions of the volume (see SESSION).
  */
 typedef struct {
     uint64_t mft_lcn;            /* Cluster location of mft data. */
@@ -18,9 +19,6 @@ typedef struct {
     uint64_t mft_record_size_in_bytes;
     uint16_t block_size_in_bytes;
 
-    INODE *cur_node;
-    INODE *root_node;
-
     int file_descriptor;
 } __attribute__((__packed__)) GENERAL_INFORMATION;
 
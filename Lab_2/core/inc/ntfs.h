@@ -24,8 +24,12 @@ GENERAL_INFORMATION *init(char *file_name);
 
 NTFS_BOOT_SECTOR *open_NTFS_file_system(int file_descriptor);
 
+#define FILE_NAME_UTF8_MAX (255 * 3)    /* Bytes of the longest name in UTF-8, 3 per UTF-16 unit at most. */
+
 int read_directory(GENERAL_INFORMATION *g_info, INODE **inode);
 
+uint32_t utf16_to_utf8(char *out, const uint8_t *name, uint32_t length);
+
 uint64_t search_mft_record(GENERAL_INFORMATION *g_info, uint32_t mft_num, MFT_RECORD **mft_record);
 
 int search_attr(GENERAL_INFORMATION *g_info, uint32_t type, MFT_RECORD *mft_record, ATTR_RECORD **attr_record);
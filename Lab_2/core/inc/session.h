@@ -0,0 +1,26 @@
+#ifndef SYSTEM_SOFTWARE_SESSION_H
+#define SYSTEM_SOFTWARE_SESSION_H
+
+#include "general_information.h"
+#include "inode.h"
+
+/**
+ * struct SESSION - Working directory of one user of a volume.
+ *
+ * The volume (GENERAL_INFORMATION) is opened once and shared, every session
+ * only keeps the chain of directories from the root to its working directory.
+ * The volume is only read through pread(), so sessions of the same volume may
+ * run commands from different threads at the same time, one session is used
+ * by one thread at a time. All sessions are closed before the volume is freed.
+ */
+typedef struct {
+    GENERAL_INFORMATION *g_info;
+    INODE *root_node;
+    INODE *cur_node;
+} SESSION;
+
+SESSION *open_session(GENERAL_INFORMATION *g_info);
+
+void close_session(SESSION *session);
+
+#endif //SYSTEM_SOFTWARE_SESSION_H
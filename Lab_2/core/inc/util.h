@@ -4,6 +4,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "ntfs.h"
+#include "session.h"
+#include "file_handle.h"
+#include "copy_job.h"
+#include "device.h"
 
 typedef struct ls_info {
     char *filename;
@@ -11,19 +15,93 @@ typedef struct ls_info {
     struct ls_info *next;
 } LS_INFO;
 
+#define LS_UTF8 0
+#define LS_UTF16 1    /* little endian */
+#define LS_NAME_MAX 255    /* UTF-16 units */
 
-char *pwd(const GENERAL_INFORMATION *g_info);
+/**
+ * struct LS_HEADER - Start of a buffer filled by ls_bulk().
+ *
+ * The header is followed by count LS_ENTRY records; the names of the entries
+ * are packed at the end of the buffer, at names_offset.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t names_offset;    /* From the start of the buffer. */
+    uint32_t names_size;
+    uint32_t reserved;
+    uint64_t cursor;    /* Entries listed so far, 0 when the listing is complete. */
+/* sizeof() = 24 bytes */
+} __attribute__((__packed__)) LS_HEADER;
 
-char *cd(GENERAL_INFORMATION *g_info, char *path);
+/**
+ * struct LS_ENTRY - One entry of a directory listing.
+ */
+typedef struct {
+    uint32_t mft_num;
+    uint32_t name_offset;    /* From the start of the buffer. */
+    uint16_t name_length;    /* In bytes, without terminator. */
+    uint16_t type;    /* 1 for directories, 0 for files, as in LS_INFO. */
+/* sizeof() = 12 bytes */
+} __attribute__((__packed__)) LS_ENTRY;
 
-LS_INFO *ls(GENERAL_INFORMATION *g_info, char *path);
+/* A buffer of this size always holds at least one entry, names take up to 3 bytes per unit in UTF-8. */
+#define LS_MIN_BUFFER (sizeof(LS_HEADER) + sizeof(LS_ENTRY) + LS_NAME_MAX * 3)
 
-char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path);
+/**
+ * struct LS_DIR - Directory opened by ls_open() and listed page by page by ls_bulk().
+ *
+ * The directory is read once when it is opened, every page continues where
+ * the last one stopped.
+ */
+typedef struct ls_dir LS_DIR;
+
+
+char *pwd(const SESSION *session);
+
+char *cd(SESSION *session, char *path);
+
+LS_INFO *ls(SESSION *session, char *path);
+
+LS_DIR *ls_open(SESSION *session, char *path);
+
+int ls_bulk(LS_DIR *dir, uint32_t encoding, uint8_t *buffer, uint32_t size);
+
+void ls_close(LS_DIR *dir);
+
+char *cp(SESSION *session, char *from_path, char *to_path);
 
 GENERAL_INFORMATION *ntfs_init(char *filename);
 
 int ntfs_close(GENERAL_INFORMATION *g_info);
 
+SESSION *ntfs_open_session(GENERAL_INFORMATION *g_info);
+
+void ntfs_close_session(SESSION *session);
+
+FILE_HANDLE *ntfs_open_file(SESSION *session, char *path);
+
+int64_t ntfs_read_file(FILE_HANDLE *handle, uint8_t *buf, uint64_t length, uint64_t offset);
+
+uint64_t ntfs_file_size(const FILE_HANDLE *handle);
+
+int ntfs_set_readahead(FILE_HANDLE *handle, uint32_t size);
+
+void ntfs_close_file(FILE_HANDLE *handle);
+
+COPY_JOB *ntfs_start_copy(SESSION *session, char *from_path, char *to_path, uint32_t workers,
+                          COPY_PROGRESS_CALLBACK callback, void *context);
+
+void ntfs_cancel_copy(COPY_JOB *job);
+
+void ntfs_copy_progress(COPY_JOB *job, COPY_PROGRESS *progress);
+
+int ntfs_wait_copy(COPY_JOB *job);
+
+void ntfs_free_copy(COPY_JOB *job);
+
+int ntfs_list_devices(DEVICE_INFO *devices, uint32_t capacity);
+
 int free_ls_info(LS_INFO *first);
 
 #endif //LAB_1_UTIL_H
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../inc/ntfs.h"
+#include "../inc/copy_job.h"
+
+static uint64_t monotonic_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int stopped(COPY_JOB *job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED) || __atomic_load_n(&job->failed, __ATOMIC_RELAXED);
+}
+
+static void fail(COPY_JOB *job) {
+    pthread_mutex_lock(&job->lock);
+    if (!job->cancelled) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    pthread_cond_broadcast(&job->queue_changed);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Queues a file for the workers, waits while the queue is full. Returns -1 when the job stopped. */
+static int queue_task(COPY_JOB *job, FILE_HANDLE *handle, char *path) {
+    COPY_TASK *task = malloc(sizeof(COPY_TASK));
+    if (task == NULL) {
+        close_file_handle(handle);
+        free(path);
+        return -1;
+    }
+    task->handle = handle;
+    task->path = path;
+    task->next = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->queued >= COPY_JOB_QUEUE && !stopped(job)) {
+        pthread_cond_wait(&job->queue_changed, &job->lock);
+    }
+    if (stopped(job)) {
+        pthread_mutex_unlock(&job->lock);
+        close_file_handle(handle);
+        free(path);
+        free(task);
+        return -1;
+    }
+    if (job->tail == NULL) {
+        job->head = task;
+    } else {
+        job->tail->next = task;
+    }
+    job->tail = task;
+    job->queued++;
+    __atomic_fetch_add(&job->files_found, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&job->bytes_found, handle->size, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&job->queue_changed);
+    pthread_mutex_unlock(&job->lock);
+    return 0;
+}
+
+/* Creates the directories of the tree under to_path and queues its files, as copy() in util.c. */
+static int scan_node(COPY_JOB *job, INODE *node, const char *to_path) {
+    if (stopped(job)) {
+        return -1;
+    }
+    char *node_path = malloc(strlen(to_path) + strlen(node->filename) + 2);
+    strcpy(node_path, to_path);
+    strcat(node_path, "/");
+    strcat(node_path, node->filename);
+
+    if (!(node->type & MFT_RECORD_IS_DIRECTORY)) {
+        // the workers read large chunks straight into their buffers, no readahead window
+        FILE_HANDLE *handle = open_file_handle(job->g_info, node, 0);
+        if (handle == NULL) {
+            free(node_path);
+            return -1;
+        }
+        return queue_task(job, handle, node_path);
+    }
+
+    if (mkdir(node_path, 00777) != 0) {
+        free(node_path);
+        return -1;
+    }
+    INODE *read_node = malloc(sizeof(INODE));
+    memcpy(read_node, node, sizeof(INODE));
+    read_node->filename = NULL;
+    read_node->next_inode = NULL;
+    int result = read_directory(job->g_info, &read_node);
+    for (INODE *tmp = read_node->next_inode; result != -1 && tmp != NULL; tmp = tmp->next_inode) {
+        result = scan_node(job, tmp, node_path);
+    }
+    free(node_path);
+    free_inode(read_node);
+    return result == -1 ? -1 : 0;
+}
+
+static void *scanner_thread(void *arg) {
+    COPY_JOB *job = arg;
+    int result = scan_node(job, &job->source, job->target);
+    pthread_mutex_lock(&job->lock);
+    if (result == -1 && !job->cancelled) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    job->scan_complete = 1;
+    pthread_cond_broadcast(&job->queue_changed);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Copies one queued file through buffer. Returns -1 on errors and when the job stopped. */
+static int copy_task(COPY_JOB *job, COPY_TASK *task, uint8_t *buffer) {
+    int fd = open(task->path, O_CREAT | O_WRONLY | O_TRUNC, 00666);
+    if (fd == -1) {
+        return -1;
+    }
+    uint64_t offset = 0;
+    while (offset < task->handle->size) {
+        if (stopped(job)) {
+            close(fd);
+            return -1;
+        }
+        int64_t length = read_file_handle(task->handle, buffer, COPY_JOB_BUFFER, offset);
+        if (length <= 0) {
+            close(fd);
+            return -1;
+        }
+        for (int64_t written = 0; written < length;) {
+            ssize_t size = pwrite(fd, buffer + written, length - written, (off_t) (offset + written));
+            if (size == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                close(fd);
+                return -1;
+            }
+            written += size;
+        }
+        offset += length;
+        __atomic_fetch_add(&job->bytes_done, (uint64_t) length, __ATOMIC_RELAXED);
+    }
+    close(fd);
+    __atomic_fetch_add(&job->files_done, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void *worker_thread(void *arg) {
+    COPY_JOB *job = arg;
+    uint8_t *buffer = malloc(COPY_JOB_BUFFER);
+    if (buffer == NULL) {
+        fail(job);
+    }
+    while (buffer != NULL) {
+        pthread_mutex_lock(&job->lock);
+        while (job->head == NULL && !job->scan_complete && !stopped(job)) {
+            pthread_cond_wait(&job->queue_changed, &job->lock);
+        }
+        COPY_TASK *task = job->head;
+        if (task == NULL || stopped(job)) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        job->head = task->next;
+        if (job->head == NULL) {
+            job->tail = NULL;
+        }
+        job->queued--;
+        pthread_cond_broadcast(&job->queue_changed);
+        pthread_mutex_unlock(&job->lock);
+
+        if (copy_task(job, task, buffer) == -1) {
+            fail(job);
+        }
+        close_file_handle(task->handle);
+        free(task->path);
+        free(task);
+    }
+    free(buffer);
+
+    pthread_mutex_lock(&job->lock);
+    if (--job->active_workers == 0) {
+        job->finished = 1;
+        pthread_cond_broadcast(&job->finished_changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void report(COPY_JOB *job) {
+    if (job->callback != NULL) {
+        COPY_PROGRESS progress;
+        copy_job_progress(job, &progress);
+        job->callback(&progress, job->context);
+    }
+}
+
+static void *reporter_thread(void *arg) {
+    COPY_JOB *job = arg;
+    pthread_mutex_lock(&job->lock);
+    while (!job->finished) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += COPY_JOB_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&job->finished_changed, &job->lock, &deadline);
+        if (!job->finished) {
+            pthread_mutex_unlock(&job->lock);
+            report(job);
+            pthread_mutex_lock(&job->lock);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+    report(job);
+    return NULL;
+}
+
+static void free_tasks(COPY_JOB *job) {
+    while (job->head != NULL) {
+        COPY_TASK *task = job->head;
+        job->head = task->next;
+        close_file_handle(task->handle);
+        free(task->path);
+        free(task);
+    }
+    job->tail = NULL;
+    job->queued = 0;
+}
+
+/*
+ * Starts copying source (a file or a directory tree) into the directory target
+ * with the given number of workers, 0 for COPY_JOB_WORKERS. The callback may
+ * be NULL. Returns the job or NULL when its threads can't be started.
+ */
+COPY_JOB *start_copy_job(GENERAL_INFORMATION *g_info, INODE *source, const char *target, uint32_t workers,
+                         COPY_PROGRESS_CALLBACK callback, void *context) {
+    COPY_JOB *job = calloc(1, sizeof(COPY_JOB));
+    if (job == NULL) {
+        return NULL;
+    }
+    if (workers == 0) {
+        workers = COPY_JOB_WORKERS;
+    }
+    if (workers > COPY_JOB_MAX_WORKERS) {
+        workers = COPY_JOB_MAX_WORKERS;
+    }
+    job->g_info = g_info;
+    memcpy(&job->source, source, sizeof(INODE));
+    job->source.filename = strdup(source->filename);
+    job->source.next_inode = NULL;
+    job->target = strdup(target);
+    job->callback = callback;
+    job->context = context;
+    job->start_time = monotonic_time();
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->queue_changed, NULL);
+    pthread_cond_init(&job->finished_changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // workers wait for the queue, so they are started first and stop at once when the rest can't start
+    for (; job->worker_count < workers; job->worker_count++) {
+        job->active_workers++;
+        if (pthread_create(&job->workers[job->worker_count], NULL, worker_thread, job) != 0) {
+            job->active_workers--;
+            break;
+        }
+    }
+    int scanner_started = job->worker_count == workers &&
+                          pthread_create(&job->scanner, NULL, scanner_thread, job) == 0;
+    if (!scanner_started || pthread_create(&job->reporter, NULL, reporter_thread, job) != 0) {
+        cancel_copy_job(job);
+        if (scanner_started) {
+            pthread_join(job->scanner, NULL);
+        }
+        for (uint32_t i = 0; i < job->worker_count; i++) {
+            pthread_join(job->workers[i], NULL);
+        }
+        job->joined = 1;
+        free_copy_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* Stops the job, files being copied are left partly written. */
+void cancel_copy_job(COPY_JOB *job) {
+    pthread_mutex_lock(&job->lock);
+    if (!job->finished) {
+        __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    }
+    pthread_cond_broadcast(&job->queue_changed);
+    pthread_mutex_unlock(&job->lock);
+}
+
+void copy_job_progress(COPY_JOB *job, COPY_PROGRESS *progress) {
+    progress->files_done = __atomic_load_n(&job->files_done, __ATOMIC_RELAXED);
+    progress->files_found = __atomic_load_n(&job->files_found, __ATOMIC_RELAXED);
+    progress->bytes_done = __atomic_load_n(&job->bytes_done, __ATOMIC_RELAXED);
+    progress->bytes_found = __atomic_load_n(&job->bytes_found, __ATOMIC_RELAXED);
+    uint64_t elapsed = monotonic_time() - job->start_time;
+    progress->bytes_per_second = elapsed > 0 ? (double) progress->bytes_done * 1e9 / (double) elapsed : 0;
+
+    pthread_mutex_lock(&job->lock);
+    progress->scan_complete = job->scan_complete;
+    if (!job->finished) {
+        progress->status = COPY_JOB_RUNNING;
+    } else if (job->cancelled) {
+        progress->status = COPY_JOB_CANCELLED;
+    } else if (job->failed) {
+        progress->status = COPY_JOB_FAILED;
+    } else {
+        progress->status = COPY_JOB_DONE;
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Waits until every thread of the job ended. Returns the final status. */
+COPY_JOB_STATUS wait_copy_job(COPY_JOB *job) {
+    if (!job->joined) {
+        pthread_join(job->reporter, NULL);
+        pthread_join(job->scanner, NULL);
+        for (uint32_t i = 0; i < job->worker_count; i++) {
+            pthread_join(job->workers[i], NULL);
+        }
+        job->joined = 1;
+    }
+    COPY_PROGRESS progress;
+    copy_job_progress(job, &progress);
+    return progress.status;
+}
+
+/* Waits for the job and frees it. Must not be called from its progress callback. */
+void free_copy_job(COPY_JOB *job) {
+    if (job == NULL) {
+        return;
+    }
+    wait_copy_job(job);
+    free_tasks(job);
+    pthread_cond_destroy(&job->queue_changed);
+    pthread_cond_destroy(&job->finished_changed);
+    pthread_mutex_destroy(&job->lock);
+    free(job->source.filename);
+    free(job->target);
+    free(job);
+}
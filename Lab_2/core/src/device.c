@@ -1,44 +1,258 @@
+#include "../inc/device.h"
+#include "../inc/boot_sector.h"
+#include "../inc/mft.h"
+#include "../inc/attribute.h"
+#include "../inc/ntfs.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <regex.h>
-
-#define SYS_BLOCK_DIR "/sys/block/"
-#define DRIVE_PATTERN "^((loop)[0-9])|(sda)|(sr[0-9])"
-
-int print_available_devices() {
-    DIR *block_devices_dir;
-    DIR *partitions_dir;
-    struct dirent *block_device_entry;
-    struct dirent *partition_entry;
-    regex_t matcher_drives;
-    regex_t matcher_partitions;
-
-    regcomp(&matcher_drives, DRIVE_PATTERN, REG_EXTENDED);
-    block_devices_dir = opendir(SYS_BLOCK_DIR);
-    if (!block_devices_dir) {
+#include <unistd.h>
+
+#define SYS_BLOCK "/sys/block"
+#define MAX_RECORD_SIZE 65536
+#define SECTOR_SIZE 512
+#define SYS_PATH_MAX (sizeof(SYS_BLOCK) + 2 * DEVICE_NAME_MAX + 16)    /* /sys/block/<disk>/<partition>/<attribute> */
+
+typedef struct {
+    DEVICE_INFO *devices;
+    uint32_t count;
+    uint32_t next;    /* Index of the next device to probe, taken atomically. */
+} PROBE_QUEUE;
+
+/* Reads a decimal number from a sysfs attribute, 0 if it can't be read. */
+static uint64_t read_sys_number(const char *path) {
+    char buf[32] = {0};
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t length = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    return length > 0 ? strtoull(buf, NULL, 10) : 0;
+}
+
+/* Adds the device described by the sysfs directory dir, skips empty devices. */
+static int add_device(DEVICE_INFO **devices, uint32_t *count, uint32_t *capacity, const char *dir,
+                      const char *name, const char *parent) {
+    char path[SYS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/size", dir);
+    // sysfs counts in 512-byte sectors whatever the logical sector size is
+    uint64_t size = read_sys_number(path) * 512;
+    if (size == 0) {
+        return 0;
+    }
+
+    if (*count == *capacity) {
+        uint32_t new_capacity = *capacity ? *capacity * 2 : 16;
+        DEVICE_INFO *new_devices = realloc(*devices, new_capacity * sizeof(DEVICE_INFO));
+        if (new_devices == NULL) {
+            return -1;
+        }
+        *devices = new_devices;
+        *capacity = new_capacity;
+    }
+
+    DEVICE_INFO *device = &(*devices)[(*count)++];
+    memset(device, 0, sizeof(DEVICE_INFO));
+    strcpy(device->name, name);
+    strncpy(device->parent, parent, DEVICE_NAME_MAX - 1);
+    device->size = size;
+    snprintf(path, sizeof(path), "%s/ro", dir);
+    device->read_only = read_sys_number(path) != 0;
+    return 0;
+}
+
+/* Adds a disk and its partitions, which are the subdirectories holding a "partition" file. */
+static int add_disk(DEVICE_INFO **devices, uint32_t *count, uint32_t *capacity, const char *disk) {
+    char dir[SYS_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%s", SYS_BLOCK, disk);
+    if (add_device(devices, count, capacity, dir, disk, "") == -1) {
         return -1;
     }
-    while ((block_device_entry = readdir(block_devices_dir)) != NULL) {
-        if (!regexec(&matcher_drives, block_device_entry->d_name, 0, NULL, 0)) {
-            printf("Drive %s\n", block_device_entry->d_name);
-
-            regcomp(&matcher_partitions, block_device_entry->d_name, 0);
-            char drive_dir[strlen(SYS_BLOCK_DIR) + strlen(block_device_entry->d_name) + 1];
-            drive_dir[0] = 0;
-            strcat(drive_dir, SYS_BLOCK_DIR);
-            strcat(drive_dir, block_device_entry->d_name);
-            partitions_dir = opendir(drive_dir);
-            if (!partitions_dir) {
-                return -1;
-            }
-            while ((partition_entry = readdir(partitions_dir)) != NULL) {
-                if (!regexec(&matcher_partitions, partition_entry->d_name, 0, NULL, 0)) {
-                    printf("\t- partition %s\n", partition_entry->d_name);
-                }
+
+    DIR *disk_dir = opendir(dir);
+    if (disk_dir == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    int err = 0;
+    while (err == 0 && (entry = readdir(disk_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= DEVICE_NAME_MAX) {
+            continue;
+        }
+        char partition[SYS_PATH_MAX + DEVICE_NAME_MAX + sizeof("/partition")];
+        snprintf(partition, sizeof(partition), "%s/%.*s/partition", dir, DEVICE_NAME_MAX - 1, entry->d_name);
+        if (access(partition, F_OK) == 0) {
+            snprintf(partition, sizeof(partition), "%s/%.*s", dir, DEVICE_NAME_MAX - 1, entry->d_name);
+            err = add_device(devices, count, capacity, partition, entry->d_name, disk);
+        }
+    }
+    closedir(disk_dir);
+    return err;
+}
+
+/* Puts back the last two bytes of every sector of the record, which were replaced by the update sequence number. */
+static int apply_fixups(uint8_t *record, uint32_t size) {
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    if (header->usa_ofs + header->usa_count * sizeof(uint16_t) > size) {
+        return -1;
+    }
+    uint16_t *usa = (uint16_t *) (record + header->usa_ofs);
+    for (uint16_t i = 1; i < header->usa_count && i * SECTOR_SIZE <= size; i++) {
+        uint16_t *sector_end = (uint16_t *) (record + i * SECTOR_SIZE - sizeof(uint16_t));
+        if (*sector_end != usa[0]) {
+            return -1;
+        }
+        *sector_end = usa[i];
+    }
+    return 0;
+}
+
+/* Copies $VOLUME_NAME of the volume into the label, the record of $Volume is in the first extent of $MFT. */
+static void read_label(int fd, DEVICE_INFO *device) {
+    if (device->mft_record_size < SECTOR_SIZE || device->mft_record_size > MAX_RECORD_SIZE) {
+        return;
+    }
+    uint8_t *record = malloc(device->mft_record_size);
+    if (record == NULL) {
+        return;
+    }
+    off_t offset = device->mft_lcn * device->cluster_size + (uint64_t) FILE_Volume * device->mft_record_size;
+    if (pread(fd, record, device->mft_record_size, offset) != device->mft_record_size ||
+        ((MFT_RECORD *) record)->magic != magic_FILE || apply_fixups(record, device->mft_record_size) == -1) {
+        free(record);
+        return;
+    }
+
+    MFT_RECORD *header = (MFT_RECORD *) record;
+    uint32_t end = header->bytes_in_use < device->mft_record_size ? header->bytes_in_use : device->mft_record_size;
+    uint32_t position = header->attrs_offset;
+    while (position + offsetof(ATTR_RECORD, resident_end) <= end) {
+        ATTR_RECORD *attr = (ATTR_RECORD *) (record + position);
+        if (attr->type == AT_END || attr->length == 0) {
+            break;
+        }
+        if (attr->type == AT_VOLUME_NAME && !attr->non_resident &&
+            position + attr->value_offset + attr->value_length <= end) {
+            const uint8_t *name = (uint8_t *) attr + attr->value_offset;
+            uint32_t length = attr->value_length / sizeof(uint16_t);
+            // UTF-8 as the directory listings, up to 3 bytes per unit
+            if (length > (DEVICE_LABEL_MAX - 1) / 3) {
+                length = (DEVICE_LABEL_MAX - 1) / 3;
             }
+            utf16_to_utf8(device->label, name, length);
+            break;
         }
+        position += attr->length;
+    }
+    free(record);
+}
+
+/*
+ * Reads the first sector of the device and fills the NTFS geometry if it holds an NTFS boot sector.
+ * Returns 0, or -1 with device->error set when the device can't be read.
+ */
+int probe_device(const char *path, DEVICE_INFO *device) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        device->error = errno;
+        return -1;
     }
-    closedir(block_devices_dir);
+
+    NTFS_BOOT_SECTOR boot_sector;
+    ssize_t length = pread(fd, &boot_sector, sizeof(boot_sector), 0);
+    if (length != sizeof(boot_sector)) {
+        device->error = length == -1 ? errno : EIO;
+        close(fd);
+        return -1;
+    }
+
+    device->ntfs = boot_sector.oem_id == NTFS_OEM_ID;
+    if (device->ntfs) {
+        device->bytes_per_sector = boot_sector.bpb.bytes_per_sector;
+        device->cluster_size = boot_sector.bpb.bytes_per_sector * boot_sector.bpb.sectors_per_cluster;
+        device->number_of_sectors = boot_sector.number_of_sectors;
+        device->mft_lcn = boot_sector.mft_lcn;
+        device->serial_number = boot_sector.volume_serial_number;
+        /* Negative value means the size is 2^-value bytes, as in init(). */
+        if (boot_sector.clusters_per_mft_record > 0) {
+            device->mft_record_size = boot_sector.clusters_per_mft_record * device->cluster_size;
+        } else if (boot_sector.clusters_per_mft_record > -32) {
+            device->mft_record_size = 1u << -boot_sector.clusters_per_mft_record;
+        }
+        if (boot_sector.clusters_per_index_record > 0) {
+            device->index_block_size = boot_sector.clusters_per_index_record * device->cluster_size;
+        } else if (boot_sector.clusters_per_index_record > -32) {
+            device->index_block_size = 1u << -boot_sector.clusters_per_index_record;
+        }
+        read_label(fd, device);
+    }
+    close(fd);
+    return 0;
+}
+
+static void *probe_worker(void *arg) {
+    PROBE_QUEUE *queue = arg;
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+        char path[DEVICE_NAME_MAX + 8];
+        snprintf(path, sizeof(path), "/dev/%s", queue->devices[i].name);
+        probe_device(path, &queue->devices[i]);
+    }
+    return NULL;
+}
+
+static int compare_devices(const void *a, const void *b) {
+    return strcmp(((const DEVICE_INFO *) a)->name, ((const DEVICE_INFO *) b)->name);
+}
+
+/*
+ * Lists the disks and partitions of /sys/block with a nonzero size, sorted by name, and probes
+ * them on up to DEVICE_PROBE_THREADS threads. *devices is malloc'd, a device that can't be
+ * read is still listed with its error. Returns 0 or -1 if /sys/block can't be read.
+ */
+int list_devices(DEVICE_INFO **devices, uint32_t *count) {
+    *devices = NULL;
+    *count = 0;
+    DIR *block_dir = opendir(SYS_BLOCK);
+    if (block_dir == NULL) {
+        return -1;
+    }
+
+    uint32_t capacity = 0;
+    struct dirent *entry;
+    int err = 0;
+    while (err == 0 && (entry = readdir(block_dir)) != NULL) {
+        if (entry->d_name[0] != '.' && strlen(entry->d_name) < DEVICE_NAME_MAX) {
+            err = add_disk(devices, count, &capacity, entry->d_name);
+        }
+    }
+    closedir(block_dir);
+    if (err == -1) {
+        free(*devices);
+        *devices = NULL;
+        *count = 0;
+        return -1;
+    }
+
+    // a probe is one read, the time goes to waiting for the device, so the threads overlap the waits
+    PROBE_QUEUE queue = {*devices, *count, 0};
+    pthread_t threads[DEVICE_PROBE_THREADS];
+    uint32_t thread_count = *count < DEVICE_PROBE_THREADS ? *count : DEVICE_PROBE_THREADS;
+    uint32_t started = 0;
+    while (started < thread_count && pthread_create(&threads[started], NULL, probe_worker, &queue) == 0) {
+        started++;
+    }
+    probe_worker(&queue);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    qsort(*devices, *count, sizeof(DEVICE_INFO), compare_devices);
     return 0;
-}
\ No newline at end of file
+}
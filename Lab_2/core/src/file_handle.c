@@ -0,0 +1,133 @@
+#include "../inc/ntfs.h"
+#include "../inc/file_handle.h"
+
+/*
+ * Opens the unnamed $DATA of a file with a readahead window of the given
+ * size, see set_readahead(). Returns the handle or NULL for directories and
+ * unreadable records.
+ */
+FILE_HANDLE *open_file_handle(GENERAL_INFORMATION *g_info, INODE *inode, uint32_t readahead) {
+    FILE_HANDLE *handle = malloc(sizeof(FILE_HANDLE));
+    if (handle == NULL) {
+        return NULL;
+    }
+    handle->data = NULL;
+    if (read_file_data(g_info, inode, &handle->data) == -1 || handle->data == NULL) {
+        free(handle);
+        return NULL;
+    }
+    handle->g_info = g_info;
+    handle->size = handle->data->length;
+    handle->window = NULL;
+    handle->window_size = 0;
+    handle->window_offset = 0;
+    handle->window_length = 0;
+    if (set_readahead(handle, readahead) == -1) {
+        close_file_handle(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+/*
+ * Reads length bytes at offset of the file, offset and length already
+ * clamped to the size, with one pread() per run. Holes read as zeroes.
+ */
+static int read_runs(FILE_HANDLE *handle, uint8_t *buf, uint64_t length, uint64_t offset) {
+    MAPPING_CHUNK_DATA *data = handle->data;
+    if (data->resident) {
+        memcpy(buf, data->buf + offset, length);
+        return 0;
+    }
+
+    uint64_t cluster_size = (uint64_t) handle->g_info->sectors_per_cluster * handle->g_info->bytes_per_sector;
+    uint64_t run_start = 0;
+    for (int i = 0; i < data->lcn_count && length > 0; i++) {
+        uint64_t run_end = run_start + data->lengths[i] * cluster_size;
+        if (offset < run_end) {
+            uint64_t size = run_end - offset < length ? run_end - offset : length;
+            if (data->lcns[i] == -1) {
+                memset(buf, 0, size);
+            } else {
+                uint64_t disk_offset = data->lcns[i] * cluster_size + (offset - run_start);
+                if (pread(handle->g_info->file_descriptor, buf, size, (long) disk_offset) != (ssize_t) size) {
+                    return -1;
+                }
+            }
+            buf += size;
+            offset += size;
+            length -= size;
+        }
+        run_start = run_end;
+    }
+    // runs shorter than the size, the rest was never allocated
+    memset(buf, 0, length);
+    return 0;
+}
+
+/*
+ * Copies up to length bytes at offset into buf.
+ * Returns the number of bytes read, 0 at the end of the file, or -1.
+ */
+int64_t read_file_handle(FILE_HANDLE *handle, uint8_t *buf, uint64_t length, uint64_t offset) {
+    if (offset >= handle->size) {
+        return 0;
+    }
+    if (length > handle->size - offset) {
+        length = handle->size - offset;
+    }
+
+    uint64_t done = 0;
+    while (done < length) {
+        uint64_t position = offset + done;
+        if (position >= handle->window_offset && position < handle->window_offset + handle->window_length) {
+            uint64_t size = handle->window_offset + handle->window_length - position;
+            if (size > length - done) {
+                size = length - done;
+            }
+            memcpy(buf + done, handle->window + (position - handle->window_offset), size);
+            done += size;
+        } else if (length - done >= handle->window_size) {
+            if (read_runs(handle, buf + done, length - done, position) == -1) {
+                return -1;
+            }
+            done = length;
+        } else {
+            uint64_t size = handle->size - position < handle->window_size ? handle->size - position
+                                                                          : handle->window_size;
+            handle->window_length = 0;
+            if (read_runs(handle, handle->window, size, position) == -1) {
+                return -1;
+            }
+            handle->window_offset = position;
+            handle->window_length = size;
+        }
+    }
+    return (int64_t) length;
+}
+
+/*
+ * Sets the readahead window, 0 to read only what is asked for.
+ * Returns 0 or -1 when the window can't be allocated.
+ */
+int set_readahead(FILE_HANDLE *handle, uint32_t size) {
+    uint8_t *window = NULL;
+    if (size > 0 && (window = malloc(size)) == NULL) {
+        return -1;
+    }
+    free(handle->window);
+    handle->window = window;
+    handle->window_size = size;
+    handle->window_offset = 0;
+    handle->window_length = 0;
+    return 0;
+}
+
+void close_file_handle(FILE_HANDLE *handle) {
+    if (handle == NULL) {
+        return;
+    }
+    free_data_chunk(handle->data);
+    free(handle->window);
+    free(handle);
+}
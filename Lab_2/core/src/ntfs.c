@@ -3,11 +3,9 @@
 #include <fcntl.h>
 #include <errno.h>
 
-#define FILE_NAME_MAX_SIZE 255
-
 extern int errno;
 
-static uint8_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry);
+static uint16_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry);
 
 static int
 read_clusters_to_buf(uint8_t **buf, uint64_t *buf_current_size, uint64_t *buf_size, int64_t lcn, uint64_t length,
@@ -33,7 +31,6 @@ GENERAL_INFORMATION *init(char *file_name) {
         return NULL;
     }
     GENERAL_INFORMATION *g_info = malloc(sizeof(GENERAL_INFORMATION));
-    INODE *root_inode = malloc(sizeof(INODE));
 
     g_info->bytes_per_sector = boot_sector->bpb.bytes_per_sector;
     g_info->sectors_per_cluster = boot_sector->bpb.sectors_per_cluster;
@@ -42,19 +39,12 @@ GENERAL_INFORMATION *init(char *file_name) {
     g_info->mft_record_size_in_bytes =
             g_info->clusters_per_mft_record * g_info->sectors_per_cluster * g_info->bytes_per_sector;
     g_info->file_descriptor = file_descriptor;
-    g_info->cur_node = root_inode;
-    g_info->root_node = root_inode;
     g_info->mft_lcn = boot_sector->mft_lcn;
     g_info->block_size_in_bytes =
             g_info->clusters_per_index_record * g_info->sectors_per_cluster * g_info->bytes_per_sector;
 
     free(boot_sector);
 
-    root_inode->mft_num = FILE_root;
-    root_inode->type = MFT_RECORD_IN_USE | MFT_RECORD_IS_DIRECTORY;
-    root_inode->parent = root_inode;
-    root_inode->next_inode = NULL;
-
     printf("%s\n", "Basic information about  file system");
     printf("Cluster location of mft data: %ld\n", g_info->mft_lcn);
     printf("Cluster per mft record: %d\n", g_info->clusters_per_mft_record);
@@ -87,8 +77,7 @@ GENERAL_INFORMATION *init(char *file_name) {
 NTFS_BOOT_SECTOR *open_NTFS_file_system(int file_descriptor) {
     NTFS_BOOT_SECTOR *boot_sector = malloc(sizeof(NTFS_BOOT_SECTOR));
     pread(file_descriptor, boot_sector, sizeof(NTFS_BOOT_SECTOR), 0);
-    uint64_t ntfs_id = 0x202020205346544e;
-    if (boot_sector->oem_id == ntfs_id) {
+    if (boot_sector->oem_id == NTFS_OEM_ID) {
         return boot_sector;
     } else {
         free(boot_sector);
@@ -102,7 +91,7 @@ int read_directory(GENERAL_INFORMATION *g_info, INODE **inode) {
     MFT_RECORD *directory_record = malloc(g_info->mft_record_size_in_bytes);
     uint64_t offset = search_mft_record(g_info, (*inode)->mft_num, &directory_record);
     int err;
-    uint8_t file_name_length;
+    uint16_t file_name_length;
     INDEX_ENTRY *index_entry = NULL;
     INODE *current_inode = *inode;
     if (offset < 0) {
@@ -117,7 +106,7 @@ int read_directory(GENERAL_INFORMATION *g_info, INODE **inode) {
         return -1;
     }
 
-    char file_name[FILE_NAME_MAX_SIZE + 1];
+    char file_name[FILE_NAME_UTF8_MAX + 1];
 
     MFT_RECORD *directory_entry = malloc(g_info->mft_record_size_in_bytes);
 
@@ -340,7 +329,6 @@ int read_block_file(GENERAL_INFORMATION *g_info, MAPPING_CHUNK_DATA **chunk_data
 }
 
 int free_g_info(GENERAL_INFORMATION *g_info) {
-    free_inode(g_info->root_node);
     close(g_info->file_descriptor);
     free(g_info);
     return 0;
@@ -377,16 +365,49 @@ int free_data_chunk(MAPPING_CHUNK_DATA *chunk_data) {
 }
 
 
-static uint8_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry) {
-    const uint16_t *filename = index_entry->key.file_name.file_name;
-    uint8_t filename_length = index_entry->key.file_name.file_name_length;
-
-    for (uint8_t i = 0; i < filename_length; i++) {
-        file_name[i] = (char) filename[i];
+/*
+ * Converts length UTF-16LE units of an ntfs name to UTF-8, an unpaired
+ * surrogate becomes U+FFFD. out holds 3 bytes per unit and the terminating
+ * zero. Returns the length without the terminating zero.
+ */
+uint32_t utf16_to_utf8(char *out, const uint8_t *name, uint32_t length) {
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t c = name[2 * i] | name[2 * i + 1] << 8;
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < length) {
+            uint32_t low = name[2 * i + 2] | name[2 * i + 3] << 8;
+            if (low >= 0xDC00 && low < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            }
+        }
+        if (c >= 0xD800 && c < 0xE000) {
+            c = 0xFFFD;
+        }
+        if (c < 0x80) {
+            out[size++] = (char) c;
+        } else if (c < 0x800) {
+            out[size++] = (char) (0xC0 | c >> 6);
+            out[size++] = (char) (0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out[size++] = (char) (0xE0 | c >> 12);
+            out[size++] = (char) (0x80 | (c >> 6 & 0x3F));
+            out[size++] = (char) (0x80 | (c & 0x3F));
+        } else {
+            out[size++] = (char) (0xF0 | c >> 18);
+            out[size++] = (char) (0x80 | (c >> 12 & 0x3F));
+            out[size++] = (char) (0x80 | (c >> 6 & 0x3F));
+            out[size++] = (char) (0x80 | (c & 0x3F));
+        }
     }
-    file_name[filename_length] = '\0';
+    out[size] = '\0';
+    return size;
+}
 
-    return filename_length + 1;
+/* Names are kept in UTF-8. Returns the length including the terminating zero. */
+static uint16_t file_name_convertor(char *file_name, const INDEX_ENTRY *index_entry) {
+    const uint8_t *filename = (const uint8_t *) index_entry->key.file_name.file_name;
+    return (uint16_t) (utf16_to_utf8(file_name, filename, index_entry->key.file_name.file_name_length) + 1);
 }
 
 static int
@@ -490,6 +511,9 @@ static int init_chunk_data(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING
     int64_t data_run_offset = 0; //на выходе, распакованное значение кластерного смещения
 
     do {
+        // every run starts from zero, only LCN carries over as the base of the next offset
+        data_run_length = 0;
+        data_run_offset = 0;
         //из старшего полубайта считаем размер поля смещения
         data_run_offset_size = (*ptr_run_list >> 4) & 0x0F;
         //из младшего размер поля смещения
@@ -502,32 +526,31 @@ static int init_chunk_data(uint64_t offset, GENERAL_INFORMATION *g_info, MAPPING
         //цикл распаковки длины отрезка, с каждой итерацией значение сдвигается на i-байт и
         //прибавляется с длиной
         for (i = 0; i < data_run_length_size; i++) {
-            data_run_length += *ptr_run_list << (i << 3);
+            data_run_length += (uint64_t) *ptr_run_list << (i << 3);
             ptr_run_list++;
         }
 
+        if (cur_size == buf_size) {
+            buf_size *= 2;
+            (*chunk_data)->lcns = realloc((*chunk_data)->lcns, sizeof(int64_t) * buf_size);
+            (*chunk_data)->lengths = realloc((*chunk_data)->lengths, sizeof(uint64_t) * buf_size);
+        }
+
         /* NTFS 3+ sparse files, если файл разряжен */
         if (data_run_offset_size == 0) {
-            data_run_offset = -1;
-            //TODO maybe break
+            // a hole has no clusters, LCN stays the base of the next run
+            (*chunk_data)->lcns[cur_size] = -1;
         } else {
             //цикл распаковки смещения
             for (i = 0; i < data_run_offset_size - 1; i++) {
-                data_run_offset += *ptr_run_list << (i << 3);
+                data_run_offset += (int64_t) *ptr_run_list << (i << 3);
                 ptr_run_list++;
             }
             //последний байт может быть знаковым, поэтому он обрабатывается отдельно
-            data_run_offset = ((char) (*(ptr_run_list++)) << (i << 3)) + data_run_offset;
+            data_run_offset = ((int64_t) (int8_t) (*(ptr_run_list++)) << (i << 3)) + data_run_offset;
+            LCN += data_run_offset;
+            (*chunk_data)->lcns[cur_size] = LCN;
         }
-
-        if (cur_size == buf_size) {
-            (*chunk_data)->lcns = realloc((*chunk_data)->lcns, 2 * buf_size);
-            (*chunk_data)->lengths = realloc((*chunk_data)->lengths, 2 * buf_size);
-            buf_size *= 2;
-        }
-        LCN += data_run_offset;
-
-        (*chunk_data)->lcns[cur_size] = LCN;
         (*chunk_data)->lengths[cur_size] = data_run_length;
         cur_size++;
     } while (*ptr_run_list);
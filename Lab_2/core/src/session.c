@@ -0,0 +1,34 @@
+#include "../inc/ntfs.h"
+#include "../inc/session.h"
+
+/*
+ * New session of the volume with the root directory as working directory.
+ * Returns the session or NULL.
+ */
+SESSION *open_session(GENERAL_INFORMATION *g_info) {
+    SESSION *session = malloc(sizeof(SESSION));
+    INODE *root_inode = malloc(sizeof(INODE));
+    if (session == NULL || root_inode == NULL) {
+        free(session);
+        free(root_inode);
+        return NULL;
+    }
+    root_inode->mft_num = FILE_root;
+    root_inode->filename = NULL;
+    root_inode->type = MFT_RECORD_IN_USE | MFT_RECORD_IS_DIRECTORY;
+    root_inode->parent = root_inode;
+    root_inode->next_inode = NULL;
+
+    session->g_info = g_info;
+    session->root_node = root_inode;
+    session->cur_node = root_inode;
+    return session;
+}
+
+void close_session(SESSION *session) {
+    if (session == NULL) {
+        return;
+    }
+    free_inode(session->root_node);
+    free(session);
+}
@@ -6,15 +6,17 @@ static int count_nodes(char *path) {
     strcpy(path_buf, path);
     int result = 0;
     char sep[2] = "/";
-    char *sub_dir = strtok(path_buf, sep);
+    char *save;
+    char *sub_dir = strtok_r(path_buf, sep, &save);
     while (sub_dir != NULL) {
         result++;
-        sub_dir = strtok(NULL, sep);
+        sub_dir = strtok_r(NULL, sep, &save);
     }
     return result;
 }
 
-static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **start_node, FIND_INFO **result) {
+static int find_node_by_name(SESSION *session, char *path, INODE **start_node, FIND_INFO **result) {
+    GENERAL_INFORMATION *g_info = session->g_info;
     INODE *result_node = malloc(sizeof(INODE));
     INODE *head;
     memcpy(result_node, *start_node, sizeof(INODE));
@@ -25,7 +27,8 @@ static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **st
     char path_buf[512];
     strcpy(path_buf, path);
     int count = count_nodes(path);
-    char *sub_dir = strtok(path_buf, sep);
+    char *save;
+    char *sub_dir = strtok_r(path_buf, sep, &save);
     int err;
     while (sub_dir != NULL) {
         found = false;
@@ -69,7 +72,7 @@ static int find_node_by_name(GENERAL_INFORMATION *g_info, char *path, INODE **st
         } else {
             count--;
         }
-        sub_dir = strtok(NULL, sep);
+        sub_dir = strtok_r(NULL, sep, &save);
     }
     return -1;
 }
@@ -149,13 +152,13 @@ static int copy(GENERAL_INFORMATION *g_info, INODE *node, char *to_path) {
     return 0;
 }
 
-char *pwd(const GENERAL_INFORMATION *const g_info) {
+char *pwd(const SESSION *session) {
     uint64_t size = 2;   // for 0x20 and 0x00
     uint16_t current_size = 256;
     uint32_t name_length;
     char *result = malloc(size);
     result[0] = '\0';
-    INODE *current_inode = g_info->root_node->next_inode;
+    INODE *current_inode = session->root_node->next_inode;
     if (current_inode == NULL) {
         strcat((char *) result, "/");
 
@@ -175,7 +178,7 @@ char *pwd(const GENERAL_INFORMATION *const g_info) {
     return result;
 }
 
-char *cd(GENERAL_INFORMATION *g_info, char *path) {
+char *cd(SESSION *session, char *path) {
     char *output = malloc(16);
     output[0] = '\0';
     char *message;
@@ -183,27 +186,27 @@ char *cd(GENERAL_INFORMATION *g_info, char *path) {
     if (strcmp(path, ".") == 0) {
         return output;
     } else if (strcmp(path, "..") == 0) {
-        if (g_info->cur_node->mft_num == FILE_root) {
+        if (session->cur_node->mft_num == FILE_root) {
             return output;
         }
-        INODE *tmp = g_info->cur_node->parent;
-        free_inode(g_info->cur_node);
-        g_info->cur_node = tmp;
-        g_info->cur_node->next_inode = NULL;
+        INODE *tmp = session->cur_node->parent;
+        free_inode(session->cur_node);
+        session->cur_node = tmp;
+        session->cur_node->next_inode = NULL;
         return output;
     }
 
     FIND_INFO *result;
     int err;
     if (path[0] == '/') {
-        err = find_node_by_name(g_info, path, &(g_info->root_node), &result);
+        err = find_node_by_name(session, path, &(session->root_node), &result);
         if (err == -1) {
             goto error;
         }
         if (result->result->type & MFT_RECORD_IS_DIRECTORY) {
-            g_info->root_node->next_inode = result->start->next_inode;
-            result->start->next_inode->parent = g_info->root_node;
-            g_info->cur_node = result->result;
+            session->root_node->next_inode = result->start->next_inode;
+            result->start->next_inode->parent = session->root_node;
+            session->cur_node = result->result;
             result->start->next_inode = NULL;
             free_inode((result->start));
             free(result);
@@ -212,12 +215,12 @@ char *cd(GENERAL_INFORMATION *g_info, char *path) {
             goto is_file;
         }
     } else {
-        err = find_node_by_name(g_info, path, &(g_info->cur_node), &result);
+        err = find_node_by_name(session, path, &(session->cur_node), &result);
         if (err == -1) goto error;
         if (result->result->type & MFT_RECORD_IS_DIRECTORY) {
-            g_info->cur_node->next_inode = result->start->next_inode;
-            result->start->next_inode->parent = g_info->cur_node;
-            g_info->cur_node = result->result;
+            session->cur_node->next_inode = result->start->next_inode;
+            result->start->next_inode->parent = session->cur_node;
+            session->cur_node = result->result;
             result->start->next_inode = NULL;
             free_inode((result->start));
             free(result);
@@ -241,85 +244,250 @@ char *cd(GENERAL_INFORMATION *g_info, char *path) {
     return output;
 }
 
-LS_INFO *ls(GENERAL_INFORMATION *g_info, char *path) {
+/*
+ * Calls callback for every entry of the directory at path (the working
+ * directory when path is NULL) until it returns non zero.
+ * Returns the number of entries passed to callback or -1 when path is not a directory.
+ */
+static int walk_directory(SESSION *session, char *path, int (*callback)(INODE *entry, void *context),
+                          void *context) {
+    GENERAL_INFORMATION *g_info = session->g_info;
     FIND_INFO *find_result;
     int error = 0;
     bool current_path = false;
     bool parent_path = false;
     if (path == NULL || strcmp(path, ".") == 0) {
         find_result = malloc(sizeof(FIND_INFO));
-        find_result->result = g_info->cur_node;
+        find_result->result = session->cur_node;
         current_path = true;
         goto parse;
     }
 
     if (strcmp(path, "..") == 0) {
         find_result = malloc(sizeof(FIND_INFO));
-        find_result->result = g_info->cur_node->parent;
+        find_result->result = session->cur_node->parent;
         current_path = true;
         parent_path = true;
         goto parse;
     }
 
     if (path[0] == '/') {
-        error = find_node_by_name(g_info, path, &g_info->root_node, &find_result);
+        error = find_node_by_name(session, path, &session->root_node, &find_result);
     } else {
-        error = find_node_by_name(g_info, path, &g_info->cur_node, &find_result);
+        error = find_node_by_name(session, path, &session->cur_node, &find_result);
+    }
+    if (error == -1) {
+        return -1;
     }
 
     parse:
-    if (error != -1) {
-        int err = read_directory(g_info, &(find_result->result));
-        if (err == -1) {
-            return NULL;
-        }
+    if (!(find_result->result->type & MFT_RECORD_IS_DIRECTORY) ||
+        read_directory(g_info, &(find_result->result)) == -1) {
+        error = -1;
+    } else {
         INODE *tmp = find_result->result->next_inode;
-//        char *result[256];
-//        char *output = malloc(err * 256);
-//        output[0] = '\0';
-
-        LS_INFO *first = malloc(sizeof(LS_INFO));
-        first->filename = NULL;
-        first->next = NULL;
-        LS_INFO *current = first;
-
         while (tmp != NULL) {
-            current->next = malloc(sizeof(LS_INFO));
-            current = current->next;
-            if (tmp->type & MFT_RECORD_IS_DIRECTORY) {
-                //sprintf((char *) result, "DIR:\t%s\n", tmp->filename);
-                current->type = 1;
-                current->filename = malloc(strlen(tmp->filename));
-                current->next = NULL;
-                strcpy(current->filename, tmp->filename);
-            } else {
-                //sprintf((char *) result, "FILE:\t%s\n", tmp->filename);
-                current->type = 0;
-                current->filename = malloc(strlen(tmp->filename));
-                current->next = NULL;
-                strcpy(current->filename, tmp->filename);
+            error++;
+            if (callback(tmp, context) != 0) {
+                break;
             }
-            //strcat(output, (const char *) result);
             tmp = tmp->next_inode;
         }
-        if (current_path) {
-            free_inode((find_result->result->next_inode));
-            find_result->result->next_inode = NULL;
+    }
+
+    if (current_path) {
+        free_inode((find_result->result->next_inode));
+        find_result->result->next_inode = NULL;
+    } else {
+        free_inode((find_result->start));
+    }
+    if (parent_path) {
+        session->cur_node->parent->next_inode = session->cur_node;
+    }
+    free(find_result);
+    return error;
+}
+
+static int add_ls_info(INODE *entry, void *context) {
+    LS_INFO **current = context;
+    (*current)->next = malloc(sizeof(LS_INFO));
+    *current = (*current)->next;
+    (*current)->type = entry->type & MFT_RECORD_IS_DIRECTORY ? 1 : 0;
+    (*current)->filename = malloc(strlen(entry->filename) + 1);
+    (*current)->next = NULL;
+    strcpy((*current)->filename, entry->filename);
+    return 0;
+}
+
+LS_INFO *ls(SESSION *session, char *path) {
+    LS_INFO *first = malloc(sizeof(LS_INFO));
+    first->filename = NULL;
+    first->next = NULL;
+    LS_INFO *current = first;
+    if (walk_directory(session, path, add_ls_info, &current) == -1) {
+        free_ls_info(first);
+        return NULL;
+    }
+    return first;
+}
+
+// entry of a directory opened by ls_open()
+typedef struct {
+    uint32_t mft_num;
+    uint16_t type;
+    char *name;    // UTF-8, see read_directory()
+} LS_DIR_ENTRY;
+
+struct ls_dir {
+    LS_DIR_ENTRY *entries;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t next;    // first entry of the next page
+    bool failed;
+};
+
+static int add_dir_entry(INODE *entry, void *context) {
+    LS_DIR *dir = context;
+    if (dir->count == dir->capacity) {
+        uint64_t capacity = dir->capacity ? dir->capacity * 2 : 64;
+        LS_DIR_ENTRY *entries = realloc(dir->entries, capacity * sizeof(LS_DIR_ENTRY));
+        if (entries == NULL) {
+            dir->failed = true;
+            return 1;
+        }
+        dir->entries = entries;
+        dir->capacity = capacity;
+    }
+    LS_DIR_ENTRY *dir_entry = &dir->entries[dir->count];
+    if ((dir_entry->name = strdup(entry->filename)) == NULL) {
+        dir->failed = true;
+        return 1;
+    }
+    dir_entry->mft_num = entry->mft_num;
+    dir_entry->type = entry->type & MFT_RECORD_IS_DIRECTORY ? 1 : 0;
+    dir->count++;
+    return 0;
+}
+
+/*
+ * Opens the directory at path (the working directory when path is NULL) for
+ * ls_bulk(), its entries are read once here. The handle is freed with ls_close().
+ * Returns the handle or NULL when path is not a directory.
+ */
+LS_DIR *ls_open(SESSION *session, char *path) {
+    LS_DIR *dir = calloc(1, sizeof(LS_DIR));
+    if (dir == NULL) {
+        return NULL;
+    }
+    if (walk_directory(session, path, add_dir_entry, dir) == -1 || dir->failed) {
+        ls_close(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+void ls_close(LS_DIR *dir) {
+    if (dir == NULL) {
+        return;
+    }
+    for (uint64_t i = 0; i < dir->count; i++) {
+        free(dir->entries[i].name);
+    }
+    free(dir->entries);
+    free(dir);
+}
+
+/*
+ * Copies a name into out, UTF-8 as it is kept or UTF-16LE. Names are valid
+ * UTF-8, made by utf16_to_utf8(). Returns the length in bytes.
+ */
+static uint32_t encode_name(const char *name, uint32_t encoding, uint8_t *out) {
+    if (encoding == LS_UTF8) {
+        uint32_t length = (uint32_t) strlen(name);
+        memcpy(out, name, length);
+        return length;
+    }
+    uint32_t length = 0;
+    const uint8_t *c = (const uint8_t *) name;
+    while (*c != '\0') {
+        uint32_t code;
+        uint32_t size;
+        if (*c < 0x80) {
+            code = *c;
+            size = 1;
+        } else if (*c < 0xE0) {
+            code = *c & 0x1F;
+            size = 2;
+        } else if (*c < 0xF0) {
+            code = *c & 0x0F;
+            size = 3;
         } else {
-            free_inode((find_result->start));
+            code = *c & 0x07;
+            size = 4;
+        }
+        for (uint32_t i = 1; i < size; i++) {
+            code = code << 6 | (c[i] & 0x3F);
+        }
+        c += size;
+        if (code >= 0x10000) {
+            // surrogate pair
+            code -= 0x10000;
+            uint32_t high = 0xD800 | code >> 10;
+            out[length++] = high & 0xFF;
+            out[length++] = high >> 8;
+            code = 0xDC00 | (code & 0x3FF);
         }
-        if (parent_path) {
-            g_info->cur_node->parent->next_inode = g_info->cur_node;
+        out[length++] = code & 0xFF;
+        out[length++] = code >> 8;
+    }
+    return length;
+}
+
+/*
+ * Fills buffer with the next entries of the directory: an LS_HEADER, then
+ * header->count LS_ENTRY records, then the names. Name offsets are from the
+ * start of the buffer, names are not terminated. header->cursor counts the
+ * entries listed so far and is 0 once the listing is complete.
+ * Returns the number of entries in the buffer, or -1 when the buffer can't
+ * hold the next entry (LS_MIN_BUFFER always can).
+ */
+int ls_bulk(LS_DIR *dir, uint32_t encoding, uint8_t *buffer, uint32_t size) {
+    if (size < sizeof(LS_HEADER) || (encoding != LS_UTF8 && encoding != LS_UTF16)) {
+        return -1;
+    }
+    LS_HEADER *header = (LS_HEADER *) buffer;
+    memset(header, 0, sizeof(LS_HEADER));
+    // names are written down from the end of the buffer
+    uint32_t names_end = size;
+    for (; dir->next < dir->count; dir->next++) {
+        const LS_DIR_ENTRY *dir_entry = &dir->entries[dir->next];
+        uint8_t name[LS_NAME_MAX * 3];
+        uint32_t name_length = encode_name(dir_entry->name, encoding, name);
+        uint32_t entries_end = sizeof(LS_HEADER) + (header->count + 1) * sizeof(LS_ENTRY);
+        if (entries_end + name_length > names_end) {
+            break;
         }
+        names_end -= name_length;
+        memcpy(buffer + names_end, name, name_length);
 
-        find_result->result = NULL;
-        find_result->start = NULL;
-        return first;
+        LS_ENTRY *entry = (LS_ENTRY *) (buffer + sizeof(LS_HEADER)) + header->count;
+        entry->mft_num = dir_entry->mft_num;
+        entry->name_offset = names_end;
+        entry->name_length = name_length;
+        entry->type = dir_entry->type;
+        header->count++;
+    }
+    if (header->count == 0 && dir->next < dir->count) {
+        return -1;
     }
-    return NULL;
+    header->cursor = dir->next < dir->count ? dir->next : 0;
+    header->names_offset = names_end;
+    header->names_size = size - names_end;
+    return (int) header->count;
 }
 
-char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path) {
+char *cp(SESSION *session, char *from_path, char *to_path) {
+    GENERAL_INFORMATION *g_info = session->g_info;
     char *output = malloc(32);
     output[0] = '\0';
     if (strcmp(from_path, ".") == 0 || strcmp(from_path, "..") == 0) {
@@ -330,11 +498,11 @@ char *cp(GENERAL_INFORMATION *g_info, char *from_path, char *to_path) {
     INODE *start_node;
     char *message;
     if (from_path[0] == '/') {
-        start_node = g_info->root_node;
+        start_node = session->root_node;
     } else {
-        start_node = g_info->cur_node;
+        start_node = session->cur_node;
     }
-    int err = find_node_by_name(g_info, from_path, &start_node, &result);
+    int err = find_node_by_name(session, from_path, &start_node, &result);
     if (err == -1) {
         message = "No such file or directory";
         sprintf(output, "%s\n", message);
@@ -359,6 +527,106 @@ int ntfs_close(GENERAL_INFORMATION *g_info) {
     return free_g_info(g_info);
 }
 
+/*
+ * Working directory of one caller of the volume opened by ntfs_init(), every
+ * thread navigates in its own session.
+ */
+SESSION *ntfs_open_session(GENERAL_INFORMATION *g_info) {
+    return open_session(g_info);
+}
+
+void ntfs_close_session(SESSION *session) {
+    close_session(session);
+}
+
+/*
+ * Opens the file at path for ntfs_read_file(). Returns the handle or NULL
+ * when there is no such file or it is a directory.
+ */
+FILE_HANDLE *ntfs_open_file(SESSION *session, char *path) {
+    FIND_INFO *result;
+    INODE *start_node = path[0] == '/' ? session->root_node : session->cur_node;
+    if (find_node_by_name(session, path, &start_node, &result) == -1) {
+        return NULL;
+    }
+    FILE_HANDLE *handle = open_file_handle(session->g_info, result->result, FILE_HANDLE_READAHEAD);
+    free_inode(result->start);
+    free(result);
+    return handle;
+}
+
+/*
+ * Fills the caller's buffer with up to length bytes at offset of the file.
+ * Returns the number of bytes read, 0 at the end of the file, or -1.
+ */
+int64_t ntfs_read_file(FILE_HANDLE *handle, uint8_t *buf, uint64_t length, uint64_t offset) {
+    return read_file_handle(handle, buf, length, offset);
+}
+
+uint64_t ntfs_file_size(const FILE_HANDLE *handle) {
+    return handle->size;
+}
+
+int ntfs_set_readahead(FILE_HANDLE *handle, uint32_t size) {
+    return set_readahead(handle, size);
+}
+
+void ntfs_close_file(FILE_HANDLE *handle) {
+    close_file_handle(handle);
+}
+
+/*
+ * Starts copying from_path into the directory to_path on worker threads,
+ * see COPY_JOB. Returns the job or NULL when there is no such file or
+ * directory. The job is freed with ntfs_free_copy() before the volume.
+ */
+COPY_JOB *ntfs_start_copy(SESSION *session, char *from_path, char *to_path, uint32_t workers,
+                          COPY_PROGRESS_CALLBACK callback, void *context) {
+    if (strcmp(from_path, ".") == 0 || strcmp(from_path, "..") == 0) {
+        return NULL;
+    }
+    FIND_INFO *result;
+    INODE *start_node = from_path[0] == '/' ? session->root_node : session->cur_node;
+    if (find_node_by_name(session, from_path, &start_node, &result) == -1) {
+        return NULL;
+    }
+    COPY_JOB *job = start_copy_job(session->g_info, result->result, to_path, workers, callback, context);
+    free_inode(result->start);
+    free(result);
+    return job;
+}
+
+void ntfs_cancel_copy(COPY_JOB *job) {
+    cancel_copy_job(job);
+}
+
+void ntfs_copy_progress(COPY_JOB *job, COPY_PROGRESS *progress) {
+    copy_job_progress(job, progress);
+}
+
+int ntfs_wait_copy(COPY_JOB *job) {
+    return wait_copy_job(job);
+}
+
+void ntfs_free_copy(COPY_JOB *job) {
+    free_copy_job(job);
+}
+
+/*
+ * Probes the block devices and copies up to capacity of them into the caller's
+ * array. Returns the number of devices found, which may exceed capacity, or -1.
+ */
+int ntfs_list_devices(DEVICE_INFO *devices, uint32_t capacity) {
+    DEVICE_INFO *found;
+    uint32_t count;
+    if (list_devices(&found, &count) == -1) {
+        return -1;
+    }
+    memcpy(devices, found, (count < capacity ? count : capacity) * sizeof(DEVICE_INFO));
+    free(found);
+    return (int) count;
+}
+
 int free_ls_info(LS_INFO *first) {
     LS_INFO *tmp;
 